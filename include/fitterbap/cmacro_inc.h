@@ -79,6 +79,7 @@
 #define FBP_USED __attribute__((used))
 #define FBP_FORMAT __attribute__((format))
 #define FBP_INLINE_FN __attribute__((always_inline)) static inline
+#define FBP_NOINLINE __attribute__((noinline))
 #define FBP_PRINTF_FORMAT __attribute__((format (printf, 1, 2)))
 #define FBP_COMPILER_ALLOC(free_fn) __attribute__((malloc))
 //#define FBP_COMPILER_ALLOC(free_fn) __attribute__((malloc, malloc(free_fn, 1)))  // gcc 11
@@ -87,6 +88,7 @@
 #define FBP_USED
 #define FBP_FORMAT
 #define FBP_INLINE_FN static inline
+#define FBP_NOINLINE
 #define FBP_PRINTF_FORMAT
 #define FBP_COMPILER_ALLOC(free_fn)
 #endif
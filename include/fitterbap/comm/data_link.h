@@ -417,6 +417,24 @@ struct fbp_dl_api_s {
 FBP_API int32_t fbp_dl_send(struct fbp_dl_s * self, uint16_t metadata,
                             uint8_t const *msg, uint32_t msg_size);
 
+/**
+ * @brief Send a message constructed from multiple fragments.  Thread-safe!
+ *
+ * @param self The instance.
+ * @param metadata The arbitrary 16-bit metadata associated with the message.
+ * @param iov The message fragments, concatenated in order.  The driver
+ *      copies the fragments directly into the transmit frame, so they
+ *      only needs to be valid for the duration of the function call.
+ * @param iov_count The number of entries in iov.
+ * @return 0 or error code.  See fbp_dl_send().
+ *
+ * This function behaves identically to fbp_dl_send(), but it allows the
+ * caller to provide a message header and payload separately without
+ * first copying them into a contiguous buffer.
+ */
+FBP_API int32_t fbp_dl_sendv(struct fbp_dl_s * self, uint16_t metadata,
+                             struct fbp_iovec_s const *iov, uint32_t iov_count);
+
 /**
  * @brief Provide receive data to this data link instance.
  *
@@ -437,6 +437,18 @@ struct fbp_framer_status_s {
     uint64_t resync;
 };
 
+/**
+ * @brief A single payload fragment for vectored (scatter-gather) sends.
+ *
+ * The framer copies each fragment, in order, directly into the frame
+ * buffer.  Callers can then provide a small header and a separate payload
+ * without first assembling them into a contiguous staging buffer.
+ */
+struct fbp_iovec_s {
+    void const * buf;   ///< The fragment data.
+    uint32_t size;      ///< The fragment size in bytes.
+};
+
 /**
  * @brief The API event callbacks to the upper layer.
  */
@@ -515,6 +527,26 @@ struct fbp_framer_s {
                               uint16_t frame_id, uint16_t metadata,
                               uint8_t const *msg, uint32_t msg_size);
 
+    /**
+     * @brief Construct a data frame from multiple payload fragments.
+     *
+     * @param b The output buffer, which must be at least
+     *      total payload size + FBP_FRAMER_OVERHEAD_SIZE bytes.
+     * @param b_size[inout] Upon input, the maximum size of b in bytes.  This function will set
+     *      this value to the actual number of bytes in b.
+     * @param frame_id The frame id for the frame.
+     * @param metadata The message metadata
+     * @param iov The payload fragments, concatenated in order.
+     * @param iov_count The number of entries in iov.
+     * @return 0 or error code.
+     *
+     * Custom framers may leave this NULL, in which case the data link
+     * only supports single-fragment sends.
+     */
+    int32_t (*construct_datav)(struct fbp_framer_s *self, uint8_t *b, uint16_t * b_size,
+                               uint16_t frame_id, uint16_t metadata,
+                               struct fbp_iovec_s const *iov, uint32_t iov_count);
+
     /**
      * @brief Construct a link frame.
      *
@@ -585,6 +617,24 @@ FBP_API int32_t fbp_framer_construct_data(struct fbp_framer_s *self, uint8_t *b,
                                           uint16_t frame_id, uint16_t metadata,
                                           uint8_t const *msg, uint32_t msg_size);
 
+/**
+ * @brief Construct a data frame from multiple payload fragments.
+ *
+ * @param self The framer instance.
+ * @param b The output buffer, which must be at least
+ *      total payload size + FBP_FRAMER_OVERHEAD_SIZE bytes.
+ * @param b_size[inout] Upon input, the maximum size of b in bytes.  This function will set
+ *      this value to the actual number of bytes in b.
+ * @param frame_id The frame id for the frame.
+ * @param metadata The message metadata
+ * @param iov The payload fragments, concatenated in order.
+ * @param iov_count The number of entries in iov.
+ * @return 0 or error code.
+ */
+FBP_API int32_t fbp_framer_construct_datav(struct fbp_framer_s *self, uint8_t *b, uint16_t * b_size,
+                                           uint16_t frame_id, uint16_t metadata,
+                                           struct fbp_iovec_s const *iov, uint32_t iov_count);
+
 /**
  * @brief Construct a link frame.
  *
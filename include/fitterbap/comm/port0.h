@@ -38,7 +38,9 @@
  *
  * Port 0 allocates port_data:
  *      port_data[7]: 0=request or unused, 1=response
- *      port_data[6:3]: reserved, 0
+ *      port_data[6:4]: reserved, 0
+ *      port_data[3]: operation-specific flag, see FBP_PORT0_ECHO_FLOOD
+ *          and FBP_PORT0_META_DIGEST.
  *      port_data[2:0]: The fbp_port0_op_e operation.
  * @{
  */
@@ -51,6 +53,41 @@ FBP_CPP_GUARD_START
 /// The character offset for the port_id to ensure printable ASCII text.
 #define FBP_PORT0_META_CHAR_OFFSET (32)
 
+/// The port_data flag for one-way echo requests that must not be answered.
+#define FBP_PORT0_ECHO_FLOOD (0x08)
+
+/// The port_data flag for metadata digest responses.
+#define FBP_PORT0_META_DIGEST (0x08)
+
+/// The maximum metadata length, in bytes, including the NULL terminator.
+#define FBP_PORT0_META_SIZE_MAX (2048)
+
+/// The negotiate feature bit for the metadata digest exchange.
+#define FBP_PORT0_FEATURE_META_DIGEST (0x00000001)
+
+/**
+ * @brief The negotiate feature bit for the pipelined connection handshake.
+ *
+ * Each side sets this bit when its "0/pipe" topic is true.  The
+ * handshake is pipelined only when the negotiate response contains it.
+ */
+#define FBP_PORT0_FEATURE_PIPELINE (0x00000002)
+
+/// The negotiate feature bit for FBP_PORT0_OP_CREDIT transport credit grants.
+#define FBP_PORT0_FEATURE_CREDIT (0x00000004)
+
+/// The interval for publishing echo statistics, in milliseconds.
+#define FBP_PORT0_ECHO_STATS_INTERVAL_MS (1000)
+
+/**
+ * @brief The RTT histogram buckets per power of two.
+ *
+ * Every RTT sample in a statistics interval lands in a log-bucketed
+ * histogram.  The reported percentiles are bucket midpoints, within
+ * 1 / (2 * FBP_PORT0_ECHO_RTT_SUB_BUCKETS) of the true value.
+ */
+#define FBP_PORT0_ECHO_RTT_SUB_BUCKETS (8)
+
 /**
  * @brief The service operations provided by port 0.
  */
@@ -71,7 +108,14 @@ enum fbp_port0_op_e {
      * @brief Echo payloads.
      *
      * If we receive a request, respond with the same payload.
-     * The payload length and contents are arbitrary.
+     * The payload length and contents are arbitrary.  When the request
+     * port_data contains FBP_PORT0_ECHO_FLOOD, the receiver only counts
+     * the request and does not respond.
+     *
+     * This implementation populates the request payload with:
+     * 0: frame_id i64, incrementing for each request
+     * 1: sender transmit time i64, when the length is at least 16 bytes.
+     * 2+: arbitrary fill
      */
     FBP_PORT0_OP_ECHO = 2,
 
@@ -93,10 +137,23 @@ enum fbp_port0_op_e {
     /**
      * @brief Retrieve port metadata definitions.
      *
-     * On request, the payload is ignored.
-     * On response, the payload contains:
+     * Without FBP_PORT0_FEATURE_META_DIGEST, the client sends a response
+     * for every port without a request.  The request payload is ignored.
+     * The response payload contains:
      * - one byte containing (32 + port_id)
-     * - a NULL-terminated JSON formatted string.
+     * - a NULL-terminated JSON formatted string, truncated to fit
+     *   a single frame.
+     *
+     * With FBP_PORT0_FEATURE_META_DIGEST, the client first sends a single
+     * response with FBP_PORT0_META_DIGEST set in port_data.  The payload
+     * contains 32 x u32 CRC32 digests of each port's JSON string, where
+     * 0 indicates no metadata.  The server then sends a request with a
+     * u32 payload containing the bitmask of ports that differ from its
+     * cached copy.  The client responds with the metadata for each
+     * requested port using the format above.  Metadata that does not fit
+     * a single frame uses FBP_TRANSPORT_SEQ_START, MIDDLE, and STOP, with
+     * the port byte only in the first frame.  Metadata is limited to
+     * FBP_PORT0_META_SIZE_MAX bytes.
      *
      * The JSON response structure consists of:
      * - name: A user-meaningful "name" key.
@@ -155,7 +212,12 @@ enum fbp_port0_op_e {
      *
      * The payload consists of 32-bit values:
      * - version: major8.minor8.patch16
-     * - sender's maximum receive window size
+     * - status: 0 or error code, response only
+     * - down_window_size
+     * - up_window_size
+     * - features: The optional FBP_PORT0_FEATURE_* bitmap.  The response
+     *   contains the features supported by both sides.  Peers that
+     *   omit this value support no features.
      */
     FBP_PORT0_OP_NEGOTIATE = 5,
 
@@ -165,6 +227,18 @@ enum fbp_port0_op_e {
      * @todo Not yet supported.
      */
     FBP_PORT0_OP_RAW = 6,
+
+    /**
+     * @brief Grant transport credits for received messages.
+     *
+     * Only sent when both sides negotiate FBP_PORT0_FEATURE_CREDIT.
+     * The receiver batches the messages its transport delivered on
+     * ports 1 and above, and the sender returns them using
+     * fbp_transport_port_credit_return().  There is no response.
+     *
+     * req_payload: u32 entries of (count << 8) | port_id.
+     */
+    FBP_PORT0_OP_CREDIT = 7,
 };
 
 enum fbp_port0_mode_e {
@@ -172,6 +246,41 @@ enum fbp_port0_mode_e {
     FBP_PORT0_MODE_SERVER, ///< Servers provide reference time.
 };
 
+/// The echo benchmark modes.
+enum fbp_port0_echo_mode_e {
+    FBP_PORT0_ECHO_MODE_PING_PONG = 0,  ///< Request and response, measures RTT.
+    FBP_PORT0_ECHO_MODE_FLOOD = 1,      ///< One-way requests, window frames each millisecond.
+};
+
+/**
+ * @brief The echo benchmark statistics.
+ *
+ * Port0 publishes this structure as binary data to "0/echo/stats"
+ * every FBP_PORT0_ECHO_STATS_INTERVAL_MS while echo is enabled or while
+ * it receives flood requests.  All counts are for the most recent interval.
+ */
+struct fbp_port0_echo_stats_s {
+    uint32_t version;           ///< The structure version, currently 1.
+    uint32_t mode;              ///< The fbp_port0_echo_mode_e, local sender only.
+    int64_t duration;           ///< The interval duration in 34Q30 time.
+    uint32_t tx_msgs;           ///< The echo requests sent.
+    uint32_t tx_bytes;          ///< The echo request payload bytes sent.
+    uint32_t rx_msgs;           ///< The echo responses or flood requests received.
+    uint32_t rx_bytes;          ///< The echo payload bytes received.
+    uint32_t tx_msgs_per_s;     ///< The transmit message rate.
+    uint32_t tx_bytes_per_s;    ///< The transmit payload throughput.
+    uint32_t rx_msgs_per_s;     ///< The receive message rate.
+    uint32_t rx_bytes_per_s;    ///< The receive payload throughput.
+    uint32_t errors;            ///< The frame_id sequence errors (lost or reordered).
+    uint32_t rtt_count;         ///< The number of RTT samples.
+    uint32_t rtt_min_us;        ///< The exact minimum round-trip time.
+    uint32_t rtt_p50_us;        ///< The median round-trip time, from the histogram.
+    uint32_t rtt_p90_us;        ///< The 90th percentile round-trip time, from the histogram.
+    uint32_t rtt_p99_us;        ///< The 99th percentile round-trip time, from the histogram.
+    uint32_t rtt_max_us;        ///< The exact maximum round-trip time.
+    uint32_t jitter_us;         ///< The RFC 3550 interarrival jitter of the RTT.
+};
+
 /// Opaque port0 instance.
 struct fbp_port0_s;
 
@@ -190,8 +299,8 @@ extern const char FBP_PORT0_META[];
  * @param dl The data link instance.
  * @param evm The event manager for this instance.
  * @param transport The transport instance.
- * @param send_fn The function to call to send data, which should be
- *      fbp_transport_send() except during unit testing.
+ * @param sendv_fn The function to call to send data, which should be
+ *      fbp_transport_sendv() except during unit testing.
  * @param pubsub The pubsub instance for event updates.
  * @param topic_prefix The prefix to use for pubsub for the stack.
  * @param timesync The timesync instance, for clients that want to
@@ -202,7 +311,7 @@ FBP_API struct fbp_port0_s * fbp_port0_initialize(enum fbp_port0_mode_e mode,
         struct fbp_dl_s * dl,
         struct fbp_evm_api_s * evm,
         struct fbp_transport_s * transport,
-        fbp_transport_send_fn send_fn,
+        fbp_transport_sendv_fn sendv_fn,
         struct fbp_pubsub_s * pubsub,
         const char * topic_prefix,
         struct fbp_ts_s * timesync);
@@ -48,6 +48,17 @@ FBP_CPP_GUARD_START
 /// Default transmit timeout
 #define FBP_PUBSUBP_TIMEOUT_MS  (250)
 
+/**
+ * @brief The maximum number of messages in flight to the peer.
+ *
+ * Applies only when port0 negotiates FBP_PORT0_FEATURE_CREDIT with the
+ * peer.  Publishing waits up to FBP_PUBSUBP_TIMEOUT_MS for the peer to
+ * grant credits.  The port returns the credit for a received publish
+ * only after the local pubsub instance processes it, so a backlogged
+ * pubsub queue slows the peer.
+ */
+#define FBP_PUBSUBP_CREDIT_LIMIT  (32)
+
 /// The opaque PubSub port instance.
 struct fbp_pubsubp_s;
 
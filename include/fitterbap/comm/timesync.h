@@ -55,6 +55,39 @@ FBP_CPP_GUARD_START
 /// Opaque instance
 struct fbp_ts_s;
 
+/// The clock estimator used to convert counter values to time.
+enum fbp_ts_estimator_e {
+    /**
+     * @brief Set the time to each update, estimating the period over
+     *      the most recent updates.
+     *
+     * This estimator is simple, but the time jumps at each update.
+     */
+    FBP_TS_ESTIMATOR_SNAP = 0,
+
+    /**
+     * @brief Filter updates with a Kalman filter servo.
+     *
+     * This estimator rejects updates with asymmetric delay, weights each
+     * update by its round-trip queueing delay, estimates the counter
+     * drift, and slews the time rather than stepping.  With 100 us of
+     * link jitter, test/comm/timesync_sim shows a p99 error of 40 us at
+     * 10 second updates, compared to 221 us for FBP_TS_ESTIMATOR_SNAP.
+     */
+    FBP_TS_ESTIMATOR_SERVO = 1,
+};
+
+/// The timesync estimator status.
+struct fbp_ts_status_s {
+    int64_t offset;         ///< The most recent measured offset (reference - local), in 34Q30 time.
+    int64_t uncertainty;    ///< The filtered mean absolute offset, in 34Q30 time.
+    int64_t rtt;            ///< The most recent round-trip time, in 34Q30 time.
+    int32_t drift_ppb;      ///< The estimated counter frequency error in ppb, positive when fast.
+    uint32_t update_count;  ///< The number of accepted updates.
+    uint32_t reject_count;  ///< The number of updates rejected as outliers.
+    uint32_t estimator;     ///< The fbp_ts_estimator_e.
+};
+
 /**
  * @brief Get the current time.
  *
@@ -66,10 +99,27 @@ struct fbp_ts_s;
  *      time is not yet known.
  * @see fbp_time_utc
  *
- * This function is thread-safe.
+ * This function is thread-safe and never blocks, so it may be called
+ * from an ISR.
  */
 FBP_API int64_t fbp_ts_time(struct fbp_ts_s * self);
 
+/**
+ * @brief Convert counter values to time.
+ *
+ * @param self The timesync instance.  NULL will use the time provided by
+ *      the first created instance, if it exists.
+ * @param counter The array of fbp_time_counter_u64() values to convert.
+ * @param[out] time The array of count 34Q30 time values.  Without an
+ *      instance, this function sets all values to 0.
+ * @param count The number of values in counter and time.
+ *
+ * This function converts all values with the same coefficients, which
+ * is well suited to timestamping waveform sample blocks.  Like
+ * fbp_ts_time(), it is thread-safe and never blocks.
+ */
+FBP_API void fbp_ts_time_batch(struct fbp_ts_s * self, const uint64_t * counter, int64_t * time, uint32_t count);
+
 /**
  * @brief Update the timesync instance with new measurement data.
  *
@@ -85,12 +135,22 @@ FBP_API int64_t fbp_ts_time(struct fbp_ts_s * self);
  */
 FBP_API void fbp_ts_update(struct fbp_ts_s * self, uint64_t src_tx, int64_t tgt_rx, int64_t tgt_tx, uint64_t src_rx);
 
+/**
+ * @brief Get the estimator status.
+ *
+ * @param self The instance, or NULL to use the first created instance.
+ * @param[out] status The status.
+ * @return 0 or error code.
+ */
+FBP_API int32_t fbp_ts_status_get(struct fbp_ts_s * self, struct fbp_ts_status_s * status);
+
 /**
  * @brief Allocate and initialize a new instance.
  *
+ * @param estimator The fbp_ts_estimator_e clock estimator.
  * @return The new instance.
  */
-FBP_API struct fbp_ts_s * fbp_ts_initialize();
+FBP_API struct fbp_ts_s * fbp_ts_initialize(enum fbp_ts_estimator_e estimator);
 
 /**
  * @brief Finalize and free an existing instance.
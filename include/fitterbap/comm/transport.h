@@ -26,6 +26,7 @@
 #include "fitterbap/common_header.h"
 #include "fitterbap/comm/data_link.h"
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * @ingroup fbp_comm
@@ -65,6 +66,24 @@ enum fbp_transport_seq_e {
 /// Opaque transport instance.
 struct fbp_transport_s;
 
+/**
+ * @brief The per-port transport statistics and flow control state.
+ *
+ * Use fbp_transport_port_status_get() to retrieve these values.
+ */
+struct fbp_transport_port_status_s {
+    uint64_t tx_msgs;           ///< The number of messages sent successfully.
+    uint64_t tx_bytes;          ///< The total payload bytes sent successfully.
+    uint64_t rx_msgs;           ///< The number of messages received.
+    uint64_t rx_bytes;          ///< The total payload bytes received.
+    uint32_t tx_errors;         ///< The number of lower-layer send failures.
+    uint32_t tx_blocked;        ///< The number of sends rejected due to no credits.
+    uint32_t credit_limit;      ///< The credit window, 0 when flow control is disabled.
+    uint32_t credits;           ///< The credits currently available to send.
+    uint32_t queue_depth;       ///< The messages sent but not yet returned as credits.
+    uint32_t queue_depth_max;   ///< The maximum queue_depth observed.
+};
+
 /**
  * @brief The function called on events.
  *
@@ -105,6 +124,32 @@ typedef void (*fbp_transport_recv_fn)(void *user_data,
 typedef int32_t (*fbp_transport_ll_send)(void * user_data, uint16_t metadata,
                                          uint8_t const *msg, uint32_t msg_size);
 
+/**
+ * @brief The function called to send a vectored message to the data link layer.
+ *
+ * @param user_data The arbitrary user data (data link layer instance).
+ * @param metadata The arbitrary 16-bit metadata associated with the message.
+ * @param iov The message fragments, concatenated in order.  The driver
+ *      copies the fragments, so they only need to be valid for the
+ *      duration of the function call.
+ * @param iov_count The number of entries in iov.
+ * @return 0 or error code.
+ */
+typedef int32_t (*fbp_transport_ll_sendv)(void * user_data, uint16_t metadata,
+                                          struct fbp_iovec_s const *iov, uint32_t iov_count);
+
+/**
+ * @brief The function called when received messages have credits to grant.
+ *
+ * @param user_data The arbitrary user data.
+ *
+ * fbp_transport_port_credit_release() calls this function when a port
+ * releases its first message since the last
+ * fbp_transport_credit_grant_take().  Since ports may release messages
+ * from their own processing thread, this function must be thread-safe.
+ */
+typedef void (*fbp_transport_credit_fn)(void * user_data);
+
 /**
  * @brief The function type used by upper layers to send a message.
  *
@@ -128,6 +173,27 @@ typedef int32_t (*fbp_transport_send_fn)(struct fbp_transport_s * self,
                                          uint8_t port_data,
                                          uint8_t const *msg, uint32_t msg_size);
 
+/**
+ * @brief The function type used by upper layers to send a vectored message.
+ *
+ * @param self The instance.
+ * @param port_id The port id for this port.
+ * @param seq The frame reassembly information.
+ * @param port_data The arbitrary 8-bit port data.  Each port is
+ *      free to assign meaning to this value.
+ * @param iov The message fragments, concatenated in order.  The data link
+ *      layer copies the fragments, so they only need to be valid for the
+ *      duration of the function call.
+ * @param iov_count The number of entries in iov.
+ * @return 0 or error code.
+ * @see fbp_transport_sendv()
+ */
+typedef int32_t (*fbp_transport_sendv_fn)(struct fbp_transport_s * self,
+                                          uint8_t port_id,
+                                          enum fbp_transport_seq_e seq,
+                                          uint8_t port_data,
+                                          struct fbp_iovec_s const *iov, uint32_t iov_count);
+
 /**
  * @brief Allocate and initialize the instance.
  *
@@ -145,6 +211,21 @@ FBP_API struct fbp_transport_s * fbp_transport_initialize(fbp_transport_ll_send
  */
 FBP_API void fbp_transport_finalize(struct fbp_transport_s * self);
 
+/**
+ * @brief Register the lower-layer vectored send function.
+ *
+ * @param self The transport instance.
+ * @param sendv_fn The function called to send vectored data.  Normally,
+ *      provide (fbp_transport_ll_sendv) fbp_dl_sendv.  The send_user_data
+ *      provided to fbp_transport_initialize() is passed to this function.
+ *
+ * When registered, fbp_transport_sendv() passes the fragments directly
+ * to the lower layer, which copies them into the frame exactly once.
+ * Otherwise, fbp_transport_sendv() gathers the fragments into a
+ * temporary buffer and calls the send_fn.
+ */
+FBP_API void fbp_transport_register_ll_sendv(struct fbp_transport_s * self, fbp_transport_ll_sendv sendv_fn);
+
 /**
  * @brief Register (or deregister) port callbacks.
  *
@@ -220,6 +301,30 @@ FBP_API int32_t fbp_transport_send(struct fbp_transport_s * self,
                                    uint8_t port_data,
                                    uint8_t const *msg, uint32_t msg_size);
 
+/**
+ * @brief Send a message constructed from multiple fragments.
+ *
+ * @param self The instance.
+ * @param port_id The port id for this port.
+ * @param seq The frame reassembly information.
+ * @param port_data The arbitrary 8-bit port data.  Each port is
+ *      free to assign meaning to this value.
+ * @param iov The message fragments, concatenated in order.  The data link
+ *      layer copies the fragments, so they only need to be valid for the
+ *      duration of the function call.
+ * @param iov_count The number of entries in iov.
+ * @return 0 or error code.
+ *
+ * Ports commonly send a small header followed by a payload owned by
+ * another module.  This function allows the port to send both without
+ * first staging them in a private buffer.
+ */
+FBP_API int32_t fbp_transport_sendv(struct fbp_transport_s * self,
+                                    uint8_t port_id,
+                                    enum fbp_transport_seq_e seq,
+                                    uint8_t port_data,
+                                    struct fbp_iovec_s const *iov, uint32_t iov_count);
+
 /**
  * @brief The function to call when the lower layer receives an event.
  *
@@ -256,6 +361,137 @@ FBP_API void fbp_transport_on_recv_cbk(struct fbp_transport_s * self, uint16_t m
  */
 FBP_API const char * fbp_transport_meta_get(struct fbp_transport_s * self, uint8_t port_id);
 
+/**
+ * @brief Configure credit-based flow control for a port.
+ *
+ * @param self The transport instance.
+ * @param port_id The port_id to configure.
+ * @param credit_limit The maximum number of messages that may be
+ *      outstanding on this port.  0 (default) disables flow control.
+ * @return 0 or error code.
+ *
+ * The limit only applies while fbp_transport_credit_enable() indicates
+ * that the peer grants credits, so a peer that never grants credits
+ * cannot stall the port.  Port0 enables it when both sides negotiate
+ * FBP_PORT0_FEATURE_CREDIT, then returns the peer grants using
+ * fbp_transport_port_credit_return().
+ *
+ * Each successful fbp_transport_send() consumes one credit.  When a port
+ * has no credits, fbp_transport_send() returns FBP_ERROR_FULL without
+ * passing the message to the lower layer.  Setting the limit restores
+ * all credits.  Credits are also restored when the data link
+ * disconnects.  The transport serializes the credit check with its own
+ * mutex, so multiple threads may send on the same port.
+ *
+ * Flow control prevents one chatty port from consuming the entire
+ * data link transmit window and starving the other ports.  The peer
+ * grants credits as its port consumers release the received messages,
+ * so a slow consumer on one port only blocks its own port.
+ */
+FBP_API int32_t fbp_transport_port_credit_limit_set(struct fbp_transport_s * self,
+                                                    uint8_t port_id, uint32_t credit_limit);
+
+/**
+ * @brief Return credits to a port.
+ *
+ * @param self The transport instance.
+ * @param port_id The port_id.
+ * @param credits The number of credits to return.  The available credits
+ *      saturate at the limit provided to fbp_transport_port_credit_limit_set().
+ * @return 0 or error code.
+ *
+ * This function is thread-safe.
+ */
+FBP_API int32_t fbp_transport_port_credit_return(struct fbp_transport_s * self,
+                                                 uint8_t port_id, uint32_t credits);
+
+/**
+ * @brief Indicate whether the peer grants credits.
+ *
+ * @param self The transport instance.
+ * @param enable True when the peer grants credits for received messages.
+ *
+ * Enabling restores all credits.  When enabled, the transport counts the
+ * messages released on ports 1 and above, so they can be granted back
+ * to the peer.  A data link disconnect disables credits.
+ */
+FBP_API void fbp_transport_credit_enable(struct fbp_transport_s * self, bool enable);
+
+/**
+ * @brief Defer the credit grant for received messages.
+ *
+ * @param self The transport instance.
+ * @param port_id The port_id.
+ * @param defer False (default) to release each message when its
+ *      fbp_transport_recv_fn returns.  True when the port calls
+ *      fbp_transport_port_credit_release() after it consumes each message.
+ * @return 0 or error code.
+ *
+ * Ports that queue received messages for later processing should defer,
+ * so that the peer only gets credits back as the queue drains.  Call
+ * this function before the data link connects.
+ */
+FBP_API int32_t fbp_transport_port_credit_defer(struct fbp_transport_s * self, uint8_t port_id, bool defer);
+
+/**
+ * @brief Release consumed received messages.
+ *
+ * @param self The transport instance.
+ * @param port_id The port_id that received the messages.
+ * @param count The number of consumed messages.
+ * @return 0 or error code.
+ *
+ * The released messages become credits to grant to the peer.  The
+ * transport releases each message itself unless the port defers
+ * with fbp_transport_port_credit_defer().  This function is thread-safe.
+ */
+FBP_API int32_t fbp_transport_port_credit_release(struct fbp_transport_s * self, uint8_t port_id, uint32_t count);
+
+/**
+ * @brief Register the function called when credits are ready to grant.
+ *
+ * @param self The transport instance.
+ * @param fn The function called when a port has credits to grant, or NULL.
+ * @param user_data The arbitrary data for fn.
+ */
+FBP_API void fbp_transport_register_credit_fn(struct fbp_transport_s * self,
+                                              fbp_transport_credit_fn fn, void * user_data);
+
+/**
+ * @brief Take the credits to grant to the peer for a port.
+ *
+ * @param self The transport instance.
+ * @param port_id The port_id.
+ * @return The number of messages released on port_id since the last
+ *      call.  This function atomically resets the count, so it is safe
+ *      against concurrent releases.
+ */
+FBP_API uint32_t fbp_transport_credit_grant_take(struct fbp_transport_s * self, uint8_t port_id);
+
+/**
+ * @brief Get the port statistics and flow control state.
+ *
+ * @param self The transport instance.
+ * @param port_id The port_id.
+ * @param[out] status The status for port_id.
+ * @return 0 or error code.
+ */
+FBP_API int32_t fbp_transport_port_status_get(struct fbp_transport_s * self,
+                                              uint8_t port_id,
+                                              struct fbp_transport_port_status_s * status);
+
+/**
+ * @brief Clear the port statistics.
+ *
+ * @param self The transport instance.
+ * @param port_id The port_id.
+ * @return 0 or error code.
+ *
+ * This function clears the counters and queue_depth_max, but it does
+ * not modify the flow control state.
+ */
+FBP_API int32_t fbp_transport_port_status_clear(struct fbp_transport_s * self, uint8_t port_id);
+
 /**
  * @brief Inject the TRANSPORT or APP CONNECTED events.
  *
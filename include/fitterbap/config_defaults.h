@@ -60,6 +60,16 @@ FBP_CPP_GUARD_START
 #define FBP_CONFIG_USE_CSTR_FLOAT 0
 #endif
 
+/// The number of free PubSub messages cached for reuse, must be a power of 2.
+#ifndef FBP_CONFIG_PUBSUB_MSG_CACHE_SIZE
+#define FBP_CONFIG_PUBSUB_MSG_CACHE_SIZE (64)
+#endif
+
+/// The maximum time in milliseconds that a FBP_PUBSUB_OVERFLOW_BLOCK executor waits for its worker.
+#ifndef FBP_CONFIG_PUBSUB_EXECUTOR_BLOCK_TIMEOUT_MS
+#define FBP_CONFIG_PUBSUB_EXECUTOR_BLOCK_TIMEOUT_MS (100)
+#endif
+
 // optional logging defines
 // #define FBP_LOG_GLOBAL_LEVEL FBP_LOG_LEVEL_ALL
 // #define FBP_LOG_PRINTF(level, format, ...) my_printf("%c %s:%d: " format "\n", fbp_log_level_char[level], __FILENAME__, __LINE__, __VA_ARGS__);
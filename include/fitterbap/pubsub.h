@@ -47,7 +47,12 @@ FBP_CPP_GUARD_START
 #define FBP_PUBSUB_TOPIC_LENGTH_MAX (32)
 #endif
 
-/// The maximum topic length between '/' separators.
+/**
+ * @brief Deprecated, no longer enforced.
+ *
+ * Subtopic names between '/' separators are interned and may be any
+ * length within FBP_PUBSUB_TOPIC_LENGTH_MAX.
+ */
 #define FBP_PUBSUB_TOPIC_LENGTH_PER_LEVEL (8)
 /// The unit separator character
 #define FBP_PUBSUB_UNIT_SEP_CHR ((char) 0x1f)
@@ -64,6 +69,11 @@ FBP_CPP_GUARD_START
 #define FBP_PUBSUB_TOPIC_ADD "_/topic/add"
 #define FBP_PUBSUB_TOPIC_REMOVE "_/topic/remove"
 #define FBP_PUBSUB_CONFIG_RETURN_CODE "_/cfg/rc"
+#define FBP_PUBSUB_CONFIG_STATS "_/cfg/stats"       // bool, enable profiling
+#define FBP_PUBSUB_STATS_MSG "_/stats/msg"          // see fbp_pubsub_stats_publish()
+#define FBP_PUBSUB_STATS_QUEUE "_/stats/queue"
+#define FBP_PUBSUB_STATS_MRB "_/stats/mrb"
+#define FBP_PUBSUB_STATS_DROP "_/stats/drop"
 #define FBP_PUBSUB_CONN_ADD "./conn/add"            // list of topics
 #define FBP_PUBSUB_CONN_REMOVE "./conn/remove"      // list of topics
 
@@ -91,6 +101,9 @@ enum fbp_pubsub_sflag_e {
 /// The opaque PubSub instance.
 struct fbp_pubsub_s;
 
+/// The opaque topic handle.
+struct fbp_pubsub_topic_s;
+
 /**
  * @brief Function called on topic updates.
  *
@@ -150,6 +163,57 @@ typedef int32_t (*fbp_pubsub_publish_fn)(
  */
 FBP_API struct fbp_pubsub_s * fbp_pubsub_initialize(const char * topic_prefix, uint32_t buffer_size);
 
+/// The PubSub instance configuration options.
+struct fbp_pubsub_config_s {
+    uint32_t buffer_size;     ///< The buffer size for dynamic pointer messages.
+    uint32_t topic_max;       ///< The topic node capacity, one node per topic level.  0 allocates from the heap.
+    uint32_t subscriber_max;  ///< The subscriber capacity.  0 allocates from the heap.
+    const uint8_t * snapshot; ///< The fbp_pubsub_snapshot_save() images to restore, or NULL.
+    uint32_t snapshot_size;   ///< The size of snapshot in bytes.
+};
+
+/**
+ * @brief Create and initialize a new PubSub instance with fixed node pools.
+ *
+ * @param topic_prefix The topic prefixes that are owned by this
+ *      pubsub instance.  See fbp_pubsub_initialize().
+ * @param config The instance configuration.
+ * @return The new PubSub instance.
+ *
+ * When topic_max or subscriber_max is nonzero, this function allocates
+ * a single contiguous pool for that node type, and the instance never
+ * allocates that node type again.  The pools are in addition to the
+ * nodes used by the internal "_/" topics.  Once a pool is exhausted,
+ * publishing to a new topic fails with FBP_ERROR_NOT_ENOUGH_MEMORY,
+ * fbp_pubsub_topic_handle_get() returns NULL, and new subscriptions are
+ * dropped.  Topics persist until fbp_pubsub_finalize(), and
+ * subscribers released by fbp_pubsub_unsubscribe() are reused.
+ *
+ * When topic_max is nonzero, this function also allocates the topic
+ * index, the subtopic name table, and the topic path strings for the
+ * full capacity, so these never grow.  The name table holds
+ * topic_max + subscriber_max names, shared by topics and the literal
+ * levels of wildcard subscriptions.  When either cap is nonzero,
+ * retained value and query traversals use a fixed pool.
+ *
+ * The caps do not bound these allocations, which remain on the heap:
+ * - one compiled pattern per wildcard subscription.
+ * - one dispatch array per topic with subscribers, rebuilt after
+ *   subscriptions change.
+ * - fbp_pubsub_topic_history() buffers.
+ * - executor queue payloads.
+ * - queued messages beyond FBP_CONFIG_PUBSUB_MSG_CACHE_SIZE, which are
+ *   recycled and so grow only to the peak queue depth.
+ * - fbp_pubsub_buf_alloc() buffers.
+ * - traversals nested by subscriber callbacks that call
+ *   fbp_pubsub_process() directly.
+ *
+ * When snapshot is provided, this function restores it using
+ * fbp_pubsub_snapshot_restore() before returning.
+ */
+FBP_API struct fbp_pubsub_s * fbp_pubsub_initialize_config(const char * topic_prefix,
+                                                           const struct fbp_pubsub_config_s * config);
+
 /**
  * @brief Finalize the instance and free resources.
  *
@@ -183,7 +247,9 @@ FBP_API void fbp_pubsub_register_on_publish(struct fbp_pubsub_s * self,
  * @brief Subscribe to a topic.
  *
  * @param self The PubSub instance.
- * @param topic The topic to subscribe.
+ * @param topic The topic to subscribe, which may contain MQTT-style
+ *      wildcards.  A '+' level matches exactly one level, and a '#'
+ *      last level matches the parent and all descendants.
  * @param flags The fbp_pubsub_sflag_e flags
  * @param cbk_fn The function to call on topic updates.
  *      Invocations are from fbp_pubsub_process().
@@ -193,7 +259,11 @@ FBP_API void fbp_pubsub_register_on_publish(struct fbp_pubsub_s * self,
  * @see fbp_pubsub_unsubscribe()
  *
  * If the topic does not already exist, this function will
- * automatically create it.
+ * automatically create it.  For wildcard subscriptions, this is the
+ * topic before the first wildcard level.  The match against each topic
+ * is computed once and cached, so topics that do not match never invoke
+ * cbk_fn.  Wildcards filter FBP_PUBSUB_SFLAG_PUB and
+ * FBP_PUBSUB_SFLAG_RETAIN deliveries.
  *
  * Note that the flags are critical to implementing the distributed
  * architecture.  The system constructs the polytree architecture with
@@ -210,7 +280,8 @@ FBP_API int32_t fbp_pubsub_subscribe(struct fbp_pubsub_s * self, const char * to
  * @brief Unsubscribe from a topic.
  *
  * @param self The PubSub instance.
- * @param topic The topic to unsubscribe.
+ * @param topic The topic provided to fbp_pubsub_subscribe(),
+ *      including any wildcards.
  * @param cbk_fn The function provided to fbp_pubsub_subscribe().
  * @param cbk_user_data The arbitrary data provided to fbp_pubsub_subscribe().
  * @return 0 or error code.
@@ -242,6 +313,112 @@ FBP_API int32_t fbp_pubsub_unsubscribe(struct fbp_pubsub_s * self, const char *
 FBP_API int32_t fbp_pubsub_unsubscribe_from_all(struct fbp_pubsub_s * self,
                                                 fbp_pubsub_subscribe_fn cbk_fn, void * cbk_user_data);
 
+/// The executor policy when its queue is full.
+enum fbp_pubsub_overflow_e {
+    /**
+     * @brief Wait for the worker, which stalls fbp_pubsub_process().
+     *
+     * The wait is limited to FBP_CONFIG_PUBSUB_EXECUTOR_BLOCK_TIMEOUT_MS.
+     * On timeout, the executor drops the oldest message, counts it,
+     * and keeps dropping without waiting until the worker dequeues
+     * again.  The worker must not be the thread that calls
+     * fbp_pubsub_process(), which would wait for itself.
+     */
+    FBP_PUBSUB_OVERFLOW_BLOCK = 0,
+    /// Discard the oldest queued message.
+    FBP_PUBSUB_OVERFLOW_DROP_OLDEST = 1,
+    /// Replace any queued message for the same topic and callback, then drop the oldest.
+    FBP_PUBSUB_OVERFLOW_CONFLATE = 2,
+};
+
+/// The opaque subscriber executor.
+struct fbp_pubsub_executor_s;
+
+/// The subscriber executor configuration.
+struct fbp_pubsub_executor_config_s {
+    uint32_t queue_size;                     ///< The maximum number of queued messages, at least 1.
+    uint8_t overflow;                        ///< The fbp_pubsub_overflow_e policy.
+    fbp_os_mutex_t mutex;                    ///< The mutex for a worker thread, or NULL.
+    fbp_pubsub_on_publish_fn on_enqueue_fn;  ///< Called to wake the worker, or NULL.
+    void * on_enqueue_user_data;             ///< The arbitrary data for on_enqueue_fn.
+};
+
+/**
+ * @brief Allocate a subscriber executor.
+ *
+ * @param config The executor configuration.
+ * @return The new executor or NULL.
+ *
+ * An executor is a bounded message queue that decouples slow
+ * subscribers from fbp_pubsub_process().  Subscribers registered with
+ * fbp_pubsub_subscribe_executor() receive their PUB and RETAIN messages
+ * through the queue, and a worker thread owned by the caller delivers
+ * them with fbp_pubsub_executor_process().  Each executor has a single
+ * worker, which preserves per-subscriber ordering.  Share an executor
+ * between subscribers to serve them with one worker.
+ *
+ * Pointer values that are neither CONST nor REF are copied into the
+ * queue.  REF values hold a reference until delivered.
+ */
+FBP_API struct fbp_pubsub_executor_s * fbp_pubsub_executor_alloc(const struct fbp_pubsub_executor_config_s * config);
+
+/**
+ * @brief Free a subscriber executor.
+ *
+ * @param executor The executor from fbp_pubsub_executor_alloc().
+ *
+ * Unsubscribe all subscribers that use this executor and stop its
+ * worker first.  Queued messages are discarded.
+ */
+FBP_API void fbp_pubsub_executor_free(struct fbp_pubsub_executor_s * executor);
+
+/**
+ * @brief Subscribe to a topic with callbacks delivered by an executor.
+ *
+ * @param self The PubSub instance.
+ * @param topic The topic to subscribe.  See fbp_pubsub_subscribe().
+ * @param flags The fbp_pubsub_sflag_e flags
+ * @param cbk_fn The function to call on topic updates.
+ *      PUB and RETAIN invocations are from fbp_pubsub_executor_process().
+ *      Other invocations are from fbp_pubsub_process().
+ * @param cbk_user_data The arbitrary data for cbk_fn.
+ * @param executor The executor for cbk_fn or NULL to call
+ *      cbk_fn directly, which is equivalent to fbp_pubsub_subscribe().
+ * @return 0 or error code.
+ *
+ * The return value of cbk_fn is ignored for executor deliveries.
+ * fbp_pubsub_unsubscribe() discards queued messages for cbk_fn, but
+ * a call already running in the worker may complete after it returns.
+ */
+FBP_API int32_t fbp_pubsub_subscribe_executor(struct fbp_pubsub_s * self, const char * topic,
+                                              uint8_t flags,
+                                              fbp_pubsub_subscribe_fn cbk_fn, void * cbk_user_data,
+                                              struct fbp_pubsub_executor_s * executor);
+
+/**
+ * @brief Deliver queued executor messages.
+ *
+ * @param executor The executor.
+ * @param max_messages The maximum number of messages to deliver
+ *      or 0 to deliver all queued messages.
+ * @return The number of messages delivered.
+ *
+ * Call this function from the worker thread, usually after
+ * on_enqueue_fn signals it.  Only one thread may call this
+ * function for each executor.  With FBP_PUBSUB_OVERFLOW_BLOCK, the
+ * worker must run on a thread other than fbp_pubsub_process() and keep
+ * draining the queue, or messages are dropped after the timeout.
+ */
+FBP_API uint32_t fbp_pubsub_executor_process(struct fbp_pubsub_executor_s * executor, uint32_t max_messages);
+
+/**
+ * @brief Get the number of messages discarded by the overflow policy.
+ *
+ * @param executor The executor.
+ * @return The number of messages dropped or replaced.
+ */
+FBP_API uint32_t fbp_pubsub_executor_drop_count(struct fbp_pubsub_executor_s * executor);
+
 /**
  * @brief Publish to a topic.
  *
@@ -256,7 +433,10 @@ FBP_API int32_t fbp_pubsub_unsubscribe_from_all(struct fbp_pubsub_s * self,
  * @see fbp_pubsub_publish_fn()
  *
  * If the topic does not already exist, this function will
- * automatically create it.
+ * automatically create it.  The queued message refers to the topic
+ * rather than copying the topic string, which takes the instance mutex
+ * briefly to look up the topic.  fbp_pubsub_publish_handle() skips the
+ * lookup.
  *
  * The src_fn and src_user_data provide trivial, built-in support
  * to ensure that a publisher/subscriber does not receive their
@@ -290,11 +470,187 @@ FBP_API int32_t fbp_pubsub_unsubscribe_from_all(struct fbp_pubsub_s * self,
  * FBP_ERROR_PARAMETER_INVALID.
  * If the circular buffer is full, this function returns
  * FBP_ERROR_NOT_ENOUGH_MEMORY.  The caller can optionally wait and retry.
+ *
+ * The third pointer type is a reference counted buffer marked with
+ * FBP_UNION_FLAG_REF and allocated by fbp_pubsub_buf_alloc().
+ * Publishing does not copy the buffer, and the size is not limited by
+ * the circular buffer.  On success, the caller's reference passes to
+ * the pubsub instance.  On error, the caller still owns the reference.
+ * FBP_UNION_FLAG_RETAIN is allowed, and the topic holds a reference
+ * until a new value publishes.  Subscribers that keep the value after
+ * their callback returns must call fbp_pubsub_buf_incr().  Subscribers
+ * that forward the value to another publish must also call
+ * fbp_pubsub_buf_incr() first.
  */
 FBP_API int32_t fbp_pubsub_publish(struct fbp_pubsub_s * self,
                                    const char * topic, const struct fbp_union_s * value,
                                    fbp_pubsub_subscribe_fn src_fn, void * src_user_data);
 
+/// A single update for fbp_pubsub_publish_batch().
+struct fbp_pubsub_entry_s {
+    const char * topic;                  ///< The topic name, or NULL to use handle.
+    struct fbp_pubsub_topic_s * handle;  ///< The topic handle, only used when topic is NULL.
+    struct fbp_union_s value;            ///< The new value for the topic.
+};
+
+/**
+ * @brief Publish multiple values together.
+ *
+ * @param self The PubSub instance.
+ * @param entries The updates to publish, in order.
+ * @param count The number of entries.
+ * @return 0 or error code.
+ * @see fbp_pubsub_publish()
+ *
+ * Each entry behaves like fbp_pubsub_publish() with NULL src_fn, but
+ * the batch allocates all messages first, then queues them together
+ * while holding the mutex once.  The payloads that must be copied
+ * share one message buffer reservation, and on_publish is called
+ * once.  Updates from other threads do not interleave with the
+ * batch.  The batch is all or nothing: on error, no entry publishes,
+ * and the caller keeps any FBP_UNION_FLAG_REF references.
+ */
+FBP_API int32_t fbp_pubsub_publish_batch(struct fbp_pubsub_s * self,
+                                         const struct fbp_pubsub_entry_s * entries, uint32_t count);
+
+/**
+ * @brief Allocate a reference counted buffer for publishing.
+ *
+ * @param size The buffer size in bytes.
+ * @return The new buffer with a reference count of 1.
+ * @see fbp_pubsub_publish()
+ *
+ * Publish the buffer using FBP_UNION_FLAG_REF.  The buffer is freed
+ * when the last reference is released, regardless of the order that
+ * the pubsub instance processes other messages.
+ */
+FBP_API uint8_t * fbp_pubsub_buf_alloc(uint32_t size);
+
+/**
+ * @brief Add a reference to a buffer.
+ *
+ * @param buf The buffer from fbp_pubsub_buf_alloc().
+ *
+ * This function is thread-safe.
+ */
+FBP_API void fbp_pubsub_buf_incr(const void * buf);
+
+/**
+ * @brief Release a reference to a buffer.
+ *
+ * @param buf The buffer from fbp_pubsub_buf_alloc().
+ *
+ * This function is thread-safe.  When the last reference is released,
+ * this function frees the buffer.
+ */
+FBP_API void fbp_pubsub_buf_decr(const void * buf);
+
+/**
+ * @brief Get the handle for a topic.
+ *
+ * @param self The PubSub instance.
+ * @param topic The normal topic name, which must not end with a
+ *      metadata, query, or return code character.
+ * @return The topic handle or NULL on error.
+ * @see fbp_pubsub_publish_handle()
+ *
+ * If the topic does not already exist, this function will
+ * automatically create it.  The handle remains valid until the
+ * topic is removed, which currently only occurs with
+ * fbp_pubsub_finalize().  Repeated calls for the same topic return
+ * the same handle.
+ *
+ * Like fbp_pubsub_unsubscribe(), this function runs in the caller's
+ * context.  Most applications get their handles once during
+ * initialization.
+ */
+FBP_API struct fbp_pubsub_topic_s * fbp_pubsub_topic_handle_get(struct fbp_pubsub_s * self, const char * topic);
+
+/**
+ * @brief Publish to a topic handle.
+ *
+ * @param self The PubSub instance.
+ * @param topic The topic handle from fbp_pubsub_topic_handle_get().
+ * @param value The new value for the topic.
+ * @param src_fn The callback function for the source subscriber
+ *      that is publishing the update.  Can be NULL.
+ * @param src_user_data The arbitrary user data for the source subscriber
+ *      callback function.
+ * @return 0 or error code.
+ * @see fbp_pubsub_publish()
+ *
+ * This function behaves identically to fbp_pubsub_publish(), but it
+ * skips copying, parsing, and finding the topic string.  Use it for
+ * topics that publish frequently.
+ */
+FBP_API int32_t fbp_pubsub_publish_handle(struct fbp_pubsub_s * self,
+                                          struct fbp_pubsub_topic_s * topic, const struct fbp_union_s * value,
+                                          fbp_pubsub_subscribe_fn src_fn, void * src_user_data);
+
+/**
+ * @brief Configure latest-value-only delivery for a topic.
+ *
+ * @param self The PubSub instance.
+ * @param topic The normal topic name, which must not end with a
+ *      metadata, query, or return code character.
+ * @param enable True to conflate updates, false for normal delivery.
+ * @return 0 or error code.
+ *
+ * While an update for a conflating topic is waiting for
+ * fbp_pubsub_process(), new publishes replace the pending value in
+ * place instead of queuing another message.  Subscribers then only
+ * receive the latest value, which bounds the queue size and link
+ * usage for topics that publish faster than they are consumed.
+ * Replaced FBP_UNION_FLAG_REF values are released.  Values that
+ * pubsub must copy, which are pointer types without
+ * FBP_UNION_FLAG_CONST or FBP_UNION_FLAG_REF, are never conflated.
+ *
+ * Like fbp_pubsub_unsubscribe(), this function runs in the caller's
+ * context.
+ */
+FBP_API int32_t fbp_pubsub_topic_conflate(struct fbp_pubsub_s * self, const char * topic, bool enable);
+
+/**
+ * @brief Configure the value history for a topic.
+ *
+ * @param self The PubSub instance.
+ * @param topic The normal topic name, which must not end with a
+ *      metadata, query, or return code character.
+ * @param length The number of values to keep, or 0 to disable
+ *      and free the history.
+ * @return 0 or error code.
+ *
+ * The history is a ring of the most recent (time, value) records,
+ * stored as separate time and value columns.  fbp_pubsub_process()
+ * adds a record for each accepted publish, including publishes that
+ * repeat the retained value.  Only non-pointer types are recorded.
+ * When the value type changes, the history restarts.
+ * Changing the length discards the existing history.
+ *
+ * Like fbp_pubsub_unsubscribe(), this function runs in the caller's
+ * context.
+ */
+FBP_API int32_t fbp_pubsub_topic_history(struct fbp_pubsub_s * self, const char * topic, uint32_t length);
+
+/**
+ * @brief Get the recent value history for a topic.
+ *
+ * @param self The PubSub instance.
+ * @param topic The topic configured with fbp_pubsub_topic_history().
+ * @param time_start The earliest record time to return, in FBP time
+ *      from fbp_time_utc().  Use 0 for all records.
+ * @param[out] time The record times, oldest first, or NULL.
+ * @param[out] value The record values, oldest first, or NULL.
+ * @param[out] type The fbp_union_e type for all values, or NULL.
+ * @param[inout] count On input, the capacity of time and value.
+ *      On output, the number of records written.  When more records
+ *      match, the most recent records are written.
+ * @return 0 or error code.
+ */
+FBP_API int32_t fbp_pubsub_history_get(struct fbp_pubsub_s * self, const char * topic, int64_t time_start,
+                                       int64_t * time, union fbp_union_inner_u * value, uint8_t * type,
+                                       uint32_t * count);
+
 /**
  * @brief Convenience function to set the topic metadata.
  *
@@ -318,6 +674,8 @@ FBP_API int32_t fbp_pubsub_meta(struct fbp_pubsub_s * self, const char * topic,
  * @param[out] value The current value for topic.  Since this request is
  *      handled in the caller's thread, it does not account
  *      for any updates queued for fbp_pubsub_process().
+ *      For FBP_UNION_FLAG_REF values, this function adds a reference
+ *      that the caller must release with fbp_pubsub_buf_decr().
  * @return 0 or error code.
  *
  * For a distributed PubSub implementation, use topic? to get the retained
@@ -331,9 +689,144 @@ FBP_API int32_t fbp_pubsub_query(struct fbp_pubsub_s * self, const char * topic,
  * @param self The PubSub instance to process.
  *
  * Many implementation choose to run this from a unique thread.
+ * Any thread may publish, but only one thread may call this
+ * function at a time.
  */
 FBP_API void fbp_pubsub_process(struct fbp_pubsub_s * self);
 
+/**
+ * @brief Process outstanding topic updates with a limited budget.
+ *
+ * @param self The PubSub instance to process.
+ * @param max_messages The maximum number of messages and traversal
+ *      steps to process, or 0 for no limit.
+ * @param max_time The maximum duration in fbp time (34Q30 seconds),
+ *      or 0 for no limit.  This function checks the time after each
+ *      message or step, so one long subscriber callback can exceed it.
+ * @return True if work remains, false if all work is done.
+ *
+ * Retained value replay for new subscribers and query responses
+ * visit one topic per traversal step, and they resume on the next
+ * call.  Pending traversals finish before later messages, so update
+ * order matches fbp_pubsub_process().  Single-threaded systems can
+ * call this function from their main loop to bound pubsub latency.
+ * When it returns true, call it again soon.
+ */
+FBP_API bool fbp_pubsub_process_budget(struct fbp_pubsub_s * self, uint32_t max_messages, int64_t max_time);
+
+/**
+ * @brief Save the retained topic values and metadata to a binary image.
+ *
+ * @param self The PubSub instance.
+ * @param buffer The output buffer.  NULL only computes the size.
+ * @param size[inout] The buffer size on input.  The image size or the
+ *      required size on output.
+ * @param incremental When false, save all retained values and metadata.
+ *      When true, save only the changes since the last save, including
+ *      cleared values.  When nothing changed, size is 0.
+ * @return 0, FBP_ERROR_TOO_SMALL, or error code.
+ *
+ * The image excludes the internal "_/" topics and uses native byte
+ * order, so restore it on the same platform.  The image header includes
+ * a CRC-32 of the records.  A successful save with a buffer clears the
+ * change tracking.  FBP_ERROR_TOO_SMALL leaves both the change tracking
+ * and any bytes beyond size unchanged.
+ *
+ * This function holds the instance mutex while it builds the image,
+ * and fbp_pubsub_process() updates retained values and change tracking
+ * under the same mutex, so any thread may call it.  Without a mutex,
+ * call it from the thread that calls fbp_pubsub_process().
+ * Applications typically save a full image to a file or flash region,
+ * then append incremental images from a low-priority thread.
+ */
+FBP_API int32_t fbp_pubsub_snapshot_save(struct fbp_pubsub_s * self, uint8_t * buffer, uint32_t * size, bool incremental);
+
+/**
+ * @brief Restore retained topic values and metadata from binary images.
+ *
+ * @param self The PubSub instance.
+ * @param buffer One or more concatenated images from fbp_pubsub_snapshot_save().
+ *      The images end at size or at the first invalid image header,
+ *      such as erased flash.  Pointer values and metadata reference
+ *      buffer directly, so buffer must remain valid and unchanged until
+ *      fbp_pubsub_finalize(), like a memory-mapped file or flash region.
+ * @param size The buffer size in bytes.
+ * @return 0, FBP_ERROR_MESSAGE_INTEGRITY on a CRC mismatch, or error code.
+ *
+ * Each image is checked before it changes any topic, so a corrupted
+ * image leaves the topics from earlier images in place.
+ * This function updates the topic tree in one pass without publishing,
+ * so call it before subscribing.  Later images override earlier ones.
+ * A metadata publish does not replace a restored value with the
+ * metadata default.
+ */
+FBP_API int32_t fbp_pubsub_snapshot_restore(struct fbp_pubsub_s * self, const uint8_t * buffer, uint32_t size);
+
+/**
+ * @brief The PubSub instance statistics.
+ *
+ * Publish true to FBP_PUBSUB_CONFIG_STATS to enable profiling, which
+ * also clears these statistics.  drop_count is always updated.
+ */
+struct fbp_pubsub_stats_s {
+    uint32_t msg_count;          ///< The number of messages processed.
+    uint32_t queue_depth_max;    ///< The pending message queue high-water mark.
+    uint32_t mrb_used_max;       ///< The message buffer high-water mark in bytes.
+    uint32_t mrb_size;           ///< The message buffer size in bytes.
+    uint32_t drop_count;         ///< The publishes that failed with FBP_ERROR_NOT_ENOUGH_MEMORY.
+};
+
+/// A topic or subscriber callback profile.
+struct fbp_pubsub_profile_s {
+    const char * topic;              ///< The topic, only valid during the callback.
+    fbp_pubsub_subscribe_fn cbk_fn;  ///< The subscriber or NULL for the topic.
+    void * cbk_user_data;            ///< The subscriber user data.
+    uint64_t count;                  ///< The publishes to the topic or calls to the subscriber.
+    int64_t time_total;              ///< The total callback time in FBP time.
+    int64_t time_min;                ///< The minimum callback time in FBP time.
+    int64_t time_avg;                ///< The average callback time in FBP time.
+    int64_t time_max;                ///< The maximum callback time in FBP time.
+};
+
+/**
+ * @brief The function called for each profile.
+ *
+ * @param user_data The arbitrary user data.
+ * @param profile The profile.
+ */
+typedef void (*fbp_pubsub_profile_fn)(void * user_data, const struct fbp_pubsub_profile_s * profile);
+
+/**
+ * @brief Get the instance statistics.
+ *
+ * @param self The PubSub instance.
+ * @param stats The statistics output.
+ * @return 0 or error code.
+ */
+FBP_API int32_t fbp_pubsub_stats_get(struct fbp_pubsub_s * self, struct fbp_pubsub_stats_s * stats);
+
+/**
+ * @brief Dump the topic and subscriber callback profiles.
+ *
+ * @param self The PubSub instance.
+ * @param cbk_fn The function called for each profile with a nonzero count.
+ *      The topic profile measures the dispatch to all of its subscribers,
+ *      including subscribers to parent topics.
+ * @param user_data The arbitrary data for cbk_fn.
+ * @return 0 or error code.
+ *
+ * Compute the publish rate from the count difference between dumps.
+ */
+FBP_API int32_t fbp_pubsub_stats_dump(struct fbp_pubsub_s * self, fbp_pubsub_profile_fn cbk_fn, void * user_data);
+
+/**
+ * @brief Publish the instance statistics to the "_/stats/..." topics.
+ *
+ * @param self The PubSub instance.
+ * @return 0 or error code.
+ */
+FBP_API int32_t fbp_pubsub_stats_publish(struct fbp_pubsub_s * self);
+
 /**
  * @brief Register functions to lock and unlock the send-side mutex.
  *
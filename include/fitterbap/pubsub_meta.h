@@ -75,6 +75,40 @@ FBP_API int32_t fbp_pubsub_meta_default(const char * meta, struct fbp_union_s *
  */
 FBP_API int32_t fbp_pubsub_meta_value(const char * meta, struct fbp_union_s * value);
 
+/// The opaque compiled metadata validator.
+struct fbp_pubsub_meta_validator_s;
+
+/**
+ * @brief Compile the metadata into a validator.
+ *
+ * @param meta The JSON metadata.
+ * @return The validator, which the caller must free with
+ *      fbp_pubsub_meta_free().  Returns NULL if the metadata could
+ *      not be parsed.
+ *
+ * The validator holds the dtype and option table in a single binary
+ * allocation.  fbp_pubsub_meta_validate() then behaves identically to
+ * fbp_pubsub_meta_value() without parsing the JSON.
+ */
+FBP_API struct fbp_pubsub_meta_validator_s * fbp_pubsub_meta_compile(const char * meta);
+
+/**
+ * @brief Validate a parameter value using the compiled metadata.
+ *
+ * @param validator The validator from fbp_pubsub_meta_compile().
+ * @param value[inout] The value, which is modified in place.
+ * @return 0 or error code.
+ */
+FBP_API int32_t fbp_pubsub_meta_validate(const struct fbp_pubsub_meta_validator_s * validator,
+                                         struct fbp_union_s * value);
+
+/**
+ * @brief Free a compiled validator.
+ *
+ * @param validator The validator from fbp_pubsub_meta_compile() or NULL.
+ */
+FBP_API void fbp_pubsub_meta_free(struct fbp_pubsub_meta_validator_s * validator);
+
 FBP_CPP_GUARD_END
 
 /** @} */
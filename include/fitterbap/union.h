@@ -74,6 +74,9 @@ enum fbp_union_flag_e {
 
     /// The value points to a const that will remain valid indefinitely.
     FBP_UNION_FLAG_CONST = (1 << 1),
+
+    /// The value points to a reference counted buffer from fbp_pubsub_buf_alloc().
+    FBP_UNION_FLAG_REF = (1 << 2),
 };
 
 /// The actual value holder for fbp_union_s.
@@ -129,17 +129,24 @@ static inline void unlock(struct fbp_dl_s * self) {
     }
 }
 
-int32_t fbp_dl_send(struct fbp_dl_s * self,
-                    uint16_t metadata,
-                    uint8_t const *msg, uint32_t msg_size) {
+int32_t fbp_dl_sendv(struct fbp_dl_s * self,
+                     uint16_t metadata,
+                     struct fbp_iovec_s const *iov, uint32_t iov_count) {
     if (self->state != ST_CONNECTED) {
         return FBP_ERROR_UNAVAILABLE;
     }
     struct fbp_framer_s * framer = self->framer;
+    uint32_t msg_size = 0;
+    for (uint32_t i = 0; i < iov_count; ++i) {
+        msg_size += iov[i].size;
+    }
     if (msg_size > FBP_FRAMER_PAYLOAD_MAX_SIZE) {
         FBP_LOGW("fbp_framer_send msg_size too big: %d", (int) msg_size);
         return FBP_ERROR_PARAMETER_INVALID;
     }
+    if (!framer->construct_datav && (iov_count != 1)) {
+        return FBP_ERROR_NOT_SUPPORTED;
+    }
     lock(self);
     uint16_t frame_id = self->tx_frame_next_id;
     uint16_t idx = frame_id & (self->tx_frame_count - 1);
@@ -155,7 +162,11 @@ int32_t fbp_dl_send(struct fbp_dl_s * self,
     f->next_send_time = 0;
     self->tx_status.msg_bytes += msg_size;
 
-    FBP_ASSERT(0 == framer->construct_data(framer, f->msg, &f->length, frame_id, metadata, msg, msg_size));
+    if (framer->construct_datav) {
+        FBP_ASSERT(0 == framer->construct_datav(framer, f->msg, &f->length, frame_id, metadata, iov, iov_count));
+    } else {
+        FBP_ASSERT(0 == framer->construct_data(framer, f->msg, &f->length, frame_id, metadata, iov[0].buf, iov[0].size));
+    }
     self->tx_frame_next_id = (frame_id + 1) & FBP_FRAMER_FRAME_ID_MAX;
     f->state = TX_FRAME_ST_VALID | TX_FRAME_ST_FORCE;
     unlock(self);
@@ -167,6 +178,13 @@ int32_t fbp_dl_send(struct fbp_dl_s * self,
     return 0;
 }
 
+int32_t fbp_dl_send(struct fbp_dl_s * self,
+                    uint16_t metadata,
+                    uint8_t const *msg, uint32_t msg_size) {
+    struct fbp_iovec_s iov = {.buf = msg, .size = msg_size};
+    return fbp_dl_sendv(self, metadata, &iov, 1);
+}
+
 FBP_USED static uint16_t tx_buf_frame_id(struct tx_frame_s * f) {
     return (((uint16_t) f->msg[2] & 0x7) << 8) | f->msg[3];
 }
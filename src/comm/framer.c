@@ -290,12 +290,16 @@ void fbp_framer_reset(struct fbp_framer_s * ext_self) {
     fbp_memset(&ext_self->status, 0, sizeof(ext_self->status));
 }
 
-int32_t fbp_framer_construct_data(
+int32_t fbp_framer_construct_datav(
         struct fbp_framer_s * ext_self,
         uint8_t * b, uint16_t * b_size,
         uint16_t frame_id, uint16_t metadata,
-        uint8_t const *msg, uint32_t msg_size) {
+        struct fbp_iovec_s const *iov, uint32_t iov_count) {
     (void) ext_self;
+    uint32_t msg_size = 0;
+    for (uint32_t i = 0; i < iov_count; ++i) {
+        msg_size += iov[i].size;
+    }
     if ((msg_size < 1) || (msg_size > 256) || (frame_id > FBP_FRAMER_FRAME_ID_MAX)) {
         return FBP_ERROR_PARAMETER_INVALID;
     }
@@ -312,7 +316,13 @@ int32_t fbp_framer_construct_data(
     b[5] = length_crc_table[length_field];
     b[6] = metadata & 0xff;
     b[7] = (metadata >> 8) & 0xff;
-    memcpy(b + FBP_FRAMER_HEADER_SIZE, msg, msg_size);
+    uint8_t * p = b + FBP_FRAMER_HEADER_SIZE;
+    for (uint32_t i = 0; i < iov_count; ++i) {
+        if (iov[i].size) {
+            memcpy(p, iov[i].buf, iov[i].size);
+            p += iov[i].size;
+        }
+    }
     uint32_t crc = FBP_CONFIG_COMM_FRAMER_CRC32(b + 2, msg_size + FBP_FRAMER_HEADER_SIZE - 2);
     b[FBP_FRAMER_HEADER_SIZE + msg_size + 0] = crc & 0xff;
     b[FBP_FRAMER_HEADER_SIZE + msg_size + 1] = (crc >> 8) & 0xff;
@@ -321,6 +331,15 @@ int32_t fbp_framer_construct_data(
     return 0;
 }
 
+int32_t fbp_framer_construct_data(
+        struct fbp_framer_s * ext_self,
+        uint8_t * b, uint16_t * b_size,
+        uint16_t frame_id, uint16_t metadata,
+        uint8_t const *msg, uint32_t msg_size) {
+    struct fbp_iovec_s iov = {.buf = msg, .size = msg_size};
+    return fbp_framer_construct_datav(ext_self, b, b_size, frame_id, metadata, &iov, 1);
+}
+
 int32_t fbp_framer_construct_link(
         struct fbp_framer_s * ext_self,
         uint64_t * b, enum fbp_framer_type_e frame_type, uint16_t frame_id) {
@@ -370,6 +389,7 @@ FBP_API struct fbp_framer_s * fbp_framer_initialize() {
     x->recv = fbp_framer_recv;
     x->reset = fbp_framer_reset;
     x->construct_data = fbp_framer_construct_data;
+    x->construct_datav = fbp_framer_construct_datav;
     x->construct_link = fbp_framer_construct_link;
     x->finalize = fbp_framer_finalize;
     fbp_framer_reset(x);
@@ -15,6 +15,7 @@
  */
 
 #include "fitterbap/comm/log_port.h"
+#include "fitterbap/cdef.h"
 #include "fitterbap/log.h"
 #include "fitterbap/pubsub.h"
 #include "fitterbap/collections/list.h"
@@ -44,16 +45,6 @@ static const char LEVEL_META[] =
         "]"
     "}";
 
-/**
- * @brief The full-sized logging message structure.
- */
-struct buf_s {
-    /// The message metadata.
-    struct fbp_logh_header_s header;
-    /// The filename and message strings.
-    char data[FBP_LOGP_DATA_SIZE_MAX];
-};
-
 struct logp_s {
     struct fbp_port_api_s api;
     uint8_t is_connected;
@@ -162,28 +153,30 @@ void on_transport_recv(void *user_data,
 int32_t fbp_logp_recv(void * user_data, struct fbp_logh_header_s const * header,
                       const char * filename, const char * message) {
     struct logp_s * self = (struct logp_s *) user_data;
-    struct buf_s buf;
-    char * p_start = (char *) &buf;
-    char * p;
+    static const char sep[2] = {FBP_LOGP_SEP, 0};
+    uint32_t filename_sz = 0;
+    uint32_t message_sz = 0;
     if (!self || !self->is_connected) {
         return FBP_ERROR_UNAVAILABLE;  // discard
     }
     if (header->level > self->level_filter) {
         return 0;
     }
-    buf.header = *header;
-    p = buf.data;
-    for (int i = 0; (i < FBP_LOGH_FILENAME_SIZE_MAX) && (*filename); ++i) {
-        *p++ = *filename++;
+    while ((filename_sz < FBP_LOGH_FILENAME_SIZE_MAX) && filename[filename_sz]) {
+        ++filename_sz;
     }
-    *p++ = FBP_LOGP_SEP;
-    for (int i = 0; (i < FBP_LOGH_MESSAGE_SIZE_MAX) && (*message); ++i) {
-        *p++ = *message++;
+    while ((message_sz < FBP_LOGH_MESSAGE_SIZE_MAX) && message[message_sz]) {
+        ++message_sz;
     }
-    *p++ = 0;
-
-    return fbp_transport_send(self->transport, self->port_id, FBP_TRANSPORT_SEQ_SINGLE,
-                              0, (uint8_t *) p_start, (uint32_t) (p - p_start));
+    struct fbp_iovec_s iov[5] = {
+            {.buf = header, .size = sizeof(*header)},
+            {.buf = filename, .size = filename_sz},
+            {.buf = &sep[0], .size = 1},
+            {.buf = message, .size = message_sz},
+            {.buf = &sep[1], .size = 1},
+    };
+    return fbp_transport_sendv(self->transport, self->port_id, FBP_TRANSPORT_SEQ_SINGLE,
+                               0, iov, FBP_ARRAY_SIZE(iov));
 }
 
 void fbp_logp_handler_register(struct fbp_port_api_s * api, fbp_logp_publish_formatted fn, void * user_data) {
@@ -20,6 +20,7 @@
 #include "fitterbap/comm/transport.h"
 #include "fitterbap/pubsub.h"
 #include "fitterbap/cdef.h"
+#include "fitterbap/crc.h"
 #include "fitterbap/cstr.h"
 #include "fitterbap/log.h"
 #include "fitterbap/ec.h"
@@ -31,6 +32,11 @@
 
 
 #define TIMESYNC_INTERVAL_MS  (10000)
+#define FEATURES (FBP_PORT0_FEATURE_META_DIGEST | FBP_PORT0_FEATURE_CREDIT)
+#define META_PORT_COUNT (FBP_TRANSPORT_PORT_MAX + 1)
+#define META_RX_PORT_NONE (0xff)
+#define ECHO_RTT_SUB_BITS (3)  // log2(FBP_PORT0_ECHO_RTT_SUB_BUCKETS)
+#define ECHO_RTT_BUCKETS ((32 - ECHO_RTT_SUB_BITS + 1) * FBP_PORT0_ECHO_RTT_SUB_BUCKETS)
 
 const char FBP_PORT0_META[] = "{\"type\":\"oam\", \"name\": \"oam\"}";
 static const char STATE_TOPIC[] = "0/state";
@@ -39,6 +45,12 @@ static const char REMOTE_STATUS_TOPIC[] = "0/rstat";
 static const char ECHO_ENABLE_META_TOPIC[] = "0/echo/enable";
 static const char ECHO_OUTSTANDING_META_TOPIC[] = "0/echo/window";
 static const char ECHO_LENGTH_META_TOPIC[] = "0/echo/length";
+static const char ECHO_MODE_META_TOPIC[] = "0/echo/mode";
+static const char ECHO_STATS_TOPIC[] = "0/echo/stats";
+static const char PIPELINE_META_TOPIC[] = "0/pipe";
+static const char LATENCY_TOPIC[] = "0/latency";
+static const char TS_DRIFT_TOPIC[] = "0/ts/drift";
+static const char TS_UNCERTAINTY_TOPIC[] = "0/ts/uncertainty";
 
 
 static const char STATE_META[] =
@@ -51,6 +63,45 @@ static const char STATE_META[] =
     "\"retain\": 1"
     "}";
 
+static const char PIPELINE_META[] =
+    "{"
+    "\"dtype\": \"bool\","
+    "\"brief\": \"Pipeline the connection handshake\","
+    "\"detail\": \"Send negotiate, timesync and meta together and connect ports as soon as negotiate completes.  Requires both sides and takes effect on the next connection.\","
+    "\"default\": 0,"
+    "\"retain\": 1"
+    "}";
+
+static const char LATENCY_META[] =
+    "{"
+    "\"dtype\": \"u32\","
+    "\"brief\": \"Connect latency\","
+    "\"detail\": \"The duration from data link connect to port0 connected in microseconds.\","
+    "\"default\": 0,"
+    "\"flags\": [\"ro\"],"
+    "\"retain\": 1"
+    "}";
+
+static const char TS_DRIFT_META[] =
+    "{"
+    "\"dtype\": \"i32\","
+    "\"brief\": \"Timesync counter drift\","
+    "\"detail\": \"The estimated local counter frequency error in ppb, positive when fast.\","
+    "\"default\": 0,"
+    "\"flags\": [\"ro\"],"
+    "\"retain\": 1"
+    "}";
+
+static const char TS_UNCERTAINTY_META[] =
+    "{"
+    "\"dtype\": \"u32\","
+    "\"brief\": \"Timesync uncertainty\","
+    "\"detail\": \"The filtered mean absolute offset measured by timesync in nanoseconds.\","
+    "\"default\": 0,"
+    "\"flags\": [\"ro\"],"
+    "\"retain\": 1"
+    "}";
+
 static const char ECHO_ENABLE_META[] =
     "{"
     "\"dtype\": \"bool\","
@@ -72,11 +123,21 @@ static const char ECHO_LENGTH_META[] =
     "{"
     "\"dtype\": \"u32\","
     "\"brief\": \"Length of each frame in bytes\","
+    "\"detail\": \"RTT measurement requires at least 16 bytes.\","
     "\"default\": 256,"
     "\"range\": [8, 256],"  // inclusive
     "\"retain\": 1"
     "}";
 
+static const char ECHO_MODE_META[] =
+    "{"
+    "\"dtype\": \"u32\","
+    "\"brief\": \"Echo benchmark mode\","
+    "\"default\": 0,"
+    "\"options\": [[0, \"ping_pong\"], [1, \"flood\"]],"
+    "\"retain\": 1"
+    "}";
+
 
 enum events_e {
     EV_DL_DISCONNECTED,
@@ -97,6 +158,11 @@ enum port0_state_e {
     ST_CONNECTED,
 };
 
+struct meta_cache_s {
+    uint32_t digest;            ///< The CRC32 digest, 0 for no metadata.
+    char * json;                ///< The metadata, NULL for no metadata.
+};
+
 struct fbp_port0_s {
     struct fbp_fsm_s fsm;
     enum fbp_port0_mode_e mode;
@@ -105,28 +171,64 @@ struct fbp_port0_s {
     struct fbp_pubsub_s * pubsub;
     struct fbp_evm_api_s evm;
     char topic_prefix[FBP_PUBSUB_TOPIC_LENGTH_MAX];
-    fbp_transport_send_fn send_fn;
+    fbp_transport_sendv_fn sendv_fn;
     uint8_t meta_port_id;
+    uint8_t meta_digest_sent;   ///< Client sent the digest
+    uint8_t meta_req_valid;     ///< Client received the request bitmask
+    uint8_t meta_req_pending;   ///< Server request bitmask not yet sent
+    uint8_t meta_rx_port_id;    ///< Server segmented metadata port_id
+    uint32_t features;          ///< The negotiated FBP_PORT0_FEATURE_* bitmap
+    uint32_t features_req;      ///< The FBP_PORT0_FEATURE_* bitmap in the server negotiate request
+    uint32_t meta_req_mask;     ///< The requested metadata ports
+    uint32_t meta_offset;       ///< Client metadata bytes sent for meta_port_id
+    uint32_t meta_rx_size;      ///< Server segmented metadata size
+    char * meta_rx;             ///< Server segmented metadata buffer
+    uint32_t meta_digest[META_PORT_COUNT];          ///< Server received digests
+    struct meta_cache_s meta_cache[META_PORT_COUNT];  ///< Server metadata cache
     uint8_t topic_prefix_length;
     struct fbp_ts_s * timesync;
 
     int32_t timeout_event_id;
     int32_t tick_event_id;
 
+    uint8_t pipeline;               ///< Pipelined handshake on/off control
+    uint8_t transport_connected;    ///< FBP_DL_EV_TRANSPORT_CONNECTED injected
+    int64_t connect_start;          ///< The data link connect time
+
     uint8_t echo_enable;        ///< Echo on/off control
     uint8_t echo_window;        ///< Number of outstanding echo frames
     uint16_t echo_length;       ///< Echo payload length
+    uint8_t echo_mode;          ///< The fbp_port0_echo_mode_e
+    uint8_t echo_flood_rx;      ///< Receiving flood requests from the remote
 
     int64_t echo_rx_frame_id;
     int64_t echo_tx_frame_id;
     int64_t echo_buffer[FBP_FRAMER_PAYLOAD_MAX_SIZE / sizeof(int64_t)];
 
-    int32_t negotiate_rsp[4];
+    int32_t echo_event_id;
+    int64_t echo_interval_start;
+    uint32_t echo_rtt_last_us;
+    uint32_t echo_jitter_q4;    ///< RFC 3550 jitter estimate in 28Q4 microseconds
+    uint32_t echo_rtt_hist[ECHO_RTT_BUCKETS];  ///< RTT counts for the interval
+    struct fbp_port0_echo_stats_s echo_accum;
+    struct fbp_port0_echo_stats_s echo_stats;
+
+    int32_t negotiate_rsp[5];
+
+    int32_t credit_event_id;
+    uint32_t credit_grant[FBP_TRANSPORT_PORT_MAX + 1];  ///< Taken but not yet sent
 };
 
 #define REQ(op)    ((0x00) | ((FBP_PORT0_OP_##op) & 0x07))
 #define RSP(op)    ((0x80) | ((FBP_PORT0_OP_##op) & 0x07))
 
+static void publish(struct fbp_port0_s * self, const char * subtopic, const struct fbp_union_s * value);
+
+static int32_t send_msg(struct fbp_port0_s * self, uint8_t port_data, void const * msg, uint32_t msg_size) {
+    struct fbp_iovec_s iov = {.buf = msg, .size = msg_size};
+    return self->sendv_fn(self->transport, 0, FBP_TRANSPORT_SEQ_SINGLE, port_data, &iov, 1);
+}
+
 static const char * event_to_str(struct fbp_fsm_s * self, fbp_fsm_event_t event) {
     (void) self;
     switch (event) {
@@ -210,33 +312,211 @@ static inline void topic_reset(struct fbp_port0_s * self) {
 }
 
 static void echo_send(struct fbp_port0_s * self) {
-    while ((self->fsm.state == ST_CONNECTED) && self->echo_enable
-            && ((self->echo_tx_frame_id - self->echo_rx_frame_id) < self->echo_window)) {
-        self->echo_buffer[0] = self->echo_tx_frame_id++;
-        if (self->send_fn(self->transport, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(ECHO),
-                          (uint8_t *) self->echo_buffer, self->echo_length)) {
-            FBP_LOGW("echo_send error");
-            --self->echo_rx_frame_id;
-            break;
+    uint8_t port_data = REQ(ECHO);
+    bool flood = (self->echo_mode == FBP_PORT0_ECHO_MODE_FLOOD);
+    if (flood) {
+        port_data |= FBP_PORT0_ECHO_FLOOD;
+    }
+    // ping_pong: limit outstanding frames, flood: limit frames per echo timer tick
+    int64_t limit = (flood ? self->echo_tx_frame_id : self->echo_rx_frame_id) + self->echo_window;
+    while ((self->fsm.state == ST_CONNECTED) && self->echo_enable && (self->echo_tx_frame_id < limit)) {
+        self->echo_buffer[0] = self->echo_tx_frame_id;
+        self->echo_buffer[1] = self->evm.timestamp(self->evm.evm);
+        if (send_msg(self, port_data, (uint8_t *) self->echo_buffer, self->echo_length)) {
+            if (!flood) {
+                FBP_LOGW("echo_send error");
+            }
+            break;  // flood: wait for echo timer to refill
+        }
+        ++self->echo_tx_frame_id;
+        self->echo_accum.tx_msgs += 1;
+        self->echo_accum.tx_bytes += self->echo_length;
+    }
+}
+
+static void echo_accum_reset(struct fbp_port0_s * self, int64_t now) {
+    fbp_memset(&self->echo_accum, 0, sizeof(self->echo_accum));
+    fbp_memset(self->echo_rtt_hist, 0, sizeof(self->echo_rtt_hist));
+    self->echo_interval_start = now;
+}
+
+static uint32_t rate_per_second(uint32_t count, int64_t duration) {
+    if (duration <= 0) {
+        return 0;
+    }
+    return (uint32_t) ((((int64_t) count) * FBP_TIME_SECOND) / duration);
+}
+
+/*
+ * The histogram buckets are exact below FBP_PORT0_ECHO_RTT_SUB_BUCKETS.
+ * Above, each power of two splits into FBP_PORT0_ECHO_RTT_SUB_BUCKETS
+ * equal buckets, like a float with ECHO_RTT_SUB_BITS of mantissa.
+ */
+static uint32_t echo_rtt_bucket(uint32_t rtt_us) {
+    if (rtt_us < FBP_PORT0_ECHO_RTT_SUB_BUCKETS) {
+        return rtt_us;
+    }
+    uint32_t group = (31 - fbp_clz(rtt_us)) - ECHO_RTT_SUB_BITS + 1;
+    uint32_t mantissa = (rtt_us >> (group - 1)) & (FBP_PORT0_ECHO_RTT_SUB_BUCKETS - 1);
+    return group * FBP_PORT0_ECHO_RTT_SUB_BUCKETS + mantissa;
+}
+
+static uint32_t echo_rtt_bucket_midpoint(uint32_t bucket) {
+    if (bucket < FBP_PORT0_ECHO_RTT_SUB_BUCKETS) {
+        return bucket;
+    }
+    uint32_t group = bucket / FBP_PORT0_ECHO_RTT_SUB_BUCKETS;
+    uint64_t mantissa = FBP_PORT0_ECHO_RTT_SUB_BUCKETS + (bucket % FBP_PORT0_ECHO_RTT_SUB_BUCKETS);
+    uint64_t width = 1ULL << (group - 1);
+    return (uint32_t) ((mantissa * width) + (width >> 1));
+}
+
+static void echo_rtt_add(struct fbp_port0_s * self, int64_t rtt) {
+    if (rtt < 0) {
+        return;
+    }
+    int64_t rtt_us64 = FBP_TIME_TO_COUNTER(rtt, 1000000);
+    uint32_t rtt_us = (rtt_us64 > UINT32_MAX) ? UINT32_MAX : (uint32_t) rtt_us64;
+    self->echo_rtt_hist[echo_rtt_bucket(rtt_us)] += 1;
+    if (self->echo_rtt_last_us != UINT32_MAX) {
+        // RFC 3550 section 6.4.1: J += (|D| - J) / 16
+        uint32_t d = (rtt_us > self->echo_rtt_last_us) ? (rtt_us - self->echo_rtt_last_us) : (self->echo_rtt_last_us - rtt_us);
+        self->echo_jitter_q4 += d - ((self->echo_jitter_q4 + 8) >> 4);
+    }
+    self->echo_rtt_last_us = rtt_us;
+    if (!self->echo_accum.rtt_count || (rtt_us < self->echo_accum.rtt_min_us)) {
+        self->echo_accum.rtt_min_us = rtt_us;
+    }
+    if (rtt_us > self->echo_accum.rtt_max_us) {
+        self->echo_accum.rtt_max_us = rtt_us;
+    }
+    self->echo_accum.rtt_count += 1;
+}
+
+static uint32_t echo_rtt_percentile(struct fbp_port0_s * self, uint32_t pct) {
+    const struct fbp_port0_echo_stats_s * s = &self->echo_accum;
+    uint32_t rank = (uint32_t) ((((uint64_t) s->rtt_count - 1) * pct + 50) / 100);
+    uint32_t bucket = 0;
+    uint32_t total = self->echo_rtt_hist[0];
+    while ((total <= rank) && (bucket < (ECHO_RTT_BUCKETS - 1))) {
+        total += self->echo_rtt_hist[++bucket];
+    }
+    uint32_t v = echo_rtt_bucket_midpoint(bucket);
+    if (v < s->rtt_min_us) {
+        v = s->rtt_min_us;
+    } else if (v > s->rtt_max_us) {
+        v = s->rtt_max_us;
+    }
+    return v;
+}
+
+static void echo_stats_publish(struct fbp_port0_s * self, int64_t now) {
+    struct fbp_port0_echo_stats_s * s = &self->echo_stats;
+    *s = self->echo_accum;
+    s->version = 1;
+    s->mode = self->echo_mode;
+    s->duration = now - self->echo_interval_start;
+    s->tx_msgs_per_s = rate_per_second(s->tx_msgs, s->duration);
+    s->tx_bytes_per_s = rate_per_second(s->tx_bytes, s->duration);
+    s->rx_msgs_per_s = rate_per_second(s->rx_msgs, s->duration);
+    s->rx_bytes_per_s = rate_per_second(s->rx_bytes, s->duration);
+
+    if (s->rtt_count) {
+        s->rtt_p50_us = echo_rtt_percentile(self, 50);
+        s->rtt_p90_us = echo_rtt_percentile(self, 90);
+        s->rtt_p99_us = echo_rtt_percentile(self, 99);
+    }
+    s->jitter_us = self->echo_jitter_q4 >> 4;
+    publish(self, ECHO_STATS_TOPIC, &fbp_union_cbin((const uint8_t *) s, sizeof(*s)));
+    echo_accum_reset(self, now);
+}
+
+static void echo_timer_clear(struct fbp_port0_s * self) {
+    if (self->echo_event_id) {
+        self->evm.cancel(self->evm.evm, self->echo_event_id);
+        self->echo_event_id = 0;
+    }
+}
+
+static void on_echo_timer(void * user_data, int32_t event_id);
+
+static void echo_timer_set(struct fbp_port0_s * self) {
+    uint32_t timeout_ms = FBP_PORT0_ECHO_STATS_INTERVAL_MS;
+    if (self->echo_enable && (self->echo_mode == FBP_PORT0_ECHO_MODE_FLOOD)) {
+        timeout_ms = 1;  // refill the transmit window
+    }
+    echo_timer_clear(self);
+    int64_t now = self->evm.timestamp(self->evm.evm);
+    int64_t ts = now + FBP_COUNTER_TO_TIME(timeout_ms, 1000);
+    self->echo_event_id = self->evm.schedule(self->evm.evm, ts, on_echo_timer, self);
+}
+
+static void on_echo_timer(void * user_data, int32_t event_id) {
+    (void) event_id;
+    struct fbp_port0_s * self = (struct fbp_port0_s *) user_data;
+    self->echo_event_id = 0;
+    echo_send(self);
+    int64_t now = self->evm.timestamp(self->evm.evm);
+    if ((now - self->echo_interval_start) >= FBP_COUNTER_TO_TIME(FBP_PORT0_ECHO_STATS_INTERVAL_MS, 1000)) {
+        if (!self->echo_enable && !self->echo_accum.rx_msgs) {
+            self->echo_flood_rx = 0;  // remote flood finished
+            return;
         }
+        echo_stats_publish(self, now);
+    }
+    if (self->echo_enable || self->echo_flood_rx) {
+        echo_timer_set(self);
     }
 }
 
+static void echo_start(struct fbp_port0_s * self) {
+    self->echo_tx_frame_id = 0;
+    self->echo_rx_frame_id = 0;
+    self->echo_jitter_q4 = 0;
+    self->echo_rtt_last_us = UINT32_MAX;
+    echo_accum_reset(self, self->evm.timestamp(self->evm.evm));
+    echo_timer_set(self);
+    echo_send(self);
+}
+
 static uint8_t on_echo_enable(void * user_data, const char * topic, const struct fbp_union_s * value) {
     (void) topic;
     struct fbp_port0_s * self = (struct fbp_port0_s *) user_data;
-    if (value->type != FBP_UNION_U32) {
+    bool enable = false;
+    if (fbp_union_to_bool(value, &enable)) {
         FBP_LOGW("echo enable, bad type");
         return FBP_ERROR_PARAMETER_INVALID;
     }
-    self->echo_enable = value->value.u32 ? 1 : 0;
+    self->echo_enable = enable ? 1 : 0;
     if (self->echo_enable) {
         FBP_LOGD1("echo on");
-        self->echo_tx_frame_id = 0;
-        self->echo_rx_frame_id = 0;
-        echo_send(self);
+        echo_start(self);
     } else {
         FBP_LOGD1("echo off");
+        if (!self->echo_flood_rx) {
+            echo_timer_clear(self);
+        }
+    }
+    return 0;
+}
+
+static uint8_t on_echo_mode(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) topic;
+    struct fbp_port0_s * self = (struct fbp_port0_s *) user_data;
+    struct fbp_union_s x = *value;
+    if (fbp_union_as_type(&x, FBP_UNION_U32)) {  // accept any integer type
+        FBP_LOGW("on_echo_mode, bad type");
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    uint32_t v = x.value.u32;
+    if (v > FBP_PORT0_ECHO_MODE_FLOOD) {
+        FBP_LOGW("on_echo_mode, bad value");
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    FBP_LOGD1("on_echo_mode");
+    self->echo_mode = (uint8_t) v;
+    if (self->echo_enable) {
+        echo_start(self);
     }
     return 0;
 }
@@ -277,6 +557,27 @@ static uint8_t on_echo_length(void * user_data, const char * topic, const struct
     return 0;
 }
 
+/// The FBP_PORT0_FEATURE_* bitmap this side supports.
+static uint32_t features_local(struct fbp_port0_s * self) {
+    return FEATURES | (self->pipeline ? FBP_PORT0_FEATURE_PIPELINE : 0);
+}
+
+static inline bool pipelined(struct fbp_port0_s * self) {
+    return (self->features & FBP_PORT0_FEATURE_PIPELINE) != 0;
+}
+
+static uint8_t on_pipeline(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) topic;
+    struct fbp_port0_s * self = (struct fbp_port0_s *) user_data;
+    bool enable = false;
+    if (fbp_union_to_bool(value, &enable)) {
+        FBP_LOGW("on_pipeline, bad type");
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    self->pipeline = enable ? 1 : 0;
+    return 0;
+}
+
 static void publish(struct fbp_port0_s * self, const char * subtopic, const struct fbp_union_s * value) {
     topic_append(self, subtopic);
     fbp_pubsub_publish(self->pubsub, self->topic_prefix, value, NULL, NULL);
@@ -309,6 +610,69 @@ void fbp_port0_on_event_cbk(struct fbp_port0_s * self, enum fbp_dl_event_e event
 
 typedef void (*dispatch_fn)(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size);
 
+static void credit_timer_clear(struct fbp_port0_s * self) {
+    if (self->credit_event_id) {
+        self->evm.cancel(self->evm.evm, self->credit_event_id);
+        self->credit_event_id = 0;
+    }
+}
+
+static void on_credit_timer(void * user_data, int32_t event_id);
+
+static void credit_timer_set(struct fbp_port0_s * self, uint32_t timeout_ms) {
+    if (!self->credit_event_id) {
+        int64_t ts = self->evm.timestamp(self->evm.evm) + FBP_COUNTER_TO_TIME(timeout_ms, 1000);
+        self->credit_event_id = self->evm.schedule(self->evm.evm, ts, on_credit_timer, self);
+    }
+}
+
+static void on_credit_timer(void * user_data, int32_t event_id) {
+    (void) event_id;
+    struct fbp_port0_s * self = (struct fbp_port0_s *) user_data;
+    uint32_t grant[FBP_TRANSPORT_PORT_MAX];
+    uint32_t count = 0;
+    self->credit_event_id = 0;
+    for (uint8_t port_id = 1; port_id <= FBP_TRANSPORT_PORT_MAX; ++port_id) {
+        self->credit_grant[port_id] += fbp_transport_credit_grant_take(self->transport, port_id);
+        uint32_t credits = min_u32(self->credit_grant[port_id], 0x00ffffffU);
+        if (credits) {
+            grant[count++] = (credits << 8) | port_id;
+        }
+    }
+    if (!count) {
+        return;
+    }
+    if (send_msg(self, REQ(CREDIT), grant, count * sizeof(uint32_t))) {
+        credit_timer_set(self, 1);  // buffer full, retry
+        return;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        self->credit_grant[grant[i] & FBP_TRANSPORT_PORT_MAX] -= grant[i] >> 8;
+    }
+}
+
+/// fbp_transport_credit_fn: grant in one batch after the current receive burst.
+static void on_credit(void * user_data) {
+    credit_timer_set((struct fbp_port0_s *) user_data, 0);
+}
+
+static void credit_clear(struct fbp_port0_s * self) {
+    credit_timer_clear(self);
+    fbp_memset(self->credit_grant, 0, sizeof(self->credit_grant));
+}
+
+static void op_credit_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
+    uint32_t entry;
+    if (!(self->features & FBP_PORT0_FEATURE_CREDIT) || (msg_size & 3)) {
+        FBP_LOGW("credit_req invalid on %s", self->topic_prefix);
+        return;
+    }
+    for (uint32_t offset = 0; offset < msg_size; offset += sizeof(entry)) {
+        memcpy(&entry, msg + offset, sizeof(entry));
+        fbp_transport_port_credit_return(self->transport, (uint8_t) (entry & FBP_TRANSPORT_PORT_MAX), entry >> 8);
+    }
+}
+
 static void op_status_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
     (void) msg;
     (void) msg_size;
@@ -321,8 +685,7 @@ static void op_status_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_
     if (!rc) {
         return;
     }
-    self->send_fn(self->transport, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(STATUS),
-                  (uint8_t *) &status, sizeof(status));
+    send_msg(self, RSP(STATUS), (uint8_t *) &status, sizeof(status));
 }
 
 static void op_status_rsp(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
@@ -332,7 +695,31 @@ static void op_status_rsp(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_
 static void op_echo_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
     // Send response with same payload
     if (self->fsm.state == ST_CONNECTED) {
-        self->send_fn(self->transport, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(ECHO), msg, msg_size);
+        send_msg(self, RSP(ECHO), msg, msg_size);
+    }
+}
+
+static void op_echo_flood(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
+    if (self->fsm.state != ST_CONNECTED) {
+        return;
+    }
+    if (!self->echo_flood_rx) {
+        self->echo_flood_rx = 1;
+        if (!self->echo_enable) {
+            echo_accum_reset(self, self->evm.timestamp(self->evm.evm));
+            self->echo_rx_frame_id = 0;
+            echo_timer_set(self);
+        }
+    }
+    self->echo_accum.rx_msgs += 1;
+    self->echo_accum.rx_bytes += msg_size;
+    if (msg_size >= 8) {
+        int64_t frame_id;
+        memcpy(&frame_id, msg, sizeof(frame_id));
+        if ((frame_id != self->echo_rx_frame_id) && frame_id) {
+            self->echo_accum.errors += 1;
+        }
+        self->echo_rx_frame_id = frame_id + 1;
     }
 }
 
@@ -344,14 +731,22 @@ static void op_echo_rsp(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_si
     if (msg_size != self->echo_length) {
         FBP_LOGW("unexpected echo length: %d != %d", (int) msg_size, (int) self->echo_length);
     }
+    self->echo_accum.rx_msgs += 1;
+    self->echo_accum.rx_bytes += msg_size;
     if (msg_size >= 8) {
         int64_t frame_id;
         memcpy(&frame_id, msg, sizeof(frame_id));
         if (frame_id != self->echo_rx_frame_id) {
             FBP_LOGW("echo frame_id mismatch: %lld != %lld", frame_id, self->echo_rx_frame_id);
+            self->echo_accum.errors += 1;
         }
         self->echo_rx_frame_id = frame_id + 1;
     }
+    if (msg_size >= 16) {
+        int64_t tx_time;
+        memcpy(&tx_time, msg + 8, sizeof(tx_time));
+        echo_rtt_add(self, self->evm.timestamp(self->evm.evm) - tx_time);
+    }
     echo_send(self);
 }
 
@@ -361,8 +756,7 @@ static int32_t timesync_req_send(struct fbp_port0_s * self) {
     if (self->mode == FBP_PORT0_MODE_SERVER) {
         FBP_LOGW("timesync_req_send by server");
     }
-    return self->send_fn(self->transport, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(TIMESYNC),
-                         (uint8_t *) times, sizeof(times));
+    return send_msg(self, REQ(TIMESYNC), (uint8_t *) times, sizeof(times));
 }
 
 static void op_timesync_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
@@ -373,14 +767,26 @@ static void op_timesync_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t ms
     memcpy(times, msg, 2 * sizeof(int64_t));
     times[2] = fbp_time_utc();
     times[3] = times[2];
-    if (self->send_fn(self->transport, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(TIMESYNC),
-                      (uint8_t *) times, sizeof(times))) {
+    if (send_msg(self, RSP(TIMESYNC), (uint8_t *) times, sizeof(times))) {
         FBP_LOGW("timestamp reply error");
     } else if (self->mode == FBP_PORT0_MODE_SERVER) {
         emit_event(self, EV_TIMESYNC_DONE);
     }
 }
 
+static void timesync_publish(struct fbp_port0_s * self) {
+    struct fbp_ts_status_s status;
+    if (!self->timesync || fbp_ts_status_get(self->timesync, &status)) {
+        return;
+    }
+    int64_t uncertainty_ns = FBP_TIME_TO_NANOSECONDS(status.uncertainty);
+    if (uncertainty_ns > UINT32_MAX) {
+        uncertainty_ns = UINT32_MAX;
+    }
+    publish(self, TS_DRIFT_TOPIC, &fbp_union_i32_r(status.drift_ppb));
+    publish(self, TS_UNCERTAINTY_TOPIC, &fbp_union_u32_r((uint32_t) uncertainty_ns));
+}
+
 static void op_timesync_rsp(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
     int64_t times[5] = {0, 0, 0, 0, 0};
     if (msg_size < sizeof(times)) {
@@ -390,89 +796,289 @@ static void op_timesync_rsp(struct fbp_port0_s * self, uint8_t *msg, uint32_t ms
     memcpy(times, msg, sizeof(times));  // copy to guarantee alignment
     times[4] = fbp_time_counter_u64();
     fbp_ts_update(self->timesync, (uint64_t) times[1], times[2], times[3], (uint64_t) times[4]);
+    timesync_publish(self);
 
     if (self->mode == FBP_PORT0_MODE_CLIENT) {
         emit_event(self, EV_TIMESYNC_DONE);
     }
 }
 
-static int32_t meta_send_next(struct fbp_port0_s * self) {
-    uint8_t msg[FBP_FRAMER_PAYLOAD_MAX_SIZE];
-    size_t meta_sz;
+static const char * meta_get(struct fbp_port0_s * self, uint8_t port_id) {
+    const char * meta = fbp_transport_meta_get(self->transport, port_id);
+    return meta ? meta : "";
+}
 
+static int32_t meta_send_next(struct fbp_port0_s * self) {
+    uint8_t hdr;
+    uint32_t meta_sz;
+    uint32_t frame_sz;
+    uint32_t offset = self->meta_offset;
+    enum fbp_transport_seq_e seq;
+    bool digest = (self->features & FBP_PORT0_FEATURE_META_DIGEST) != 0;
+
+    if (digest) {
+        while ((self->meta_port_id <= FBP_TRANSPORT_PORT_MAX)
+                && !(self->meta_req_mask & (1U << self->meta_port_id))) {
+            ++self->meta_port_id;  // skip ports that the server did not request
+        }
+    }
     if (self->meta_port_id > FBP_TRANSPORT_PORT_MAX) {
         emit_event(self, EV_META_DONE);
         return FBP_ERROR_FULL;
     }
 
-    msg[0] = self->meta_port_id + FBP_PORT0_META_CHAR_OFFSET;
-    const char * meta = fbp_transport_meta_get(self->transport, self->meta_port_id);
-    if (!meta) {
-        meta = "";
-    };
-    meta_sz = strlen(meta) + 1;
-    if (meta_sz > (FBP_FRAMER_PAYLOAD_MAX_SIZE - 1)) {
+    hdr = self->meta_port_id + FBP_PORT0_META_CHAR_OFFSET;
+    const char * meta = meta_get(self, self->meta_port_id);
+    meta_sz = (uint32_t) strlen(meta) + 1;
+    if (!digest && (meta_sz > (FBP_FRAMER_PAYLOAD_MAX_SIZE - 1))) {
+        FBP_LOGW("truncating meta for port %d", self->meta_port_id);
+        meta_sz = FBP_FRAMER_PAYLOAD_MAX_SIZE - 1;  // truncate, peer cannot reassemble
+    } else if (meta_sz > FBP_PORT0_META_SIZE_MAX) {
         FBP_LOGW("truncating meta for port %d", self->meta_port_id);
-        meta_sz = FBP_FRAMER_PAYLOAD_MAX_SIZE - 1;  // truncate
+        meta_sz = FBP_PORT0_META_SIZE_MAX;
     }
 
-    memcpy(msg + 1, meta, meta_sz);
-    if (self->send_fn(self->transport, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(META), msg, (uint32_t) (meta_sz + 1))) {
+    struct fbp_iovec_s iov[2];
+    uint32_t iov_count = 0;
+    if (!offset) {
+        iov[iov_count].buf = &hdr;
+        iov[iov_count++].size = 1;
+        frame_sz = min_u32(meta_sz, FBP_FRAMER_PAYLOAD_MAX_SIZE - 1);
+        seq = (frame_sz == meta_sz) ? FBP_TRANSPORT_SEQ_SINGLE : FBP_TRANSPORT_SEQ_START;
+    } else {
+        frame_sz = min_u32(meta_sz - offset, FBP_FRAMER_PAYLOAD_MAX_SIZE);
+        seq = ((offset + frame_sz) == meta_sz) ? FBP_TRANSPORT_SEQ_STOP : FBP_TRANSPORT_SEQ_MIDDLE;
+    }
+    iov[iov_count].buf = meta + offset;
+    iov[iov_count++].size = frame_sz;
+
+    if (self->sendv_fn(self->transport, 0, seq, RSP(META), iov, iov_count)) {
         tick_set(self, 1);
         return FBP_ERROR_BUSY;
-    } else {
+    }
+    offset += frame_sz;
+    if (offset >= meta_sz) {
+        self->meta_offset = 0;
         ++self->meta_port_id;
-        return 0;
+    } else {
+        self->meta_offset = offset;
+    }
+    return 0;
+}
+
+static int32_t meta_digest_send(struct fbp_port0_s * self) {
+    uint32_t digest[META_PORT_COUNT];
+    for (uint32_t port_id = 0; port_id < META_PORT_COUNT; ++port_id) {
+        const char * meta = meta_get(self, (uint8_t) port_id);
+        uint32_t sz = (uint32_t) strlen(meta);
+        digest[port_id] = 0;
+        if (sz) {
+            digest[port_id] = fbp_crc32(0, (const uint8_t *) meta, sz);
+            if (!digest[port_id]) {
+                digest[port_id] = 1;  // 0 reserved for no metadata
+            }
+        }
+    }
+    return send_msg(self, RSP(META) | FBP_PORT0_META_DIGEST, digest, sizeof(digest));
+}
+
+static void meta_req_send(struct fbp_port0_s * self) {
+    uint32_t mask = self->meta_req_mask;
+    self->meta_req_pending = 0;  // clear first, responses may arrive during send
+    if (send_msg(self, REQ(META), &mask, sizeof(mask))) {
+        self->meta_req_pending = 1;
+        tick_set(self, 1);
+        return;
+    }
+    if (!mask) {
+        emit_event(self, EV_META_DONE);
     }
 }
 
 static void meta_send(struct fbp_port0_s * self) {
     if (self->mode == FBP_PORT0_MODE_CLIENT) {
+        if (self->features & FBP_PORT0_FEATURE_META_DIGEST) {
+            if (!self->meta_digest_sent) {
+                self->meta_digest_sent = 1;  // set first, request may arrive during send
+                if (meta_digest_send(self)) {
+                    self->meta_digest_sent = 0;
+                    tick_set(self, 1);
+                    return;
+                }
+            }
+            if (!self->meta_req_valid) {
+                return;  // await the server's request
+            }
+        }
         while (!meta_send_next(self)) {
             // send as many as we can - fill the buffer
         }
+    } else if (self->meta_req_pending) {
+        meta_req_send(self);
     }
 }
 
-static void op_meta_rsp(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
-    char topic[FBP_PUBSUB_TOPIC_LENGTH_MAX] = "port/";
-    char * topic_end = topic + FBP_PUBSUB_TOPIC_LENGTH_MAX;
-    if (self->fsm.state != ST_META) {
-        FBP_LOGW("meta_rsp in state %d", self->fsm.state);
-        return;
-    }
-    if (!msg_size || (msg_size > FBP_FRAMER_PAYLOAD_MAX_SIZE)) {
-        FBP_LOGW("empty op_meta_rsp");
+static void op_meta_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
+    if ((self->mode != FBP_PORT0_MODE_CLIENT) || (self->fsm.state != ST_META)
+            || !(self->features & FBP_PORT0_FEATURE_META_DIGEST)) {
+        FBP_LOGW("meta_req in state %d", self->fsm.state);
         return;
     }
-    uint8_t port_id = msg[0] - FBP_PORT0_META_CHAR_OFFSET;
-    if (port_id > FBP_TRANSPORT_PORT_MAX) {
-        FBP_LOGW("meta_rsp invalid port_id %d", (int) port_id);
+    if (msg_size < sizeof(self->meta_req_mask)) {
+        FBP_LOGW("meta_req too short");
         return;
     }
-    msg[msg_size - 1] = 0;  // enforce null termination
-    if (port_id != self->meta_port_id) {
-        FBP_LOGW("meta_rsp unexpected port_id %d != %d", (int) port_id, (int) self->meta_port_id);
-    }
+    memcpy(&self->meta_req_mask, msg, sizeof(self->meta_req_mask));
+    self->meta_req_valid = 1;
+    self->meta_port_id = 0;
+    self->meta_offset = 0;
+    meta_send(self);
+}
+
+static void meta_publish(struct fbp_port0_s * self, uint8_t port_id, const char * json) {
+    char topic[FBP_PUBSUB_TOPIC_LENGTH_MAX] = "port/";
+    char * topic_end = topic + FBP_PUBSUB_TOPIC_LENGTH_MAX;
     char * t = topic + 5;
     if (port_id >= 10) {
         *t++ = '0' + (port_id / 10);
     }
     *t++ = '0' + (port_id % 10);
     fbp_cstr_copy(t, "/meta", topic_end - t);
-    publish(self, topic, &fbp_union_json((char *) &msg[1]));
-    self->topic_prefix[self->topic_prefix_length] = 0;
-    self->meta_port_id = (port_id < self->meta_port_id) ? self->meta_port_id : (port_id + 1);
-    if (self->meta_port_id > FBP_TRANSPORT_PORT_MAX) {
-        emit_event(self, EV_META_DONE);
+    publish(self, topic, &fbp_union_json(json));
+}
+
+static void meta_cache_update(struct fbp_port0_s * self, uint8_t port_id, const char * json) {
+    struct meta_cache_s * c = &self->meta_cache[port_id];
+    if (c->json) {
+        fbp_free(c->json);
+        c->json = NULL;
     }
+    size_t sz = strlen(json) + 1;
+    c->json = fbp_alloc(sz);
+    FBP_ASSERT_ALLOC(c->json);
+    fbp_memcpy(c->json, json, sz);
+    c->digest = self->meta_digest[port_id];
 }
+
+static void meta_receive(struct fbp_port0_s * self, uint8_t port_id, const char * json) {
+    meta_publish(self, port_id, json);
+    if (self->features & FBP_PORT0_FEATURE_META_DIGEST) {
+        uint32_t port_mask = 1U << port_id;
+        if (!(self->meta_req_mask & port_mask)) {
+            FBP_LOGW("meta_rsp unrequested port_id %d", (int) port_id);
+            return;
+        }
+        meta_cache_update(self, port_id, json);
+        self->meta_req_mask &= ~port_mask;
+        if (!self->meta_req_mask && !self->meta_req_pending) {
+            emit_event(self, EV_META_DONE);
+        }
+    } else {
+        if (port_id != self->meta_port_id) {
+            FBP_LOGW("meta_rsp unexpected port_id %d != %d", (int) port_id, (int) self->meta_port_id);
+        }
+        self->meta_port_id = (port_id < self->meta_port_id) ? self->meta_port_id : (port_id + 1);
+        if (self->meta_port_id > FBP_TRANSPORT_PORT_MAX) {
+            emit_event(self, EV_META_DONE);
+        }
+    }
+}
+
+static void meta_digest_rsp(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
+    if ((self->mode != FBP_PORT0_MODE_SERVER) || !(self->features & FBP_PORT0_FEATURE_META_DIGEST)) {
+        FBP_LOGW("meta digest not negotiated");
+        return;
+    }
+    if (msg_size < sizeof(self->meta_digest)) {
+        FBP_LOGW("meta digest too short");
+        return;
+    }
+    memcpy(self->meta_digest, msg, sizeof(self->meta_digest));
+    uint32_t mask = 0;
+    for (uint32_t port_id = 0; port_id < META_PORT_COUNT; ++port_id) {
+        struct meta_cache_s * c = &self->meta_cache[port_id];
+        if (c->digest == self->meta_digest[port_id]) {
+            meta_publish(self, (uint8_t) port_id, c->json ? c->json : "");
+        } else {
+            mask |= 1U << port_id;
+        }
+    }
+    FBP_LOGD1("meta digest request 0x%08" PRIx32, mask);
+    self->meta_req_mask = mask;
+    self->meta_req_pending = 1;
+    meta_req_send(self);
+}
+
+static void meta_rx_append(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
+    if (!self->meta_rx) {
+        self->meta_rx = fbp_alloc(FBP_PORT0_META_SIZE_MAX);
+        FBP_ASSERT_ALLOC(self->meta_rx);
+    }
+    uint32_t sz = min_u32(msg_size, FBP_PORT0_META_SIZE_MAX - self->meta_rx_size);
+    if (sz < msg_size) {
+        FBP_LOGW("meta_rsp too long for port %d", (int) self->meta_rx_port_id);
+    }
+    fbp_memcpy(self->meta_rx + self->meta_rx_size, msg, sz);
+    self->meta_rx_size += sz;
+}
+
+static void op_meta_rsp(struct fbp_port0_s * self, enum fbp_transport_seq_e seq, uint8_t port_data,
+                        uint8_t *msg, uint32_t msg_size) {
+    uint8_t port_id;
+    if (self->fsm.state != ST_META) {
+        FBP_LOGW("meta_rsp in state %d", self->fsm.state);
+        return;
+    }
+    if (port_data & FBP_PORT0_META_DIGEST) {
+        meta_digest_rsp(self, msg, msg_size);
+        return;
+    }
+    if (!msg_size || (msg_size > FBP_FRAMER_PAYLOAD_MAX_SIZE)) {
+        FBP_LOGW("empty op_meta_rsp");
+        return;
+    }
+    switch (seq) {
+        case FBP_TRANSPORT_SEQ_SINGLE:  // intentional fall-through
+        case FBP_TRANSPORT_SEQ_START:
+            port_id = msg[0] - FBP_PORT0_META_CHAR_OFFSET;
+            if (port_id > FBP_TRANSPORT_PORT_MAX) {
+                FBP_LOGW("meta_rsp invalid port_id %d", (int) port_id);
+                return;
+            }
+            if (seq == FBP_TRANSPORT_SEQ_SINGLE) {
+                msg[msg_size - 1] = 0;  // enforce null termination
+                self->meta_rx_port_id = META_RX_PORT_NONE;
+                meta_receive(self, port_id, (char *) &msg[1]);
+            } else {
+                self->meta_rx_port_id = port_id;
+                self->meta_rx_size = 0;
+                meta_rx_append(self, msg + 1, msg_size - 1);
+            }
+            break;
+        default:
+            if (self->meta_rx_port_id > FBP_TRANSPORT_PORT_MAX) {
+                FBP_LOGW("meta_rsp segment without start");
+                return;
+            }
+            meta_rx_append(self, msg, msg_size);
+            if ((seq == FBP_TRANSPORT_SEQ_STOP) && self->meta_rx_size) {
+                self->meta_rx[self->meta_rx_size - 1] = 0;  // enforce null termination
+                port_id = self->meta_rx_port_id;
+                self->meta_rx_port_id = META_RX_PORT_NONE;
+                meta_receive(self, port_id, self->meta_rx);
+            }
+            break;
+    }
+}
+
 static void op_negotiate_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
-    uint32_t req[4];  // version, status, down_window_size, up_window_size
+    uint32_t req[5] = {0, 0, 0, 0, 0};  // version, status, down_window_size, up_window_size, features
     self->negotiate_rsp[0] = FBP_DL_VERSION;
     self->negotiate_rsp[1] = 0;
     self->negotiate_rsp[2] = 0;
     self->negotiate_rsp[3] = 0;
+    self->negotiate_rsp[4] = 0;
+    self->features = 0;
     bool is_good = false;
     if (self->fsm.state != ST_NEGOTIATE) {
         FBP_LOGW("negotiate_req in state %d", self->fsm.state);
@@ -480,11 +1086,11 @@ static void op_negotiate_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t m
     } else if (self->mode != FBP_PORT0_MODE_CLIENT) {
         FBP_LOGE("negotiate_req, but not client on %s", self->topic_prefix);
         self->negotiate_rsp[1] = FBP_ERROR_NOT_SUPPORTED;
-    } else if (msg_size < sizeof(req)) {
+    } else if (msg_size < (4 * sizeof(uint32_t))) {
         FBP_LOGE("incompatible negotiate packet on %s", self->topic_prefix);
         self->negotiate_rsp[1] = FBP_ERROR_PARAMETER_INVALID;
     } else {
-        memcpy(req, msg, sizeof(req));
+        memcpy(req, msg, min_u32(msg_size, sizeof(req)));  // features optional
         if (FBP_DL_VERSION_MAJOR != (req[0] >> 24)) {
             FBP_LOGE("potentially incompatible negotiate version on %s", self->topic_prefix);
             self->negotiate_rsp[1] = 0; // could issue warning
@@ -492,10 +1098,12 @@ static void op_negotiate_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t m
         self->negotiate_rsp[2] = min_u32(fbp_dl_rx_window_get(self->dl), req[2]);
         self->negotiate_rsp[3] = min_u32(fbp_dl_tx_window_max_get(self->dl), req[3]);
         fbp_dl_tx_window_set(self->dl, self->negotiate_rsp[3]);
+        self->features = req[4] & features_local(self);
+        self->negotiate_rsp[4] = self->features;
+        fbp_transport_credit_enable(self->transport, (self->features & FBP_PORT0_FEATURE_CREDIT) != 0);
         is_good = true;
     }
-    if (self->send_fn(self->transport, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE),
-                      (uint8_t *) self->negotiate_rsp, sizeof(self->negotiate_rsp))) {
+    if (send_msg(self, RSP(NEGOTIATE), (uint8_t *) self->negotiate_rsp, sizeof(self->negotiate_rsp))) {
         FBP_LOGW("negotiate_req send failed on %s", self->topic_prefix);
         if (is_good) {
             tick_set(self, 10);  // schedule retransmit
@@ -508,21 +1116,23 @@ static void op_negotiate_req(struct fbp_port0_s * self, uint8_t *msg, uint32_t m
 }
 
 static void op_negotiate_rsp(struct fbp_port0_s * self, uint8_t *msg, uint32_t msg_size) {
-    uint32_t rsp[4];  // version, status, rsv, window_size;
+    uint32_t rsp[5] = {0, 0, 0, 0, 0};  // version, status, rsv, window_size, features
     if (self->mode != FBP_PORT0_MODE_SERVER) {
         FBP_LOGE("op_negotiate_rsp, but not server on %s", self->topic_prefix);
         // fatal error: await timeout
-    } else if (msg_size < sizeof(rsp)) {
+    } else if (msg_size < (4 * sizeof(uint32_t))) {
         FBP_LOGE("incompatible negotiate packeton %s", self->topic_prefix);
         // fatal error: await timeout
     } else {
-        memcpy(rsp, msg, sizeof(rsp));
+        memcpy(rsp, msg, min_u32(msg_size, sizeof(rsp)));  // features optional
         if (FBP_DL_VERSION_MAJOR != (rsp[0] >> 24)) {
             FBP_LOGE("incompatible negotiate version on %s", self->topic_prefix);
             // fatal error: await timeout.
         } else {
             rsp[2] = min_u32(fbp_dl_tx_window_max_get(self->dl), rsp[2]);
             fbp_dl_tx_window_set(self->dl, rsp[2]);
+            self->features = rsp[4] & self->features_req;
+            fbp_transport_credit_enable(self->transport, (self->features & FBP_PORT0_FEATURE_CREDIT) != 0);
             emit_event(self, EV_NEGOTIATE_DONE);
         }
     }
@@ -536,6 +1146,10 @@ void fbp_port0_on_recv_cbk(struct fbp_port0_s * self,
     if (port_id != 0) {
         return;
     }
+    if ((port_data & 0x87) == RSP(META)) {
+        op_meta_rsp(self, seq, port_data, msg, msg_size);  // only segmented op
+        return;
+    }
     if (seq != FBP_TRANSPORT_SEQ_SINGLE) {
         // all messages are single frames only.
         FBP_LOGW("port0 received segmented message");
@@ -550,9 +1164,13 @@ void fbp_port0_on_recv_cbk(struct fbp_port0_s * self,
     if (req) {
         switch (op) {
             case FBP_PORT0_OP_STATUS:      fn = op_status_req; break;
-            case FBP_PORT0_OP_ECHO:        fn = op_echo_req; break;
+            case FBP_PORT0_OP_ECHO:
+                fn = (port_data & FBP_PORT0_ECHO_FLOOD) ? op_echo_flood : op_echo_req;
+                break;
             case FBP_PORT0_OP_TIMESYNC:    fn = op_timesync_req; break;
+            case FBP_PORT0_OP_META:        fn = op_meta_req; break;
             case FBP_PORT0_OP_NEGOTIATE:   fn = op_negotiate_req; break;
+            case FBP_PORT0_OP_CREDIT:      fn = op_credit_req; break;
             //case FBP_PORT0_OP_RAW:         fn = op_raw_req; break;
             default:
                 break;
@@ -562,7 +1180,6 @@ void fbp_port0_on_recv_cbk(struct fbp_port0_s * self,
             case FBP_PORT0_OP_STATUS:      fn = op_status_rsp; break;
             case FBP_PORT0_OP_ECHO:        fn = op_echo_rsp; break;
             case FBP_PORT0_OP_TIMESYNC:    fn = op_timesync_rsp; break;
-            case FBP_PORT0_OP_META:        fn = op_meta_rsp; break;
             case FBP_PORT0_OP_NEGOTIATE:   fn = op_negotiate_rsp; break;
             //case FBP_PORT0_OP_RAW:         fn = op_raw_rsp; break;
             default:
@@ -596,8 +1213,17 @@ static void topic_create(struct fbp_port0_s * self, const char * subtopic, const
     timeout_clear(self); \
     tick_clear(self)
 
+static void transport_connect(struct fbp_port0_s * self) {
+    if (!self->transport_connected) {
+        self->transport_connected = 1;
+        fbp_transport_event_inject(self->transport, FBP_DL_EV_TRANSPORT_CONNECTED);
+    }
+}
+
 static fbp_fsm_state_t on_enter_disconnected(struct fbp_fsm_s * fsm, fbp_fsm_event_t event) {
     ON_ENTER(fsm);
+    self->transport_connected = 0;
+    credit_clear(self);
     publish(self, STATE_TOPIC, &fbp_union_u32_r(0));
     return FBP_STATE_ANY;
 }
@@ -614,19 +1240,19 @@ static fbp_fsm_state_t on_negotiate_tick(struct fbp_fsm_s * fsm, fbp_fsm_event_t
     struct fbp_port0_s * self = (struct fbp_port0_s *) fsm;
     if (self->mode == FBP_PORT0_MODE_CLIENT) {
         // deferred from op_negotiate_req
-        if (self->send_fn(self->transport, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE),
-                          (uint8_t *) self->negotiate_rsp, sizeof(self->negotiate_rsp))) {
+        if (send_msg(self, RSP(NEGOTIATE), (uint8_t *) self->negotiate_rsp, sizeof(self->negotiate_rsp))) {
             FBP_LOGW("negotiate_rsp send buffer full");
             tick_set(self, 10);
         } else {
             emit_event(self, EV_NEGOTIATE_DONE);
         }
     } else {  // FBP_PORT0_MODE_SERVER
-        uint32_t payload[4] = {FBP_DL_VERSION, 0, 0, 0};  // version, status, down_window_size, up_window_size
+        // version, status, down_window_size, up_window_size, features
+        self->features_req = features_local(self);
+        uint32_t payload[5] = {FBP_DL_VERSION, 0, 0, 0, self->features_req};
         payload[2] = fbp_dl_tx_window_max_get(self->dl);
         payload[3] = fbp_dl_rx_window_get(self->dl);
-        if (self->send_fn(self->transport, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(NEGOTIATE),
-                          (uint8_t *) payload, sizeof(payload))) {
+        if (send_msg(self, REQ(NEGOTIATE), (uint8_t *) payload, sizeof(payload))) {
             // buffer full, schedule retry
             tick_set(self, 10);
         }
@@ -636,9 +1262,13 @@ static fbp_fsm_state_t on_negotiate_tick(struct fbp_fsm_s * fsm, fbp_fsm_event_t
 
 static fbp_fsm_state_t on_enter_negotiate(struct fbp_fsm_s * fsm, fbp_fsm_event_t event) {
     ON_ENTER(fsm);
+    self->connect_start = self->evm.timestamp(self->evm.evm);
+    self->features = 0;
     timeout_set(self, 1000);
     if (self->mode == FBP_PORT0_MODE_SERVER) {
-        tick_set(self, 50);  // allow reset to stabilize before negotiate_send_req
+        // allow reset to stabilize before negotiate_send_req.  The peer
+        // features are not known yet, so skip the delay on the local setting.
+        tick_set(self, self->pipeline ? 1 : 50);
     }
     return FBP_STATE_ANY;
 }
@@ -684,7 +1314,24 @@ static fbp_fsm_state_t on_enter_meta(struct fbp_fsm_s * fsm, fbp_fsm_event_t eve
     ON_ENTER(fsm);
     timeout_set(self, 1000);
     self->meta_port_id = 0;
-    tick_set(self, 1);
+    self->meta_offset = 0;
+    self->meta_digest_sent = 0;
+    self->meta_req_valid = 0;
+    self->meta_req_pending = 0;
+    self->meta_req_mask = 0;
+    self->meta_rx_port_id = META_RX_PORT_NONE;
+    if (pipelined(self)) {
+        // negotiate done: start the other ports while timesync and meta proceed
+        transport_connect(self);
+        if (self->mode == FBP_PORT0_MODE_CLIENT) {
+            if (timesync_req_send(self)) {
+                FBP_LOGW("pipelined timesync_req failed");  // connected tick will retry
+            }
+            meta_send(self);
+        }
+    } else {
+        tick_set(self, 1);
+    }
     return FBP_STATE_ANY;
 }
 
@@ -700,7 +1347,11 @@ static fbp_fsm_state_t on_enter_connected(struct fbp_fsm_s * fsm, fbp_fsm_event_
     if (self->mode == FBP_PORT0_MODE_CLIENT) {
         tick_set(self, 1);
     }
-    fbp_transport_event_inject(self->transport, FBP_DL_EV_TRANSPORT_CONNECTED);
+    int64_t latency = self->evm.timestamp(self->evm.evm) - self->connect_start;
+    uint32_t latency_us = (uint32_t) FBP_TIME_TO_COUNTER(latency, 1000000);
+    FBP_LOGI("%s connected in %lu us", self->topic_prefix, (unsigned long) latency_us);
+    transport_connect(self);
+    publish(self, LATENCY_TOPIC, &fbp_union_u32_r(latency_us));
     publish(self, STATE_TOPIC, &fbp_union_u32_r(1));
     echo_send(self);
     return FBP_STATE_ANY;
@@ -726,12 +1377,23 @@ static fbp_fsm_state_t only_client(struct fbp_fsm_s * fsm, fbp_fsm_event_t event
     }
 }
 
+static fbp_fsm_state_t only_client_pipeline(struct fbp_fsm_s * fsm, fbp_fsm_event_t event) {
+    (void) event;
+    struct fbp_port0_s * self = (struct fbp_port0_s *) fsm;
+    if ((self->mode == FBP_PORT0_MODE_CLIENT) && pipelined(self)) {
+        return FBP_STATE_ANY;
+    } else {
+        return FBP_STATE_SKIP;
+    }
+}
+
 static const struct fbp_fsm_transition_s transitions[] = {  // priority encoded
     {ST_CONNECTED, FBP_STATE_NULL, EV_TICK,             on_connected_tick},
     {ST_CONNECTED, FBP_STATE_NULL, EV_TIMESYNC_DONE,    NULL},
     {ST_DISCONNECTED, ST_NEGOTIATE, EV_DL_CONNECTED,    NULL},
     {ST_DISCONNECTED, FBP_STATE_NULL, EV_DL_DISCONNECTED,  NULL},
 
+    {ST_NEGOTIATE, ST_META, EV_NEGOTIATE_DONE,          only_client_pipeline},
     {ST_NEGOTIATE, ST_TIMESYNC1, EV_NEGOTIATE_DONE,     only_client},
     {ST_NEGOTIATE, ST_META, EV_NEGOTIATE_DONE,          only_server},
     {ST_NEGOTIATE, FBP_STATE_NULL, EV_TICK,             on_negotiate_tick},
@@ -760,7 +1422,7 @@ static const struct fbp_fsm_state_s states[] = {
 struct fbp_port0_s * fbp_port0_initialize(enum fbp_port0_mode_e mode,
         struct fbp_dl_s * dl,
         struct fbp_evm_api_s * evm,
-        struct fbp_transport_s * transport, fbp_transport_send_fn send_fn,
+        struct fbp_transport_s * transport, fbp_transport_sendv_fn sendv_fn,
         struct fbp_pubsub_s * pubsub, const char * topic_prefix,
         struct fbp_ts_s * timesync) {
     struct fbp_port0_s * p = fbp_alloc_clr(sizeof(struct fbp_port0_s));
@@ -782,16 +1444,22 @@ struct fbp_port0_s * fbp_port0_initialize(enum fbp_port0_mode_e mode,
     p->pubsub = pubsub;
     fbp_cstr_copy(p->topic_prefix, topic_prefix, sizeof(p->topic_prefix));
     p->topic_prefix_length = (uint8_t) strlen(p->topic_prefix);
-    p->send_fn = send_fn;
+    p->sendv_fn = sendv_fn;
     p->echo_enable = 0;
     p->echo_window = 8;
     p->echo_length = FBP_FRAMER_PAYLOAD_MAX_SIZE;
     p->timesync = timesync;
 
     topic_create(p, STATE_TOPIC, STATE_META, &fbp_union_u32_r(0), NULL, NULL);
+    topic_create(p, LATENCY_TOPIC, LATENCY_META, &fbp_union_u32_r(0), NULL, NULL);
+    topic_create(p, TS_DRIFT_TOPIC, TS_DRIFT_META, &fbp_union_i32_r(0), NULL, NULL);
+    topic_create(p, TS_UNCERTAINTY_TOPIC, TS_UNCERTAINTY_META, &fbp_union_u32_r(0), NULL, NULL);
+    topic_create(p, PIPELINE_META_TOPIC, PIPELINE_META, &fbp_union_u32_r(p->pipeline), on_pipeline, p);
     topic_create(p, ECHO_ENABLE_META_TOPIC, ECHO_ENABLE_META, &fbp_union_u32_r(p->echo_enable), on_echo_enable, p);
     topic_create(p, ECHO_OUTSTANDING_META_TOPIC, ECHO_WINDOW_META, &fbp_union_u32_r(p->echo_window), on_echo_window, p);
     topic_create(p, ECHO_LENGTH_META_TOPIC, ECHO_LENGTH_META, &fbp_union_u32_r(p->echo_length), on_echo_length, p);
+    topic_create(p, ECHO_MODE_META_TOPIC, ECHO_MODE_META, &fbp_union_u32_r(p->echo_mode), on_echo_mode, p);
+    fbp_transport_register_credit_fn(transport, on_credit, p);
 
     fbp_fsm_reset(&p->fsm);
     return p;
@@ -799,6 +1467,17 @@ struct fbp_port0_s * fbp_port0_initialize(enum fbp_port0_mode_e mode,
 
 void fbp_port0_finalize(struct fbp_port0_s * self) {
     if (self) {
+        fbp_transport_register_credit_fn(self->transport, NULL, NULL);
+        credit_timer_clear(self);
+        echo_timer_clear(self);
+        for (uint32_t port_id = 0; port_id < META_PORT_COUNT; ++port_id) {
+            if (self->meta_cache[port_id].json) {
+                fbp_free(self->meta_cache[port_id].json);
+            }
+        }
+        if (self->meta_rx) {
+            fbp_free(self->meta_rx);
+        }
         fbp_free(self);
     }
 }
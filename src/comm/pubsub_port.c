@@ -23,10 +23,12 @@
 #include "fitterbap/log.h"
 #include "fitterbap/cstr.h"
 #include "fitterbap/topic_list.h"
+#include "fitterbap/os/mutex.h"
 #include "fitterbap/os/task.h"
 
 
 #define FEEDBACK_TOPIC_PREFIX "_/fb/"
+#define CREDIT_TOPIC_PREFIX "_/cr/"
 
 enum state_e {
     ST_DISCONNECTED,   // Not connected
@@ -65,9 +67,14 @@ struct fbp_pubsubp_s {
     struct fbp_transport_s * transport;
     struct fbp_evm_api_s evm;
 
-    uint8_t msg[FBP_FRAMER_PAYLOAD_MAX_SIZE];
     char feedback_topic[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    char credit_topic[FBP_PUBSUB_TOPIC_LENGTH_MAX];
     struct fbp_topic_list_s topic_list;  // only needed by server
+
+    fbp_os_mutex_t mutex;
+    uint32_t credit_queued;     // received publishes queued to pubsub, protected by mutex
+    uint32_t credit_released;   // queued publishes processed by pubsub, protected by mutex
+    bool credit_marker;         // credit_topic publish pending in pubsub, protected by mutex
 };
 
 const char FBP_PUBSUBP_META[] = "{\"type\":\"pubsub\", \"name\":\"pubsub\"}";
@@ -147,23 +154,92 @@ static void tick_set(struct fbp_pubsubp_s * self, uint32_t timeout_ms) {
     self->tick_event_id = self->evm.schedule(self->evm.evm, ts, on_tick, self);
 }
 
-static void construct_feedback_topic(struct fbp_pubsubp_s * self) {
-    const char * feedback_prefix = FEEDBACK_TOPIC_PREFIX;
-    char * feedback_topic = self->feedback_topic;
-    while (*feedback_prefix) {
-        *feedback_topic++ = *feedback_prefix++;
+static void construct_private_topic(struct fbp_pubsubp_s * self, char * topic, const char * prefix) {
+    while (*prefix) {
+        *topic++ = *prefix++;
     }
-    uint32_t feedback_value = (uint32_t) ((intptr_t) self);
+    uint32_t value = (uint32_t) ((intptr_t) self);
     for (int i = 0; i < 7; ++i) {  // skip least significant nibble.
-        *feedback_topic++ = fbp_cstr_u4_to_hex(feedback_value >> (4 * (7 - i)));
+        *topic++ = fbp_cstr_u4_to_hex(value >> (4 * (7 - i)));
+    }
+    *topic = 0;
+}
+
+static inline void lock(struct fbp_pubsubp_s * self) {
+    if (self->mutex) {
+        fbp_os_mutex_lock(self->mutex);
+    }
+}
+
+static inline void unlock(struct fbp_pubsubp_s * self) {
+    if (self->mutex) {
+        fbp_os_mutex_unlock(self->mutex);
     }
-    *feedback_topic = 0;
 }
 
 static void publish_feedback_topic(struct fbp_pubsubp_s * self) {
     fbp_pubsub_publish(self->pubsub, self->feedback_topic, &fbp_union_u32(1), 0, 0);
 }
 
+static void credit_release(struct fbp_pubsubp_s * self, uint32_t count) {
+    if (self->transport) {
+        fbp_transport_port_credit_release(self->transport, self->port_id, count);
+    }
+}
+
+/*
+ * Received publishes only return their transport credit once pubsub
+ * processes them.  pubsub processes in order, so a marker published
+ * behind the messages releases everything queued before it.  At most
+ * one marker is pending at a time.
+ */
+static void credit_marker_publish(struct fbp_pubsubp_s * self, uint32_t marker) {
+    if (!fbp_pubsub_publish(self->pubsub, self->credit_topic, &fbp_union_u32(marker), 0, 0)) {
+        return;
+    }
+    // pubsub is full: release now rather than stall the peer
+    lock(self);
+    uint32_t count = self->credit_queued - self->credit_released;
+    self->credit_released = self->credit_queued;
+    self->credit_marker = false;
+    unlock(self);
+    credit_release(self, count);
+}
+
+static void credit_queue(struct fbp_pubsubp_s * self) {
+    bool publish = false;
+    lock(self);
+    uint32_t marker = ++self->credit_queued;
+    if (!self->credit_marker) {
+        self->credit_marker = true;
+        publish = true;
+    }
+    unlock(self);
+    if (publish) {
+        credit_marker_publish(self, marker);
+    }
+}
+
+static uint8_t on_credit(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) topic;
+    struct fbp_pubsubp_s * self = (struct fbp_pubsubp_s *) user_data;
+    if (value->type != FBP_UNION_U32) {
+        return 0;
+    }
+    lock(self);
+    uint32_t count = value->value.u32 - self->credit_released;
+    uint32_t marker = self->credit_queued;
+    bool publish = (marker != value->value.u32);  // more arrived, keep the marker pending
+    self->credit_released = value->value.u32;
+    self->credit_marker = publish;
+    unlock(self);
+    credit_release(self, count);
+    if (publish) {
+        credit_marker_publish(self, marker);
+    }
+    return 0;
+}
+
 int32_t fbp_pubsubp_transport_register(struct fbp_pubsubp_s * self,
                                         uint8_t port_id,
                                         struct fbp_transport_s * transport) {
@@ -179,7 +255,11 @@ int32_t fbp_pubsubp_transport_register(struct fbp_pubsubp_s * self,
     if (rc) {
         return rc;
     }
-    return 0;
+    rc = fbp_transport_port_credit_defer(transport, port_id, true);
+    if (rc) {
+        return rc;
+    }
+    return fbp_transport_port_credit_limit_set(transport, port_id, FBP_PUBSUBP_CREDIT_LIMIT);
 }
 
 static int32_t send_negotiate_req(struct fbp_pubsubp_s *self) {
@@ -240,7 +320,7 @@ void fbp_pubsubp_on_event(struct fbp_pubsubp_s *self, enum fbp_dl_event_e event)
 #define decode(var_, value_) \
     if (payload_len != sizeof(var_)) { \
         FBP_LOGW("invalid payload"); \
-        return;                \
+        return false;          \
     } else { \
         var_ = (value_); \
     }
@@ -380,41 +460,41 @@ static void on_topic_remove(struct fbp_pubsubp_s *self, enum fbp_transport_seq_e
     child_topic_remove(self, (char *) msg);
 }
 
-static void on_publish(struct fbp_pubsubp_s *self, enum fbp_transport_seq_e seq,
+static bool on_publish(struct fbp_pubsubp_s *self, enum fbp_transport_seq_e seq,
                        uint8_t port_data,
                        uint8_t *msg, uint32_t msg_size) {
     if ((self->fsm.state != ST_UPDATE_RECV) && (self->fsm.state != ST_CONNECTED)) {
         FBP_LOGW("unexpected publish");
-        return;
+        return false;
     } else if (seq != FBP_TRANSPORT_SEQ_SINGLE) {
         FBP_LOGW("invalid seq: %d", (int) seq);
-        return;
+        return false;
     }
     uint8_t flags = (port_data & FBP_PUBSUBP_PORT_DATA_RETAIN_BIT) ? FBP_UNION_FLAG_RETAIN : 0;
     uint8_t msg_type = port_data & FBP_PUBSUBP_PORT_DATA_MSG_MASK;
     if (msg_type != FBP_PUBSUBP_MSG_PUBLISH) {
         FBP_LOGW("invalid port_data: %d", (int) port_data);
-        return;
+        return false;
     }
     if (msg_size < 5) {  // type, rsv, topic len, topic null terminator, payload length
         FBP_LOGW("msg too small");
-        return;
+        return false;
     }
     uint8_t type = msg[0];
     if (msg[2] > FBP_PUBSUB_TOPIC_LENGTH_MAX) {
         FBP_LOGW("topic too long");
-        return;
+        return false;
     }
     uint8_t topic_len = msg[2];  // 32 max
     char * topic = (char *) (msg + 3);  // type, rsv, topic len byte + topic bytes
     uint32_t sz = 3 + topic_len;  // type, rsv, topic length byte + topic bytes
     if (msg_size < (sz + 1)) {  // +1 payload length
         FBP_LOGW("msg too small: %d < %d", (int) msg_size, (int) sz);
-        return;
+        return false;
     }
     if (topic[topic_len - 1]) {
         FBP_LOGW("topic invalid: missing null terminator");
-        return;
+        return false;
     }
 
     uint8_t payload_len = msg[sz++];
@@ -422,10 +502,10 @@ static void on_publish(struct fbp_pubsubp_s *self, enum fbp_transport_seq_e seq,
     sz += payload_len;
     if (msg_size < sz) {
         FBP_LOGW("msg too small: %d < %d", (int) msg_size, (int) sz);
-        return;
+        return false;
     } else if (msg_size > FBP_FRAMER_PAYLOAD_MAX_SIZE) {
         FBP_LOGW("msg too big: %d > %d", (int) msg_size, (int) FBP_FRAMER_PAYLOAD_MAX_SIZE);
-        return;
+        return false;
     }
 
     // parse message
@@ -439,7 +519,7 @@ static void on_publish(struct fbp_pubsubp_s *self, enum fbp_transport_seq_e seq,
         case FBP_UNION_JSON: // intentional fall-through
             if (payload[payload_len - 1]) {
                 FBP_LOGW("invalid payload string");
-                return;
+                return false;
             } else {
                 value.value.str = (char *) payload;
                 value.flags = 0;  // no flags supported
@@ -463,12 +543,12 @@ static void on_publish(struct fbp_pubsubp_s *self, enum fbp_transport_seq_e seq,
         case FBP_UNION_I64: decode(value.value.i64, (int64_t) FBP_BBUF_DECODE_U64_LE(payload)); break;
         default:
             FBP_LOGW("unsupported type: %d", (int) type);
-            return;
+            return false;
     }
     FBP_LOGD2("pubsub_port recv %s%s", topic,
              (value.flags & FBP_PUBSUB_SFLAG_RETAIN) ? " | retain" : "");
-    fbp_pubsub_publish(self->pubsub, topic, &value,
-                       (fbp_pubsub_subscribe_fn) fbp_pubsubp_on_update, self);
+    return 0 == fbp_pubsub_publish(self->pubsub, topic, &value,
+                                   (fbp_pubsub_subscribe_fn) fbp_pubsubp_on_update, self);
 }
 
 static void on_connected(struct fbp_pubsubp_s *self, enum fbp_transport_seq_e seq,
@@ -523,11 +603,17 @@ void fbp_pubsubp_on_recv(struct fbp_pubsubp_s *self,
         case FBP_PUBSUBP_MSG_TOPIC_LIST: on_topic_list(self, seq, port_data, msg, msg_size); break;
         case FBP_PUBSUBP_MSG_TOPIC_ADD: on_topic_add(self, seq, port_data, msg, msg_size); break;
         case FBP_PUBSUBP_MSG_TOPIC_REMOVE: on_topic_remove(self, seq, port_data, msg, msg_size); break;
-        case FBP_PUBSUBP_MSG_PUBLISH: on_publish(self, seq, port_data, msg, msg_size); break;
+        case FBP_PUBSUBP_MSG_PUBLISH:
+            if (on_publish(self, seq, port_data, msg, msg_size)) {
+                credit_queue(self);
+                return;
+            }
+            break;
         case FBP_PUBSUBP_MSG_CONNECTED: on_connected(self, seq, port_data, msg, msg_size); break;
         default:
             FBP_LOGW("Unsupported server message: 0x%04x", port_data);
     }
+    credit_release(self, 1);  // processed
 }
 
 static inline uint8_t topic_retain_bit(struct fbp_pubsubp_s *self) {
@@ -553,11 +639,12 @@ uint8_t fbp_pubsubp_on_update(struct fbp_pubsubp_s *self,
     int32_t rc;
     uint32_t t_start;
     uint32_t t_remaining;
-    const char * topic_orig = topic;
-    const uint8_t * msg_ptr;
-    uint32_t msg_size;
+    uint8_t hdr[3];                 // type, reserved, topic_len
+    uint8_t payload_sz = 0;
+    uint8_t payload_num[8];         // encoded scalar payload
+    struct fbp_iovec_s iov[4];
+    uint32_t iov_count;
 
-    (void) topic_orig; // when logging is off
     uint8_t port_data = 0;
     if (!self->transport) {
         return 0;
@@ -573,18 +660,16 @@ uint8_t fbp_pubsubp_on_update(struct fbp_pubsubp_s *self,
         } else if (0 == strcmp(FBP_PUBSUB_TOPIC_LIST, topic)) {
             return 0;  // topic list handled explicitly, skip here
         } else if (0 == strcmp(FBP_PUBSUB_TOPIC_ADD, topic)) {
-            msg_size = value->size ? value->size : ((uint32_t) (strlen(value->value.str) + 1));
             port_data = FBP_PUBSUBP_MSG_TOPIC_ADD | topic_retain_bit(self);
-            msg_ptr = (const uint8_t *) value->value.str;
-            goto transmit;
         } else if (0 == strcmp(FBP_PUBSUB_TOPIC_REMOVE, topic)) {
-            msg_size = value->size ? value->size : ((uint32_t) (strlen(value->value.str) + 1));
             port_data = FBP_PUBSUBP_MSG_TOPIC_REMOVE;
-            msg_ptr = (const uint8_t *) value->value.str;
-            goto transmit;
         } else {
             return 0;  // do not forward any other "_" topics.
         }
+        iov[0].buf = value->value.str;
+        iov[0].size = value->size ? value->size : ((uint32_t) (strlen(value->value.str) + 1));
+        iov_count = 1;
+        goto transmit;
     } else if (self->fsm.state <= ST_TOPIC_LIST) {
         FBP_LOGW("fbp_pubsubp_on_update before ready");
         return 0;
@@ -593,24 +678,29 @@ uint8_t fbp_pubsubp_on_update(struct fbp_pubsubp_s *self,
     bool retain = (value->flags & FBP_UNION_FLAG_RETAIN) != 0;
     FBP_LOGD1("port publish %s%s", topic, retain ? " | retain" : "");
     uint8_t topic_len = 0;
-    char * p = (char *) (self->msg + 3);
-    while (*topic) {
+    while (topic[topic_len]) {
         if (topic_len >= (FBP_PUBSUB_TOPIC_LENGTH_MAX - 1)) {
             FBP_LOGW("topic too long");
             return FBP_ERROR_PARAMETER_INVALID;
         }
-        *p++ = *topic++;
         ++topic_len;
     }
-    *p++ = 0;       // add string terminator
-    ++topic_len;
+    ++topic_len;    // include string terminator
     port_data = FBP_PUBSUBP_MSG_PUBLISH | (retain ? FBP_PUBSUBP_PORT_DATA_RETAIN_BIT : 0);
-    self->msg[0] = value->type & 0x1f;
-    self->msg[1] = 0; // reserved
-    self->msg[2] = (topic_len & 0x1f);
-    uint8_t payload_sz_max = (uint8_t) (sizeof(self->msg) - ((uint8_t *) (p + 3) - self->msg));
-    uint8_t payload_sz = 0;
-    uint8_t * payload_sz_ptr = (uint8_t *) p++;
+    hdr[0] = value->type & 0x1f;
+    hdr[1] = 0; // reserved
+    hdr[2] = (topic_len & 0x1f);
+    uint8_t payload_sz_max = (uint8_t) (FBP_FRAMER_PAYLOAD_MAX_SIZE - 6 - topic_len);
+    uint8_t * p = payload_num;
+    iov[0].buf = hdr;
+    iov[0].size = sizeof(hdr);
+    iov[1].buf = topic;
+    iov[1].size = topic_len;
+    iov[2].buf = &payload_sz;
+    iov[2].size = 1;
+    iov[3].buf = payload_num;
+    iov[3].size = 0;
+    iov_count = 4;
     if (payload_sz_max < 8) {
         FBP_LOGW("payload full");
         return FBP_ERROR_PARAMETER_INVALID;
@@ -621,29 +711,22 @@ uint8_t fbp_pubsubp_on_update(struct fbp_pubsubp_s *self,
             break;
         case FBP_UNION_STR:  // intentional fall-through
         case FBP_UNION_JSON: {
-            const char * s = value->value.str;
-            while (*s) {
-                if (payload_sz >= (payload_sz_max - 1)) {
-                    FBP_LOGW("payload full: %s", topic_orig);
-                    return FBP_ERROR_PARAMETER_INVALID;
-                }
-                *p++ = *s++;
-                ++payload_sz;
+            size_t sz = strlen(value->value.str) + 1;  // include string terminator
+            if (sz >= payload_sz_max) {
+                FBP_LOGW("payload full: %s", topic);
+                return FBP_ERROR_PARAMETER_INVALID;
             }
-            *p++ = 0;       // add string terminator
-            ++payload_sz;
+            iov[3].buf = value->value.str;
+            payload_sz = (uint8_t) sz;
             break;
         }
         case FBP_UNION_BIN: {
             if (payload_sz_max < value->size) {
-                FBP_LOGW("payload full: %s", topic_orig);
+                FBP_LOGW("payload full: %s", topic);
                 return FBP_ERROR_PARAMETER_INVALID;
             }
-            const uint8_t * s = value->value.bin;
-            for (uint8_t sz = 0; sz < value->size; ++sz) {
-                *p++ = *s++;
-                ++payload_sz;
-            }
+            iov[3].buf = value->value.bin;
+            payload_sz = (uint8_t) value->size;
             break;
         }
         case FBP_UNION_F32: FBP_BBUF_ENCODE_U32_LE(p, value->value.u32); payload_sz = 4; break;  // u32 intentional
@@ -660,15 +743,13 @@ uint8_t fbp_pubsubp_on_update(struct fbp_pubsubp_s *self,
             FBP_LOGW("unsupported type: %d", (int) value->type);
             return FBP_ERROR_PARAMETER_INVALID;
     }
-    *payload_sz_ptr = (uint8_t) payload_sz;
-    msg_ptr = self->msg;
-    msg_size = 4 + topic_len + payload_sz;
+    iov[3].size = payload_sz;
 
 transmit:
     t_start = (uint32_t) fbp_time_rel_ms();
     while (1) {
-        rc = fbp_transport_send(self->transport, self->port_id, FBP_TRANSPORT_SEQ_SINGLE,
-                                port_data, msg_ptr, msg_size);
+        rc = fbp_transport_sendv(self->transport, self->port_id, FBP_TRANSPORT_SEQ_SINGLE,
+                                 port_data, iov, iov_count);
         if (!rc) {
             break;
         } else if (rc == FBP_ERROR_FULL) {
@@ -907,8 +988,11 @@ struct fbp_pubsubp_s * fbp_pubsubp_initialize(
     self->mode = mode;
     self->pubsub = pubsub;
     self->evm = *evm;
-    construct_feedback_topic(self);
+    construct_private_topic(self, self->feedback_topic, FEEDBACK_TOPIC_PREFIX);
+    construct_private_topic(self, self->credit_topic, CREDIT_TOPIC_PREFIX);
     fbp_topic_list_clear(&self->topic_list);
+    self->mutex = fbp_os_mutex_alloc("fbp_pubsubp");
+    fbp_pubsub_subscribe(pubsub, self->credit_topic, FBP_PUBSUB_SFLAG_PUB, on_credit, self);
 
     self->fsm.name = is_client ? "pubsubp_client" : "pubsubp_server";
     self->fsm.state = ST_DISCONNECTED;
@@ -924,6 +1008,10 @@ struct fbp_pubsubp_s * fbp_pubsubp_initialize(
 
 void fbp_pubsubp_finalize(struct fbp_pubsubp_s * self) {
     if (self) {
+        fbp_pubsub_unsubscribe(self->pubsub, self->credit_topic, on_credit, self);
+        if (self->mutex) {
+            fbp_os_mutex_free(self->mutex);
+        }
         fbp_free(self);
     }
 }
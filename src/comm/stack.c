@@ -55,6 +55,7 @@ struct fbp_stack_s * fbp_stack_initialize(
         fbp_stack_finalize(self);
         return NULL;
     }
+    fbp_transport_register_ll_sendv(self->transport, (fbp_transport_ll_sendv) fbp_dl_sendv);
 
     struct fbp_dl_api_s dl_api = {
             .user_data = self->transport,
@@ -63,7 +64,7 @@ struct fbp_stack_s * fbp_stack_initialize(
     };
     fbp_dl_register_upper_layer(self->dl, &dl_api);
 
-    self->port0 = fbp_port0_initialize(port0_mode, self->dl, evm_api, self->transport, fbp_transport_send,
+    self->port0 = fbp_port0_initialize(port0_mode, self->dl, evm_api, self->transport, fbp_transport_sendv,
                                         pubsub, port_config.topic_prefix.topic, timesync);
     if (!self->port0) {
         fbp_stack_finalize(self);
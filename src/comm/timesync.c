@@ -15,10 +15,18 @@
  */
 
 #include "fitterbap/comm/timesync.h"
+#include "fitterbap/ec.h"
 #include "fitterbap/log.h"
 #include "fitterbap/platform.h"
 #include "fitterbap/os/mutex.h"
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MEMORY_BARRIER() _ReadWriteBarrier()  // x86 does not reorder loads or stores
+#else
+#define MEMORY_BARRIER() __sync_synchronize()
+#endif
+
 
 /**
  * This module converts a local counter into UTC time based upon
@@ -39,11 +47,35 @@
  * is similar to SNTP, and it performs no additional filtering, which means
  * that your system will observe small, frequent jumps.
  *
- * However, more accurate filtering is possible.  See some of the references
+ * The FBP_TS_ESTIMATOR_SERVO estimator instead filters the updates using a
+ * Kalman filter with offset and frequency state, structured like the PTP
+ * clock servo.  The frequency estimate adjusts the counter period, and
+ * the offset estimate is slewed out over the next update interval.
+ * The process noise models the counter frequency as a random walk of
+ * SERVO_WANDER.  Queueing only ever adds delay, so the round-trip time
+ * in excess of the recent minimum bounds the midpoint error.  The
+ * measurement noise is this bound plus SERVO_NOISE, which weights the
+ * updates with the least queueing delay most heavily.  Rather than
+ * stepping, each update re-anchors the coefficients at the current
+ * estimated time, so fbp_ts_time() remains continuous.
+ * Updates with a round-trip time well above the recent minimum likely
+ * have asymmetric delay, and the servo rejects them as outliers.  The
+ * servo only steps for the first update or when the offset exceeds
+ * SERVO_STEP_THRESHOLD.  The servo computations use double precision,
+ * but only on update.  The fbp_ts_time() path remains integer.
+ *
+ * More accurate filtering is possible.  See some of the references
  * below.  the actual implementation must ensure that we maintain precision
  * across the full range of possible counter frequencies.  Any implementation
  * must carefully analyze numerical precision to ensure sufficient accuracy.
  *
+ * The fbp_ts_time() readers never block.  The writer publishes the
+ * coefficients using a sequence-latched double buffer: it writes the
+ * inactive copy and then increments coef_seq to activate it.  Readers
+ * copy coef[coef_seq & 1] and retry only if coef_seq changed during
+ * the copy.  An ISR that preempts the writer reads the still-active copy,
+ * so it never spins.
+ *
  * How accurate?  If we want to allow for 1 µs accuracy over 100 seconds,
  * then we need to represent 10 ns error per second, which requires at least
  * log2(10e-9) = 27 bits.
@@ -73,14 +105,47 @@
 #define UPDATE_PROCESS_MAX (12)
 #define UPDATE_INDEX_MASK (UPDATE_COUNT - 1)
 
+#define SERVO_FREQ_MAX (1e-3)                               // 1000 ppm
+#define SERVO_WANDER (1e-8)                                 // frequency random walk, per sqrt(s)
+#define SERVO_NOISE (5e-6)                                  // offset noise with minimum round-trip, seconds
+#define SERVO_STEP_THRESHOLD (FBP_TIME_MILLISECOND * 100)
+#define SERVO_RTT_MARGIN_US (50)                            // outlier threshold is 2 * rtt_min + margin
+#define SERVO_REJECT_MAX (4)                                // then accept to follow path changes
+#define SERVO_12Q52 (4503599627370496.0)                    // 2^52
+
 struct update_s {
     uint64_t counter;    // The mean counter value = ((start + stop) / 2) >> counter_right_shift
     uint64_t time;       // The mean time value = (rx + tx) / 2
     uint64_t dcounter;   // The total counter duration = (start - stop) >> counter_right_shift
 };
 
+struct coef_s {
+    uint64_t counter_offset;        // in counter units shifted by counter_right_shift
+    int64_t time_offset;            // in fitterbap 34Q30 time
+    uint64_t counter_period_12q52;
+};
+
+enum servo_state_e {
+    SERVO_STATE_UNLOCKED,           // next update steps
+    SERVO_STATE_LOCKED,             // normal servo operation
+};
+
+struct servo_s {
+    uint8_t state;                  // servo_state_e
+    uint8_t reject_run;             // consecutive rejected updates
+    double period_nominal_12q52;    // the nominal counter period
+    double integral;                // the frequency correction ratio
+    double p00;                     // offset variance, s^2
+    double p01;                     // offset-frequency covariance, s
+    double p11;                     // frequency variance
+    uint64_t rtt_min;               // the filtered minimum round-trip, in shifted counter units
+    uint64_t rtt_margin;            // the outlier margin, in shifted counter units
+    int64_t time_prev;              // the time of the prior accepted update
+};
+
 struct fbp_ts_s {
-    fbp_os_mutex_t mutex;
+    fbp_os_mutex_t mutex;           // serializes writers only
+    uint8_t estimator;              // fbp_ts_estimator_e
 
     // FIFO for incoming time updates
     struct update_s updates[UPDATE_COUNT];
@@ -89,9 +154,10 @@ struct fbp_ts_s {
     uint8_t process_tail;
 
     uint8_t counter_right_shift;
-    uint64_t counter_offset;        // in counter units shifted by counter_right_shift
-    int64_t time_offset;            // in fitterbap 34Q30 time
-    uint64_t counter_period_12q52;
+    volatile uint32_t coef_seq;     // coef[coef_seq & 1] is active
+    struct coef_s coef[2];
+    struct servo_s servo;
+    struct fbp_ts_status_s status;  // protected by mutex
 };
 
 struct fbp_ts_s * primary_instance_ = NULL;
@@ -115,25 +181,84 @@ static inline void unlock(struct fbp_ts_s * self) {
     fbp_os_mutex_unlock(self->mutex);
 }
 
+static void coef_get(struct fbp_ts_s * self, struct coef_s * coef) {
+    uint32_t seq;
+    do {
+        seq = self->coef_seq;
+        MEMORY_BARRIER();
+        *coef = self->coef[seq & 1];
+        MEMORY_BARRIER();
+    } while (seq != self->coef_seq);
+}
+
+static void coef_set(struct fbp_ts_s * self, uint64_t counter_period_12q52, uint64_t counter_offset, int64_t time_offset) {
+    lock(self);
+    uint32_t seq = self->coef_seq + 1;
+    struct coef_s * coef = &self->coef[seq & 1];
+    coef->counter_period_12q52 = counter_period_12q52;
+    coef->counter_offset = counter_offset;
+    coef->time_offset = time_offset;
+    MEMORY_BARRIER();
+    self->coef_seq = seq;
+    unlock(self);
+}
+
+static inline int64_t coef_eval(const struct coef_s * coef, uint64_t counter_shifted) {
+    int64_t counter = (int64_t) (counter_shifted - coef->counter_offset);
+    int64_t value = (int64_t) (coef->counter_period_12q52 * (uint64_t) counter);
+    return (value >> 22) + coef->time_offset;
+}
+
+static inline int64_t counter_to_time(const struct coef_s * coef, uint8_t right_shift, uint64_t counter_u64) {
+    return coef_eval(coef, counter_u64 >> right_shift);
+}
+
+static inline const struct coef_s * coef_active(struct fbp_ts_s * self) {
+    return &self->coef[self->coef_seq & 1];  // writer only
+}
+
+static inline int64_t abs_i64(int64_t x) {
+    return (x < 0) ? -x : x;
+}
+
+static void status_update(struct fbp_ts_s * self, int64_t offset, uint64_t rtt, double drift, bool step) {
+    struct fbp_ts_status_s * status = &self->status;
+    lock(self);
+    status->offset = offset;
+    status->rtt = (int64_t) ((((uint64_t) self->servo.period_nominal_12q52) * rtt) >> 22);
+    if (step) {
+        status->uncertainty = status->rtt / 2;  // bounded by the possible delay asymmetry
+    } else {
+        status->uncertainty += (abs_i64(offset) - status->uncertainty) / 4;
+    }
+    status->drift_ppb = (int32_t) (drift * 1e9);
+    ++status->update_count;
+    unlock(self);
+}
+
 FBP_API int64_t fbp_ts_time(struct fbp_ts_s * self) {
+    struct coef_s coef;
     self = resolve_instance(self);
     if (!self) {
         return 0;
     }
-
-    // Thread-safety: get coefficients using mutex
-    lock(self);
-    uint64_t counter_period_12q52 = self->counter_period_12q52;
-    uint64_t counter_offset = self->counter_offset;
-    int64_t time_offset = self->time_offset;
-    unlock(self);
-
+    coef_get(self, &coef);
     // Get counter, may not always be instantaneous
-    int64_t counter = fbp_time_counter_u64() >> self->counter_right_shift;
-    counter -= counter_offset;
-    int64_t value = counter_period_12q52 * counter;
-    value = (value >> 22) + time_offset;
-    return value;
+    return counter_to_time(&coef, self->counter_right_shift, fbp_time_counter_u64());
+}
+
+FBP_API void fbp_ts_time_batch(struct fbp_ts_s * self, const uint64_t * counter, int64_t * time, uint32_t count) {
+    struct coef_s coef;
+    self = resolve_instance(self);
+    if (!self) {
+        fbp_memset(time, 0, count * sizeof(*time));
+        return;
+    }
+    coef_get(self, &coef);
+    uint8_t right_shift = self->counter_right_shift;
+    for (uint32_t i = 0; i < count; ++i) {
+        time[i] = counter_to_time(&coef, right_shift, counter[i]);
+    }
 }
 
 static inline uint8_t next_idx(uint8_t idx) {
@@ -155,8 +280,7 @@ static int32_t process_one(struct fbp_ts_s * self) {
 
     if (self->process_tail == self->process_head) {
         // initial update since tail should eventually be UPDATE_PROCESS_MAX behind.
-        self->counter_offset = current->counter;
-        self->time_offset = current->time;
+        coef_set(self, coef_active(self)->counter_period_12q52, current->counter, current->time);
         self->process_head = next_idx(self->process_head);
         return 0;
     }
@@ -183,11 +307,10 @@ static int32_t process_one(struct fbp_ts_s * self) {
     uint64_t counter_period_12q52 = (dt_u64 << 22 /* 12Q52 */) / (uint32_t) dc_u64;
 
     // update the state (used for fbp_ts_time() computations).
-    lock(self);
-    self->counter_period_12q52 = counter_period_12q52;
-    self->time_offset = current->time;
-    self->counter_offset = current->counter;
-    unlock(self);
+    int64_t offset = (int64_t) current->time - coef_eval(coef_active(self), current->counter);
+    coef_set(self, counter_period_12q52, current->counter, current->time);
+    double drift = (self->servo.period_nominal_12q52 / (double) counter_period_12q52) - 1.0;
+    status_update(self, offset, current->dcounter, drift, false);
 
     // Advance the process index pointers.
     self->process_head = next_idx(self->process_head);
@@ -203,6 +326,84 @@ static int32_t process_one(struct fbp_ts_s * self) {
     return 0;
 }
 
+static inline uint64_t period_to_12q52(double period) {
+    return (uint64_t) (period + 0.5);
+}
+
+static void servo_update(struct fbp_ts_s * self, struct update_s * u) {
+    struct servo_s * servo = &self->servo;
+    const struct coef_s * coef = coef_active(self);
+
+    if (servo->state != SERVO_STATE_UNLOCKED) {
+        if (u->dcounter > (2 * servo->rtt_min + servo->rtt_margin)) {
+            if (++servo->reject_run <= SERVO_REJECT_MAX) {
+                FBP_LOGD1("timesync outlier rejected");
+                lock(self);
+                ++self->status.reject_count;
+                unlock(self);
+                return;
+            }
+            servo->rtt_min = u->dcounter;  // path changed, accept
+        } else if (u->dcounter < servo->rtt_min) {
+            servo->rtt_min = u->dcounter;
+        } else {
+            servo->rtt_min += (u->dcounter - servo->rtt_min) >> 4;  // slowly age
+        }
+    } else {
+        servo->rtt_min = u->dcounter;
+    }
+    servo->reject_run = 0;
+
+    // Queueing only adds delay, so the round-trip excess over the minimum
+    // bounds the error of the midpoint.
+    double excess = (double) (u->dcounter - servo->rtt_min) * servo->period_nominal_12q52 / SERVO_12Q52;
+    double r = 0.25 * excess * excess + SERVO_NOISE * SERVO_NOISE;
+
+    int64_t local = coef_eval(coef, u->counter);
+    int64_t offset = (int64_t) u->time - local;
+    int64_t dt = (int64_t) u->time - servo->time_prev;
+    if ((servo->state == SERVO_STATE_UNLOCKED) || (abs_i64(offset) > SERVO_STEP_THRESHOLD) || (dt <= 0)) {
+        if (servo->state != SERVO_STATE_UNLOCKED) {
+            FBP_LOGW("timesync step");
+        }
+        double period = servo->period_nominal_12q52 * (1.0 + servo->integral);
+        coef_set(self, period_to_12q52(period), u->counter, u->time);
+        servo->state = SERVO_STATE_LOCKED;
+        servo->time_prev = u->time;
+        servo->p00 = r;
+        servo->p01 = 0.0;
+        servo->p11 = SERVO_FREQ_MAX * SERVO_FREQ_MAX;
+        status_update(self, offset, u->dcounter, -servo->integral, true);
+        return;
+    }
+
+    // Kalman filter with offset and frequency state.  The corrections
+    // feed back into the coefficients, so the predicted offset is zero.
+    double t = (double) dt / (double) FBP_TIME_SECOND;
+    double z = (double) offset / (double) FBP_TIME_SECOND;
+    double q = SERVO_WANDER * SERVO_WANDER;
+    servo->p00 += t * (2.0 * servo->p01 + t * servo->p11) + q * t * t * t / 3.0;
+    servo->p01 += t * servo->p11 + q * t * t / 2.0;
+    servo->p11 += q * t;
+    double k0 = servo->p00 / (servo->p00 + r);
+    double k1 = servo->p01 / (servo->p00 + r);
+    servo->p11 -= k1 * servo->p01;
+    servo->p01 -= k0 * servo->p01;
+    servo->p00 -= k0 * servo->p00;
+
+    servo->integral += k1 * z;
+    if (servo->integral > SERVO_FREQ_MAX) {
+        servo->integral = SERVO_FREQ_MAX;
+    } else if (servo->integral < -SERVO_FREQ_MAX) {
+        servo->integral = -SERVO_FREQ_MAX;
+    }
+    // slew out the offset correction over the next interval
+    double period = servo->period_nominal_12q52 * (1.0 + servo->integral + k0 * z / t);
+    coef_set(self, period_to_12q52(period), u->counter, local);  // slew: continuous at local
+    servo->time_prev = u->time;
+    status_update(self, offset, u->dcounter, -servo->integral, false);
+}
+
 static int32_t fbp_ts_process(struct fbp_ts_s * self) {
     while (0 == process_one(self)) {
         // continue;
@@ -231,23 +432,44 @@ FBP_API void fbp_ts_update(struct fbp_ts_s * self, uint64_t src_tx, int64_t tgt_
     }
 
     struct update_s *current_entry = &self->updates[self->update_head];
-    current_entry->counter = ((src_tx >> 1) + (src_rx >> 1)) >> self->counter_right_shift;
+    current_entry->counter = (src_tx + ((src_rx - src_tx) >> 1)) >> self->counter_right_shift;
     current_entry->time = (tgt_tx >> 1) + (tgt_rx >> 1);
     current_entry->dcounter = ((src_rx - src_tx) >> self->counter_right_shift);
     self->update_head = next_update_head;
 
-    fbp_ts_process(self);
+    if (self->estimator == FBP_TS_ESTIMATOR_SERVO) {
+        servo_update(self, current_entry);
+        self->process_tail = self->update_head;  // FIFO unused
+        self->process_head = self->update_head;
+    } else {
+        fbp_ts_process(self);
+    }
+}
+
+FBP_API int32_t fbp_ts_status_get(struct fbp_ts_s * self, struct fbp_ts_status_s * status) {
+    self = resolve_instance(self);
+    if (!self || !status) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    lock(self);
+    *status = self->status;
+    unlock(self);
+    return 0;
 }
 
-FBP_API struct fbp_ts_s * fbp_ts_initialize() {
+FBP_API struct fbp_ts_s * fbp_ts_initialize(enum fbp_ts_estimator_e estimator) {
     struct fbp_ts_s * self = fbp_alloc_clr(sizeof(struct fbp_ts_s));
     self->mutex = fbp_os_mutex_alloc("fbp_ts");
+    self->estimator = (uint8_t) estimator;
+    self->status.estimator = (uint32_t) estimator;
     uint32_t frequency = fbp_time_counter_frequency();
     while (frequency > FREQ_MAX) {
         ++self->counter_right_shift;
         frequency >>= 1;
     }
-    self->counter_period_12q52 = (((uint64_t) 1) << 52) / frequency;
+    self->coef[0].counter_period_12q52 = (((uint64_t) 1) << 52) / frequency;
+    self->servo.period_nominal_12q52 = ((double) (((uint64_t) 1) << 52)) / (double) frequency;
+    self->servo.rtt_margin = (((uint64_t) frequency) * SERVO_RTT_MARGIN_US) / 1000000;
 
     if (!primary_instance_) {
         primary_instance_ = self;
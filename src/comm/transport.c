@@ -18,6 +18,7 @@
 #include "fitterbap/ec.h"
 #include "fitterbap/platform.h"
 #include "fitterbap/time.h"
+#include "fitterbap/os/mutex.h"
 
 
 struct port_s {
@@ -25,18 +26,49 @@ struct port_s {
     const char * meta;
     fbp_transport_event_fn event_fn;
     fbp_transport_recv_fn recv_fn;
+    struct fbp_transport_port_status_s status;  // protected by mutex
+    uint32_t credit_used;       // credited messages sent, protected by mutex
+    uint32_t credit_returned;   // credits returned by the peer, protected by mutex
+    uint32_t rx_grant;          // messages released, not yet granted to the peer, protected by mutex
+    bool credit_deferred;       // the port releases received messages explicitly
 };
 
 /// The transport instance.
 struct fbp_transport_s {
     fbp_transport_ll_send send_fn;
+    fbp_transport_ll_sendv sendv_fn;
     void * send_user_data;
     /// The defined ports.
-    struct port_s ports[FBP_TRANSPORT_PORT_MAX];
+    struct port_s ports[FBP_TRANSPORT_PORT_MAX + 1];
     struct port_s port_default;
     enum fbp_dl_event_e last_state_event;   // to properly initialize new port registrations
+    fbp_os_mutex_t mutex;                   // protects the port status and credits
+    bool credit_enable;                     // the peer grants credits, protected by mutex
+    fbp_transport_credit_fn credit_fn;
+    void * credit_user_data;
 };
 
+static inline void lock(struct fbp_transport_s * self) {
+    if (self->mutex) {
+        fbp_os_mutex_lock(self->mutex);
+    }
+}
+
+static inline void unlock(struct fbp_transport_s * self) {
+    if (self->mutex) {
+        fbp_os_mutex_unlock(self->mutex);
+    }
+}
+
+static inline uint32_t credit_depth(struct port_s * port) {
+    return port->credit_used - port->credit_returned;  // unsigned wrap intended
+}
+
+static void credits_restore(struct port_s * port) {
+    port->credit_returned = port->credit_used;
+    port->rx_grant = 0;
+}
+
 void fbp_transport_on_event_cbk(struct fbp_transport_s * self, enum fbp_dl_event_e event) {
     switch (event) {
         case FBP_DL_EV_CONNECTED:       // intentional fall-through
@@ -48,7 +80,15 @@ void fbp_transport_on_event_cbk(struct fbp_transport_s * self, enum fbp_dl_event
         default:
             break;
     }
-    for (uint32_t i = 0; i < FBP_TRANSPORT_PORT_MAX; ++i) {
+    if (event == FBP_DL_EV_DISCONNECTED) {
+        lock(self);
+        self->credit_enable = false;  // until the next connection negotiates it
+        for (uint32_t i = 0; i <= FBP_TRANSPORT_PORT_MAX; ++i) {
+            credits_restore(&self->ports[i]);
+        }
+        unlock(self);
+    }
+    for (uint32_t i = 0; i <= FBP_TRANSPORT_PORT_MAX; ++i) {
         if (self->ports[i].event_fn) {
             self->ports[i].event_fn(self->ports[i].user_data, event);
         }
@@ -63,6 +103,10 @@ void fbp_transport_on_recv_cbk(struct fbp_transport_s * self, uint16_t metadata,
     uint8_t port_id = metadata & FBP_TRANSPORT_PORT_MAX;
     enum fbp_transport_seq_e seq = (enum fbp_transport_seq_e) ((metadata >> 6) & 3);
     uint8_t port_data = (uint8_t) (metadata >> 8);
+    lock(self);
+    self->ports[port_id].status.rx_msgs += 1;
+    self->ports[port_id].status.rx_bytes += msg_size;
+    unlock(self);
     if (self->ports[port_id].recv_fn) {
         self->ports[port_id].recv_fn(self->ports[port_id].user_data, port_id, seq, port_data, msg, msg_size);
     } else if (self->port_default.recv_fn) {
@@ -70,6 +114,9 @@ void fbp_transport_on_recv_cbk(struct fbp_transport_s * self, uint16_t metadata,
     } else {
         // no registered handlers, drop silently
     }
+    if (!self->ports[port_id].credit_deferred) {
+        fbp_transport_port_credit_release(self, port_id, 1);
+    }
 }
 
 struct fbp_transport_s * fbp_transport_initialize(fbp_transport_ll_send send_fn, void * send_user_data) {
@@ -78,11 +125,15 @@ struct fbp_transport_s * fbp_transport_initialize(fbp_transport_ll_send send_fn,
     t->last_state_event = FBP_DL_EV_DISCONNECTED;
     t->send_fn = send_fn;
     t->send_user_data = send_user_data;
+    t->mutex = fbp_os_mutex_alloc("fbp_transport");
     return t;
 }
 
 void fbp_transport_finalize(struct fbp_transport_s * self) {
     if (self) {
+        if (self->mutex) {
+            fbp_os_mutex_free(self->mutex);
+        }
         fbp_free(self);
     }
 }
@@ -124,19 +175,92 @@ int32_t fbp_transport_port_register_default(
     return 0;
 }
 
-int32_t fbp_transport_send(struct fbp_transport_s * self,
-                           uint8_t port_id,
-                           enum fbp_transport_seq_e seq,
-                           uint8_t port_data,
-                           uint8_t const *msg, uint32_t msg_size) {
-    if (port_id > FBP_TRANSPORT_PORT_MAX) {
+void fbp_transport_register_ll_sendv(struct fbp_transport_s * self, fbp_transport_ll_sendv sendv_fn) {
+    self->sendv_fn = sendv_fn;
+}
+
+// Not inlined, so callers of the fast paths do not pay for the buffer.
+static FBP_NOINLINE int32_t ll_send_gather(struct fbp_transport_s * self, uint16_t metadata,
+                                           struct fbp_iovec_s const *iov, uint32_t iov_count, uint32_t msg_size) {
+    uint8_t buf[FBP_FRAMER_PAYLOAD_MAX_SIZE];
+    if (msg_size > sizeof(buf)) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    uint8_t * p = buf;
+    for (uint32_t i = 0; i < iov_count; ++i) {
+        if (iov[i].size) {
+            fbp_memcpy(p, iov[i].buf, iov[i].size);
+            p += iov[i].size;
+        }
+    }
+    return self->send_fn(self->send_user_data, metadata, buf, msg_size);
+}
+
+static int32_t ll_sendv(struct fbp_transport_s * self, uint16_t metadata,
+                        struct fbp_iovec_s const *iov, uint32_t iov_count, uint32_t msg_size) {
+    if (self->sendv_fn) {
+        return self->sendv_fn(self->send_user_data, metadata, iov, iov_count);
+    } else if (iov_count == 1) {
+        return self->send_fn(self->send_user_data, metadata, iov[0].buf, iov[0].size);
+    }
+    return ll_send_gather(self, metadata, iov, iov_count, msg_size);
+}
+
+int32_t fbp_transport_sendv(struct fbp_transport_s * self,
+                            uint8_t port_id,
+                            enum fbp_transport_seq_e seq,
+                            uint8_t port_data,
+                            struct fbp_iovec_s const *iov, uint32_t iov_count) {
+    if ((port_id > FBP_TRANSPORT_PORT_MAX) || (!iov && iov_count)) {
         return FBP_ERROR_PARAMETER_INVALID;
     }
+    struct port_s * port = &self->ports[port_id];
+    struct fbp_transport_port_status_s * s = &port->status;
+    lock(self);
+    bool credited = s->credit_limit && self->credit_enable;
+    if (credited) {
+        if (credit_depth(port) >= s->credit_limit) {
+            s->tx_blocked += 1;
+            unlock(self);
+            return FBP_ERROR_FULL;
+        }
+        port->credit_used += 1;  // reserve before sending without the lock
+    }
+    unlock(self);
     uint16_t metadata = ((seq & 0x3) << 6)
         | (port_id & FBP_TRANSPORT_PORT_MAX)
         | (((uint16_t) port_data) << 8);
+    uint32_t msg_size = 0;
+    for (uint32_t i = 0; i < iov_count; ++i) {
+        msg_size += iov[i].size;
+    }
+
+    int32_t rc = ll_sendv(self, metadata, iov, iov_count, msg_size);
+    lock(self);
+    uint32_t depth = credit_depth(port);
+    if (rc) {
+        s->tx_errors += 1;
+        if (credited && depth) {  // a disconnect may have restored the credits
+            port->credit_used -= 1;
+        }
+    } else {
+        s->tx_msgs += 1;
+        s->tx_bytes += msg_size;
+        if (credited && (depth > s->queue_depth_max)) {
+            s->queue_depth_max = depth;
+        }
+    }
+    unlock(self);
+    return rc;
+}
 
-    return self->send_fn(self->send_user_data, metadata, msg, msg_size);
+int32_t fbp_transport_send(struct fbp_transport_s * self,
+                           uint8_t port_id,
+                           enum fbp_transport_seq_e seq,
+                           uint8_t port_data,
+                           uint8_t const *msg, uint32_t msg_size) {
+    struct fbp_iovec_s iov = {.buf = msg, .size = msg_size};
+    return fbp_transport_sendv(self, port_id, seq, port_data, &iov, 1);
 }
 
 const char * fbp_transport_meta_get(struct fbp_transport_s * self, uint8_t port_id) {
@@ -155,3 +279,123 @@ void fbp_transport_event_inject(struct fbp_transport_s * self, enum fbp_dl_event
     }
     fbp_transport_on_event_cbk(self, event);
 }
+
+int32_t fbp_transport_port_credit_limit_set(struct fbp_transport_s * self,
+                                            uint8_t port_id, uint32_t credit_limit) {
+    if (port_id > FBP_TRANSPORT_PORT_MAX) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    lock(self);
+    self->ports[port_id].status.credit_limit = credit_limit;
+    self->ports[port_id].credit_returned = self->ports[port_id].credit_used;
+    unlock(self);
+    return 0;
+}
+
+int32_t fbp_transport_port_credit_return(struct fbp_transport_s * self,
+                                         uint8_t port_id, uint32_t credits) {
+    if (port_id > FBP_TRANSPORT_PORT_MAX) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    struct port_s * port = &self->ports[port_id];
+    lock(self);
+    uint32_t depth = credit_depth(port);
+    if (credits > depth) {
+        credits = depth;  // saturate at the limit
+    }
+    port->credit_returned += credits;
+    unlock(self);
+    return 0;
+}
+
+int32_t fbp_transport_port_credit_defer(struct fbp_transport_s * self, uint8_t port_id, bool defer) {
+    if (port_id > FBP_TRANSPORT_PORT_MAX) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    self->ports[port_id].credit_deferred = defer;
+    return 0;
+}
+
+int32_t fbp_transport_port_credit_release(struct fbp_transport_s * self, uint8_t port_id, uint32_t count) {
+    if (port_id > FBP_TRANSPORT_PORT_MAX) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    if (!port_id || !count) {
+        return 0;  // port 0 carries the grants
+    }
+    bool notify = false;
+    lock(self);
+    if (self->credit_enable) {
+        notify = (0 == self->ports[port_id].rx_grant);
+        self->ports[port_id].rx_grant += count;
+    }
+    unlock(self);
+    if (notify && self->credit_fn) {
+        self->credit_fn(self->credit_user_data);
+    }
+    return 0;
+}
+
+void fbp_transport_credit_enable(struct fbp_transport_s * self, bool enable) {
+    lock(self);
+    for (uint32_t i = 0; i <= FBP_TRANSPORT_PORT_MAX; ++i) {
+        credits_restore(&self->ports[i]);
+    }
+    self->credit_enable = enable;
+    unlock(self);
+}
+
+void fbp_transport_register_credit_fn(struct fbp_transport_s * self, fbp_transport_credit_fn fn, void * user_data) {
+    self->credit_fn = NULL;
+    self->credit_user_data = user_data;
+    self->credit_fn = fn;
+}
+
+uint32_t fbp_transport_credit_grant_take(struct fbp_transport_s * self, uint8_t port_id) {
+    if (port_id > FBP_TRANSPORT_PORT_MAX) {
+        return 0;
+    }
+    lock(self);
+    uint32_t grant = self->ports[port_id].rx_grant;
+    self->ports[port_id].rx_grant = 0;
+    unlock(self);
+    return grant;
+}
+
+int32_t fbp_transport_port_status_get(struct fbp_transport_s * self,
+                                      uint8_t port_id,
+                                      struct fbp_transport_port_status_s * status) {
+    if ((port_id > FBP_TRANSPORT_PORT_MAX) || !status) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    struct port_s * port = &self->ports[port_id];
+    lock(self);
+    *status = port->status;
+    uint32_t depth = credit_depth(port);
+    unlock(self);
+    if (status->credit_limit) {
+        status->queue_depth = depth;
+        status->credits = (depth < status->credit_limit) ? (status->credit_limit - depth) : 0;
+    } else {
+        status->queue_depth = 0;
+        status->credits = 0;
+    }
+    return 0;
+}
+
+int32_t fbp_transport_port_status_clear(struct fbp_transport_s * self, uint8_t port_id) {
+    if (port_id > FBP_TRANSPORT_PORT_MAX) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    struct fbp_transport_port_status_s * s = &self->ports[port_id].status;
+    lock(self);
+    s->tx_msgs = 0;
+    s->tx_bytes = 0;
+    s->rx_msgs = 0;
+    s->rx_bytes = 0;
+    s->tx_errors = 0;
+    s->tx_blocked = 0;
+    s->queue_depth_max = credit_depth(&self->ports[port_id]);
+    unlock(self);
+    return 0;
+}
@@ -24,49 +24,279 @@
 #include "fitterbap/topic_list.h"
 #include "fitterbap/collections/list.h"
 #include "fitterbap/cstr.h"
+#include "fitterbap/crc.h"
+#include "fitterbap/time.h"
+#include "fitterbap/os/task.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define TOPIC_INDEX_SIZE_INIT (64)      // must be power of 2
+#define MSG_CACHE_MASK (FBP_CONFIG_PUBSUB_MSG_CACHE_SIZE - 1)
+#define BUF_MAGIC (0x42504246U)  // "FBPB"
+#define FNV1A_OFFSET (2166136261U)
+#define FNV1A_PRIME (16777619U)
+#define SNAPSHOT_MAGIC (0x53504246U)  // "FBPS"
+#define SNAPSHOT_VERSION (2)
+#define SNAPSHOT_ALIGN (8)
+#define TOPIC_POOL_INTERNAL (15)        // root, _, topic, prefix, list, add, remove, cfg, rc, stats, stats/*
+#define SUBSCRIBER_POOL_INTERNAL (4)    // _/topic/add, _/topic/remove, _/cfg/rc, _/cfg/stats
+#define INTERN_POOL_ENTRY_SIZE ((sizeof(struct intern_s) + FBP_PUBSUB_TOPIC_LENGTH_MAX + 7) & ~((size_t) 7))
+#define WALK_POOL_SIZE (FBP_TOPIC_LIST_LENGTH_MAX / 2 + 1)  // one query per top-level prefix or one retain
 
 enum op_e {
     OP_PUBLISH,
     OP_SUBSCRIBE,
+    OP_CONFLATE,    // publish the pending topic conflate value
+};
+
+enum dirty_e {
+    DIRTY_VALUE = (1 << 0),   // retained value changed since the last snapshot
+    DIRTY_META = (1 << 1),    // metadata changed since the last snapshot
+};
+
+/// The callback profile, in fbp_time_counter_u64() ticks.
+struct profile_s {
+    uint64_t count;
+    uint64_t time_total;
+    uint64_t time_min;
+    uint64_t time_max;
+};
+
+/**
+ * @brief A compiled wildcard subscription pattern.
+ *
+ * Each level is an interned subtopic name, PATTERN_ONE for '+', or
+ * PATTERN_ALL for '#'.  The levels are relative to the topic that holds
+ * the subscriber.
+ */
+struct pattern_s {
+    uint32_t count;
+    const char * level[];
 };
 
+static const char PATTERN_ONE[] = "+";
+static const char PATTERN_ALL[] = "#";
+
 struct subscriber_s {
     fbp_pubsub_subscribe_fn cbk_fn;
     void * cbk_user_data;
+    struct pattern_s * pattern;   // wildcard subscription or NULL for the entire subtree
+    struct fbp_pubsub_executor_s * executor;  // deliver PUB and RETAIN through the executor, or NULL
     uint8_t flags;
+    struct profile_s profile;     // only updated with stats enabled
     struct fbp_list_s item;
 };
 
+struct dispatch_s {
+    fbp_pubsub_subscribe_fn cbk_fn;
+    void * cbk_user_data;
+    struct fbp_pubsub_executor_s * executor;
+    struct subscriber_s * subscriber;
+};
+
 struct topic_s {
     struct fbp_union_s value;
     struct topic_s * parent;
+    struct topic_s * index_next;  // used by the topic index bucket chain
+    uint32_t hash;                // FNV-1a of the full topic string
+    char * path;                  // full topic string, only for topics with handles
+    bool owned;                   // top-level topic is in the instance prefix, cached at creation
     const char * meta;
+    struct fbp_pubsub_meta_validator_s * validator;  // compiled meta
+    struct dispatch_s * dispatch;  // PUB subscribers for this topic and its ancestors
+    uint32_t dispatch_count;
+    uint32_t dispatch_alloc;
+    bool dispatch_valid;
+    uint8_t dirty;                // dirty_e, changes since the last snapshot
+    bool restored;                // value from a snapshot, do not replace with the meta default
+    bool conflate;                // pending publishes replace the value in place
+    bool conflate_pending;        // OP_CONFLATE message is queued
+    struct fbp_union_s conflate_value;
+    fbp_pubsub_subscribe_fn conflate_src_fn;
+    void * conflate_src_user_data;
+    struct profile_s profile;     // dispatch to all subscribers, only updated with stats enabled
+    struct history_s * history;   // fbp_pubsub_topic_history() or NULL
     struct fbp_list_s item;  // used by parent->children list
     struct fbp_list_s children;
     struct fbp_list_s subscribers;
-    char name[FBP_PUBSUB_TOPIC_LENGTH_PER_LEVEL];
+    const char * name;            // interned subtopic name for this level
+};
+
+/// A topic value history ring, with the columns following in the same allocation.
+struct history_s {
+    int64_t * time;                   // record times from fbp_time_utc()
+    union fbp_union_inner_u * value;  // record values
+    uint32_t size;                    // capacity in records
+    uint32_t head;                    // next record to write
+    uint32_t count;
+    uint8_t type;                     // fbp_union_e for all records
+};
+
+/// An interned subtopic name, shared by all topics with this name.
+struct intern_s {
+    struct intern_s * next;       // used by the intern index bucket chain
+    uint32_t hash;                // FNV-1a of str
+    char str[];
+};
+
+/// A topic string buffer for messages that do not resolve to a topic.
+union name_u {
+    union name_u * next;          // used by the free list
+    char str[FBP_PUBSUB_TOPIC_LENGTH_MAX];
 };
 
 struct message_s {
-    char name[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    struct topic_s * topic;      // resolved topic, name unused
+    char * name;                 // name_alloc() topic string when topic is NULL
     struct fbp_union_s value;
     fbp_pubsub_subscribe_fn src_fn;
     void * src_user_data;
-    struct fbp_list_s item;
+    uint8_t * mrb;               // mrb reservation to pop once processed, or NULL
+    uint32_t mrb_size;
+    bool counted;                // included in stats_push_count
+    struct fbp_pubsub_executor_s * executor;  // OP_SUBSCRIBE executor or NULL
+    void * volatile next;        // used by the pending queue
+};
+
+enum walk_op_e {
+    WALK_RETAIN,    // replay retained values to a new subscriber
+    WALK_QUERY,     // respond to a query request
+};
+
+/// A resumable topic subtree traversal, run by fbp_pubsub_process().
+struct walk_s {
+    struct walk_s * next;
+    uint8_t op;                          // walk_op_e
+    struct topic_s * root;
+    struct topic_s * topic;              // next topic to visit, NULL when done
+    const struct pattern_s * pattern;    // WALK_RETAIN subscriber pattern or NULL
+    fbp_pubsub_subscribe_fn cbk_fn;      // WALK_RETAIN subscriber, NULL when cancelled
+    void * cbk_user_data;
+    struct fbp_pubsub_executor_s * executor;  // WALK_RETAIN subscriber executor or NULL
+    const struct subscriber_s * subscriber;   // WALK_RETAIN subscriber, compared by pointer only
+};
+
+/// A message queued for an executor subscriber.
+struct exec_msg_s {
+    fbp_pubsub_subscribe_fn cbk_fn;      // NULL when cancelled
+    void * cbk_user_data;
+    const struct subscriber_s * subscriber;  // the queuing subscriber, compared by pointer only
+    struct fbp_union_s value;
+    uint8_t * payload;                   // copy of non-CONST, non-REF pointer values
+    uint32_t payload_alloc;
+    char topic[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+};
+
+struct fbp_pubsub_executor_s {
+    fbp_os_mutex_t mutex;
+    uint8_t overflow;                    // fbp_pubsub_overflow_e
+    fbp_pubsub_on_publish_fn on_enqueue_fn;
+    void * on_enqueue_user_data;
+    uint32_t drop_count;
+    bool stalled;                        // BLOCK timed out, drop until the worker dequeues
+    uint32_t head;
+    uint32_t count;
+    uint32_t size;
+    struct exec_msg_s current;           // the message being delivered, worker only
+    struct exec_msg_s queue[];           // MUST BE LAST
+};
+
+/// The snapshot image header, in native byte order.
+struct snapshot_hdr_s {
+    uint32_t magic;          // SNAPSHOT_MAGIC
+    uint16_t version;        // SNAPSHOT_VERSION
+    uint16_t rsv;
+    uint32_t size;           // total image size in bytes, including this header
+    uint32_t count;          // number of records
+    uint32_t crc32;          // fbp_crc32() of the records that follow this header
+    uint32_t rsv2;
+};
+
+/**
+ * @brief A snapshot record, in native byte order.
+ *
+ * The null-terminated topic follows, then the payload for pointer types.
+ * A topic ending with FBP_PUBSUB_CHAR_METADATA holds JSON metadata.
+ * Each record is padded to SNAPSHOT_ALIGN bytes.
+ */
+struct snapshot_rec_s {
+    uint8_t type;            // fbp_union_e, FBP_UNION_NULL clears the retained value
+    uint8_t flags;
+    uint8_t op;
+    uint8_t app;
+    uint16_t topic_size;     // including the null terminator
+    uint16_t rsv;
+    uint32_t size;           // payload size for pointer types
+    uint32_t rsv2;
+    union fbp_union_inner_u value;  // for non-pointer types
+};
+
+/// The header that precedes each fbp_pubsub_buf_alloc() buffer.
+struct buf_hdr_s {
+    uint32_t magic;
+    volatile uint32_t ref_count;
+};
+
+struct msg_cache_cell_s {
+    volatile uint32_t seq;
+    struct message_s * msg;
 };
 
 struct fbp_pubsub_s {
     struct fbp_topic_list_s topic_prefix;               // The top-level topic names for this instance
     struct fbp_topic_list_s topic_list;                 // The known top-level topic names
+    const char * prefix[FBP_TOPIC_LIST_LENGTH_MAX / 2]; // interned topic_prefix names
+    uint32_t prefix_count;
     fbp_pubsub_on_publish_fn cbk_fn;
     void * cbk_user_data;
     fbp_os_mutex_t mutex;
     int8_t depth;                                      // The single-threaded reentrant depth
     int8_t return_code;                                // 0=error only, 1=always
     struct topic_s * root_topic;
+    struct topic_s ** topic_index;                      // full topic string hash to topic_s
+    uint32_t topic_index_size;                          // power of 2
+    uint32_t topic_index_count;
+    struct intern_s ** intern_index;                    // interned subtopic names
+    uint32_t intern_index_size;                         // power of 2
+    uint32_t intern_index_count;
+    uint32_t conflate_count;                            // topics with conflate enabled
+    struct walk_s * walk_head;                          // pending traversals, consumer only
+    struct walk_s * walk_tail;
     struct fbp_list_s subscriber_free;
-    struct fbp_list_s msg_pend;
-    struct fbp_list_s msg_free;
+
+    // profiling, see fbp_pubsub_stats_get()
+    volatile uint8_t stats_enable;
+    volatile uint32_t stats_push_count;                 // counted messages pushed, producers
+    uint32_t stats_pop_count;                           // counted messages popped, consumer
+    struct fbp_pubsub_stats_s stats;
+
+    // optional fixed node pools, allocated once by fbp_pubsub_initialize_config()
+    struct topic_s * topic_pool;                        // NULL to allocate topics from the heap
+    uint32_t topic_pool_size;
+    uint32_t topic_pool_next;                           // topics persist until fbp_pubsub_finalize()
+    struct subscriber_s * subscriber_pool;              // NULL to allocate subscribers from the heap
+    uint32_t subscriber_pool_size;
+    uint32_t subscriber_pool_next;                      // first never-used subscriber_pool entry
+    uint8_t * intern_pool;                              // NULL to allocate interned names from the heap
+    uint32_t intern_pool_size;                          // entries of INTERN_POOL_ENTRY_SIZE
+    uint32_t intern_pool_next;                          // interned names persist until fbp_pubsub_finalize()
+    char * path_pool;                                   // one path per topic_pool entry
+    struct walk_s * walk_pool;                          // WALK_POOL_SIZE traversals
+    struct walk_s * walk_free;                          // free walk_pool entries
+
+    // lock-free intrusive MPSC queue: any thread pushes, fbp_pubsub_process() pops
+    void * volatile msg_pend_head;                      // producers
+    struct message_s * msg_pend_tail;                   // consumer
+    struct message_s msg_pend_stub;
+
+    // lock-free bounded MPMC ring of free messages, overflow to msg_free under lock
+    volatile uint32_t msg_cache_enq;
+    volatile uint32_t msg_cache_deq;
+    struct msg_cache_cell_s msg_cache[FBP_CONFIG_PUBSUB_MSG_CACHE_SIZE];
+    struct message_s * msg_free_list;
+    union name_u * name_free_list;
 
     struct fbp_rbm_s mrb;                               // for mutable message payloads
     uint8_t buffer[];                                   // MUST BE LAST
@@ -74,8 +304,10 @@ struct fbp_pubsub_s {
 
 const char RESERVED_SUFFIX[] = "/?#$'\"\\`&@%";
 
-static uint8_t publish(struct topic_s * topic, struct message_s * msg);
+static uint8_t publish(struct fbp_pubsub_s * self, struct topic_s * topic, const char * topic_str, struct message_s * msg);
 static void publish_normal(struct fbp_pubsub_s * self, struct message_s * msg);
+static void topic_path_set(struct fbp_pubsub_s * self, struct topic_s * t);
+static void walk_free(struct fbp_pubsub_s * self, struct walk_s * w);
 
 static inline void lock(struct fbp_pubsub_s * self) {
     if (self->mutex) {
@@ -89,43 +321,356 @@ static inline void unlock(struct fbp_pubsub_s * self) {
     }
 }
 
+#if defined(_MSC_VER)
+// x86 volatile accesses have acquire / release semantics
+static inline void * atomic_load_ptr(void * volatile * ptr) {
+    void * rv = *ptr;
+    _ReadWriteBarrier();
+    return rv;
+}
+
+static inline void atomic_store_ptr(void * volatile * ptr, void * value) {
+    _ReadWriteBarrier();
+    *ptr = value;
+}
+
+static inline void * atomic_xchg_ptr(void * volatile * ptr, void * value) {
+    return _InterlockedExchangePointer(ptr, value);
+}
+
+static inline uint32_t atomic_load_u32(volatile uint32_t * ptr) {
+    uint32_t rv = *ptr;
+    _ReadWriteBarrier();
+    return rv;
+}
+
+static inline void atomic_store_u32(volatile uint32_t * ptr, uint32_t value) {
+    _ReadWriteBarrier();
+    *ptr = value;
+}
+
+static inline bool atomic_cas_u32(volatile uint32_t * ptr, uint32_t expected, uint32_t value) {
+    return ((long) expected) == _InterlockedCompareExchange((volatile long *) ptr, (long) value, (long) expected);
+}
+
+static inline uint32_t atomic_add_u32(volatile uint32_t * ptr, uint32_t value) {
+    return (uint32_t) _InterlockedExchangeAdd((volatile long *) ptr, (long) value) + value;
+}
+#else
+static inline void * atomic_load_ptr(void * volatile * ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_ptr(void * volatile * ptr, void * value) {
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline void * atomic_xchg_ptr(void * volatile * ptr, void * value) {
+    return __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t atomic_load_u32(volatile uint32_t * ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_u32(volatile uint32_t * ptr, uint32_t value) {
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline bool atomic_cas_u32(volatile uint32_t * ptr, uint32_t expected, uint32_t value) {
+    return __atomic_compare_exchange_n(ptr, &expected, value, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t atomic_add_u32(volatile uint32_t * ptr, uint32_t value) {
+    return __atomic_add_fetch(ptr, value, __ATOMIC_ACQ_REL);
+}
+#endif
+
+/**
+ * @brief Add a message to the free message cache.
+ *
+ * @param self The instance.
+ * @param msg The message to cache.
+ * @return true if cached, false if the cache is full.
+ *
+ * This is the bounded MPMC queue by Dmitry Vyukov.  Each cell sequence
+ * number tells enqueue and dequeue which lap of the ring owns the cell.
+ */
+static bool msg_cache_push(struct fbp_pubsub_s * self, struct message_s * msg) {
+    struct msg_cache_cell_s * cell;
+    uint32_t pos = atomic_load_u32(&self->msg_cache_enq);
+    while (1) {
+        cell = &self->msg_cache[pos & MSG_CACHE_MASK];
+        int32_t diff = (int32_t) (atomic_load_u32(&cell->seq) - pos);
+        if (diff == 0) {
+            if (atomic_cas_u32(&self->msg_cache_enq, pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;  // full
+        }
+        pos = atomic_load_u32(&self->msg_cache_enq);
+    }
+    cell->msg = msg;
+    atomic_store_u32(&cell->seq, pos + 1);
+    return true;
+}
+
+static struct message_s * msg_cache_pop(struct fbp_pubsub_s * self) {
+    struct msg_cache_cell_s * cell;
+    uint32_t pos = atomic_load_u32(&self->msg_cache_deq);
+    while (1) {
+        cell = &self->msg_cache[pos & MSG_CACHE_MASK];
+        int32_t diff = (int32_t) (atomic_load_u32(&cell->seq) - (pos + 1));
+        if (diff == 0) {
+            if (atomic_cas_u32(&self->msg_cache_deq, pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL;  // empty
+        }
+        pos = atomic_load_u32(&self->msg_cache_deq);
+    }
+    struct message_s * msg = cell->msg;
+    atomic_store_u32(&cell->seq, pos + FBP_CONFIG_PUBSUB_MSG_CACHE_SIZE);
+    return msg;
+}
+
+/**
+ * @brief Add a message to the pending queue.
+ *
+ * @param self The instance.
+ * @param msg The message to add.
+ *
+ * This is the intrusive MPSC queue by Dmitry Vyukov.  Producers only
+ * contend on a single atomic exchange.  Between the exchange and the
+ * link store, the consumer cannot see this message or any that follow.
+ */
+static void msg_link(struct fbp_pubsub_s * self, struct message_s * msg) {
+    msg->next = NULL;
+    struct message_s * prev = atomic_xchg_ptr(&self->msg_pend_head, msg);
+    atomic_store_ptr(&prev->next, msg);
+}
+
+static void msg_push(struct fbp_pubsub_s * self, struct message_s * msg) {
+    msg->counted = self->stats_enable;
+    if (msg->counted) {
+        atomic_add_u32(&self->stats_push_count, 1);  // before visible to the consumer
+    }
+    msg_link(self, msg);
+}
+
+static void msg_stats_update(struct fbp_pubsub_s * self) {
+    // depth includes this message, so the maximum is exact
+    uint32_t depth = atomic_load_u32(&self->stats_push_count) - self->stats_pop_count;
+    ++self->stats_pop_count;
+    if (depth > self->stats.queue_depth_max) {
+        self->stats.queue_depth_max = depth;
+    }
+    ++self->stats.msg_count;
+}
+
+static void mrb_stats_update(struct fbp_pubsub_s * self) {
+    if (self->stats_enable) {
+        uint32_t head = self->mrb.head;
+        uint32_t tail = self->mrb.tail;
+        uint32_t used = (head >= tail) ? (head - tail) : (self->mrb.buf_size - tail + head);
+        if (used > self->stats.mrb_used_max) {
+            self->stats.mrb_used_max = used;
+        }
+    }
+}
+
+/**
+ * @brief Remove the oldest message from the pending queue.
+ *
+ * @param self The instance.
+ * @return The message or NULL if no message is available.
+ *
+ * Only call from the single consumer, fbp_pubsub_process().  This function
+ * may return NULL while a producer is in the middle of msg_push(). That
+ * producer calls the on_publish callback once its push completes.
+ */
+static struct message_s * msg_pop(struct fbp_pubsub_s * self) {
+    struct message_s * stub = &self->msg_pend_stub;
+    struct message_s * tail = self->msg_pend_tail;
+    struct message_s * next = atomic_load_ptr(&tail->next);
+    if (tail == stub) {
+        if (!next) {
+            return NULL;
+        }
+        self->msg_pend_tail = next;
+        tail = next;
+        next = atomic_load_ptr(&next->next);
+    }
+    if (next) {
+        self->msg_pend_tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_ptr(&self->msg_pend_head)) {
+        return NULL;  // producer push in progress
+    }
+    msg_link(self, stub);
+    next = atomic_load_ptr(&tail->next);
+    if (next) {
+        self->msg_pend_tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
 static struct message_s * msg_alloc(struct fbp_pubsub_s * self) {
-    struct message_s * msg;
-    lock(self);
-    if (fbp_list_is_empty(&self->msg_free)) {
+    struct message_s * msg = msg_cache_pop(self);
+    if (!msg) {
+        lock(self);
+        msg = self->msg_free_list;
+        if (msg) {
+            self->msg_free_list = msg->next;
+        }
+        unlock(self);
+    }
+    if (!msg) {
         msg = fbp_alloc(sizeof(struct message_s));
-    } else {
-        struct fbp_list_s * item = fbp_list_remove_head(&self->msg_free);
-        msg = FBP_CONTAINER_OF(item, struct message_s, item);
     }
-    fbp_list_initialize(&msg->item);
-    msg->name[0] = 0;
+    msg->next = NULL;
+    msg->mrb = NULL;
+    msg->mrb_size = 0;
+    msg->name = NULL;
+    msg->topic = NULL;
     msg->value.op = OP_PUBLISH;
     msg->value.type = FBP_UNION_NULL;
     msg->value.size = 0;
     msg->src_fn = NULL;
     msg->src_user_data = NULL;
-    unlock(self);
+    msg->executor = NULL;
     return msg;
 }
 
-static void msg_free(struct fbp_pubsub_s * self, struct message_s * msg) {
+/*
+ * Only subscribe, metadata, query, and return code messages and
+ * publishes that cannot resolve their topic carry the topic string.
+ */
+static char * name_alloc(struct fbp_pubsub_s * self) {
+    lock(self);
+    union name_u * n = self->name_free_list;
+    if (n) {
+        self->name_free_list = n->next;
+    }
+    unlock(self);
+    if (!n) {
+        n = fbp_alloc(sizeof(union name_u));
+    }
+    n->str[0] = 0;
+    return n->str;
+}
+
+static void name_free(struct fbp_pubsub_s * self, char * name) {
+    union name_u * n = (union name_u *) name;
     lock(self);
-    fbp_list_add_tail(&self->msg_free, &msg->item);
+    n->next = self->name_free_list;
+    self->name_free_list = n;
     unlock(self);
 }
 
+static void msg_free(struct fbp_pubsub_s * self, struct message_s * msg) {
+    if (msg->name) {
+        name_free(self, msg->name);
+        msg->name = NULL;
+    }
+    if (!msg_cache_push(self, msg)) {
+        lock(self);
+        msg->next = self->msg_free_list;
+        self->msg_free_list = msg;
+        unlock(self);
+    }
+}
+
+static bool is_ptr_type(uint8_t type) {
+    switch (type) {
+        case FBP_UNION_STR:   // intentional fall-through
+        case FBP_UNION_JSON:  // intentional fall-through
+        case FBP_UNION_BIN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_str_type(uint8_t type) {
+    switch (type) {
+        case FBP_UNION_STR:   // intentional fall-through
+        case FBP_UNION_JSON:  // intentional fall-through
+            return true;
+        default:
+            return false;
+    }
+}
+
+static struct buf_hdr_s * buf_hdr(const void * buf) {
+    struct buf_hdr_s * hdr = ((struct buf_hdr_s *) buf) - 1;
+    if (hdr->magic != BUF_MAGIC) {
+        FBP_FATAL("invalid pubsub buffer");
+    }
+    return hdr;
+}
+
+uint8_t * fbp_pubsub_buf_alloc(uint32_t size) {
+    struct buf_hdr_s * hdr = fbp_alloc(sizeof(struct buf_hdr_s) + size);
+    hdr->magic = BUF_MAGIC;
+    hdr->ref_count = 1;
+    return (uint8_t *) (hdr + 1);
+}
+
+void fbp_pubsub_buf_incr(const void * buf) {
+    atomic_add_u32(&buf_hdr(buf)->ref_count, 1);
+}
+
+void fbp_pubsub_buf_decr(const void * buf) {
+    struct buf_hdr_s * hdr = buf_hdr(buf);
+    if (0 == atomic_add_u32(&hdr->ref_count, (uint32_t) -1)) {
+        hdr->magic = 0;
+        fbp_free(hdr);
+    }
+}
+
+static inline bool is_ref(const struct fbp_union_s * value) {
+    return is_ptr_type(value->type) && (value->flags & FBP_UNION_FLAG_REF);
+}
+
+static void msg_value_free(struct fbp_pubsub_s * self, struct message_s * msg, const struct fbp_union_s * value) {
+    if (is_ref(value)) {
+        fbp_pubsub_buf_decr(value->value.bin);
+    }
+    if (msg->mrb) {
+        uint32_t sz = 0;
+        lock(self);
+        uint8_t * buf = fbp_rbm_pop(&self->mrb, &sz);
+        unlock(self);
+        if ((buf != msg->mrb) || (sz != msg->mrb_size)) {
+            FBP_LOGE("internal msgbuf sync error");
+        }
+    }
+}
+
 static struct subscriber_s * subscriber_alloc(struct fbp_pubsub_s * self) {
     struct subscriber_s * sub;
     if (!fbp_list_is_empty(&self->subscriber_free)) {
         struct fbp_list_s * item;
         item = fbp_list_remove_head(&self->subscriber_free);
         sub = FBP_CONTAINER_OF(item, struct subscriber_s, item);
+    } else if (self->subscriber_pool) {
+        if (self->subscriber_pool_next >= self->subscriber_pool_size) {
+            FBP_LOGW("subscriber pool exhausted: %u", (unsigned int) self->subscriber_pool_size);
+            return NULL;
+        }
+        sub = &self->subscriber_pool[self->subscriber_pool_next++];
     } else {
         sub = fbp_alloc_clr(sizeof(struct subscriber_s));
         FBP_LOGD3("subscriber alloc: %p", (void *) sub);
     }
     fbp_list_initialize(&sub->item);
+    sub->pattern = NULL;
+    sub->executor = NULL;
     sub->flags = 0;
     sub->cbk_fn = NULL;
     sub->cbk_user_data = NULL;
@@ -133,74 +678,266 @@ static struct subscriber_s * subscriber_alloc(struct fbp_pubsub_s * self) {
 }
 
 static void subscriber_free(struct fbp_pubsub_s * self, struct subscriber_s * sub) {
+    sub->flags = 0;  // prevent dispatch from a stale cache
+    sub->cbk_fn = NULL;
+    if (sub->pattern) {
+        fbp_free(sub->pattern);
+        sub->pattern = NULL;
+    }
     fbp_list_add_tail(&self->subscriber_free, &sub->item);
 }
 
-static bool is_reserved_char(char ch) {
-    for (const char * p = RESERVED_SUFFIX; *p; ++p) {
-        if (ch == *p) {
-            return true;
-        }
+static inline void executor_lock(struct fbp_pubsub_executor_s * ex) {
+    if (ex->mutex) {
+        fbp_os_mutex_lock(ex->mutex);
     }
-    return false;
 }
 
-static bool topic_name_set(struct topic_s * topic, const char * name) {
-    const char * name_orig = name;
-    (void) name_orig;  // when logging is off
-    for (int i = 0; i < FBP_PUBSUB_TOPIC_LENGTH_PER_LEVEL; ++i) {
-        if (*name) {
-            topic->name[i] = *name++;
-        } else {
-            topic->name[i] = 0;
-            return true;
+static inline void executor_unlock(struct fbp_pubsub_executor_s * ex) {
+    if (ex->mutex) {
+        fbp_os_mutex_unlock(ex->mutex);
+    }
+}
+
+static inline void executor_notify(struct fbp_pubsub_executor_s * ex) {
+    if (ex->on_enqueue_fn) {
+        ex->on_enqueue_fn(ex->on_enqueue_user_data);
+    }
+}
+
+static void exec_msg_clear(struct exec_msg_s * m) {
+    if (is_ref(&m->value)) {
+        fbp_pubsub_buf_decr(m->value.value.bin);
+    }
+    m->value = fbp_union_null();
+    m->cbk_fn = NULL;
+    m->cbk_user_data = NULL;
+    m->subscriber = NULL;
+}
+
+static void exec_msg_set(struct exec_msg_s * m, const char * topic, const struct fbp_union_s * value) {
+    fbp_cstr_copy(m->topic, topic, sizeof(m->topic));
+    m->value = *value;
+    if (is_ref(value)) {
+        fbp_pubsub_buf_incr(value->value.bin);
+    } else if (is_ptr_type(value->type) && !(value->flags & FBP_UNION_FLAG_CONST) && value->size) {
+        // the message buffer is released once fbp_pubsub_process() finishes this message
+        if (m->payload_alloc < value->size) {
+            if (m->payload) {
+                fbp_free(m->payload);
+            }
+            m->payload = fbp_alloc(value->size);
+            m->payload_alloc = value->size;
         }
+        fbp_memcpy(m->payload, value->value.bin, value->size);
+        m->value.value.bin = m->payload;
     }
-    FBP_LOGW("topic name truncated: %s", name_orig);
-    topic->name[FBP_PUBSUB_TOPIC_LENGTH_PER_LEVEL - 1] = 0;
-    return false;
 }
 
-static bool topic_str_copy(char * topic_str, const char * src, size_t * str_len) {
-    size_t sz = 0;
-    while (src[sz]) {
-        if (sz >= FBP_PUBSUB_TOPIC_LENGTH_MAX) {
-            topic_str[FBP_PUBSUB_TOPIC_LENGTH_MAX - 1] = 0;  // truncate
-            FBP_LOGW("topic too long: %s", src);
-            if (str_len) {
-                *str_len = FBP_PUBSUB_TOPIC_LENGTH_MAX;
+/**
+ * @brief Queue a subscriber callback for an executor.
+ *
+ * @param ex The executor.
+ * @param subscriber The subscriber, which identifies its queued messages.
+ * @param cbk_fn The subscriber callback.
+ * @param cbk_user_data The arbitrary data for cbk_fn.
+ * @param topic The topic string.
+ * @param value The value, which is copied or referenced as needed.
+ *
+ * Called from fbp_pubsub_process() without the instance lock, so
+ * FBP_PUBSUB_OVERFLOW_BLOCK can wait for the worker.
+ */
+static void executor_push(struct fbp_pubsub_executor_s * ex, const struct subscriber_s * subscriber,
+        fbp_pubsub_subscribe_fn cbk_fn, void * cbk_user_data, const char * topic, const struct fbp_union_s * value) {
+    struct exec_msg_s * m = NULL;
+    executor_lock(ex);
+    if (ex->overflow == FBP_PUBSUB_OVERFLOW_CONFLATE) {
+        for (uint32_t i = 0; i < ex->count; ++i) {
+            struct exec_msg_s * c = &ex->queue[(ex->head + i) % ex->size];
+            if ((c->subscriber == subscriber) && c->cbk_fn && (0 == strcmp(c->topic, topic))) {
+                exec_msg_clear(c);  // replace in place to keep the original order
+                ++ex->drop_count;
+                m = c;
+                break;
             }
-            return false;
         }
-        topic_str[sz] = src[sz];
-        ++sz;
     }
-    topic_str[sz] = 0;
-    if (str_len) {
-        *str_len = sz;
+    uint32_t wait_ms = 0;
+    while (!m && (ex->count >= ex->size)) {
+        if ((ex->overflow == FBP_PUBSUB_OVERFLOW_BLOCK) && !ex->stalled
+                && (wait_ms++ < FBP_CONFIG_PUBSUB_EXECUTOR_BLOCK_TIMEOUT_MS)) {
+            executor_unlock(ex);
+            executor_notify(ex);
+            fbp_os_sleep(FBP_TIME_MILLISECOND);
+            executor_lock(ex);
+        } else {
+            if ((ex->overflow == FBP_PUBSUB_OVERFLOW_BLOCK) && !ex->stalled) {
+                FBP_LOGW("executor stalled, dropping until the worker runs");
+                ex->stalled = true;
+            }
+            exec_msg_clear(&ex->queue[ex->head]);
+            ex->head = (ex->head + 1) % ex->size;
+            --ex->count;
+            ++ex->drop_count;
+        }
     }
-    return true;
+    if (!m) {
+        m = &ex->queue[(ex->head + ex->count) % ex->size];
+        ++ex->count;
+    }
+    m->cbk_fn = cbk_fn;
+    m->cbk_user_data = cbk_user_data;
+    m->subscriber = subscriber;
+    exec_msg_set(m, topic, value);
+    executor_unlock(ex);
+    executor_notify(ex);
 }
 
-static void topic_str_append(char * topic_str, const char * topic_sub_str) {
-    // WARNING: topic_str must be >= TOPIC_LENGTH_MAX
-    // topic_sub_str <= TOPIC_LENGTH_PER_LEVEL
-    size_t topic_len = 0;
-    char * t = topic_str;
-
-    // find the end of topic_str
-    while (*t) {
-        ++topic_len;
-        ++t;
-    }
-    if (topic_len >= (FBP_PUBSUB_TOPIC_LENGTH_MAX - 1)) {
+/// Discard the queued messages for one subscriber, before it is freed.
+static void executor_cancel(struct fbp_pubsub_executor_s * ex, const struct subscriber_s * subscriber) {
+    if (!ex) {
         return;
     }
-
-    // add separator
-    if (topic_len) {
-        *t++ = '/';
-        ++topic_len;
+    executor_lock(ex);
+    for (uint32_t i = 0; i < ex->count; ++i) {
+        struct exec_msg_s * m = &ex->queue[(ex->head + i) % ex->size];
+        if (m->cbk_fn && (m->subscriber == subscriber)) {
+            exec_msg_clear(m);
+        }
+    }
+    executor_unlock(ex);
+}
+
+struct fbp_pubsub_executor_s * fbp_pubsub_executor_alloc(const struct fbp_pubsub_executor_config_s * config) {
+    if (!config || !config->queue_size || (config->overflow > FBP_PUBSUB_OVERFLOW_CONFLATE)) {
+        return NULL;
+    }
+    struct fbp_pubsub_executor_s * ex = fbp_alloc_clr(sizeof(struct fbp_pubsub_executor_s)
+            + config->queue_size * sizeof(struct exec_msg_s));
+    ex->mutex = config->mutex;
+    ex->overflow = config->overflow;
+    ex->on_enqueue_fn = config->on_enqueue_fn;
+    ex->on_enqueue_user_data = config->on_enqueue_user_data;
+    ex->size = config->queue_size;
+    return ex;
+}
+
+void fbp_pubsub_executor_free(struct fbp_pubsub_executor_s * executor) {
+    if (!executor) {
+        return;
+    }
+    for (uint32_t i = 0; i < executor->size; ++i) {
+        struct exec_msg_s * m = &executor->queue[i];
+        if (i < executor->count) {
+            exec_msg_clear(&executor->queue[(executor->head + i) % executor->size]);
+        }
+        if (m->payload) {
+            fbp_free(m->payload);
+        }
+    }
+    if (executor->current.payload) {
+        fbp_free(executor->current.payload);
+    }
+    fbp_free(executor);
+}
+
+uint32_t fbp_pubsub_executor_process(struct fbp_pubsub_executor_s * executor, uint32_t max_messages) {
+    struct exec_msg_s * m = &executor->current;
+    uint32_t count = 0;
+    while (!max_messages || (count < max_messages)) {
+        executor_lock(executor);
+        if (!executor->count) {
+            executor_unlock(executor);
+            break;
+        }
+        // swap so that both entries keep their payload buffers
+        struct exec_msg_s tmp = *m;
+        *m = executor->queue[executor->head];
+        executor->queue[executor->head] = tmp;
+        executor->head = (executor->head + 1) % executor->size;
+        --executor->count;
+        executor->stalled = false;
+        executor_unlock(executor);
+        if (m->cbk_fn) {
+            m->cbk_fn(m->cbk_user_data, m->topic, &m->value);
+            ++count;
+        }
+        exec_msg_clear(m);
+    }
+    return count;
+}
+
+uint32_t fbp_pubsub_executor_drop_count(struct fbp_pubsub_executor_s * executor) {
+    executor_lock(executor);
+    uint32_t count = executor->drop_count;
+    executor_unlock(executor);
+    return count;
+}
+
+static bool is_reserved_char(char ch) {
+    for (const char * p = RESERVED_SUFFIX; *p; ++p) {
+        if (ch == *p) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool topic_str_copy(char * topic_str, const char * src, size_t * str_len) {
+    size_t sz = 0;
+    while (src[sz]) {
+        if (sz >= (FBP_PUBSUB_TOPIC_LENGTH_MAX - 1)) {
+            topic_str[sz] = 0;  // truncate
+            FBP_LOGW("topic too long: %s", src);
+            if (str_len) {
+                *str_len = FBP_PUBSUB_TOPIC_LENGTH_MAX;
+            }
+            return false;
+        }
+        topic_str[sz] = src[sz];
+        ++sz;
+    }
+    topic_str[sz] = 0;
+    if (str_len) {
+        *str_len = sz;
+    }
+    return true;
+}
+
+/**
+ * @brief Copy a topic string into a message.
+ *
+ * @param self The instance.
+ * @param msg The message without a resolved topic.
+ * @param topic The topic string.
+ * @param[out] str_len The topic length, excluding the terminator.  NULL to ignore.
+ * @return True on success, false if the topic is too long.
+ */
+static bool msg_name_set(struct fbp_pubsub_s * self, struct message_s * msg, const char * topic, size_t * str_len) {
+    if (!msg->name) {
+        msg->name = name_alloc(self);
+    }
+    return topic_str_copy(msg->name, topic, str_len);
+}
+
+static void topic_str_append(char * topic_str, const char * topic_sub_str) {
+    // WARNING: topic_str must be >= TOPIC_LENGTH_MAX, result truncated to fit
+    size_t topic_len = 0;
+    char * t = topic_str;
+
+    // find the end of topic_str
+    while (*t) {
+        ++topic_len;
+        ++t;
+    }
+    if (topic_len >= (FBP_PUBSUB_TOPIC_LENGTH_MAX - 1)) {
+        return;
+    }
+
+    // add separator
+    if (topic_len) {
+        *t++ = '/';
+        ++topic_len;
     }
 
     // Copy substring
@@ -230,18 +967,260 @@ static void topic_str_pop(char * topic_str) {
     }
 }
 
+static inline bool topic_pool_full(struct fbp_pubsub_s * self) {
+    return self->topic_pool && (self->topic_pool_next >= self->topic_pool_size);
+}
+
+/**
+ * @brief Allocate a new topic node.
+ *
+ * @param self The PubSub instance.
+ * @param name The interned topic name for this level.
+ * @return The new topic or NULL if the topic pool is exhausted.
+ *
+ * With a topic pool, entries are handed out in creation order, so
+ * topics created together, such as the children of a newly created
+ * parent, are adjacent in memory.
+ */
 static struct topic_s * topic_alloc(struct fbp_pubsub_s * self, const char * name) {
-    (void) self;
-    struct topic_s * topic = fbp_alloc_clr(sizeof(struct topic_s));
+    struct topic_s * topic;
+    if (!self->topic_pool) {
+        topic = fbp_alloc_clr(sizeof(struct topic_s));
+    } else if (topic_pool_full(self)) {
+        FBP_LOGW("topic pool exhausted: %u", (unsigned int) self->topic_pool_size);
+        return NULL;
+    } else {
+        topic = &self->topic_pool[self->topic_pool_next++];
+    }
     topic->value.type = FBP_UNION_NULL;
     fbp_list_initialize(&topic->item);
     fbp_list_initialize(&topic->children);
     fbp_list_initialize(&topic->subscribers);
-    topic_name_set(topic, name);
+    topic->name = name;
     FBP_LOGD3("topic alloc: %p", (void *)topic);
     return topic;
 }
 
+static inline uint32_t fnv1a_char(uint32_t hash, char ch) {
+    return (hash ^ (uint8_t) ch) * FNV1A_PRIME;
+}
+
+static void intern_index_grow(struct fbp_pubsub_s * self) {
+    uint32_t size = self->intern_index_size ? (self->intern_index_size * 2) : TOPIC_INDEX_SIZE_INIT;
+    struct intern_s ** index = fbp_alloc_clr(size * sizeof(struct intern_s *));
+    for (uint32_t i = 0; i < self->intern_index_size; ++i) {
+        struct intern_s * n = self->intern_index[i];
+        while (n) {
+            struct intern_s * n_next = n->next;
+            uint32_t k = n->hash & (size - 1);
+            n->next = index[k];
+            index[k] = n;
+            n = n_next;
+        }
+    }
+    if (self->intern_index) {
+        fbp_free(self->intern_index);
+    }
+    self->intern_index = index;
+    self->intern_index_size = size;
+}
+
+/**
+ * @brief Get the interned subtopic name.
+ *
+ * @param self The PubSub instance.
+ * @param str The subtopic name, which need not be null terminated.
+ * @param len The length of str.
+ * @param create When true, intern str if not yet interned.
+ * @return The interned, null-terminated name or NULL.
+ *
+ * Each distinct subtopic name is stored once and persists until
+ * fbp_pubsub_finalize(), so topics compare names by pointer.
+ * With an intern pool, the index is sized for the whole pool at
+ * initialize and never grows.  The caller must hold the lock.
+ */
+static const char * intern_locked(struct fbp_pubsub_s * self, const char * str, size_t len, bool create) {
+    uint32_t hash = FNV1A_OFFSET;
+    for (size_t i = 0; i < len; ++i) {
+        hash = fnv1a_char(hash, str[i]);
+    }
+    if (self->intern_index) {
+        struct intern_s * n = self->intern_index[hash & (self->intern_index_size - 1)];
+        for (; n; n = n->next) {
+            if ((n->hash == hash) && (0 == strncmp(n->str, str, len)) && !n->str[len]) {
+                return n->str;
+            }
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    struct intern_s * n;
+    if (!self->intern_pool) {
+        if ((self->intern_index_count + 1) > ((self->intern_index_size * 3) / 4)) {
+            intern_index_grow(self);
+        }
+        n = fbp_alloc(sizeof(struct intern_s) + len + 1);
+    } else if (self->intern_pool_next >= self->intern_pool_size) {
+        FBP_LOGW("intern pool exhausted: %u", (unsigned int) self->intern_pool_size);
+        return NULL;
+    } else {
+        n = (struct intern_s *) (self->intern_pool + self->intern_pool_next++ * INTERN_POOL_ENTRY_SIZE);
+    }
+    n->hash = hash;
+    fbp_memcpy(n->str, str, len);
+    n->str[len] = 0;
+    uint32_t k = hash & (self->intern_index_size - 1);
+    n->next = self->intern_index[k];
+    self->intern_index[k] = n;
+    ++self->intern_index_count;
+    return n->str;
+}
+
+/// Lock and intern, since intern_index_grow() frees the bucket array.
+static const char * intern(struct fbp_pubsub_s * self, const char * str, size_t len, bool create) {
+    lock(self);
+    const char * name = intern_locked(self, str, len, create);
+    unlock(self);
+    return name;
+}
+
+static void intern_free(struct fbp_pubsub_s * self) {
+    for (uint32_t i = 0; !self->intern_pool && (i < self->intern_index_size); ++i) {
+        struct intern_s * n = self->intern_index[i];
+        while (n) {
+            struct intern_s * n_next = n->next;
+            fbp_free(n);
+            n = n_next;
+        }
+    }
+    if (self->intern_index) {
+        fbp_free(self->intern_index);
+    }
+    if (self->intern_pool) {
+        fbp_free(self->intern_pool);
+    }
+    self->intern_index = NULL;
+    self->intern_index_size = 0;
+    self->intern_index_count = 0;
+    self->intern_pool = NULL;
+}
+
+static void topic_hash_set(struct topic_s * topic) {
+    struct topic_s * parent = topic->parent;
+    uint32_t hash = FNV1A_OFFSET;
+    if (parent && parent->parent) {
+        hash = fnv1a_char(parent->hash, '/');
+    }
+    for (const char * c = topic->name; *c; ++c) {
+        hash = fnv1a_char(hash, *c);
+    }
+    topic->hash = hash;
+}
+
+/// Get the power of 2 index size that holds count entries without growing.
+static uint32_t index_size(uint32_t count) {
+    uint32_t size = TOPIC_INDEX_SIZE_INIT;
+    while (((size * 3) / 4) < count) {
+        size *= 2;
+    }
+    return size;
+}
+
+static void topic_index_grow(struct fbp_pubsub_s * self) {
+    uint32_t size = self->topic_index_size ? (self->topic_index_size * 2) : TOPIC_INDEX_SIZE_INIT;
+    struct topic_s ** index = fbp_alloc_clr(size * sizeof(struct topic_s *));
+    for (uint32_t i = 0; i < self->topic_index_size; ++i) {
+        struct topic_s * t = self->topic_index[i];
+        while (t) {
+            struct topic_s * t_next = t->index_next;
+            uint32_t k = t->hash & (size - 1);
+            t->index_next = index[k];
+            index[k] = t;
+            t = t_next;
+        }
+    }
+    if (self->topic_index) {
+        fbp_free(self->topic_index);
+    }
+    self->topic_index = index;
+    self->topic_index_size = size;
+}
+
+static void topic_index_add(struct fbp_pubsub_s * self, struct topic_s * topic) {
+    if ((self->topic_index_count + 1) > ((self->topic_index_size * 3) / 4)) {
+        topic_index_grow(self);
+    }
+    uint32_t k = topic->hash & (self->topic_index_size - 1);
+    topic->index_next = self->topic_index[k];
+    self->topic_index[k] = topic;
+    ++self->topic_index_count;
+}
+
+static void topic_index_remove(struct fbp_pubsub_s * self, struct topic_s * topic) {
+    if (!self->topic_index) {
+        return;
+    }
+    struct topic_s ** p = &self->topic_index[topic->hash & (self->topic_index_size - 1)];
+    while (*p) {
+        if (*p == topic) {
+            *p = topic->index_next;
+            topic->index_next = NULL;
+            --self->topic_index_count;
+            return;
+        }
+        p = &(*p)->index_next;
+    }
+}
+
+/**
+ * @brief Check if a topic matches a full topic string.
+ *
+ * @param topic The topic.
+ * @param str The full topic string.
+ * @param len The length of str, excluding the terminator.
+ * @return true if the topic's full name is str, otherwise false.
+ *
+ * This function matches levels from the end without building the
+ * topic's full name.
+ */
+static bool topic_str_match(struct topic_s * topic, const char * str, size_t len) {
+    while (topic->parent) {
+        size_t sz = strlen(topic->name);
+        if ((sz > len) || (0 != memcmp(str + len - sz, topic->name, sz))) {
+            return false;
+        }
+        len -= sz;
+        topic = topic->parent;
+        if (topic->parent) {
+            if (!len || (str[len - 1] != '/')) {
+                return false;
+            }
+            --len;
+        }
+    }
+    return 0 == len;
+}
+
+static struct topic_s * topic_index_find(struct fbp_pubsub_s * self, const char * topic) {
+    if (!self->topic_index) {
+        return NULL;
+    }
+    uint32_t hash = FNV1A_OFFSET;
+    size_t len = 0;
+    while (topic[len]) {
+        hash = fnv1a_char(hash, topic[len++]);
+    }
+    struct topic_s * t = self->topic_index[hash & (self->topic_index_size - 1)];
+    while (t) {
+        if ((t->hash == hash) && topic_str_match(t, topic, len)) {
+            return t;
+        }
+        t = t->index_next;
+    }
+    return NULL;
+}
+
 static void topic_free(struct fbp_pubsub_s * self, struct topic_s * topic) {
     struct fbp_list_s * item;
     struct subscriber_s * subscriber;
@@ -256,68 +1235,288 @@ static void topic_free(struct fbp_pubsub_s * self, struct topic_s * topic) {
         fbp_list_remove(item);
         topic_free(self, subtopic);
     }
+    topic_index_remove(self, topic);
+    if (is_ref(&topic->value)) {
+        fbp_pubsub_buf_decr(topic->value.value.bin);
+    }
+    if (topic->conflate_pending && is_ref(&topic->conflate_value)) {
+        fbp_pubsub_buf_decr(topic->conflate_value.value.bin);
+    }
+    if (topic->path && !self->path_pool) {
+        fbp_free(topic->path);
+    }
+    fbp_pubsub_meta_free(topic->validator);
+    if (topic->dispatch) {
+        fbp_free(topic->dispatch);
+    }
+    if (topic->history) {
+        fbp_free(topic->history);
+    }
     FBP_LOGD3("topic free: %p", (void *)topic);
-    fbp_free(topic);
+    if (!self->topic_pool) {
+        fbp_free(topic);
+    }
+}
+
+static void dispatch_invalidate(struct topic_s * topic) {
+    struct fbp_list_s * item;
+    topic->dispatch_valid = false;
+    fbp_list_foreach(&topic->children, item) {
+        dispatch_invalidate(FBP_CONTAINER_OF(item, struct topic_s, item));
+    }
+}
+
+static bool is_wildcard(const char * level, size_t len) {
+    return (len == 1) && ((level[0] == '+') || (level[0] == '#'));
 }
 
 /**
- * @brief Parse the next subtopic.
- * @param topic[inout] The topic, which is advanced to the next subtopic.
- * @param subtopic[out] The parsed subtopic, which must be
- *      at least FBP_PUBSUB_TOPIC_LENGTH_PER_LEVEL bytes.
- * @return true on success, false on failure.
+ * @brief Check a subscription topic for valid wildcards.
+ *
+ * @param topic The subscription topic.
+ * @return true if '+' and '#' only appear as entire levels and '#' only
+ *      appears as the last level, otherwise false.
  */
-static bool subtopic_get_str(const char ** topic, char * subtopic) {
-    const char * t = *topic;
-    for (int i = 0; i < FBP_PUBSUB_TOPIC_LENGTH_PER_LEVEL; ++i) {
-        if (*t == 0) {
-            *subtopic = 0;
-            *topic = t;
-            return true;
-        } else if (*t == '/') {
-            *subtopic = 0;
-            t++;
-            *topic = t;
-            return true;
+static bool pattern_valid(const char * topic) {
+    const char * c = topic;
+    while (*c) {
+        const char * end = c;
+        while (*end && (*end != '/')) {
+            ++end;
+        }
+        size_t len = (size_t) (end - c);
+        if (!is_wildcard(c, len)) {
+            for (const char * k = c; k < end; ++k) {
+                if ((*k == '+') || (*k == '#')) {
+                    return false;
+                }
+            }
+        } else if ((c[0] == '#') && *end) {
+            return false;
+        }
+        c = *end ? (end + 1) : end;
+    }
+    return true;
+}
+
+/**
+ * @brief Compile a subscription topic.
+ *
+ * @param self The PubSub instance.
+ * @param topic_str[inout] The subscription topic from pattern_valid(),
+ *      which is truncated to the topic that holds the subscriber:
+ *      the levels before the first wildcard.
+ * @param create When true, intern new level names.  When false, levels
+ *      that are not interned are NULL, which never match.
+ * @return The compiled pattern or NULL when the subscription matches the
+ *      entire subtree.  A trailing '#' matches the entire subtree.
+ */
+static struct pattern_s * pattern_compile(struct fbp_pubsub_s * self, char * topic_str, bool create) {
+    char * anchor_end = NULL;
+    char * anchor_next = NULL;
+    uint32_t count = 0;
+    char * c = topic_str;
+    while (*c) {
+        char * end = c;
+        while (*end && (*end != '/')) {
+            ++end;
+        }
+        if (!anchor_end && is_wildcard(c, (size_t) (end - c))) {
+            anchor_end = (c == topic_str) ? c : (c - 1);
+            anchor_next = c;
+        }
+        if (anchor_end) {
+            ++count;
+        }
+        c = *end ? (end + 1) : end;
+    }
+    if (!anchor_end) {
+        return NULL;
+    } else if ((count == 1) && (anchor_next[0] == '#')) {
+        *anchor_end = 0;  // only a trailing '#'
+        return NULL;
+    }
+
+    struct pattern_s * p = fbp_alloc(sizeof(struct pattern_s) + count * sizeof(const char *));
+    p->count = 0;
+    c = anchor_next;
+    while (*c) {
+        char * end = c;
+        while (*end && (*end != '/')) {
+            ++end;
+        }
+        size_t len = (size_t) (end - c);
+        if (is_wildcard(c, len)) {
+            p->level[p->count++] = (c[0] == '+') ? PATTERN_ONE : PATTERN_ALL;
         } else {
-            *subtopic++ = *t++;
+            p->level[p->count++] = intern(self, c, len, create);
+        }
+        c = *end ? (end + 1) : end;
+    }
+    *anchor_end = 0;
+    return p;
+}
+
+static bool pattern_eq(const struct pattern_s * a, const struct pattern_s * b) {
+    if (!a || !b) {
+        return a == b;
+    }
+    if (a->count != b->count) {
+        return false;
+    }
+    for (uint32_t i = 0; i < a->count; ++i) {
+        if (a->level[i] != b->level[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Check if a topic matches a pattern.
+ *
+ * @param p The compiled pattern or NULL to match the entire subtree.
+ * @param anchor The topic that holds the subscriber.
+ * @param topic The topic, which must be anchor or one of its descendants.
+ * @return true on match, otherwise false.
+ */
+static bool pattern_match(const struct pattern_s * p, struct topic_s * anchor, struct topic_s * topic) {
+    const char * levels[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    uint32_t n = 0;
+    if (!p) {
+        return true;
+    }
+    for (struct topic_s * t = topic; t != anchor; t = t->parent) {
+        if (!t || (n >= FBP_PUBSUB_TOPIC_LENGTH_MAX)) {
+            return false;
+        }
+        levels[n++] = t->name;  // reversed
+    }
+    for (uint32_t i = 0; i < p->count; ++i) {
+        if (p->level[i] == PATTERN_ALL) {
+            return true;  // always the last level
+        } else if (!n) {
+            return false;
+        }
+        --n;
+        if ((p->level[i] != PATTERN_ONE) && (p->level[i] != levels[n])) {
+            return false;
+        }
+    }
+    return 0 == n;
+}
+
+static void dispatch_build(struct topic_s * topic) {
+    struct fbp_list_s * item;
+    struct subscriber_s * subscriber;
+    uint32_t count = 0;
+    for (struct topic_s * t = topic; t; t = t->parent) {
+        fbp_list_foreach(&t->subscribers, item) {
+            subscriber = FBP_CONTAINER_OF(item, struct subscriber_s, item);
+            if ((subscriber->flags & FBP_PUBSUB_SFLAG_PUB) && pattern_match(subscriber->pattern, t, topic)) {
+                ++count;
+            }
+        }
+    }
+    if (count > topic->dispatch_alloc) {
+        if (topic->dispatch) {
+            fbp_free(topic->dispatch);
+        }
+        topic->dispatch = fbp_alloc(count * sizeof(struct dispatch_s));
+        topic->dispatch_alloc = count;
+    }
+    count = 0;
+    for (struct topic_s * t = topic; t; t = t->parent) {
+        fbp_list_foreach(&t->subscribers, item) {
+            subscriber = FBP_CONTAINER_OF(item, struct subscriber_s, item);
+            if ((subscriber->flags & FBP_PUBSUB_SFLAG_PUB) && pattern_match(subscriber->pattern, t, topic)) {
+                struct dispatch_s * d = &topic->dispatch[count++];
+                d->cbk_fn = subscriber->cbk_fn;
+                d->cbk_user_data = subscriber->cbk_user_data;
+                d->executor = subscriber->executor;
+                d->subscriber = subscriber;
+            }
+        }
+    }
+    topic->dispatch_count = count;
+    topic->dispatch_valid = true;
+}
+
+static bool prefix_owned(struct fbp_pubsub_s * self, const char * name) {
+    for (uint32_t i = 0; i < self->prefix_count; ++i) {
+        if (name == self->prefix[i]) {  // interned
+            return true;
         }
     }
-    FBP_LOGW("subtopic too long: %s", *topic);
     return false;
 }
 
-static struct topic_s * subtopic_find(struct topic_s * parent, const char * subtopic_str) {
+/**
+ * @brief Check if this instance owns a topic string.
+ *
+ * @param self The instance.
+ * @param topic The topic string.
+ * @return True if the top-level name is in the topic prefix.
+ *
+ * Use topic_s.owned instead when the topic already exists.
+ */
+static bool topic_str_owned(struct fbp_pubsub_s * self, const char * topic) {
+    const char * end = topic;
+    while (*end && (*end != '/')) {
+        ++end;
+    }
+    const char * name = intern(self, topic, (size_t) (end - topic), false);
+    return name && prefix_owned(self, name);
+}
+
+static struct topic_s * subtopic_find(struct topic_s * parent, const char * name) {
     struct fbp_list_s * item;
     struct topic_s * topic;
     fbp_list_foreach(&parent->children, item) {
         topic = FBP_CONTAINER_OF(item, struct topic_s, item);
-        if (0 == strcmp(subtopic_str, topic->name)) {
+        if (name == topic->name) {  // interned
             return topic;
         }
     }
     return NULL;
 }
 
-static struct topic_s * topic_find(struct fbp_pubsub_s * self, const char * topic, bool create) {
-    char subtopic_str[FBP_PUBSUB_TOPIC_LENGTH_PER_LEVEL];
+static struct topic_s * topic_find_locked(struct fbp_pubsub_s * self, const char * topic, bool create) {
     const char * c = topic;
 
-    struct topic_s * t = self->root_topic;
+    struct topic_s * t = topic_index_find(self, topic);
+    if (t) {
+        return t;
+    }
+
+    // not indexed: empty, not normalized, or does not exist yet
+    t = self->root_topic;
     struct topic_s * subtopic;
     while (*c != 0) {
-        if (!subtopic_get_str(&c, subtopic_str)) {
-            return NULL;
+        const char * end = c;
+        while (*end && (*end != '/')) {
+            ++end;
         }
-        subtopic = subtopic_find(t, subtopic_str);
+        const char * name = intern_locked(self, c, (size_t) (end - c), create);
+        c = *end ? (end + 1) : end;
+        if (!name) {
+            return NULL;  // never seen this subtopic name
+        }
+        subtopic = subtopic_find(t, name);
         if (!subtopic) {
             if (!create) {
                 return NULL;
             }
-            FBP_LOGD1("%s: create new topic %s", topic, subtopic_str);
-            subtopic = topic_alloc(self, subtopic_str);
+            FBP_LOGD1("%s: create new topic %s", topic, name);
+            subtopic = topic_alloc(self, name);
+            if (!subtopic) {
+                return NULL;
+            }
             subtopic->parent = t;
+            subtopic->owned = (t == self->root_topic) ? prefix_owned(self, name) : t->owned;
             fbp_list_add_tail(&t->children, &subtopic->item);
+            topic_hash_set(subtopic);
+            topic_index_add(self, subtopic);
         }
         t = subtopic;
     }
@@ -325,31 +1524,25 @@ static struct topic_s * topic_find(struct fbp_pubsub_s * self, const char * topi
 }
 
 /**
- * @brief Extract the top-level base topic string.
+ * @brief Find a topic.
  *
- * @param src The source topic string which must be null terminated and
- *      less than FBP_PUBSUB_TOPIC_LENGTH_MAX size or shorter.
- * @param dst The destination topic string which must be
- *      FBP_PUBSUB_TOPIC_LENGTH_MAX size or longer.
- * @return 0 or error code.
+ * @param self The PubSub instance.
+ * @param topic The topic string.
+ * @param create When true, create the topic if it does not exist.
+ * @return The topic or NULL.
+ *
+ * Both fbp_pubsub_process() and caller-context functions, like
+ * fbp_pubsub_query() and fbp_pubsub_topic_handle_get(), find and create
+ * topics.  Hold the lock since creation modifies the children lists,
+ * the topic index, and the intern index, and index growth frees the
+ * old bucket array.  Topics persist until fbp_pubsub_finalize(), so
+ * the returned topic remains valid after unlock.
  */
-static int32_t topic_str_base(const char * src, char * dst) {
-    uint32_t sz = 0;
-    while (*src) {
-        if (*src == '/') {
-            break;
-        }
-        *dst++ = *src++;
-        ++sz;
-        if (sz == FBP_PUBSUB_TOPIC_LENGTH_MAX) {
-            --dst;
-            *dst = 0;
-            FBP_LOGE("src truncated");
-            return FBP_ERROR_PARAMETER_INVALID;
-        }
-    }
-    *dst = 0;
-    return 0;
+static struct topic_s * topic_find(struct fbp_pubsub_s * self, const char * topic, bool create) {
+    lock(self);
+    struct topic_s * t = topic_find_locked(self, topic, create);
+    unlock(self);
+    return t;
 }
 
 /**
@@ -400,7 +1593,7 @@ static void topic_list_update(struct fbp_pubsub_s * self, bool do_publish) {
         .src_user_data = NULL,
     };
     if (do_publish) {
-        publish(t, &msg);
+        publish(self, t, msg.name, &msg);
     }
 }
 
@@ -434,6 +1627,10 @@ static int32_t top_topic_add(void * user_data, const char * topic) {
     }
     fbp_topic_list_append(&self->topic_prefix, t);
     fbp_topic_list_append(&self->topic_list, t);
+    const char * name = intern(self, t, strlen(t), true);
+    if (!prefix_owned(self, name) && (self->prefix_count < (uint32_t) FBP_ARRAY_SIZE(self->prefix))) {
+        self->prefix[self->prefix_count++] = name;
+    }
     return 0;
 }
 
@@ -448,13 +1645,84 @@ static uint8_t on_return_code(void * user_data, const char * topic, const struct
     return 0;
 }
 
+static void profile_clear(struct topic_s * topic) {
+    struct fbp_list_s * item;
+    fbp_memset(&topic->profile, 0, sizeof(topic->profile));
+    fbp_list_foreach(&topic->subscribers, item) {
+        struct subscriber_s * sub = FBP_CONTAINER_OF(item, struct subscriber_s, item);
+        fbp_memset(&sub->profile, 0, sizeof(sub->profile));
+    }
+    fbp_list_foreach(&topic->children, item) {
+        profile_clear(FBP_CONTAINER_OF(item, struct topic_s, item));
+    }
+}
+
+static uint8_t on_stats_enable(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) topic;
+    struct fbp_pubsub_s * self = (struct fbp_pubsub_s *) user_data;
+    bool v = false;
+    if (fbp_union_to_bool(value, &v)) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    if (v && !self->stats_enable) {
+        lock(self);
+        profile_clear(self->root_topic);
+        self->stats.msg_count = 0;
+        self->stats.queue_depth_max = 0;
+        self->stats.mrb_used_max = 0;
+        self->stats.drop_count = 0;
+        unlock(self);
+    }
+    self->stats_enable = v ? 1 : 0;
+    return 0;
+}
+
 struct fbp_pubsub_s * fbp_pubsub_initialize(const char * topic_prefix, uint32_t buffer_size) {
+    struct fbp_pubsub_config_s config = {
+        .buffer_size = buffer_size,
+        .topic_max = 0,
+        .subscriber_max = 0,
+        .snapshot = NULL,
+        .snapshot_size = 0,
+    };
+    return fbp_pubsub_initialize_config(topic_prefix, &config);
+}
+
+struct fbp_pubsub_s * fbp_pubsub_initialize_config(const char * topic_prefix, const struct fbp_pubsub_config_s * config) {
     FBP_LOGI("initialize");
+    uint32_t buffer_size = config->buffer_size;
     struct fbp_pubsub_s * self = (struct fbp_pubsub_s *) fbp_alloc_clr(sizeof(struct fbp_pubsub_s) + buffer_size);
-    self->root_topic = topic_alloc(self, "");
+    if (config->topic_max) {
+        self->topic_pool_size = config->topic_max + TOPIC_POOL_INTERNAL;
+        self->topic_pool = fbp_alloc_clr(self->topic_pool_size * sizeof(struct topic_s));
+    }
+    if (config->subscriber_max) {
+        self->subscriber_pool_size = config->subscriber_max + SUBSCRIBER_POOL_INTERNAL;
+        self->subscriber_pool = fbp_alloc_clr(self->subscriber_pool_size * sizeof(struct subscriber_s));
+    }
+    if (config->topic_max) {
+        // each topic adds at most one name, each wildcard subscriber may add its own
+        self->intern_pool_size = self->topic_pool_size + self->subscriber_pool_size;
+        self->intern_pool = fbp_alloc(self->intern_pool_size * INTERN_POOL_ENTRY_SIZE);
+        self->intern_index_size = index_size(self->intern_pool_size);
+        self->intern_index = fbp_alloc_clr(self->intern_index_size * sizeof(struct intern_s *));
+        self->topic_index_size = index_size(self->topic_pool_size);
+        self->topic_index = fbp_alloc_clr(self->topic_index_size * sizeof(struct topic_s *));
+        self->path_pool = fbp_alloc(self->topic_pool_size * FBP_PUBSUB_TOPIC_LENGTH_MAX);
+    }
+    if (config->topic_max || config->subscriber_max) {
+        self->walk_pool = fbp_alloc(WALK_POOL_SIZE * sizeof(struct walk_s));
+        for (uint32_t i = 0; i < WALK_POOL_SIZE; ++i) {
+            walk_free(self, &self->walk_pool[i]);
+        }
+    }
+    self->root_topic = topic_alloc(self, intern(self, "", 0, true));
     fbp_list_initialize(&self->subscriber_free);
-    fbp_list_initialize(&self->msg_pend);
-    fbp_list_initialize(&self->msg_free);
+    self->msg_pend_head = &self->msg_pend_stub;
+    self->msg_pend_tail = &self->msg_pend_stub;
+    for (uint32_t i = 0; i < FBP_CONFIG_PUBSUB_MSG_CACHE_SIZE; ++i) {
+        self->msg_cache[i].seq = i;
+    }
     fbp_rbm_init(&self->mrb, self->buffer, buffer_size);
     fbp_topic_list_clear(&self->topic_list);
 
@@ -493,6 +1761,24 @@ struct fbp_pubsub_s * fbp_pubsub_initialize(const char * topic_prefix, uint32_t
     sub->cbk_user_data = self;
     fbp_list_add_tail(&t->subscribers, &sub->item);
 
+    t = topic_find(self, FBP_PUBSUB_CONFIG_STATS, true);
+    sub = subscriber_alloc(self);
+    sub->flags = FBP_PUBSUB_SFLAG_PUB;
+    sub->cbk_fn = on_stats_enable;
+    sub->cbk_user_data = self;
+    fbp_list_add_tail(&t->subscribers, &sub->item);
+    self->stats.mrb_size = buffer_size;
+    topic_find(self, FBP_PUBSUB_STATS_MSG, true);
+    topic_find(self, FBP_PUBSUB_STATS_QUEUE, true);
+    topic_find(self, FBP_PUBSUB_STATS_MRB, true);
+    topic_find(self, FBP_PUBSUB_STATS_DROP, true);
+
+    if (config->snapshot) {
+        int32_t rc = fbp_pubsub_snapshot_restore(self, config->snapshot, config->snapshot_size);
+        if (rc) {
+            FBP_LOGW("snapshot restore failed: %d", (int) rc);
+        }
+    }
     return self;
 }
 
@@ -506,16 +1792,6 @@ void subscriber_list_free(struct fbp_list_s * list) {
     fbp_list_initialize(list);
 }
 
-void msg_list_free(struct fbp_list_s * list) {
-    struct fbp_list_s * item;
-    struct message_s * msg;
-    fbp_list_foreach(list, item) {
-        msg = FBP_CONTAINER_OF(item, struct message_s, item);
-        fbp_free(msg);
-    }
-    fbp_list_initialize(list);
-}
-
 void fbp_pubsub_finalize(struct fbp_pubsub_s * self) {
     FBP_LOGI("finalize");
 
@@ -523,9 +1799,52 @@ void fbp_pubsub_finalize(struct fbp_pubsub_s * self) {
         fbp_os_mutex_t mutex = self->mutex;
         lock(self);
         topic_free(self, self->root_topic);
-        subscriber_list_free(&self->subscriber_free);
-        msg_list_free(&self->msg_pend);
-        msg_list_free(&self->msg_free);
+        intern_free(self);
+        if (self->topic_index) {
+            fbp_free(self->topic_index);
+        }
+        if (self->subscriber_pool) {
+            fbp_free(self->subscriber_pool);
+        } else {
+            subscriber_list_free(&self->subscriber_free);
+        }
+        if (self->topic_pool) {
+            fbp_free(self->topic_pool);
+        }
+        if (self->path_pool) {
+            fbp_free(self->path_pool);
+        }
+        struct message_s * msg;
+        while (NULL != (msg = msg_pop(self))) {
+            if (is_ref(&msg->value)) {
+                fbp_pubsub_buf_decr(msg->value.value.bin);
+            }
+            if (msg->name) {
+                fbp_free(msg->name);
+            }
+            fbp_free(msg);
+        }
+        while (NULL != (msg = msg_cache_pop(self))) {
+            fbp_free(msg);
+        }
+        while (self->walk_head) {
+            struct walk_s * w = self->walk_head;
+            self->walk_head = w->next;
+            walk_free(self, w);
+        }
+        if (self->walk_pool) {
+            fbp_free(self->walk_pool);
+        }
+        while (self->msg_free_list) {
+            msg = self->msg_free_list;
+            self->msg_free_list = msg->next;
+            fbp_free(msg);
+        }
+        while (self->name_free_list) {
+            union name_u * n = self->name_free_list;
+            self->name_free_list = n->next;
+            fbp_free(n);
+        }
         fbp_free(self);
         if (mutex) {
             fbp_os_mutex_unlock(mutex);
@@ -543,36 +1862,89 @@ void fbp_pubsub_register_on_publish(struct fbp_pubsub_s * self,
     self->cbk_user_data = cbk_user_data;
 }
 
-static void subscribe_traverse(struct topic_s * topic, char * topic_str, fbp_pubsub_subscribe_fn cbk_fn, void * cbk_user_data) {
-    size_t topic_str_len = strlen(topic_str);
-    char * topic_str_last = topic_str + topic_str_len;
-    if ((topic->value.type != FBP_UNION_NULL) && (topic->value.flags & FBP_UNION_FLAG_RETAIN)) {
-        cbk_fn(cbk_user_data, topic_str, &topic->value);
-    }
-    struct fbp_list_s * item;
-    struct topic_s * subtopic;
-    fbp_list_foreach(&topic->children, item) {
-        subtopic = FBP_CONTAINER_OF(item, struct topic_s, item);
-        topic_str_append(topic_str, subtopic->name);
-        subscribe_traverse(subtopic, topic_str, cbk_fn, cbk_user_data);
-        *topic_str_last = 0;  // reset string to original
+/**
+ * @brief Get the next topic in a pre-order subtree traversal.
+ *
+ * @param root The subtree root.
+ * @param topic The current topic.
+ * @return The next topic or NULL when the traversal is complete.
+ */
+static struct topic_s * walk_next(struct topic_s * root, struct topic_s * topic) {
+    if (!fbp_list_is_empty(&topic->children)) {
+        return FBP_CONTAINER_OF(topic->children.next, struct topic_s, item);
+    }
+    while (topic != root) {
+        if (topic->item.next != &topic->parent->children) {
+            return FBP_CONTAINER_OF(topic->item.next, struct topic_s, item);
+        }
+        topic = topic->parent;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Allocate a traversal, consumer only.
+ *
+ * @param self The PubSub instance.
+ * @return The new traversal.
+ *
+ * Traversals finish before the next message, so WALK_POOL_SIZE covers
+ * one query per top-level prefix.  Only subscriber callbacks that call
+ * fbp_pubsub_process() directly can nest more, which uses the heap.
+ */
+static struct walk_s * walk_alloc(struct fbp_pubsub_s * self) {
+    struct walk_s * w = self->walk_free;
+    if (w) {
+        self->walk_free = w->next;
+    } else {
+        w = fbp_alloc(sizeof(struct walk_s));
+    }
+    return w;
+}
+
+static void walk_free(struct fbp_pubsub_s * self, struct walk_s * w) {
+    if (self->walk_pool && (w >= self->walk_pool) && (w < (self->walk_pool + WALK_POOL_SIZE))) {
+        w->next = self->walk_free;
+        self->walk_free = w;
+    } else {
+        fbp_free(w);
     }
 }
 
-static int32_t msg_enqueue(struct fbp_pubsub_s * self, struct message_s * msg) {
-    lock(self);
-    fbp_list_add_tail(&self->msg_pend, &msg->item);
+static void walk_add(struct fbp_pubsub_s * self, uint8_t op, struct topic_s * root,
+        const struct pattern_s * pattern, const struct subscriber_s * subscriber) {
+    struct walk_s * w = walk_alloc(self);
+    w->next = NULL;
+    w->op = op;
+    w->root = root;
+    w->pattern = pattern;
+    w->topic = (op == WALK_QUERY) ? walk_next(root, root) : root;  // query excludes root
+    w->cbk_fn = subscriber ? subscriber->cbk_fn : NULL;
+    w->cbk_user_data = subscriber ? subscriber->cbk_user_data : NULL;
+    w->executor = subscriber ? subscriber->executor : NULL;
+    w->subscriber = subscriber;
+    lock(self);  // for walk_cancel
+    if (self->walk_tail) {
+        self->walk_tail->next = w;
+    } else {
+        self->walk_head = w;
+    }
+    self->walk_tail = w;
     unlock(self);
-    if (self->cbk_fn) {
-        self->cbk_fn(self->cbk_user_data);
+}
+
+/// Cancel the retained value walk for one subscriber, before it is freed.
+static void walk_cancel(struct fbp_pubsub_s * self, const struct subscriber_s * subscriber) {
+    for (struct walk_s * w = self->walk_head; w; w = w->next) {
+        if (w->cbk_fn && (w->subscriber == subscriber)) {
+            w->cbk_fn = NULL;
+        }
     }
-    return 0;
 }
 
-static int32_t handle_message(struct fbp_pubsub_s * self, struct message_s * msg) {
-    int32_t rv = msg_enqueue(self, msg);
-    if (rv) {
-        return rv;
+static int32_t msg_enqueued(struct fbp_pubsub_s * self) {
+    if (self->cbk_fn) {
+        self->cbk_fn(self->cbk_user_data);
     }
     if (!self->mutex && (self->depth == 0)) {
         ++self->depth;
@@ -582,8 +1954,19 @@ static int32_t handle_message(struct fbp_pubsub_s * self, struct message_s * msg
     return 0;
 }
 
+static int32_t handle_message(struct fbp_pubsub_s * self, struct message_s * msg) {
+    msg_push(self, msg);
+    return msg_enqueued(self);
+}
+
 int32_t fbp_pubsub_subscribe(struct fbp_pubsub_s * self, const char * topic,
         uint8_t flags, fbp_pubsub_subscribe_fn cbk_fn, void * cbk_user_data) {
+    return fbp_pubsub_subscribe_executor(self, topic, flags, cbk_fn, cbk_user_data, NULL);
+}
+
+int32_t fbp_pubsub_subscribe_executor(struct fbp_pubsub_s * self, const char * topic,
+        uint8_t flags, fbp_pubsub_subscribe_fn cbk_fn, void * cbk_user_data,
+        struct fbp_pubsub_executor_s * executor) {
     if (!self || !cbk_fn) {
         return FBP_ERROR_PARAMETER_INVALID;
     }
@@ -591,16 +1974,21 @@ int32_t fbp_pubsub_subscribe(struct fbp_pubsub_s * self, const char * topic,
         FBP_LOGW("req | rsp subscribers must only subscribe to root");
         return FBP_ERROR_PARAMETER_INVALID;
     }
+    if (!pattern_valid(topic)) {
+        FBP_LOGW("invalid wildcard subscription \"%s\"", topic);
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
 
     FBP_LOGI("subscribe \"%s\"", topic);
     struct message_s * msg = msg_alloc(self);
-    if (!topic_str_copy(msg->name, topic, NULL)) {
+    if (!msg_name_set(self, msg, topic, NULL)) {
         msg_free(self, msg);
         return FBP_ERROR_PARAMETER_INVALID;
     }
 
     msg->src_fn = cbk_fn;
     msg->src_user_data = cbk_user_data;
+    msg->executor = executor;
     msg->value.type = FBP_UNION_U32;
     msg->value.flags = 0;
     msg->value.op = OP_SUBSCRIBE;
@@ -610,23 +1998,41 @@ int32_t fbp_pubsub_subscribe(struct fbp_pubsub_s * self, const char * topic,
 
 int32_t fbp_pubsub_unsubscribe(struct fbp_pubsub_s * self, const char * topic,
                                 fbp_pubsub_subscribe_fn cbk_fn, void * cbk_user_data) {
-    struct topic_s * t = topic_find(self, topic, false);
+    char topic_str[FBP_PUBSUB_TOPIC_LENGTH_MAX];
     struct fbp_list_s * item;
     struct subscriber_s * subscriber;
     int count = 0;
-    if (!t) {
+    if (!topic_str_copy(topic_str, topic, NULL) || !pattern_valid(topic_str)) {
         return FBP_ERROR_NOT_FOUND;
     }
     lock(self);
+    struct pattern_s * pattern = pattern_compile(self, topic_str, false);
+    struct topic_s * t = topic_find(self, topic_str, false);
+    if (!t) {
+        unlock(self);
+        if (pattern) {
+            fbp_free(pattern);
+        }
+        return FBP_ERROR_NOT_FOUND;
+    }
     fbp_list_foreach(&t->subscribers, item) {
         subscriber = FBP_CONTAINER_OF(item, struct subscriber_s, item);
-        if ((subscriber->cbk_fn == cbk_fn) && (subscriber->cbk_user_data == cbk_user_data)) {
+        if ((subscriber->cbk_fn == cbk_fn) && (subscriber->cbk_user_data == cbk_user_data)
+                && pattern_eq(subscriber->pattern, pattern)) {
             fbp_list_remove(item);
+            executor_cancel(subscriber->executor, subscriber);
+            walk_cancel(self, subscriber);
             subscriber_free(self, subscriber);
             ++count;
         }
     }
+    if (count) {
+        dispatch_invalidate(t);
+    }
     unlock(self);
+    if (pattern) {
+        fbp_free(pattern);
+    }
     if (!count) {
         return FBP_ERROR_NOT_FOUND;
     }
@@ -641,6 +2047,8 @@ static void unsubscribe_traverse(struct fbp_pubsub_s * self, struct topic_s * to
         subscriber = FBP_CONTAINER_OF(item, struct subscriber_s, item);
         if ((subscriber->cbk_fn == cbk_fn) && (subscriber->cbk_user_data == cbk_user_data)) {
             fbp_list_remove(item);
+            executor_cancel(subscriber->executor, subscriber);
+            walk_cancel(self, subscriber);
             subscriber_free(self, subscriber);
         }
     }
@@ -656,91 +2064,499 @@ int32_t fbp_pubsub_unsubscribe_from_all(struct fbp_pubsub_s * self,
     struct topic_s * t = self->root_topic;
     lock(self);
     unsubscribe_traverse(self, t, cbk_fn, cbk_user_data);
+    dispatch_invalidate(t);
     unlock(self);
     return 0;
 }
 
-static bool is_ptr_type(uint8_t type) {
-    switch (type) {
-        case FBP_UNION_STR:   // intentional fall-through
-        case FBP_UNION_JSON:  // intentional fall-through
-        case FBP_UNION_BIN:
-            return true;
-        default:
-            return false;
+/**
+ * @brief Find the conflating topic for a publish.
+ *
+ * @param self The instance, which must be locked.
+ * @param topic The topic string, only used when t is NULL.
+ * @param t The resolved topic or NULL.
+ * @return The topic if it conflates, otherwise NULL.
+ */
+static struct topic_s * conflate_topic(struct fbp_pubsub_s * self, const char * topic, struct topic_s * t) {
+    if (!t) {
+        size_t sz = strlen(topic);
+        if (sz && !is_reserved_char(topic[sz - 1])) {
+            t = topic_find(self, topic, false);
+        }
     }
+    return (t && t->conflate) ? t : NULL;
 }
 
-static bool is_str_type(uint8_t type) {
-    switch (type) {
-        case FBP_UNION_STR:   // intentional fall-through
-        case FBP_UNION_JSON:  // intentional fall-through
-            return true;
-        default:
-            return false;
-    }
+/**
+ * @brief Update the pending value for a conflating topic.
+ *
+ * @param self The instance, which must be locked.
+ * @param t The topic with conflate enabled.
+ * @param value The value, which is not copied.
+ * @param src_fn The source subscriber callback.
+ * @param src_user_data The source subscriber callback user data.
+ * @return True if the caller must queue an OP_CONFLATE message for t.
+ *      False if an update is already pending, which now has value.
+ */
+static bool conflate_update(struct fbp_pubsub_s * self, struct topic_s * t, const struct fbp_union_s * value,
+        fbp_pubsub_subscribe_fn src_fn, void * src_user_data) {
+    (void) self;
+    bool pending = t->conflate_pending;
+    if (pending && is_ref(&t->conflate_value)) {
+        fbp_pubsub_buf_decr(t->conflate_value.value.bin);
+    }
+    t->conflate_value = *value;
+    t->conflate_value.op = OP_PUBLISH;
+    t->conflate_src_fn = src_fn;
+    t->conflate_src_user_data = src_user_data;
+    t->conflate_pending = true;
+    return !pending;
 }
 
-int32_t fbp_pubsub_publish(struct fbp_pubsub_s * self,
-        const char * topic, const struct fbp_union_s * value,
-        fbp_pubsub_subscribe_fn src_fn, void * src_user_data) {
+static void conflate_msg(struct message_s * msg, struct topic_s * t) {
+    msg->topic = t;
+    msg->value = fbp_union_null();
+    msg->value.op = OP_CONFLATE;
+}
 
-    bool do_copy = false;
-    uint32_t size = value->size;
+static void conflate_take(struct fbp_pubsub_s * self, struct message_s * msg) {
+    struct topic_s * t = msg->topic;
+    lock(self);
+    msg->value = t->conflate_value;
+    msg->src_fn = t->conflate_src_fn;
+    msg->src_user_data = t->conflate_src_user_data;
+    t->conflate_value = fbp_union_null();
+    t->conflate_pending = false;
+    unlock(self);
+}
+
+/**
+ * @brief Check a value to publish.
+ *
+ * @param self The instance.
+ * @param value The value to publish.
+ * @param[out] size The payload size, which is 0 for non-pointer types.
+ * @param[out] do_copy True if the payload must be copied into mrb.
+ * @return 0 or error code.
+ */
+static int32_t publish_value_check(struct fbp_pubsub_s * self, const struct fbp_union_s * value,
+        uint32_t * size, bool * do_copy) {
+    *do_copy = false;
+    *size = value->size;
     if (is_ptr_type(value->type)) {
         if ((!value->size) && is_str_type(value->type)) {
             size_t sz = strlen(value->value.str) + 1;
             if (sz > UINT32_MAX) {
                 return FBP_ERROR_TOO_BIG;
             }
-            size = (uint32_t) sz;
+            *size = (uint32_t) sz;
+        }
+        if (value->flags & FBP_UNION_FLAG_REF) {
+            // take ownership of the caller's reference, no copy
+        } else if (0 == (value->flags & FBP_UNION_FLAG_CONST)) {
+            if (value->flags & FBP_UNION_FLAG_RETAIN) {
+                FBP_LOGE("non-const retained ptr not allowed");
+                return FBP_ERROR_PARAMETER_INVALID;
+            }
+            *do_copy = (*size > 0);
+            if (*size > (self->mrb.buf_size / 2)) {
+                FBP_LOGE("too big for available buffer");
+                return FBP_ERROR_PARAMETER_INVALID;
+            }
+        }
+    } else {
+        *size = 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief Resolve the topic for a normal publish.
+ *
+ * @param self The instance.
+ * @param topic The topic string.
+ * @return The topic, or NULL if the string needs fbp_pubsub_process()
+ *      to handle it, such as metadata, query, and return code topics.
+ *
+ * Messages carry the resolved topic, whose path is built once per
+ * topic, rather than a copy of the topic string.
+ */
+static struct topic_s * publish_topic_resolve(struct fbp_pubsub_s * self, const char * topic) {
+    size_t sz = 0;
+    while (topic[sz]) {
+        if (++sz >= FBP_PUBSUB_TOPIC_LENGTH_MAX) {
+            return NULL;
+        }
+    }
+    if (!sz || is_reserved_char(topic[sz - 1])) {
+        return NULL;
+    }
+    lock(self);
+    struct topic_s * t = topic_find_locked(self, topic, true);
+    topic_path_set(self, t);
+    unlock(self);
+    return t;
+}
+
+static int32_t publish_enqueue(struct fbp_pubsub_s * self,
+        const char * topic, struct topic_s * t, const struct fbp_union_s * value,
+        fbp_pubsub_subscribe_fn src_fn, void * src_user_data) {
+    bool do_copy = false;
+    uint32_t size = 0;
+    int32_t rv = publish_value_check(self, value, &size, &do_copy);
+    if (rv) {
+        return rv;
+    }
+
+    if (!t) {
+        t = publish_topic_resolve(self, topic);
+    }
+    if (!do_copy && self->conflate_count) {
+        lock(self);
+        struct topic_s * c = conflate_topic(self, topic, t);
+        if (c) {
+            struct fbp_union_s v = *value;
+            v.size = size;
+            bool queue = conflate_update(self, c, &v, src_fn, src_user_data);
+            if (queue) {
+                struct message_s * msg = msg_alloc(self);
+                conflate_msg(msg, c);
+                msg_push(self, msg);
+            }
+            unlock(self);
+            return queue ? msg_enqueued(self) : 0;
+        }
+        unlock(self);
+    }
+
+    struct message_s * msg = msg_alloc(self);
+    if (t) {
+        msg->topic = t;
+    } else if (!msg_name_set(self, msg, topic, NULL)) {
+        msg_free(self, msg);
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+
+    msg->src_fn = src_fn;
+    msg->src_user_data = src_user_data;
+    msg->value = *value;
+    msg->value.op = OP_PUBLISH;
+    msg->value.size = size;
+    if (do_copy) {
+        lock(self);
+        uint8_t *buf = fbp_rbm_alloc(&self->mrb, size);
+        if (!buf) { // full!
+            atomic_add_u32(&self->stats.drop_count, 1);
+            unlock(self);
+            msg_free(self, msg);
+            return FBP_ERROR_NOT_ENOUGH_MEMORY;
+        }
+        mrb_stats_update(self);
+        fbp_memcpy(buf, value->value.str, size);
+        msg->value.value.bin = buf;
+        msg->mrb = buf;
+        msg->mrb_size = size;
+        msg_push(self, msg);  // under lock to match mrb order
+        unlock(self);
+        return msg_enqueued(self);
+    }
+    return handle_message(self, msg);
+}
+
+static void msg_chain_free(struct fbp_pubsub_s * self, struct message_s * msg) {
+    struct message_s * next;
+    for (; msg; msg = next) {
+        next = msg->next;
+        msg_free(self, msg);
+    }
+}
+
+int32_t fbp_pubsub_publish_batch(struct fbp_pubsub_s * self,
+        const struct fbp_pubsub_entry_s * entries, uint32_t count) {
+    struct message_s * head = NULL;
+    struct message_s * tail = NULL;
+    struct message_s * dropped = NULL;
+    struct message_s * owner = NULL;  // last message with copied payload
+    struct message_s * msg;
+    struct message_s * next;
+    uint32_t copy_size = 0;
+    int32_t rv = 0;
+    if (!self || (count && !entries)) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+
+    // check all entries and prepare messages before queuing any
+    for (uint32_t i = 0; !rv && (i < count); ++i) {
+        const struct fbp_pubsub_entry_s * e = &entries[i];
+        uint32_t size = 0;
+        bool do_copy = false;
+        rv = publish_value_check(self, &e->value, &size, &do_copy);
+        if (rv) {
+            break;
+        }
+        msg = msg_alloc(self);
+        if (tail) {
+            tail->next = msg;
+        } else {
+            head = msg;
+        }
+        tail = msg;
+        if (e->topic) {
+            msg->topic = publish_topic_resolve(self, e->topic);
+            if (!msg->topic && !msg_name_set(self, msg, e->topic, NULL)) {
+                rv = FBP_ERROR_PARAMETER_INVALID;
+            }
+        } else if (e->handle) {
+            msg->topic = (struct topic_s *) e->handle;
+        } else {
+            rv = FBP_ERROR_PARAMETER_INVALID;
+        }
+        msg->value = e->value;
+        msg->value.op = OP_PUBLISH;
+        msg->value.size = size;
+        if (do_copy) {
+            msg->mrb_size = size;  // copy pending
+            copy_size += size;
+            owner = msg;
+        }
+    }
+    if (!rv && (copy_size > (self->mrb.buf_size / 2))) {
+        FBP_LOGE("batch too big for available buffer");
+        rv = FBP_ERROR_PARAMETER_INVALID;
+    }
+    if (rv) {
+        msg_chain_free(self, head);
+        return rv;
+    }
+
+    lock(self);
+    uint8_t * buf = NULL;
+    if (copy_size) {
+        buf = fbp_rbm_alloc(&self->mrb, copy_size);  // one reservation for the batch
+        if (!buf) {
+            atomic_add_u32(&self->stats.drop_count, count);
+            unlock(self);
+            msg_chain_free(self, head);
+            return FBP_ERROR_NOT_ENOUGH_MEMORY;
+        }
+        mrb_stats_update(self);
+    }
+    uint8_t * p = buf;
+    for (msg = head; msg; msg = next) {
+        next = msg->next;
+        if (msg->mrb_size) {
+            fbp_memcpy(p, msg->value.value.bin, msg->mrb_size);
+            msg->value.value.bin = p;
+            p += msg->mrb_size;
+            msg->mrb_size = 0;
+            if (msg == owner) {  // pop after the last message using the reservation
+                msg->mrb = buf;
+                msg->mrb_size = copy_size;
+            }
+        } else if (self->conflate_count) {
+            struct topic_s * c = conflate_topic(self, msg->name, msg->topic);
+            if (c) {
+                if (!conflate_update(self, c, &msg->value, NULL, NULL)) {
+                    msg->next = dropped;
+                    dropped = msg;
+                    continue;
+                }
+                conflate_msg(msg, c);
+            }
+        }
+        msg_push(self, msg);
+    }
+    unlock(self);
+    msg_chain_free(self, dropped);
+    return count ? msg_enqueued(self) : 0;
+}
+
+int32_t fbp_pubsub_publish(struct fbp_pubsub_s * self,
+        const char * topic, const struct fbp_union_s * value,
+        fbp_pubsub_subscribe_fn src_fn, void * src_user_data) {
+    return publish_enqueue(self, topic, NULL, value, src_fn, src_user_data);
+}
+
+static void topic_path_build(struct topic_s * topic, char * topic_str) {
+    if (topic->parent && topic->parent->parent) {
+        topic_path_build(topic->parent, topic_str);
+    } else {
+        topic_str[0] = 0;
+    }
+    topic_str_append(topic_str, topic->name);
+}
+
+static void topic_path_set(struct fbp_pubsub_s * self, struct topic_s * t) {
+    char topic_str[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    if (t && !t->path) {
+        topic_path_build(t, topic_str);
+        size_t sz = strlen(topic_str) + 1;
+        if (self->path_pool) {
+            t->path = self->path_pool + (t - self->topic_pool) * FBP_PUBSUB_TOPIC_LENGTH_MAX;
+        } else {
+            t->path = fbp_alloc(sz);
+        }
+        fbp_memcpy(t->path, topic_str, sz);
+    }
+}
+
+struct fbp_pubsub_topic_s * fbp_pubsub_topic_handle_get(struct fbp_pubsub_s * self, const char * topic) {
+    char topic_str[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    size_t sz = 0;
+    if (!self || !topic || !topic_str_copy(topic_str, topic, &sz) || !sz || is_reserved_char(topic_str[sz - 1])) {
+        return NULL;
+    }
+    lock(self);
+    struct topic_s * t = topic_find(self, topic_str, true);
+    topic_path_set(self, t);
+    unlock(self);
+    return (struct fbp_pubsub_topic_s *) t;
+}
+
+int32_t fbp_pubsub_topic_conflate(struct fbp_pubsub_s * self, const char * topic, bool enable) {
+    char topic_str[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    size_t sz = 0;
+    if (!self || !topic || !topic_str_copy(topic_str, topic, &sz) || !sz || is_reserved_char(topic_str[sz - 1])) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    lock(self);
+    struct topic_s * t = topic_find(self, topic_str, true);
+    if (!t) {
+        unlock(self);
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    topic_path_set(self, t);
+    if (enable && !t->conflate) {
+        ++self->conflate_count;
+    } else if (!enable && t->conflate) {
+        --self->conflate_count;
+    }
+    t->conflate = enable;
+    unlock(self);
+    return 0;
+}
+
+static struct history_s * history_alloc(uint32_t length) {
+    struct history_s * h = fbp_alloc(sizeof(struct history_s)
+            + length * (sizeof(int64_t) + sizeof(union fbp_union_inner_u)));
+    h->time = (int64_t *) (h + 1);
+    h->value = (union fbp_union_inner_u *) (h->time + length);
+    h->size = length;
+    h->head = 0;
+    h->count = 0;
+    h->type = FBP_UNION_NULL;
+    return h;
+}
+
+/**
+ * @brief Add a record to a topic history.
+ *
+ * @param self The instance.
+ * @param t The topic, which must have a history.
+ * @param value The accepted value.
+ */
+static void history_add(struct fbp_pubsub_s * self, struct topic_s * t, const struct fbp_union_s * value) {
+    if ((value->type == FBP_UNION_NULL) || is_ptr_type(value->type)) {
+        return;
+    }
+    int64_t now = fbp_time_utc();
+    lock(self);  // for fbp_pubsub_history_get()
+    struct history_s * h = t->history;
+    if (h) {
+        if (h->type != value->type) {
+            h->type = value->type;
+            h->head = 0;
+            h->count = 0;
+        }
+        h->time[h->head] = now;
+        h->value[h->head] = value->value;
+        h->head = (h->head + 1) % h->size;
+        if (h->count < h->size) {
+            ++h->count;
+        }
+    }
+    unlock(self);
+}
+
+int32_t fbp_pubsub_topic_history(struct fbp_pubsub_s * self, const char * topic, uint32_t length) {
+    char topic_str[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    size_t sz = 0;
+    if (!self || !topic || !topic_str_copy(topic_str, topic, &sz) || !sz || is_reserved_char(topic_str[sz - 1])) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    struct history_s * h = length ? history_alloc(length) : NULL;
+    lock(self);
+    struct topic_s * t = topic_find(self, topic_str, true);
+    if (!t) {
+        unlock(self);
+        if (h) {
+            fbp_free(h);
+        }
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    struct history_s * h_prev = t->history;
+    t->history = h;
+    unlock(self);
+    if (h_prev) {
+        fbp_free(h_prev);
+    }
+    return 0;
+}
+
+int32_t fbp_pubsub_history_get(struct fbp_pubsub_s * self, const char * topic, int64_t time_start,
+                               int64_t * time, union fbp_union_inner_u * value, uint8_t * type,
+                               uint32_t * count) {
+    if (!self || !topic || !count) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    lock(self);
+    struct topic_s * t = topic_find(self, topic, false);
+    struct history_s * h = t ? t->history : NULL;
+    if (!h) {
+        unlock(self);
+        *count = 0;
+        return FBP_ERROR_NOT_FOUND;
+    }
+    uint32_t oldest = (h->head + h->size - h->count) % h->size;
+    uint32_t n = h->count;
+    while (n && (h->time[oldest] < time_start)) {  // times only increase
+        oldest = (oldest + 1) % h->size;
+        --n;
+    }
+    if (n > *count) {
+        oldest = (oldest + n - *count) % h->size;
+        n = *count;
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t k = (oldest + i) % h->size;
+        if (time) {
+            time[i] = h->time[k];
         }
-        if (0 == (value->flags & FBP_UNION_FLAG_CONST)) {
-            if (value->flags & FBP_UNION_FLAG_RETAIN) {
-                FBP_LOGE("non-const retained ptr not allowed");
-                return FBP_ERROR_PARAMETER_INVALID;
-            }
-            do_copy = true;
-            if (size > (self->mrb.buf_size / 2)) {
-                FBP_LOGE("too big for available buffer");
-                return FBP_ERROR_PARAMETER_INVALID;
-            }
+        if (value) {
+            value[i] = h->value[k];
         }
-    } else {
-        size = 0;
     }
-
-    struct message_s * msg = msg_alloc(self);
-    if (!topic_str_copy(msg->name, topic, NULL)) {
-        msg_free(self, msg);
-        return FBP_ERROR_PARAMETER_INVALID;
+    if (type) {
+        *type = h->type;
     }
+    *count = n;
+    unlock(self);
+    return 0;
+}
 
-    msg->src_fn = src_fn;
-    msg->src_user_data = src_user_data;
-    msg->value = *value;
-    msg->value.op = OP_PUBLISH;
-    msg->value.size = size;
-    if (do_copy && size) {
-        lock(self);
-        uint8_t *buf = fbp_rbm_alloc(&self->mrb, size);
-        if (!buf) { // full!
-            fbp_list_add_tail(&self->msg_free, &msg->item);
-            msg_free(self, msg);
-            unlock(self);
-            return FBP_ERROR_NOT_ENOUGH_MEMORY;
-        }
-        fbp_memcpy(buf, value->value.str, size);
-        msg->value.value.bin = buf;
-        unlock(self);
+int32_t fbp_pubsub_publish_handle(struct fbp_pubsub_s * self,
+        struct fbp_pubsub_topic_s * topic, const struct fbp_union_s * value,
+        fbp_pubsub_subscribe_fn src_fn, void * src_user_data) {
+    if (!self || !topic) {
+        return FBP_ERROR_PARAMETER_INVALID;
     }
-    return handle_message(self, msg);
+    return publish_enqueue(self, NULL, (struct topic_s *) topic, value, src_fn, src_user_data);
 }
 
 int32_t fbp_pubsub_meta(struct fbp_pubsub_s * self, const char * topic, const char * meta_json) {
     size_t sz = 0;
     struct message_s * msg = msg_alloc(self);
-    if (!topic_str_copy(msg->name, topic, &sz)) {
+    if (!msg_name_set(self, msg, topic, &sz)) {
         msg_free(self, msg);
         return FBP_ERROR_PARAMETER_INVALID;
     }
@@ -774,11 +2590,390 @@ int32_t fbp_pubsub_query(struct fbp_pubsub_s * self, const char * topic, struct
         return FBP_ERROR_PARAMETER_INVALID;
     }
     if (value) {
+        lock(self);
         *value = t->value;
+        if (is_ref(value)) {
+            fbp_pubsub_buf_incr(value->value.bin);
+        }
+        unlock(self);
+    }
+    return 0;
+}
+
+static inline uint32_t snapshot_align(uint32_t sz) {
+    return (sz + (SNAPSHOT_ALIGN - 1)) & ~((uint32_t) (SNAPSHOT_ALIGN - 1));
+}
+
+struct snapshot_s {
+    uint8_t * buffer;        // NULL to only compute the size
+    uint32_t capacity;       // buffer size in bytes
+    uint32_t size;           // bytes used, or needed on overflow
+    uint32_t count;          // records
+    bool incremental;
+    bool overflow;           // records did not fit in buffer
+};
+
+static void snapshot_rec_add(struct snapshot_s * s, const char * topic_str, char suffix,
+                             const struct fbp_union_s * value) {
+    struct snapshot_rec_s rec;
+    uint16_t topic_size = (uint16_t) (strlen(topic_str) + (suffix ? 2 : 1));
+    uint32_t payload_size = is_ptr_type(value->type) ? value->size : 0;
+    uint32_t sz = snapshot_align(sizeof(rec) + topic_size + payload_size);
+    if (s->buffer && (sz > (s->capacity - s->size))) {
+        s->overflow = true;
+    }
+    if (s->buffer && !s->overflow) {
+        uint8_t * p = s->buffer + s->size;
+        fbp_memset(&rec, 0, sizeof(rec));
+        rec.type = value->type;
+        rec.flags = value->flags & (FBP_UNION_FLAG_RETAIN | FBP_UNION_FLAG_CONST);
+        rec.op = value->op;
+        rec.app = value->app;
+        rec.topic_size = topic_size;
+        rec.size = payload_size;
+        if (!is_ptr_type(value->type)) {
+            rec.value = value->value;
+        }
+        fbp_memset(p, 0, sz);
+        fbp_memcpy(p, &rec, sizeof(rec));
+        p += sizeof(rec);
+        fbp_memcpy(p, topic_str, topic_size - (suffix ? 2 : 1));
+        p += topic_size - 1;
+        if (suffix) {
+            p[-1] = suffix;
+        }
+        ++p;  // null terminator, already cleared
+        if (payload_size) {
+            fbp_memcpy(p, value->value.bin, payload_size);
+        }
+    }
+    s->size += sz;
+    ++s->count;
+}
+
+static void snapshot_topic(struct snapshot_s * s, struct topic_s * t) {
+    char topic_str[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    struct fbp_list_s * item;
+    bool do_value = (t->value.flags & FBP_UNION_FLAG_RETAIN) && (t->value.type != FBP_UNION_NULL)
+            && (!is_ptr_type(t->value.type) || (t->value.value.bin && t->value.size));
+    bool do_meta = (NULL != t->meta);
+    if (s->incremental) {
+        do_value = (t->dirty & DIRTY_VALUE) != 0;
+        do_meta = do_meta && (t->dirty & DIRTY_META);
+    }
+    if (do_value || do_meta) {
+        topic_path_build(t, topic_str);
+        if (do_value) {
+            snapshot_rec_add(s, topic_str, 0, &t->value);
+        }
+        if (do_meta) {
+            struct fbp_union_s meta = fbp_union_json(t->meta);
+            meta.size = (uint32_t) (strlen(t->meta) + 1);
+            snapshot_rec_add(s, topic_str, FBP_PUBSUB_CHAR_METADATA, &meta);
+        }
+    }
+    fbp_list_foreach(&t->children, item) {
+        snapshot_topic(s, FBP_CONTAINER_OF(item, struct topic_s, item));
+    }
+}
+
+static void snapshot_dirty_clear(struct topic_s * t) {
+    struct fbp_list_s * item;
+    t->dirty = 0;
+    fbp_list_foreach(&t->children, item) {
+        snapshot_dirty_clear(FBP_CONTAINER_OF(item, struct topic_s, item));
+    }
+}
+
+static void snapshot_build(struct fbp_pubsub_s * self, struct snapshot_s * s) {
+    struct fbp_list_s * item;
+    s->size = sizeof(struct snapshot_hdr_s);
+    s->count = 0;
+    fbp_list_foreach(&self->root_topic->children, item) {
+        struct topic_s * t = FBP_CONTAINER_OF(item, struct topic_s, item);
+        if (0 != strcmp(t->name, "_")) {  // internal topics are rebuilt by initialize
+            snapshot_topic(s, t);
+        }
+    }
+    if (s->buffer && !s->overflow) {
+        struct snapshot_hdr_s hdr = {
+            .magic = SNAPSHOT_MAGIC,
+            .version = SNAPSHOT_VERSION,
+            .rsv = 0,
+            .size = s->size,
+            .count = s->count,
+            .crc32 = fbp_crc32(0, s->buffer + sizeof(hdr), s->size - (uint32_t) sizeof(hdr)),
+            .rsv2 = 0,
+        };
+        fbp_memcpy(s->buffer, &hdr, sizeof(hdr));
+    }
+}
+
+int32_t fbp_pubsub_snapshot_save(struct fbp_pubsub_s * self, uint8_t * buffer, uint32_t * size, bool incremental) {
+    struct snapshot_s s = {
+        .buffer = NULL,
+        .capacity = 0,
+        .size = 0,
+        .count = 0,
+        .incremental = incremental,
+        .overflow = false,
+    };
+    if (!self || !size) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    // publish_normal() updates retained values and dirty bits under this lock
+    lock(self);
+    snapshot_build(self, &s);
+    if (!s.count && incremental) {
+        s.size = 0;  // nothing changed
+    } else if (buffer) {
+        if (s.size > *size) {
+            unlock(self);
+            *size = s.size;
+            return FBP_ERROR_TOO_SMALL;
+        }
+        s.buffer = buffer;
+        s.capacity = *size;
+        snapshot_build(self, &s);
+        if (s.overflow) {  // the writer never exceeds capacity
+            unlock(self);
+            *size = s.size;
+            return FBP_ERROR_TOO_SMALL;
+        }
+        snapshot_dirty_clear(self->root_topic);
+    }
+    unlock(self);
+    *size = s.size;
+    return 0;
+}
+
+static void snapshot_rec_apply(struct fbp_pubsub_s * self, const struct snapshot_rec_s * rec,
+                               const char * topic_str, const uint8_t * payload) {
+    size_t sz = strlen(topic_str);
+    bool is_meta = sz && (topic_str[sz - 1] == FBP_PUBSUB_CHAR_METADATA);
+    char name[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    fbp_cstr_copy(name, topic_str, sizeof(name));
+    if (is_meta) {
+        name[sz - 1] = 0;
+    }
+    struct topic_s * t = topic_find(self, name, true);
+    if (!t) {
+        FBP_LOGW("snapshot restore skip %s", topic_str);
+        return;
+    }
+    if (is_meta) {
+        if (rec->type == FBP_UNION_JSON) {
+            t->meta = (const char *) payload;
+            fbp_pubsub_meta_free(t->validator);
+            t->validator = fbp_pubsub_meta_compile(t->meta);
+        }
+    } else {
+        if (is_ref(&t->value)) {
+            fbp_pubsub_buf_decr(t->value.value.bin);
+        }
+        if (rec->type == FBP_UNION_NULL) {
+            t->value = fbp_union_null();
+            t->restored = false;
+        } else {
+            t->value.type = rec->type;
+            t->value.flags = FBP_UNION_FLAG_RETAIN;
+            t->value.op = rec->op;
+            t->value.app = rec->app;
+            t->value.size = rec->size;
+            if (is_ptr_type(rec->type)) {
+                t->value.flags |= FBP_UNION_FLAG_CONST;  // points into the snapshot image
+                t->value.value.bin = payload;
+            } else {
+                t->value.value = rec->value;
+            }
+            t->restored = true;
+        }
+    }
+    t->dirty = 0;
+}
+
+static bool snapshot_type_valid(uint8_t type) {
+    switch (type) {
+        case FBP_UNION_NULL: return true;
+        case FBP_UNION_STR: return true;
+        case FBP_UNION_JSON: return true;
+        case FBP_UNION_BIN: return true;
+        case FBP_UNION_F32: return true;
+        case FBP_UNION_F64: return true;
+        case FBP_UNION_U8: return true;
+        case FBP_UNION_U16: return true;
+        case FBP_UNION_U32: return true;
+        case FBP_UNION_U64: return true;
+        case FBP_UNION_I8: return true;
+        case FBP_UNION_I16: return true;
+        case FBP_UNION_I32: return true;
+        case FBP_UNION_I64: return true;
+        default: return false;
+    }
+}
+
+/// Check one image and its records before changing any topic.
+static int32_t snapshot_image_check(const uint8_t * buffer, uint32_t size) {
+    struct snapshot_hdr_s hdr;
+    struct snapshot_rec_s rec;
+    fbp_memcpy(&hdr, buffer, sizeof(hdr));
+    if (hdr.crc32 != fbp_crc32(0, buffer + sizeof(hdr), size - (uint32_t) sizeof(hdr))) {
+        return FBP_ERROR_MESSAGE_INTEGRITY;
+    }
+    uint32_t offset = sizeof(hdr);
+    for (uint32_t i = 0; i < hdr.count; ++i) {
+        if ((offset > size) || ((size - offset) < sizeof(rec))) {
+            return FBP_ERROR_INVALID_MESSAGE_LENGTH;
+        }
+        fbp_memcpy(&rec, buffer + offset, sizeof(rec));
+        uint32_t avail = size - offset - (uint32_t) sizeof(rec);
+        if (!rec.topic_size || (rec.topic_size > FBP_PUBSUB_TOPIC_LENGTH_MAX) || (rec.topic_size > avail)) {
+            return FBP_ERROR_INVALID_MESSAGE_LENGTH;
+        }
+        avail -= rec.topic_size;
+        if (rec.size > avail) {  // before adding, so rec_end cannot wrap
+            return FBP_ERROR_INVALID_MESSAGE_LENGTH;
+        }
+        uint32_t payload_offset = offset + (uint32_t) sizeof(rec) + rec.topic_size;
+        uint32_t rec_end = payload_offset + rec.size;
+        const char * topic_str = (const char *) (buffer + offset + sizeof(rec));
+        if (topic_str[rec.topic_size - 1]) {
+            return FBP_ERROR_SYNTAX_ERROR;
+        }
+        if (!snapshot_type_valid(rec.type)) {
+            return FBP_ERROR_NOT_SUPPORTED;
+        }
+        if (!is_ptr_type(rec.type) && rec.size) {
+            return FBP_ERROR_SYNTAX_ERROR;
+        }
+        if (is_str_type(rec.type) && (!rec.size || buffer[rec_end - 1])) {
+            return FBP_ERROR_SYNTAX_ERROR;
+        }
+        offset = snapshot_align(rec_end);
+    }
+    return 0;
+}
+
+static int32_t snapshot_image_restore(struct fbp_pubsub_s * self, const uint8_t * buffer, uint32_t size) {
+    struct snapshot_hdr_s hdr;
+    struct snapshot_rec_s rec;
+    int32_t rc = snapshot_image_check(buffer, size);
+    if (rc) {
+        return rc;
+    }
+    fbp_memcpy(&hdr, buffer, sizeof(hdr));
+    uint32_t offset = sizeof(hdr);
+    for (uint32_t i = 0; i < hdr.count; ++i) {
+        fbp_memcpy(&rec, buffer + offset, sizeof(rec));
+        uint32_t payload_offset = offset + (uint32_t) sizeof(rec) + rec.topic_size;
+        const char * topic_str = (const char *) (buffer + offset + sizeof(rec));
+        snapshot_rec_apply(self, &rec, topic_str, buffer + payload_offset);
+        offset = snapshot_align(payload_offset + rec.size);
+    }
+    return 0;
+}
+
+int32_t fbp_pubsub_snapshot_restore(struct fbp_pubsub_s * self, const uint8_t * buffer, uint32_t size) {
+    struct snapshot_hdr_s hdr;
+    int32_t rc = 0;
+    if (!self || (!buffer && size)) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    lock(self);
+    while (size >= sizeof(hdr)) {
+        fbp_memcpy(&hdr, buffer, sizeof(hdr));
+        if (hdr.magic != SNAPSHOT_MAGIC) {
+            break;  // end of images, such as erased flash
+        }
+        if (hdr.version != SNAPSHOT_VERSION) {
+            rc = FBP_ERROR_NOT_SUPPORTED;
+            break;
+        }
+        if ((hdr.size < sizeof(hdr)) || (hdr.size > size)) {
+            rc = FBP_ERROR_INVALID_MESSAGE_LENGTH;
+            break;
+        }
+        rc = snapshot_image_restore(self, buffer, hdr.size);
+        if (rc) {
+            break;
+        }
+        buffer += hdr.size;
+        size -= hdr.size;
+    }
+    unlock(self);
+    return rc;
+}
+
+int32_t fbp_pubsub_stats_get(struct fbp_pubsub_s * self, struct fbp_pubsub_stats_s * stats) {
+    if (!self || !stats) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    lock(self);
+    *stats = self->stats;
+    unlock(self);
+    return 0;
+}
+
+static void profile_emit(const struct profile_s * p, struct fbp_pubsub_profile_s * e,
+                         fbp_pubsub_profile_fn cbk_fn, void * user_data) {
+    uint64_t freq = fbp_time_counter_frequency();
+    e->count = p->count;
+    e->time_total = FBP_COUNTER_TO_TIME(p->time_total, freq);
+    e->time_min = FBP_COUNTER_TO_TIME(p->time_min, freq);
+    e->time_avg = FBP_COUNTER_TO_TIME(p->time_total / p->count, freq);
+    e->time_max = FBP_COUNTER_TO_TIME(p->time_max, freq);
+    cbk_fn(user_data, e);
+}
+
+static void profile_dump(struct topic_s * topic, fbp_pubsub_profile_fn cbk_fn, void * user_data) {
+    char topic_str[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    struct fbp_pubsub_profile_s e;
+    struct fbp_list_s * item;
+    topic_path_build(topic, topic_str);
+    e.topic = topic_str;
+    if (topic->profile.count) {
+        e.cbk_fn = NULL;
+        e.cbk_user_data = NULL;
+        profile_emit(&topic->profile, &e, cbk_fn, user_data);
+    }
+    fbp_list_foreach(&topic->subscribers, item) {
+        struct subscriber_s * sub = FBP_CONTAINER_OF(item, struct subscriber_s, item);
+        if (sub->profile.count) {
+            e.cbk_fn = sub->cbk_fn;
+            e.cbk_user_data = sub->cbk_user_data;
+            profile_emit(&sub->profile, &e, cbk_fn, user_data);
+        }
+    }
+    fbp_list_foreach(&topic->children, item) {
+        profile_dump(FBP_CONTAINER_OF(item, struct topic_s, item), cbk_fn, user_data);
+    }
+}
+
+int32_t fbp_pubsub_stats_dump(struct fbp_pubsub_s * self, fbp_pubsub_profile_fn cbk_fn, void * user_data) {
+    if (!self || !cbk_fn) {
+        return FBP_ERROR_PARAMETER_INVALID;
     }
+    lock(self);
+    profile_dump(self->root_topic, cbk_fn, user_data);
+    unlock(self);
     return 0;
 }
 
+int32_t fbp_pubsub_stats_publish(struct fbp_pubsub_s * self) {
+    struct fbp_pubsub_stats_s stats;
+    int32_t rc = fbp_pubsub_stats_get(self, &stats);
+    if (rc) {
+        return rc;
+    }
+    struct fbp_pubsub_entry_s entries[] = {
+        {.topic = FBP_PUBSUB_STATS_MSG, .handle = NULL, .value = fbp_union_u32_r(stats.msg_count)},
+        {.topic = FBP_PUBSUB_STATS_QUEUE, .handle = NULL, .value = fbp_union_u32_r(stats.queue_depth_max)},
+        {.topic = FBP_PUBSUB_STATS_MRB, .handle = NULL, .value = fbp_union_u32_r(stats.mrb_used_max)},
+        {.topic = FBP_PUBSUB_STATS_DROP, .handle = NULL, .value = fbp_union_u32_r(stats.drop_count)},
+    };
+    return fbp_pubsub_publish_batch(self, entries, (uint32_t) (sizeof(entries) / sizeof(entries[0])));
+}
+
 static void req_forward(struct fbp_pubsub_s * self, uint8_t flag_mask, struct message_s * msg) {
     struct fbp_list_s * item;
     struct subscriber_s * subscriber;
@@ -866,8 +3061,7 @@ static int32_t metadata_top_req(void * user_data, const char * topic) {
 }
 
 static void publish_meta(struct fbp_pubsub_s * self, struct message_s * msg, size_t name_sz) {
-    char topic_prefix_str[FBP_TOPIC_LIST_LENGTH_MAX];
-    topic_str_base(msg->name, topic_prefix_str);
+    bool owned = topic_str_owned(self, msg->name);
     struct topic_s * t;
     uint8_t dtype = msg->value.type;
     if (name_sz == 1) {
@@ -878,7 +3072,7 @@ static void publish_meta(struct fbp_pubsub_s * self, struct message_s * msg, siz
         // metadata request topic
         msg->name[name_sz - 2] = 0;
         t = topic_find_existing_base(self, msg->name);
-        if (fbp_topic_list_contains(&self->topic_prefix, topic_prefix_str)) {
+        if (owned) {
             // we own this topic, fulfill metadata request
             metadata_req_handle(t, msg->name);
         } else {
@@ -888,7 +3082,7 @@ static void publish_meta(struct fbp_pubsub_s * self, struct message_s * msg, siz
         }
     } else {
         // metadata publish
-        if (fbp_topic_list_contains(&self->topic_prefix, topic_prefix_str)) {
+        if (owned) {
             // for us, retain as needed
             msg->name[name_sz - 1] = 0;
             t = topic_find(self, msg->name, true);
@@ -896,7 +3090,16 @@ static void publish_meta(struct fbp_pubsub_s * self, struct message_s * msg, siz
                 if ((dtype == FBP_UNION_JSON)
                     && (msg->value.flags & FBP_UNION_FLAG_RETAIN)
                     && (msg->value.flags & FBP_UNION_FLAG_CONST)) {
-                    t->meta = msg->value.value.str;
+                    if (t->meta != msg->value.value.str) {
+                        lock(self);  // for fbp_pubsub_snapshot_save()
+                        if (!t->meta || strcmp(t->meta, msg->value.value.str)) {
+                            t->dirty |= DIRTY_META;
+                        }
+                        t->meta = msg->value.value.str;
+                        unlock(self);
+                        fbp_pubsub_meta_free(t->validator);
+                        t->validator = fbp_pubsub_meta_compile(t->meta);
+                    }
                     // FBP_LOGD3("metadata retain: %s, %s, %s", msg->name, t->name, t->meta);
                 } else if (dtype == FBP_UNION_NULL) {
                     // query (cannot clear metadata)
@@ -904,9 +3107,14 @@ static void publish_meta(struct fbp_pubsub_s * self, struct message_s * msg, siz
                 metadata_rsp_handle(t, msg->name);
 
                 struct fbp_union_s default_value = fbp_union_null();
-                if ((0 == fbp_pubsub_meta_default(t->meta, &default_value)) && (default_value.type != FBP_UNION_NULL)) {
+                if (t->restored) {
+                    // keep the value restored from the snapshot
+                } else if ((0 == fbp_pubsub_meta_default(t->meta, &default_value)) && (default_value.type != FBP_UNION_NULL)) {
+                    lock(self);
+                    topic_path_set(self, t);
+                    unlock(self);
                     struct message_s * m = msg_alloc(self);
-                    fbp_cstr_copy(m->name, msg->name, sizeof(m->name));
+                    m->topic = t;
                     m->value = default_value;
                     m->value.op = OP_PUBLISH;
                     publish_normal(self, m);
@@ -947,37 +3155,20 @@ static void query_rsp_handle(struct topic_s * topic, char * topic_str) {
     topic_str[idx] = 0;
 }
 
-static void query_req_handle(struct topic_s * t, const char * topic) {
-    char t_str[FBP_TOPIC_LIST_LENGTH_MAX];
-    if (!t) {
-        return;
-    }
-    fbp_cstr_copy(t_str, topic, sizeof(t_str));
-    size_t topic_str_len = strlen(t_str);
-    char * topic_str_last = t_str + topic_str_len;
-    struct fbp_list_s * item;
-    struct topic_s * subtopic;
-    fbp_list_foreach(&t->children, item) {
-        subtopic = FBP_CONTAINER_OF(item, struct topic_s, item);
-        topic_str_append(t_str, subtopic->name);
-        query_rsp_handle(subtopic, t_str);
-        query_req_handle(subtopic, t_str);  // recursive decent
-        *topic_str_last = 0;  // reset string to original
+static void query_req_handle(struct fbp_pubsub_s * self, struct topic_s * t) {
+    if (t) {
+        walk_add(self, WALK_QUERY, t, NULL, NULL);
     }
 }
 
 static int32_t query_top_req(void * user_data, const char * topic) {
     struct fbp_pubsub_s * self = (struct fbp_pubsub_s *) user_data;
-    struct topic_s * t = topic_find(self, topic, false);
-    if (t) {
-        query_req_handle(t, topic);
-    }
+    query_req_handle(self, topic_find(self, topic, false));
     return 0;
 }
 
 static void publish_query(struct fbp_pubsub_s * self, struct message_s * msg, size_t name_sz) {
-    char topic_prefix_str[FBP_TOPIC_LIST_LENGTH_MAX];
-    topic_str_base(msg->name, topic_prefix_str);
+    bool owned = topic_str_owned(self, msg->name);
     struct topic_s * t;
     if (name_sz == 1) {
         // query request root, respond with our owned topics
@@ -987,30 +3178,30 @@ static void publish_query(struct fbp_pubsub_s * self, struct message_s * msg, si
         // query request topic
         msg->name[name_sz - 2] = 0;
         t = topic_find_existing_base(self, msg->name);
-        if (fbp_topic_list_contains(&self->topic_prefix, topic_prefix_str)) {
+        if (owned) {
             // we own this topic, fulfill metadata request
-            query_req_handle(t, msg->name);
+            query_req_handle(self, t);
         } else {
             // not for us, forward request to link subscribers
             msg->name[name_sz - 2] = '/';
             req_forward(self, FBP_PUBSUB_SFLAG_QUERY_REQ, msg);
         }
     } else {  // query response
-        if (fbp_topic_list_contains(&self->topic_prefix, topic_prefix_str)) {
+        if (owned) {
             rsp_forward(self, FBP_PUBSUB_SFLAG_QUERY_RSP, msg);
         }
     }
 }
 
-static void publish_error(struct fbp_pubsub_s * self, struct message_s * msg, size_t name_sz, bool external) {
+static void publish_error(struct fbp_pubsub_s * self, struct message_s * msg, char * name, size_t name_sz, bool external) {
     struct fbp_list_s * item;
     struct subscriber_s * subscriber;
-    if (!name_sz || (msg->name[name_sz - 1] != FBP_PUBSUB_CHAR_RETURN_CODE)) {
-        FBP_LOGW("invalid publish_error: %s", msg->name);
+    if (!name_sz || (name[name_sz - 1] != FBP_PUBSUB_CHAR_RETURN_CODE)) {
+        FBP_LOGW("invalid publish_error: %s", name);
     }
-    msg->name[name_sz - 1] = 0;
-    struct topic_s * t = topic_find_existing_base(self, msg->name);
-    msg->name[name_sz - 1] = FBP_PUBSUB_CHAR_RETURN_CODE;
+    name[name_sz - 1] = 0;
+    struct topic_s * t = topic_find_existing_base(self, name);
+    name[name_sz - 1] = FBP_PUBSUB_CHAR_RETURN_CODE;
 
     while (t) {
         fbp_list_foreach(&t->subscribers, item) {
@@ -1020,31 +3211,65 @@ static void publish_error(struct fbp_pubsub_s * self, struct message_s * msg, si
                 continue;
             }
             if (subscriber->flags & FBP_PUBSUB_SFLAG_RETURN_CODE) {
-                subscriber->cbk_fn(subscriber->cbk_user_data, msg->name, &msg->value);
+                subscriber->cbk_fn(subscriber->cbk_user_data, name, &msg->value);
             }
         }
         t = t->parent;
     }
 }
 
-static uint8_t publish(struct topic_s * topic, struct message_s * msg) {
+static void profile_update(struct profile_s * p, uint64_t duration) {
+    if (!p->count || (duration < p->time_min)) {
+        p->time_min = duration;
+    }
+    if (duration > p->time_max) {
+        p->time_max = duration;
+    }
+    p->time_total += duration;
+    ++p->count;
+}
+
+static uint8_t publish(struct fbp_pubsub_s * self, struct topic_s * topic, const char * topic_str, struct message_s * msg) {
     uint8_t status = 0;
-    struct fbp_list_s * item;
-    struct subscriber_s * subscriber;
-    while (topic) {
-        fbp_list_foreach(&topic->subscribers, item) {
-            subscriber = FBP_CONTAINER_OF(item, struct subscriber_s, item);
-            if ((msg->src_fn == subscriber->cbk_fn) && (msg->src_user_data == subscriber->cbk_user_data)) {
+    bool stats = self->stats_enable;
+    uint64_t t_start = stats ? fbp_time_counter_u64() : 0;
+    uint64_t t_cbk = t_start;
+    if (!topic->dispatch_valid) {
+        lock(self);  // for fbp_pubsub_unsubscribe()
+        dispatch_build(topic);
+        unlock(self);
+    }
+    for (uint32_t i = 0; i < topic->dispatch_count; ++i) {
+        const struct dispatch_s * d = &topic->dispatch[i];
+        if ((msg->src_fn == d->cbk_fn) && (msg->src_user_data == d->cbk_user_data)) {
+            continue;
+        }
+        if (!topic->dispatch_valid) {
+            // a callback unsubscribed, skip removed subscribers
+            const struct subscriber_s * subscriber = d->subscriber;
+            if ((subscriber->cbk_fn != d->cbk_fn) || (subscriber->cbk_user_data != d->cbk_user_data)
+                    || !(subscriber->flags & FBP_PUBSUB_SFLAG_PUB)) {
                 continue;
             }
-            if (subscriber->flags & FBP_PUBSUB_SFLAG_PUB) {
-                uint8_t rv = subscriber->cbk_fn(subscriber->cbk_user_data, msg->name, &msg->value);
-                if (!status && rv) {
-                    status = rv;
-                }
-            }
         }
-        topic = topic->parent;
+        if (stats) {
+            t_cbk = fbp_time_counter_u64();
+        }
+        uint8_t rv = 0;
+        if (d->executor) {
+            executor_push(d->executor, d->subscriber, d->cbk_fn, d->cbk_user_data, topic_str, &msg->value);
+        } else {
+            rv = d->cbk_fn(d->cbk_user_data, topic_str, &msg->value);
+        }
+        if (stats) {
+            profile_update(&d->subscriber->profile, fbp_time_counter_u64() - t_cbk);
+        }
+        if (!status && rv) {
+            status = rv;
+        }
+    }
+    if (stats) {
+        profile_update(&topic->profile, fbp_time_counter_u64() - t_start);
     }
     return status;
 }
@@ -1052,62 +3277,114 @@ static uint8_t publish(struct topic_s * topic, struct message_s * msg) {
 static void publish_normal(struct fbp_pubsub_s * self, struct message_s * msg) {
     uint8_t status = 0;
     bool do_publish = true;
-    struct topic_s * t = topic_find(self, msg->name, true);
+    struct topic_s * t = msg->topic;
+    const char * topic_str = t ? t->path : msg->name;
+    if (!t) {
+        t = topic_find(self, msg->name, true);
+    }
     if (t) {
-        if (t->meta) {  // validate values using metadata
+        if (t->validator) {  // validate values using compiled metadata
+            if (fbp_pubsub_meta_validate(t->validator, &msg->value)) {
+                status = FBP_ERROR_PARAMETER_INVALID;
+            }
+        } else if (t->meta) {  // could not compile, let the parser report errors
             if (fbp_pubsub_meta_value(t->meta, &msg->value)) {
                 status = FBP_ERROR_PARAMETER_INVALID;
             }
         }
         if (!status) {
+            lock(self);  // for fbp_pubsub_snapshot_save() and fbp_pubsub_query()
             if (msg->value.flags & FBP_UNION_FLAG_RETAIN) {
                 if (fbp_union_eq(&t->value, &msg->value)) {
                     do_publish = false;
                 } else {
-                    if (fbp_union_is_type_ptr(&msg->value) && (0 == (msg->value.flags & FBP_UNION_FLAG_CONST))) {
-                        FBP_LOGW("%s retain ptr but not const", msg->name);
+                    if (is_ref(&msg->value)) {
+                        fbp_pubsub_buf_incr(msg->value.value.bin);
+                    } else if (fbp_union_is_type_ptr(&msg->value) && (0 == (msg->value.flags & FBP_UNION_FLAG_CONST))) {
+                        FBP_LOGW("%s retain ptr but not const", topic_str);
+                    }
+                    if (is_ref(&t->value)) {
+                        fbp_pubsub_buf_decr(t->value.value.bin);
                     }
                     t->value = msg->value;
+                    t->dirty |= DIRTY_VALUE;
+                    t->restored = false;
                 }
             } else {
+                if (is_ref(&t->value)) {
+                    fbp_pubsub_buf_decr(t->value.value.bin);
+                }
+                if (t->value.flags & FBP_UNION_FLAG_RETAIN) {
+                    t->dirty |= DIRTY_VALUE;
+                }
                 t->value = fbp_union_null();
+                t->restored = false;
+            }
+            unlock(self);
+            if (t->history) {
+                history_add(self, t, &msg->value);
             }
             if (do_publish) {
-                status = publish(t, msg);
+                status = publish(self, t, topic_str, msg);
             }
         }
+    } else if (topic_pool_full(self)) {
+        atomic_add_u32(&self->stats.drop_count, 1);
+        status = FBP_ERROR_NOT_ENOUGH_MEMORY;
     }
 
-    char topic_str[FBP_TOPIC_LIST_LENGTH_MAX];
-    topic_str_base(msg->name, topic_str);
-    if (status || (self->return_code && fbp_topic_list_contains(&self->topic_prefix, topic_str))) {
+    if (!status && !self->return_code) {
+        return;
+    }
+    bool owned = t ? t->owned : topic_str_owned(self, msg->name);
+    if (status || owned) {
         // send return code message
-        size_t topic_sz = strlen(msg->name);
-        msg->name[topic_sz] = FBP_PUBSUB_CHAR_RETURN_CODE;
-        msg->name[topic_sz + 1] = 0;
+        char name[FBP_PUBSUB_TOPIC_LENGTH_MAX + 1];  // + FBP_PUBSUB_CHAR_RETURN_CODE
+        size_t topic_sz = 0;
+        topic_str_copy(name, topic_str, &topic_sz);
+        name[topic_sz] = FBP_PUBSUB_CHAR_RETURN_CODE;
+        name[topic_sz + 1] = 0;
         msg->value = fbp_union_i32((int32_t) status);
-        publish_error(self, msg, topic_sz + 1, false);
+        publish_error(self, msg, name, topic_sz + 1, false);
     }
 }
 
 static void subscribe(struct fbp_pubsub_s * self, struct message_s * msg) {
     struct topic_s * t;
+    struct pattern_s * pattern = pattern_compile(self, msg->name, true);
     t = topic_find(self, msg->name, true);
     if (!t) {
         FBP_LOGE("could not find/create subscribe topic");
+        if (pattern) {
+            fbp_free(pattern);
+        }
         return;
     }
 
+    uint8_t flags = (uint8_t) msg->value.value.u32;
+    lock(self);  // for fbp_pubsub_unsubscribe(), which frees subscribers
     struct subscriber_s * sub = subscriber_alloc(self);
-    sub->flags = (uint32_t) msg->value.value.u32;
+    if (!sub) {
+        unlock(self);
+        FBP_LOGE("could not allocate subscriber");
+        if (pattern) {
+            fbp_free(pattern);
+        }
+        return;
+    }
+    sub->flags = flags;
     sub->cbk_fn = msg->src_fn;
     sub->cbk_user_data = msg->src_user_data;
+    sub->pattern = pattern;
+    sub->executor = msg->executor;
     fbp_list_add_tail(&t->subscribers, &sub->item);
-
-    if (sub->flags & FBP_PUBSUB_SFLAG_RETAIN) {
+    dispatch_invalidate(t);
+    if (flags & FBP_PUBSUB_SFLAG_RETAIN) {
+        // before unlock, so fbp_pubsub_unsubscribe() cancels the walk with sub
         FBP_LOGI("subscribe traverse \"%s\"", msg->name);
-        subscribe_traverse(t, msg->name, sub->cbk_fn, sub->cbk_user_data);
+        walk_add(self, WALK_RETAIN, t, pattern, sub);
     }
+    unlock(self);
 }
 
 static void process_one(struct fbp_pubsub_s * self, struct message_s * msg) {
@@ -1132,10 +3409,15 @@ static void process_one(struct fbp_pubsub_s * self, struct message_s * msg) {
         case FBP_UNION_I32: break;
         case FBP_UNION_I64: break;
         default:
-            FBP_LOGW("unsupported type for %s: %d", msg->name, (int) msg->value.type);
+            FBP_LOGW("unsupported type for %s: %d", msg->topic ? msg->topic->path : msg->name, (int) msg->value.type);
             return;
     }
 
+    if (msg->topic) {  // resolved by the publisher
+        publish_normal(self, msg);
+        return;
+    }
+
     size_t name_sz = strlen(msg->name);  // excluding terminator
     if (msg->value.op == OP_PUBLISH) {
         if (0 == name_sz) {
@@ -1144,7 +3426,7 @@ static void process_one(struct fbp_pubsub_s * self, struct message_s * msg) {
             switch (msg->name[name_sz - 1]) {
                 case FBP_PUBSUB_CHAR_METADATA: publish_meta(self, msg, name_sz); break;
                 case FBP_PUBSUB_CHAR_QUERY: publish_query(self, msg, name_sz); break;
-                case FBP_PUBSUB_CHAR_RETURN_CODE: publish_error(self, msg, name_sz, true); break;
+                case FBP_PUBSUB_CHAR_RETURN_CODE: publish_error(self, msg, msg->name, name_sz, true); break;
                 default: publish_normal(self, msg); break;
             }
         }
@@ -1155,33 +3437,94 @@ static void process_one(struct fbp_pubsub_s * self, struct message_s * msg) {
     }
 }
 
-void fbp_pubsub_process(struct fbp_pubsub_s * self) {
-    struct fbp_list_s * item;
-    struct message_s * msg;
-    while (1) {
-        lock(self);
-        item = fbp_list_remove_head(&self->msg_pend);
-        unlock(self);
-        if (!item) {
-            return;
+/**
+ * @brief Visit the next topic for the oldest pending traversal.
+ *
+ * @param self The instance.
+ *
+ * Advance the traversal before any callbacks, since callbacks
+ * may publish and process recursively.
+ */
+static void walk_step(struct fbp_pubsub_s * self) {
+    char topic_str[FBP_TOPIC_LIST_LENGTH_MAX];
+    lock(self);  // for walk_cancel
+    struct walk_s * w = self->walk_head;
+    struct topic_s * t = w->topic;
+    uint8_t op = w->op;
+    fbp_pubsub_subscribe_fn cbk_fn = w->cbk_fn;
+    void * cbk_user_data = w->cbk_user_data;
+    struct fbp_pubsub_executor_s * executor = w->executor;
+    const struct subscriber_s * subscriber = w->subscriber;
+    bool match = cbk_fn && t && pattern_match(w->pattern, w->root, t);
+    w->topic = t ? walk_next(w->root, t) : NULL;
+    if (!w->topic || ((op == WALK_RETAIN) && !cbk_fn)) {
+        self->walk_head = w->next;
+        if (!self->walk_head) {
+            self->walk_tail = NULL;
+        }
+    } else {
+        w = NULL;
+    }
+    unlock(self);
+    if (w) {
+        walk_free(self, w);
+    }
+    if (!t || (t->value.type == FBP_UNION_NULL)) {
+        return;
+    }
+    topic_path_build(t, topic_str);
+    if (op == WALK_QUERY) {
+        query_rsp_handle(t, topic_str);
+    } else if (match && (t->value.flags & FBP_UNION_FLAG_RETAIN)) {
+        if (executor) {
+            executor_push(executor, subscriber, cbk_fn, cbk_user_data, topic_str, &t->value);
+        } else {
+            cbk_fn(cbk_user_data, topic_str, &t->value);
         }
-        msg = FBP_CONTAINER_OF(item, struct message_s, item);
-        process_one(self, msg);
+    }
+}
 
-        // free message and any buffer
-        lock(self);
-        if (is_ptr_type(msg->value.type) && (0 == (msg->value.flags & FBP_UNION_FLAG_CONST))) {
-            uint32_t sz = 0;
-            uint8_t * buf = fbp_rbm_pop(&self->mrb, &sz);
-            if ((buf != msg->value.value.bin) || (sz != msg->value.size)) {
-                FBP_LOGE("internal msgbuf sync error");
+static bool msg_pending(struct fbp_pubsub_s * self) {
+    struct message_s * tail = self->msg_pend_tail;
+    return (tail != &self->msg_pend_stub) || (NULL != atomic_load_ptr(&tail->next));
+}
+
+bool fbp_pubsub_process_budget(struct fbp_pubsub_s * self, uint32_t max_messages, int64_t max_time) {
+    struct message_s * msg;
+    uint32_t count = 0;
+    uint64_t t_end = 0;
+    if (max_time > 0) {
+        t_end = fbp_time_counter_u64() + (uint64_t) FBP_TIME_TO_COUNTER(max_time, fbp_time_counter_frequency());
+    }
+    while (1) {
+        if (self->walk_head) {
+            // finish traversals before later messages to preserve order
+            walk_step(self);
+        } else if (NULL != (msg = msg_pop(self))) {
+            if (msg->counted) {
+                msg_stats_update(self);
+            }
+            if (msg->value.op == OP_CONFLATE) {
+                conflate_take(self, msg);
             }
+            struct fbp_union_s value = msg->value;  // return code responses overwrite msg->value
+            process_one(self, msg);
+            msg_value_free(self, msg, &value);
+            msg_free(self, msg);
+        } else {
+            return false;
+        }
+        ++count;
+        if ((max_messages && (count >= max_messages)) || (t_end && (fbp_time_counter_u64() >= t_end))) {
+            return (NULL != self->walk_head) || msg_pending(self);
         }
-        fbp_list_add_tail(&self->msg_free, item);
-        unlock(self);
     }
 }
 
+void fbp_pubsub_process(struct fbp_pubsub_s * self) {
+    fbp_pubsub_process_budget(self, 0, 0);
+}
+
 void fbp_pubsub_register_mutex(struct fbp_pubsub_s * self, fbp_os_mutex_t mutex) {
     self->mutex = mutex;
 }
@@ -18,6 +18,7 @@
 #include "fitterbap/cstr.h"
 #include "fitterbap/ec.h"
 #include "fitterbap/json.h"
+#include "fitterbap/platform.h"
 
 
 struct dtype_map_s {
@@ -287,3 +288,209 @@ int32_t fbp_pubsub_meta_value(const char * meta, struct fbp_union_s * value) {
     };
     return fbp_json_parse(meta, on_value, &self);
 }
+
+
+enum validator_kind_e {
+    VALIDATOR_NONE,     // no dtype, accept all values unchanged
+    VALIDATOR_BOOL,     // convert to u8 0 or 1
+    VALIDATOR_DTYPE,    // dtype with optional options
+    VALIDATOR_ERROR,    // reject all values with rc
+};
+
+struct validator_match_s {
+    struct fbp_union_s token;   // widened option value or alias, strings in the pool
+    uint32_t option_idx;
+};
+
+struct fbp_pubsub_meta_validator_s {
+    uint8_t kind;               // validator_kind_e
+    uint8_t dtype;
+    uint8_t has_options;
+    int32_t rc;                 // for VALIDATOR_ERROR
+    uint32_t option_count;
+    uint32_t match_count;
+    union fbp_union_inner_u * options;
+    struct validator_match_s * matches;
+    // followed by the options, matches, and strings storage
+};
+
+struct compile_s {
+    uint8_t state;  // value_state_e
+    uint8_t depth;
+    uint8_t array_idx;
+    uint8_t kind;
+    uint8_t dtype;
+    uint8_t has_options;
+    int32_t rc;
+    uint32_t option_count;
+    uint32_t match_count;
+    uint32_t string_size;
+    struct fbp_pubsub_meta_validator_s * v;  // NULL when counting
+    char * strings;
+};
+
+static void compile_match_add(struct compile_s * s, const struct fbp_union_s * token) {
+    if (s->v) {
+        struct validator_match_s * m = &s->v->matches[s->match_count];
+        m->token = *token;
+        m->option_idx = s->option_count - 1;
+        if (token->type == FBP_UNION_STR) {
+            char * str = s->strings + s->string_size;
+            fbp_memcpy(str, token->value.str, token->size - 1);
+            str[token->size - 1] = 0;
+            m->token.value.str = str;
+        }
+        fbp_union_widen(&m->token);
+    }
+    if (token->type == FBP_UNION_STR) {
+        s->string_size += token->size;
+    }
+    ++s->match_count;
+}
+
+// Follows on_value() so that the compiled validator behaves identically.
+static int32_t on_compile(void * user_data, const struct fbp_union_s * token) {
+    int32_t rc = 0;
+    struct compile_s * s = (struct compile_s *) user_data;
+    struct fbp_union_s t;
+    switch (token->op) {
+        case FBP_JSON_VALUE:
+            if (s->state == VALUE_ST_DTYPE_KEY) {
+                if (fbp_cstr_starts_with(token->value.str, "bool")) {
+                    s->kind = VALIDATOR_BOOL;
+                    rc = FBP_ERROR_ABORTED;
+                } else {
+                    rc = dtype_lookup(token, &s->dtype);
+                    if (rc) {
+                        s->kind = VALIDATOR_ERROR;
+                        s->rc = rc;
+                        rc = FBP_ERROR_ABORTED;
+                    } else {
+                        s->kind = VALIDATOR_DTYPE;
+                        s->state = VALUE_ST_SEARCH;
+                    }
+                }
+            } else if (s->state == VALUE_ST_OPTIONS_VAL) {
+                if (0 == s->array_idx++) {
+                    t = *token;
+                    if (fbp_union_as_type(&t, s->dtype)) {
+                        // values only reach this option without an earlier match
+                        return FBP_ERROR_ABORTED;
+                    }
+                    if (s->v) {
+                        s->v->options[s->option_count] = t.value;
+                    }
+                    ++s->option_count;
+                }
+                compile_match_add(s, token);
+            }
+            break;
+        case FBP_JSON_KEY:
+            if ((s->state == VALUE_ST_DTYPE_SEARCH) && (s->depth == 1) && (0 == fbp_json_strcmp("dtype", token))) {
+                s->state = VALUE_ST_DTYPE_KEY;
+            } else if ((s->state == VALUE_ST_SEARCH) && (s->depth == 1) && (0 == fbp_json_strcmp("range", token))) {
+                s->state = VALUE_ST_RANGE_KEY;  // parsed but not enforced by on_value()
+            } else if ((s->state == VALUE_ST_SEARCH) && (s->depth == 1) && (0 == fbp_json_strcmp("options", token))) {
+                s->state = VALUE_ST_OPTIONS;
+                s->has_options = 1;
+            }
+            break;
+        case FBP_JSON_OBJ_START: s->depth++; break;
+        case FBP_JSON_OBJ_END: s->depth--; break;
+        case FBP_JSON_ARRAY_START:
+            s->depth++;
+            if ((s->state == VALUE_ST_OPTIONS) && (s->depth == 3)) {
+                s->array_idx = 0;
+                s->state = VALUE_ST_OPTIONS_VAL;
+            }
+            if (s->state == VALUE_ST_RANGE_KEY) {
+                s->state = VALUE_ST_RANGE_VAL;
+            }
+            break;
+        case FBP_JSON_ARRAY_END:
+            if ((s->state == VALUE_ST_OPTIONS_VAL) && (s->depth == 3)) {
+                s->state = VALUE_ST_OPTIONS;
+            } else if ((s->state == VALUE_ST_OPTIONS) && (s->depth == 2)) {
+                s->state = VALUE_ST_SEARCH;
+            } else if ((s->state == VALUE_ST_RANGE_VAL) && (s->depth == 2)) {
+                s->state = VALUE_ST_SEARCH;
+            }
+            s->depth--;
+            break;
+        default: break;
+    }
+    return rc;
+}
+
+struct fbp_pubsub_meta_validator_s * fbp_pubsub_meta_compile(const char * meta) {
+    if (!meta) {
+        return NULL;
+    }
+    struct compile_s s;
+    fbp_memset(&s, 0, sizeof(s));
+    if (fbp_json_parse(meta, on_compile, &s)) {
+        return NULL;  // let fbp_pubsub_meta_value() report the error
+    }
+    uint32_t option_count = s.option_count;
+    uint32_t match_count = s.match_count;
+    size_t sz = sizeof(struct fbp_pubsub_meta_validator_s)
+            + option_count * sizeof(union fbp_union_inner_u)
+            + match_count * sizeof(struct validator_match_s)
+            + s.string_size;
+    struct fbp_pubsub_meta_validator_s * v = fbp_alloc_clr((fbp_size_t) sz);
+    v->options = (union fbp_union_inner_u *) (v + 1);
+    v->matches = (struct validator_match_s *) (v->options + option_count);
+
+    fbp_memset(&s, 0, sizeof(s));
+    s.v = v;
+    s.strings = (char *) (v->matches + match_count);
+    fbp_json_parse(meta, on_compile, &s);
+    v->kind = s.kind;
+    v->dtype = s.dtype;
+    v->has_options = s.has_options;
+    v->rc = s.rc;
+    v->option_count = s.option_count;
+    v->match_count = s.match_count;
+    return v;
+}
+
+int32_t fbp_pubsub_meta_validate(const struct fbp_pubsub_meta_validator_s * v, struct fbp_union_s * value) {
+    if (!v || !value) {
+        return FBP_ERROR_PARAMETER_INVALID;
+    }
+    switch (v->kind) {
+        case VALIDATOR_NONE:
+            return 0;
+        case VALIDATOR_BOOL: {
+            bool val_bool = false;
+            int32_t rc = fbp_union_to_bool(value, &val_bool);
+            if (!rc) {
+                value->type = FBP_UNION_U8;
+                value->value.u8 = val_bool ? 1 : 0;
+            }
+            return rc;
+        }
+        case VALIDATOR_DTYPE:
+            break;
+        default:
+            return v->rc;
+    }
+    if (!v->has_options) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < v->match_count; ++i) {
+        const struct validator_match_s * m = &v->matches[i];
+        if (fbp_union_equiv(value, &m->token)) {
+            value->value.u64 = v->options[m->option_idx].u64;
+            value->type = v->dtype;
+            return 0;
+        }
+    }
+    return FBP_ERROR_PARAMETER_INVALID;
+}
+
+void fbp_pubsub_meta_free(struct fbp_pubsub_meta_validator_s * v) {
+    if (v) {
+        fbp_free(v);
+    }
+}
@@ -240,6 +240,28 @@ static void test_multiple_data_one_buffer(void ** state) {
     self->f->recv(self->f, b, p - b);
 }
 
+static void test_construct_datav(void ** state) {
+    struct test_s *self = (struct test_s *) *state;
+    uint8_t b1[FBP_FRAMER_MAX_SIZE];
+    uint8_t b2[FBP_FRAMER_MAX_SIZE];
+    uint16_t b1_size = sizeof(b1);
+    uint16_t b2_size = sizeof(b2);
+    struct fbp_iovec_s iov[3] = {
+            {.buf = PAYLOAD1, .size = 1},
+            {.buf = PAYLOAD1 + 1, .size = 0},
+            {.buf = PAYLOAD1 + 1, .size = sizeof(PAYLOAD1) - 1},
+    };
+    assert_int_equal(0, self->f->construct_data(self->f, b1, &b1_size, 7, 0x1234, PAYLOAD1, sizeof(PAYLOAD1)));
+    assert_int_equal(0, self->f->construct_datav(self->f, b2, &b2_size, 7, 0x1234, iov, 3));
+    assert_int_equal(b1_size, b2_size);
+    assert_memory_equal(b1, b2, b1_size);
+    self->f->recv(self->f, b2, b2_size);
+    expect_data(7, 0x1234, PAYLOAD1, sizeof(PAYLOAD1));
+    send_eof(self->f);
+    b2_size = sizeof(b2);
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, self->f->construct_datav(self->f, b2, &b2_size, 7, 0x1234, iov, 0));
+}
+
 static void test_sofs_data(void ** state) {
     struct test_s *self = (struct test_s *) *state;
     self->f->recv(self->f, SOF1_64, sizeof(SOF1_64));
@@ -402,6 +424,7 @@ int main(void) {
             cmocka_unit_test_setup_teardown(test_data, setup, teardown),
             cmocka_unit_test_setup_teardown(test_construct_data_buffer_too_small, setup, teardown),
             cmocka_unit_test_setup_teardown(test_multiple_data_one_buffer, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_construct_datav, setup, teardown),
             cmocka_unit_test_setup_teardown(test_sofs_data, setup, teardown),
             cmocka_unit_test_setup_teardown(test_data_split, setup, teardown),
             cmocka_unit_test_setup_teardown(test_data_truncated_data, setup, teardown),
@@ -19,10 +19,14 @@
 #include <setjmp.h>
 #include <cmocka.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include "fitterbap/comm/port0.h"
 #include "fitterbap/comm/data_link.h"
+#include "fitterbap/comm/timesync.h"
 #include "fitterbap/comm/transport.h"
 #include "fitterbap/cdef.h"
+#include "fitterbap/crc.h"
 #include "fitterbap/ec.h"
 #include "fitterbap/pubsub.h"
 #include "fitterbap/platform.h"
@@ -54,6 +58,11 @@ struct fbp_transport_s {
     int64_t timestamp;
     uint64_t counter;
     struct ev_s events[EVENT_COUNT_MAX];
+    bool credit_enable;
+    fbp_transport_credit_fn credit_fn;
+    void * credit_user_data;
+    uint32_t credit_grant[FBP_TRANSPORT_PORT_MAX + 1];
+    struct fbp_ts_status_s ts_status;
 };
 
 struct fbp_transport_s * instance_;
@@ -61,10 +70,14 @@ struct fbp_transport_s * instance_;
 #define META_PORT0 "{\"type\":\"oam\", \"name\": \"oam\"}"
 #define META_PORT1 "{\"type\":\"pubsub\", \"name\": \"pubsub\"}"
 
+#define META_PORT2_SIZE (600)  // requires segmentation
+static char META_PORT2[META_PORT2_SIZE];
+
 #define META_MSG_PORT0 "\x20" META_PORT0
 #define META_MSG_PORT1 "\x21" META_PORT1
 #define TX_WINDOW_SIZE 16
 #define RX_WINDOW_SIZE 12
+#define SERVER_FEATURES (FBP_PORT0_FEATURE_META_DIGEST | FBP_PORT0_FEATURE_CREDIT)
 
 uint32_t fbp_time_counter_frequency_() {
     return 1000;
@@ -86,6 +99,12 @@ void fbp_ts_update(struct fbp_ts_s * self, uint64_t src_tx, int64_t tgt_rx, int6
     (void) src_rx;
 }
 
+int32_t fbp_ts_status_get(struct fbp_ts_s * self, struct fbp_ts_status_s * status) {
+    (void) self;
+    *status = instance_->ts_status;
+    return 0;
+}
+
 void fbp_dl_reset_tx_from_event(struct fbp_dl_s * dl_ptr) {
     if (!instance_->p2) {
         intptr_t dl = (intptr_t) dl_ptr;
@@ -138,6 +157,35 @@ void fbp_transport_event_inject(struct fbp_transport_s * self, enum fbp_dl_event
 #define expect_dl_event_inject(dl_, event_) \
     expect_value(fbp_transport_event_inject, event, event_);
 
+void fbp_transport_credit_enable(struct fbp_transport_s * self, bool enable) {
+    (void) self;
+    instance_->credit_enable = enable;
+}
+
+void fbp_transport_register_credit_fn(struct fbp_transport_s * self, fbp_transport_credit_fn fn, void * user_data) {
+    (void) self;
+    instance_->credit_fn = fn;
+    instance_->credit_user_data = user_data;
+}
+
+uint32_t fbp_transport_credit_grant_take(struct fbp_transport_s * self, uint8_t port_id) {
+    (void) self;
+    uint32_t grant = instance_->credit_grant[port_id];
+    instance_->credit_grant[port_id] = 0;
+    return grant;
+}
+
+int32_t fbp_transport_port_credit_return(struct fbp_transport_s * self, uint8_t port_id, uint32_t credits) {
+    (void) self;
+    check_expected(port_id);
+    check_expected(credits);
+    return 0;
+}
+
+#define expect_credit_return(port_id_, credits_) \
+    expect_value(fbp_transport_port_credit_return, port_id, port_id_); \
+    expect_value(fbp_transport_port_credit_return, credits, credits_)
+
 int64_t fbp_time_utc_() {
     return instance_->timestamp;
 }
@@ -147,6 +195,7 @@ const char * fbp_transport_meta_get(struct fbp_transport_s * self, uint8_t port_
     switch (port_id) {
         case 0: return META_PORT0;
         case 1: return META_PORT1;
+        case 2: return META_PORT2;
         default: return NULL;
     }
 }
@@ -159,6 +208,10 @@ void fbp_os_mutex_unlock_(fbp_os_mutex_t mutex) {
     (void) mutex;
 }
 
+void fbp_os_sleep_(int64_t duration) {
+    (void) duration;
+}
+
 static int32_t ll_send(struct fbp_transport_s * t,
                        uint8_t port_id,
                        enum fbp_transport_seq_e seq,
@@ -173,6 +226,26 @@ static int32_t ll_send(struct fbp_transport_s * t,
     return 0;
 }
 
+static uint32_t iov_gather(uint8_t * buf, struct fbp_iovec_s const *iov, uint32_t iov_count) {
+    uint32_t sz = 0;
+    for (uint32_t i = 0; i < iov_count; ++i) {
+        memcpy(buf + sz, iov[i].buf, iov[i].size);
+        sz += iov[i].size;
+    }
+    assert_true(sz <= FBP_FRAMER_PAYLOAD_MAX_SIZE);
+    return sz;
+}
+
+static int32_t ll_sendv(struct fbp_transport_s * t,
+                        uint8_t port_id,
+                        enum fbp_transport_seq_e seq,
+                        uint8_t port_data,
+                        struct fbp_iovec_s const *iov, uint32_t iov_count) {
+    uint8_t msg[FBP_FRAMER_PAYLOAD_MAX_SIZE];
+    uint32_t msg_size = iov_gather(msg, iov, iov_count);
+    return ll_send(t, port_id, seq, port_data, msg, msg_size);
+}
+
 #define expect_send(_port_id, _seq, _port_data, _msg_data, _msg_size)  \
     expect_value(ll_send, port_id, _port_id);                          \
     expect_value(ll_send, seq, _seq);                                  \
@@ -261,6 +334,12 @@ static void setup_evm(struct fbp_transport_s * self) {
 
 static int setup(void ** state) {
     (void) state;
+    if (!META_PORT2[0]) {
+        memset(META_PORT2, 'x', sizeof(META_PORT2) - 1);
+        const char * prefix = "{\"type\":\"msg\", \"name\": \"";
+        memcpy(META_PORT2, prefix, strlen(prefix));
+        memcpy(META_PORT2 + sizeof(META_PORT2) - 3, "\"}", 2);
+    }
     struct fbp_transport_s * self = fbp_alloc_clr(sizeof(struct fbp_transport_s));
     instance_ = self;
     setup_evm(self);
@@ -282,9 +361,9 @@ static int teardown(void ** state) {
 
 #define INITIALIZE(mode_) \
     struct fbp_transport_s * self = (struct fbp_transport_s *) *state; \
-    struct fbp_pubsub_s * pubsub = fbp_pubsub_initialize("h", 1024);   \
+    struct fbp_pubsub_s * pubsub = fbp_pubsub_initialize("h", 4096);   \
     assert_non_null(pubsub);                                           \
-    struct fbp_port0_s * p = fbp_port0_initialize(FBP_PORT0_MODE_##mode_, &self->dl1, &self->evm, self, ll_send, pubsub, "h/c0/", NULL); \
+    struct fbp_port0_s * p = fbp_port0_initialize(FBP_PORT0_MODE_##mode_, &self->dl1, &self->evm, self, ll_sendv, pubsub, "h/c0/", NULL); \
     assert_non_null(p); \
     self->p1 = p
 
@@ -319,19 +398,20 @@ static void server_timestamp(struct fbp_transport_s * self) {
     fbp_port0_on_recv_cbk(self->p1, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(ECHO), echo, sizeof(echo));     \
 }
 
-static void test_server_connect(void ** state) {
-    INITIALIZE(SERVER);
+static void server_connect(struct fbp_transport_s * self) {
+    struct fbp_port0_s * p = self->p1;
 
     // disconnected -> negotiate
     fbp_port0_on_event_cbk(p, FBP_DL_EV_CONNECTED);
 
     // process tick to initiate negotiation req
-    uint32_t negotiate_payload[4] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE};
+    uint32_t negotiate_payload[5] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE, SERVER_FEATURES};
     expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(NEGOTIATE), negotiate_payload, sizeof(negotiate_payload));
     evm_process_next(self);
 
     // negotiate -> meta
     negotiate_payload[2] = RX_WINDOW_SIZE;
+    negotiate_payload[4] = 0;  // client without features
     expect_tx_window_set(&self->dl1, RX_WINDOW_SIZE);
     fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE), (uint8_t *) negotiate_payload, sizeof(negotiate_payload));
 
@@ -349,6 +429,12 @@ static void test_server_connect(void ** state) {
     }
 
     server_timestamp(self);
+}
+
+static void test_server_connect(void ** state) {
+    INITIALIZE(SERVER);
+    server_connect(self);
+    assert_false(self->credit_enable);  // client without features
     echo_one(self, 1);
     echo_one(self, 2);
     echo_one(self, 3);
@@ -358,6 +444,160 @@ static void test_server_connect(void ** state) {
     FINALIZE();
 }
 
+static struct fbp_port0_echo_stats_s echo_stats_;
+
+static uint8_t on_echo_stats(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) user_data;
+    (void) topic;
+    assert_int_equal(FBP_UNION_BIN, value->type);
+    assert_int_equal(sizeof(echo_stats_), value->size);
+    memcpy(&echo_stats_, value->value.bin, sizeof(echo_stats_));
+    function_called();
+    return 0;
+}
+
+static void echo_publish(struct fbp_pubsub_s * pubsub, const char * subtopic, uint32_t value) {
+    char topic[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    snprintf(topic, sizeof(topic), "h/c0/0/echo/%s", subtopic);
+    assert_int_equal(0, fbp_pubsub_publish(pubsub, topic, &fbp_union_u32_r(value), NULL, NULL));
+    fbp_pubsub_process(pubsub);
+}
+
+static void echo_ping_pong_rsp(struct fbp_transport_s * self, int64_t frame_id, int64_t tx_time) {
+    int64_t rsp[2] = {frame_id, tx_time};
+    int64_t req[2] = {frame_id + 1, self->timestamp};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(ECHO), req, sizeof(req));
+    fbp_port0_on_recv_cbk(self->p1, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(ECHO), (uint8_t *) rsp, sizeof(rsp));
+}
+
+static void test_echo_ping_pong(void ** state) {
+    INITIALIZE(SERVER);
+    server_connect(self);
+    fbp_pubsub_subscribe(pubsub, "h/c0/0/echo/stats", FBP_PUBSUB_SFLAG_PUB, on_echo_stats, self);
+    fbp_pubsub_process(pubsub);
+    echo_publish(pubsub, "length", 16);
+    echo_publish(pubsub, "window", 1);
+
+    int64_t t0 = self->timestamp;
+    int64_t req[2] = {0, t0};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(ECHO), req, sizeof(req));
+    echo_publish(pubsub, "enable", 1);
+    assert_int_equal(1, evm_count(self));
+
+    self->timestamp += 2 * FBP_TIME_MILLISECOND;
+    echo_ping_pong_rsp(self, 0, t0);
+    int64_t t1 = self->timestamp;
+    self->timestamp += 4 * FBP_TIME_MILLISECOND;
+    echo_ping_pong_rsp(self, 1, t1);
+
+    expect_function_call(on_echo_stats);
+    evm_process_next(self);
+    assert_int_equal(1, echo_stats_.version);
+    assert_int_equal(FBP_PORT0_ECHO_MODE_PING_PONG, echo_stats_.mode);
+    assert_int_equal(FBP_TIME_SECOND, echo_stats_.duration);
+    assert_int_equal(3, echo_stats_.tx_msgs);
+    assert_int_equal(48, echo_stats_.tx_bytes);
+    assert_int_equal(2, echo_stats_.rx_msgs);
+    assert_int_equal(32, echo_stats_.rx_bytes_per_s);
+    assert_int_equal(0, echo_stats_.errors);
+    assert_int_equal(2, echo_stats_.rtt_count);
+    assert_int_equal(2000, echo_stats_.rtt_min_us);
+    assert_in_range(echo_stats_.rtt_p50_us, 3750, 4000);  // histogram bucket, clamped to max
+    assert_int_equal(4000, echo_stats_.rtt_max_us);
+    assert_int_equal(2000 / 16, echo_stats_.jitter_us);
+
+    assert_int_equal(1, evm_count(self));
+    echo_publish(pubsub, "enable", 0);
+    assert_int_equal(0, evm_count(self));
+    FINALIZE();
+}
+
+static void test_echo_rtt_percentiles(void ** state) {
+    INITIALIZE(SERVER);
+    server_connect(self);
+    fbp_pubsub_subscribe(pubsub, "h/c0/0/echo/stats", FBP_PUBSUB_SFLAG_PUB, on_echo_stats, self);
+    fbp_pubsub_process(pubsub);
+    echo_publish(pubsub, "length", 16);
+    echo_publish(pubsub, "window", 1);
+
+    int64_t req[2] = {0, self->timestamp};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(ECHO), req, sizeof(req));
+    echo_publish(pubsub, "enable", 1);
+
+    // percentiles cover every sample in the interval, not just the latest
+    uint32_t count = 1000;
+    for (uint32_t i = 0; i < count; ++i) {
+        int64_t tx_time = self->timestamp;
+        uint32_t rtt_us = (i == 0) ? 500 : ((i < 10) ? 9000 : ((i < 100) ? 3000 : 1000));
+        self->timestamp += FBP_COUNTER_TO_TIME(rtt_us, 1000000);
+        echo_ping_pong_rsp(self, i, tx_time);
+    }
+
+    expect_function_call(on_echo_stats);
+    evm_process_next(self);
+    assert_int_equal(count, echo_stats_.rtt_count);
+    assert_int_equal(500, echo_stats_.rtt_min_us);
+    assert_in_range(echo_stats_.rtt_p50_us, 1000 * 15 / 16, 1000 * 17 / 16);
+    assert_in_range(echo_stats_.rtt_p90_us, 1000 * 15 / 16, 1000 * 17 / 16);
+    assert_in_range(echo_stats_.rtt_p99_us, 3000 * 15 / 16, 3000 * 17 / 16);
+    assert_int_equal(9000, echo_stats_.rtt_max_us);
+
+    echo_publish(pubsub, "enable", 0);
+    FINALIZE();
+}
+
+static void test_echo_flood_rx(void ** state) {
+    INITIALIZE(SERVER);
+    server_connect(self);
+    fbp_pubsub_subscribe(pubsub, "h/c0/0/echo/stats", FBP_PUBSUB_SFLAG_PUB, on_echo_stats, self);
+    fbp_pubsub_process(pubsub);
+
+    int64_t frame_ids[] = {0, 1, 3};
+    for (uint32_t i = 0; i < FBP_ARRAY_SIZE(frame_ids); ++i) {
+        int64_t req[2] = {frame_ids[i], 0};
+        fbp_port0_on_recv_cbk(self->p1, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(ECHO) | FBP_PORT0_ECHO_FLOOD,
+                              (uint8_t *) req, sizeof(req));
+    }
+    assert_int_equal(1, evm_count(self));
+
+    expect_function_call(on_echo_stats);
+    evm_process_next(self);
+    assert_int_equal(0, echo_stats_.tx_msgs);
+    assert_int_equal(3, echo_stats_.rx_msgs);
+    assert_int_equal(48, echo_stats_.rx_bytes);
+    assert_int_equal(3, echo_stats_.rx_msgs_per_s);
+    assert_int_equal(1, echo_stats_.errors);
+    assert_int_equal(0, echo_stats_.rtt_count);
+
+    // no more flood requests, stop
+    evm_process_next(self);
+    assert_int_equal(0, evm_count(self));
+    FINALIZE();
+}
+
+static void test_echo_flood_tx(void ** state) {
+    INITIALIZE(SERVER);
+    server_connect(self);
+    // mode accepts any integer type
+    assert_int_equal(0, fbp_pubsub_publish(pubsub, "h/c0/0/echo/mode", &fbp_union_u8_r(FBP_PORT0_ECHO_MODE_FLOOD), NULL, NULL));
+    fbp_pubsub_process(pubsub);
+    echo_publish(pubsub, "window", 2);
+
+    // each tick sends up to window frames, without waiting for responses
+    for (int i = 0; i < 2; ++i) {
+        expect_send_ignore_msg(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(ECHO) | FBP_PORT0_ECHO_FLOOD);
+    }
+    echo_publish(pubsub, "enable", 1);
+    for (int i = 0; i < 2; ++i) {
+        expect_send_ignore_msg(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(ECHO) | FBP_PORT0_ECHO_FLOOD);
+    }
+    evm_process_next(self);
+    assert_int_equal(1, evm_count(self));
+    echo_publish(pubsub, "enable", 0);
+    assert_int_equal(0, evm_count(self));
+    FINALIZE();
+}
+
 static void client_timestamp(struct fbp_transport_s * self) {
     // timestamp, receive request and respond
     int64_t timesync[5] = {0, 0, 0, 0, 0};
@@ -385,7 +625,7 @@ static void test_client_connect(void ** state) {
 
     // negotiate -> timesync
     uint32_t negotiate_req[4] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE};
-    uint32_t negotiate_rsq[4] = {FBP_DL_VERSION, 0, RX_WINDOW_SIZE, RX_WINDOW_SIZE};
+    uint32_t negotiate_rsq[5] = {FBP_DL_VERSION, 0, RX_WINDOW_SIZE, RX_WINDOW_SIZE, 0};
     expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE), negotiate_rsq, sizeof(negotiate_rsq));
 
     // negotiate -> timestamp
@@ -416,6 +656,300 @@ static void test_client_connect(void ** state) {
     FINALIZE();
 }
 
+static void pipeline_enable(struct fbp_pubsub_s * pubsub) {
+    assert_int_equal(0, fbp_pubsub_publish(pubsub, "h/c0/0/pipe", &fbp_union_u32_r(1), NULL, NULL));
+    fbp_pubsub_process(pubsub);
+}
+
+static uint32_t latency_get(struct fbp_pubsub_s * pubsub) {
+    struct fbp_union_s value;
+    fbp_pubsub_process(pubsub);
+    assert_int_equal(0, fbp_pubsub_query(pubsub, "h/c0/0/latency", &value));
+    return value.value.u32;
+}
+
+static void test_client_timesync_publish(void ** state) {
+    struct fbp_transport_s * self = (struct fbp_transport_s *) *state;
+    struct fbp_pubsub_s * pubsub = fbp_pubsub_initialize("h", 4096);
+    struct fbp_ts_s * ts = (struct fbp_ts_s *) self;  // opaque, only passed to the mocks
+    struct fbp_port0_s * p = fbp_port0_initialize(FBP_PORT0_MODE_CLIENT, &self->dl1, &self->evm, self, ll_sendv, pubsub, "h/c0/", ts);
+    self->p1 = p;
+    struct fbp_union_s value;
+
+    self->ts_status.drift_ppb = -1234;
+    self->ts_status.uncertainty = FBP_TIME_MICROSECOND * 25;
+    int64_t timesync[5] = {0, 1234, self->timestamp, self->timestamp, 0};
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(TIMESYNC), (uint8_t *) timesync, sizeof(timesync));
+    fbp_pubsub_process(pubsub);
+    assert_int_equal(0, fbp_pubsub_query(pubsub, "h/c0/0/ts/drift", &value));
+    assert_int_equal(FBP_UNION_I32, value.type);
+    assert_int_equal(-1234, value.value.i32);
+    assert_int_equal(0, fbp_pubsub_query(pubsub, "h/c0/0/ts/uncertainty", &value));
+    assert_int_equal(FBP_UNION_U32, value.type);
+    assert_int_equal(FBP_TIME_TO_NANOSECONDS(self->ts_status.uncertainty), value.value.u32);
+    FINALIZE();
+}
+
+static void test_client_connect_pipelined(void ** state) {
+    INITIALIZE(CLIENT);
+    pipeline_enable(pubsub);
+    fbp_port0_on_event_cbk(p, FBP_DL_EV_CONNECTED);
+    self->timestamp += FBP_TIME_MILLISECOND * 3;
+
+    // negotiate, timesync and meta all sent together
+    uint32_t negotiate_req[5] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE, FBP_PORT0_FEATURE_PIPELINE};
+    uint32_t negotiate_rsq[5] = {FBP_DL_VERSION, 0, RX_WINDOW_SIZE, RX_WINDOW_SIZE, FBP_PORT0_FEATURE_PIPELINE};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE), negotiate_rsq, sizeof(negotiate_rsq));
+    expect_tx_window_set(&self->dl1, RX_WINDOW_SIZE);
+    expect_dl_event_inject(&self->dl1, FBP_DL_EV_TRANSPORT_CONNECTED);
+    expect_send_ignore_msg(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(TIMESYNC));
+    for (int i = 0; i < 32; ++i) {
+        expect_send_ignore_msg(0, FBP_TRANSPORT_SEQ_SINGLE, RSP(META));
+    }
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(NEGOTIATE), (uint8_t *) negotiate_req, sizeof(negotiate_req));
+    assert_int_equal(3000, latency_get(pubsub));
+
+    client_timestamp(self);
+    echo_one(self, 1);
+    assert_int_equal(1, evm_count(self));
+    FINALIZE();
+}
+
+static void test_server_connect_pipelined(void ** state) {
+    INITIALIZE(SERVER);
+    pipeline_enable(pubsub);
+    int64_t t0 = self->timestamp;
+    fbp_port0_on_event_cbk(p, FBP_DL_EV_CONNECTED);
+
+    // no stabilization delay
+    uint32_t negotiate_payload[5] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE,
+                                     SERVER_FEATURES | FBP_PORT0_FEATURE_PIPELINE};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(NEGOTIATE), negotiate_payload, sizeof(negotiate_payload));
+    evm_process_next(self);
+    assert_int_equal(t0 + FBP_COUNTER_TO_TIME(1, 1000), self->timestamp);
+
+    // negotiate -> meta, other ports may connect immediately
+    negotiate_payload[2] = RX_WINDOW_SIZE;
+    negotiate_payload[4] = FBP_PORT0_FEATURE_PIPELINE;  // client pipelined without meta digest
+    expect_tx_window_set(&self->dl1, RX_WINDOW_SIZE);
+    expect_dl_event_inject(&self->dl1, FBP_DL_EV_TRANSPORT_CONNECTED);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE), (uint8_t *) negotiate_payload, sizeof(negotiate_payload));
+    server_timestamp(self);
+
+    for (int i = 0; i < 32; ++i) {
+        char meta[] = " {\"type\":\"oam\", \"name\": \"oam\"}";
+        meta[0] = i + 32;
+        fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(META), (uint8_t *) meta, sizeof(meta));
+    }
+    assert_int_equal(FBP_TIME_TO_COUNTER(self->timestamp - t0, 1000000), latency_get(pubsub));
+    echo_one(self, 1);
+    assert_int_equal(0, evm_count(self));
+    FINALIZE();
+}
+
+static void test_client_connect_pipeline_mixed(void ** state) {
+    INITIALIZE(CLIENT);
+    pipeline_enable(pubsub);
+    fbp_port0_on_event_cbk(p, FBP_DL_EV_CONNECTED);
+
+    // server without pipelining: sequential handshake
+    uint32_t negotiate_req[5] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE, 0};
+    uint32_t negotiate_rsq[5] = {FBP_DL_VERSION, 0, RX_WINDOW_SIZE, RX_WINDOW_SIZE, 0};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE), negotiate_rsq, sizeof(negotiate_rsq));
+    expect_tx_window_set(&self->dl1, RX_WINDOW_SIZE);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(NEGOTIATE), (uint8_t *) negotiate_req, sizeof(negotiate_req));
+    client_timestamp(self);
+    client_timestamp(self);
+
+    for (int i = 0; i < 32; ++i) {
+        expect_send_ignore_msg(0, FBP_TRANSPORT_SEQ_SINGLE, RSP(META));
+    }
+    expect_dl_event_inject(&self->dl1, FBP_DL_EV_TRANSPORT_CONNECTED);
+    evm_process_next(self);
+
+    client_timestamp(self);
+    echo_one(self, 1);
+    FINALIZE();
+}
+
+static void test_server_connect_pipeline_mixed(void ** state) {
+    INITIALIZE(SERVER);
+    pipeline_enable(pubsub);
+    fbp_port0_on_event_cbk(p, FBP_DL_EV_CONNECTED);
+
+    uint32_t negotiate_payload[5] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE,
+                                     SERVER_FEATURES | FBP_PORT0_FEATURE_PIPELINE};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(NEGOTIATE), negotiate_payload, sizeof(negotiate_payload));
+    evm_process_next(self);
+
+    // client without pipelining: other ports connect only after meta
+    negotiate_payload[2] = RX_WINDOW_SIZE;
+    negotiate_payload[4] = 0;
+    expect_tx_window_set(&self->dl1, RX_WINDOW_SIZE);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE), (uint8_t *) negotiate_payload, sizeof(negotiate_payload));
+    server_timestamp(self);
+    server_timestamp(self);
+
+    for (int i = 0; i < 32; ++i) {
+        char meta[] = " {\"type\":\"oam\", \"name\": \"oam\"}";
+        meta[0] = i + 32;
+        if (i == 31) {
+            expect_dl_event_inject(&self->dl1, FBP_DL_EV_TRANSPORT_CONNECTED);
+        }
+        fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(META), (uint8_t *) meta, sizeof(meta));
+    }
+    server_timestamp(self);
+    echo_one(self, 1);
+    FINALIZE();
+}
+
+static void test_credit_grant(void ** state) {
+    INITIALIZE(CLIENT);
+    fbp_port0_on_event_cbk(p, FBP_DL_EV_CONNECTED);
+    uint32_t negotiate_req[5] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE, FBP_PORT0_FEATURE_CREDIT};
+    uint32_t negotiate_rsq[5] = {FBP_DL_VERSION, 0, RX_WINDOW_SIZE, RX_WINDOW_SIZE, FBP_PORT0_FEATURE_CREDIT};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE), negotiate_rsq, sizeof(negotiate_rsq));
+    expect_tx_window_set(&self->dl1, RX_WINDOW_SIZE);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(NEGOTIATE), (uint8_t *) negotiate_req, sizeof(negotiate_req));
+    assert_true(self->credit_enable);
+    int32_t count = evm_count(self);
+
+    // messages received on ports 1 and 5, granted in one batch
+    self->credit_grant[1] = 3;
+    self->credit_fn(self->credit_user_data);
+    self->credit_grant[5] = 2;
+    self->credit_fn(self->credit_user_data);
+    assert_int_equal(count + 1, evm_count(self));
+    uint32_t grant[2] = {(3 << 8) | 1, (2 << 8) | 5};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(CREDIT), grant, sizeof(grant));
+    evm_process_next(self);
+    assert_int_equal(count, evm_count(self));
+
+    // the peer grants credits for our messages
+    uint32_t rx_grant[2] = {(4 << 8) | 1, (1 << 8) | 2};
+    expect_credit_return(1, 4);
+    expect_credit_return(2, 1);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(CREDIT), (uint8_t *) rx_grant, sizeof(rx_grant));
+    FINALIZE();
+}
+
+static void meta_digest(uint32_t * digest) {
+    memset(digest, 0, 32 * sizeof(uint32_t));
+    digest[0] = fbp_crc32(0, (const uint8_t *) META_PORT0, (uint32_t) strlen(META_PORT0));
+    digest[1] = fbp_crc32(0, (const uint8_t *) META_PORT1, (uint32_t) strlen(META_PORT1));
+    digest[2] = fbp_crc32(0, (const uint8_t *) META_PORT2, (uint32_t) strlen(META_PORT2));
+}
+
+static void test_client_meta_digest(void ** state) {
+    INITIALIZE(CLIENT);
+    fbp_port0_on_event_cbk(p, FBP_DL_EV_CONNECTED);
+
+    uint32_t negotiate_req[5] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE, FBP_PORT0_FEATURE_META_DIGEST | 0x80};
+    uint32_t negotiate_rsq[5] = {FBP_DL_VERSION, 0, RX_WINDOW_SIZE, RX_WINDOW_SIZE, FBP_PORT0_FEATURE_META_DIGEST};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE), negotiate_rsq, sizeof(negotiate_rsq));
+    expect_tx_window_set(&self->dl1, RX_WINDOW_SIZE);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(NEGOTIATE), (uint8_t *) negotiate_req, sizeof(negotiate_req));
+    client_timestamp(self);
+    client_timestamp(self);
+
+    // single digest frame replaces the per-port meta frames
+    uint32_t digest[32];
+    meta_digest(digest);
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, RSP(META) | FBP_PORT0_META_DIGEST, digest, sizeof(digest));
+    evm_process_next(self);
+
+    // server requests port 2, which is segmented
+    uint32_t mask = 1U << 2;
+    expect_send_ignore_msg(0, FBP_TRANSPORT_SEQ_START, RSP(META));
+    expect_send_ignore_msg(0, FBP_TRANSPORT_SEQ_MIDDLE, RSP(META));
+    expect_send_ignore_msg(0, FBP_TRANSPORT_SEQ_STOP, RSP(META));
+    expect_dl_event_inject(&self->dl1, FBP_DL_EV_TRANSPORT_CONNECTED);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, REQ(META), (uint8_t *) &mask, sizeof(mask));
+
+    client_timestamp(self);
+    FINALIZE();
+}
+
+static void server_meta_digest_connect(struct fbp_transport_s * self, uint32_t * digest, uint32_t mask) {
+    struct fbp_port0_s * p = self->p1;
+    fbp_port0_on_event_cbk(p, FBP_DL_EV_CONNECTED);
+    uint32_t negotiate_payload[5] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE, SERVER_FEATURES};
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(NEGOTIATE), negotiate_payload, sizeof(negotiate_payload));
+    evm_process_next(self);
+    negotiate_payload[2] = RX_WINDOW_SIZE;
+    expect_tx_window_set(&self->dl1, RX_WINDOW_SIZE);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(NEGOTIATE), (uint8_t *) negotiate_payload, sizeof(negotiate_payload));
+
+    expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(META), &mask, sizeof(mask));
+    if (!mask) {
+        expect_dl_event_inject(&self->dl1, FBP_DL_EV_TRANSPORT_CONNECTED);
+    }
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(META) | FBP_PORT0_META_DIGEST,
+                          (uint8_t *) digest, 32 * sizeof(uint32_t));
+}
+
+static char meta_published_[32][META_PORT2_SIZE];
+
+static uint8_t on_meta_publish(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) user_data;
+    const char * t = strstr(topic, "port/") + 5;
+    int port_id = atoi(t);
+    assert_true((port_id >= 0) && (port_id < 32));
+    strcpy(meta_published_[port_id], value->value.str);
+    return 0;
+}
+
+static void assert_meta(struct fbp_pubsub_s * pubsub, uint8_t port_id, const char * expect) {
+    fbp_pubsub_process(pubsub);
+    assert_string_equal(expect, meta_published_[port_id]);
+    meta_published_[port_id][0] = '?';
+    meta_published_[port_id][1] = 0;
+}
+
+static void meta_rsp_single(struct fbp_transport_s * self, const char * meta_msg, uint32_t size) {
+    uint8_t msg[FBP_FRAMER_PAYLOAD_MAX_SIZE];
+    memcpy(msg, meta_msg, size);  // receiver modifies msg
+    fbp_port0_on_recv_cbk(self->p1, 0, FBP_TRANSPORT_SEQ_SINGLE, RSP(META), msg, size);
+}
+
+static void test_server_meta_digest(void ** state) {
+    INITIALIZE(SERVER);
+    fbp_pubsub_subscribe(pubsub, "h/c0/port", FBP_PUBSUB_SFLAG_PUB, on_meta_publish, NULL);
+    uint32_t digest[32];
+    meta_digest(digest);
+
+    // first connection, request all ports with metadata
+    server_meta_digest_connect(self, digest, 0x7);
+    meta_rsp_single(self, META_MSG_PORT0, sizeof(META_MSG_PORT0));
+    meta_rsp_single(self, META_MSG_PORT1, sizeof(META_MSG_PORT1));
+    uint8_t msg[FBP_FRAMER_PAYLOAD_MAX_SIZE];
+    msg[0] = 0x22;
+    memcpy(msg + 1, META_PORT2, 255);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_START, RSP(META), msg, 256);
+    memcpy(msg, META_PORT2 + 255, 256);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_MIDDLE, RSP(META), msg, 256);
+    memcpy(msg, META_PORT2 + 511, sizeof(META_PORT2) - 511);
+    expect_dl_event_inject(&self->dl1, FBP_DL_EV_TRANSPORT_CONNECTED);
+    fbp_port0_on_recv_cbk(p, 0, FBP_TRANSPORT_SEQ_STOP, RSP(META), msg, sizeof(META_PORT2) - 511);
+    assert_meta(pubsub, 1, META_PORT1);
+    assert_meta(pubsub, 2, META_PORT2);
+    assert_meta(pubsub, 3, "");
+    fbp_port0_on_event_cbk(p, FBP_DL_EV_DISCONNECTED);
+
+    // reconnect, all cached
+    server_meta_digest_connect(self, digest, 0);
+    assert_meta(pubsub, 2, META_PORT2);
+    fbp_port0_on_event_cbk(p, FBP_DL_EV_DISCONNECTED);
+
+    // reconnect, only port 1 changed
+    digest[1] += 1;
+    server_meta_digest_connect(self, digest, 0x2);
+    expect_dl_event_inject(&self->dl1, FBP_DL_EV_TRANSPORT_CONNECTED);
+    meta_rsp_single(self, META_MSG_PORT0, sizeof(META_MSG_PORT0) - 1);
+    meta_rsp_single(self, META_MSG_PORT1, sizeof(META_MSG_PORT1));
+    FINALIZE();
+}
+
 static void test_server_timeout_in_negotiate(void ** state) {
     INITIALIZE(SERVER);
 
@@ -424,7 +958,7 @@ static void test_server_timeout_in_negotiate(void ** state) {
     fbp_port0_on_event_cbk(p, FBP_DL_EV_CONNECTED);
 
     // await_client -> negotiate
-    uint32_t negotiate_payload[4] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE};
+    uint32_t negotiate_payload[5] = {FBP_DL_VERSION, 0, TX_WINDOW_SIZE, RX_WINDOW_SIZE, SERVER_FEATURES};
     expect_send(0, FBP_TRANSPORT_SEQ_SINGLE, REQ(NEGOTIATE), negotiate_payload, sizeof(negotiate_payload));
     evm_process_next(self);
 
@@ -437,15 +971,19 @@ static void test_server_timeout_in_negotiate(void ** state) {
 
 static int32_t send_p1_to_p2(struct fbp_transport_s * t,
                              uint8_t port_id, enum fbp_transport_seq_e seq, uint8_t port_data,
-                             uint8_t const *msg, uint32_t msg_size) {
-    fbp_port0_on_recv_cbk(t->p2, port_id, seq, port_data, (uint8_t *) msg, msg_size);
+                             struct fbp_iovec_s const *iov, uint32_t iov_count) {
+    uint8_t msg[FBP_FRAMER_PAYLOAD_MAX_SIZE];
+    uint32_t msg_size = iov_gather(msg, iov, iov_count);
+    fbp_port0_on_recv_cbk(t->p2, port_id, seq, port_data, msg, msg_size);
     return 0;
 }
 
 static int32_t send_p2_to_p1(struct fbp_transport_s * t,
                              uint8_t port_id, enum fbp_transport_seq_e seq, uint8_t port_data,
-                             uint8_t const *msg, uint32_t msg_size) {
-    fbp_port0_on_recv_cbk(t->p1, port_id, seq, port_data, (uint8_t *) msg, msg_size);
+                             struct fbp_iovec_s const *iov, uint32_t iov_count) {
+    uint8_t msg[FBP_FRAMER_PAYLOAD_MAX_SIZE];
+    uint32_t msg_size = iov_gather(msg, iov, iov_count);
+    fbp_port0_on_recv_cbk(t->p1, port_id, seq, port_data, msg, msg_size);
     return 0;
 }
 
@@ -518,7 +1056,19 @@ static void test_connect(void ** state) {
 int main(void) {
     const struct CMUnitTest tests[] = {
             cmocka_unit_test_setup_teardown(test_server_connect, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_echo_ping_pong, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_echo_rtt_percentiles, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_echo_flood_rx, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_echo_flood_tx, setup, teardown),
             cmocka_unit_test_setup_teardown(test_client_connect, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_client_connect_pipelined, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_server_connect_pipelined, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_client_connect_pipeline_mixed, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_server_connect_pipeline_mixed, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_credit_grant, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_client_timesync_publish, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_client_meta_digest, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_server_meta_digest, setup, teardown),
             cmocka_unit_test_setup_teardown(test_server_timeout_in_negotiate, setup, teardown),
             cmocka_unit_test_setup_teardown(test_connect, setup, teardown),
     };
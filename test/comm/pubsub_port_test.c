@@ -73,18 +73,39 @@ static uint8_t CONN_RSP[2] = {0, 1};
     (void) state;                                                       \
     struct test_s * self = port_hal_initialize();                       \
     expect_unsubscribe_from_all();                                      \
+    expect_any_subscribe();                                             \
     self->s = fbp_pubsubp_initialize(&self->p, &self->evm_api, mode);   \
     expect_value(fbp_transport_port_register, port_id, PORT_ID);        \
+    expect_value(fbp_transport_port_credit_defer, port_id, PORT_ID);    \
+    expect_value(fbp_transport_port_credit_defer, defer, true);         \
+    expect_value(fbp_transport_port_credit_limit_set, port_id, PORT_ID);  \
+    expect_value(fbp_transport_port_credit_limit_set, credit_limit, FBP_PUBSUBP_CREDIT_LIMIT); \
     fbp_pubsubp_transport_register(self->s, PORT_ID, &self->t)
 
-#define FINALIZE()                  \
-    fbp_pubsubp_finalize(self->s);  \
+#define FINALIZE()                          \
+    expect_any(fbp_pubsub_unsubscribe, topic); \
+    fbp_pubsubp_finalize(self->s);          \
     port_hal_finalize(self)
 
+#define expect_credit_marker(_v)                                        \
+    expect_string(fbp_pubsub_publish, topic, credit_topic(self));       \
+    expect_value(fbp_pubsub_publish, type, FBP_UNION_U32);              \
+    expect_value(fbp_pubsub_publish, u32, _v)
+
+static const char * credit_topic(struct test_s * self) {
+    static char topic[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    strcpy(topic, fbp_pubsubp_feedback_topic(self->s));
+    topic[2] = 'c';  // _/fb/ to _/cr/
+    topic[3] = 'r';
+    return topic;
+}
 
-static void publish_after_connect(struct test_s * self) {
+static void publish_after_connect(struct test_s * self, uint32_t marker) {
     // publish from other after connect
     expect_publish_str("a/vg", "hello");
+    if (marker) {
+        expect_credit_marker(marker);
+    }
     fbp_pubsubp_on_recv(self->s, PORT_ID, FBP_TRANSPORT_SEQ_SINGLE, FBP_PUBSUBP_MSG_PUBLISH,
                         publish_msg_str, sizeof(publish_msg_str));
 
@@ -113,6 +134,7 @@ static void test_server_connect_initial(void ** state) {
                         (uint8_t *) topic_list, sizeof(topic_list));
 
     expect_publish_u32("a/vg", 42);
+    expect_credit_marker(1);
     fbp_pubsubp_on_recv(self->s, PORT_ID, FBP_TRANSPORT_SEQ_SINGLE, FBP_PUBSUBP_MSG_PUBLISH,
                         publish_msg_u32, sizeof(publish_msg_u32));
 
@@ -122,7 +144,7 @@ static void test_server_connect_initial(void ** state) {
     fbp_pubsubp_on_recv(self->s, PORT_ID, FBP_TRANSPORT_SEQ_SINGLE, FBP_PUBSUBP_MSG_CONNECTED,
                         CONN_REQ, sizeof(CONN_REQ));
 
-    publish_after_connect(self);
+    publish_after_connect(self, 0);  // marker still pending
     FINALIZE();
 }
 
@@ -157,7 +179,7 @@ static void initialize_client(struct test_s * self) {
 static void test_client_connect_initial(void ** state) {
     INITIALIZE(FBP_PUBSUBP_MODE_UPSTREAM);
     initialize_client(self);
-    publish_after_connect(self);
+    publish_after_connect(self, 1);
     FINALIZE();
 }
 
@@ -166,6 +188,7 @@ static void test_client_publish_when_disconnected(void ** state) {
     fbp_pubsubp_on_recv(self->s, PORT_ID, FBP_TRANSPORT_SEQ_SINGLE, FBP_PUBSUBP_MSG_PUBLISH,
                         publish_msg_str, sizeof(publish_msg_str));
     fbp_pubsubp_on_update(self->s, "a/vg", &fbp_union_str("hello"));
+    assert_int_equal(1, self->credit_released);  // dropped, so released immediately
     FINALIZE();
 }
 
@@ -216,6 +239,7 @@ static void test_deserialize(void ** state) {
     initialize_client(self);
 
     expect_publish_null("a/vg");
+    expect_credit_marker(1);
     fbp_pubsubp_on_recv(self->s, 2, FBP_TRANSPORT_SEQ_SINGLE, PD, publish_msg_null, sizeof(publish_msg_null));
     expect_publish_str("a/vg", (char *) publish_msg_str + 9);
     fbp_pubsubp_on_recv(self->s, 2, FBP_TRANSPORT_SEQ_SINGLE, PD, publish_msg_str, sizeof(publish_msg_str));
@@ -250,6 +274,35 @@ static void test_deserialize(void ** state) {
     FINALIZE();
 }
 
+static void test_credit_release(void ** state) {
+    INITIALIZE(FBP_PUBSUBP_MODE_UPSTREAM);
+    fbp_pubsub_subscribe_fn on_credit = self->subscribe_cbk_fn;
+    void * on_credit_user_data = self->subscribe_cbk_user_data;
+    initialize_client(self);
+    uint32_t released = self->credit_released;  // control messages
+
+    expect_publish_u32("a/vg", 42);
+    expect_credit_marker(1);
+    fbp_pubsubp_on_recv(self->s, 2, FBP_TRANSPORT_SEQ_SINGLE, PD, publish_msg_u32, sizeof(publish_msg_u32));
+    for (int i = 0; i < 2; ++i) {
+        expect_publish_u32("a/vg", 42);
+        fbp_pubsubp_on_recv(self->s, 2, FBP_TRANSPORT_SEQ_SINGLE, PD, publish_msg_u32, sizeof(publish_msg_u32));
+    }
+    assert_int_equal(released, self->credit_released);
+
+    // pubsub processed the first publish, the next marker covers the rest
+    expect_credit_marker(3);
+    on_credit(on_credit_user_data, credit_topic(self), &fbp_union_u32(1));
+    assert_int_equal(released + 1, self->credit_released);
+    on_credit(on_credit_user_data, credit_topic(self), &fbp_union_u32(3));
+    assert_int_equal(released + 3, self->credit_released);
+
+    expect_publish_u32("a/vg", 42);
+    expect_credit_marker(4);
+    fbp_pubsubp_on_recv(self->s, 2, FBP_TRANSPORT_SEQ_SINGLE, PD, publish_msg_u32, sizeof(publish_msg_u32));
+    FINALIZE();
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
             cmocka_unit_test(test_server_connect_initial),
@@ -257,6 +310,7 @@ int main(void) {
             cmocka_unit_test(test_client_publish_when_disconnected),
             cmocka_unit_test(test_serialize),
             cmocka_unit_test(test_deserialize),
+            cmocka_unit_test(test_credit_release),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
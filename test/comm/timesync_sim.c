@@ -0,0 +1,355 @@
+/*
+ * Copyright 2021 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ *
+ * @brief Timesync accuracy and cost simulator.
+ *
+ * This program drives fbp_ts_update() with a simulated local counter
+ * and link.  The counter has a fixed frequency error (ppm) plus a random
+ * walk (wander).  Each TIMESYNC exchange sees a fixed link delay, a
+ * delay asymmetry between the request and response directions, and
+ * exponentially distributed jitter.  Between updates, the program
+ * compares fbp_ts_time() against the ground truth.
+ *
+ * The program sweeps the update interval and reports the error
+ * distribution for each, followed by the longest interval that meets
+ * the target accuracy at the 99th percentile.  It finishes with the
+ * cost of fbp_ts_time() and fbp_ts_time_batch().
+ *
+ * Usage: timesync_sim [options]
+ *
+ *     -e {snap|servo}   The estimator, default servo.
+ *     -p PPM            The counter frequency error, default 50.
+ *     -w PPB            The frequency wander in ppb / sqrt(s), default 1.
+ *     -d US             The round-trip link delay, default 1000.
+ *     -a US             The request delay minus response delay, default 0.
+ *     -j US             The mean jitter per direction, default 100.
+ *     -T S              The simulated duration per interval, default 3600.
+ *     -t US             The target accuracy, default 100.
+ *     -s SEED           The random seed, default 1.
+ */
+
+#include "fitterbap/comm/timesync.h"
+#include "fitterbap/time.h"
+#include "fitterbap/os/mutex.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+
+#define PI (3.14159265358979323846)
+#define COUNTER_FREQ (1000000U)
+#define SAMPLES_PER_UPDATE (8)
+#define WANDER_STEP (0.01)            // seconds
+#define TGT_PROCESS_TIME (10e-6)      // seconds between tgt_rx and tgt_tx
+#define TIME_EPOCH (FBP_TIME_YEAR * 3)
+#define COST_ITERATIONS (10000000)
+#define COST_BATCH (1024)
+
+static const double INTERVALS[] = {0.1, 0.2, 0.5, 1.0, 2.0, 5.0, 10.0, 20.0, 30.0, 60.0, 120.0, 300.0};
+#define INTERVAL_COUNT ((int) (sizeof(INTERVALS) / sizeof(INTERVALS[0])))
+
+struct config_s {
+    enum fbp_ts_estimator_e estimator;
+    double ppm;
+    double wander_ppb;
+    double delay_us;
+    double asymmetry_us;
+    double jitter_us;
+    double duration;
+    double target_us;
+    uint64_t seed;
+};
+
+struct stats_s {
+    double mean_us;
+    double p50_us;      // all percentiles of |error|
+    double p90_us;
+    double p99_us;
+    double max_us;
+    uint32_t update_count;
+    uint32_t reject_count;
+};
+
+struct sim_s {
+    double t;           // true elapsed time in seconds
+    double counter;     // local counter in ticks
+    double rate_error;  // current fractional frequency error
+    double wander_accum;
+    uint64_t rng;
+};
+
+static uint64_t counter_;
+static struct sim_s sim_;
+
+fbp_os_mutex_t fbp_os_mutex_alloc_() {return NULL;}
+void fbp_os_mutex_free_(fbp_os_mutex_t mutex) {(void) mutex;}
+void fbp_os_mutex_lock_(fbp_os_mutex_t mutex) {(void) mutex;}
+void fbp_os_mutex_unlock_(fbp_os_mutex_t mutex) {(void) mutex;}
+
+uint32_t fbp_time_counter_frequency_() {
+    return COUNTER_FREQ;
+}
+
+uint64_t fbp_time_counter_u64_() {
+    return counter_;
+}
+
+uint32_t fbp_time_counter_u32_() {
+    return (uint32_t) counter_;
+}
+
+static double rand_uniform(struct sim_s * s) {  // (0, 1]
+    // xorshift64*
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    uint64_t x = s->rng * 0x2545F4914F6CDD1DULL;
+    return ((double) ((x >> 11) + 1)) * (1.0 / 9007199254740992.0);
+}
+
+static double rand_gauss(struct sim_s * s) {
+    // Box-Muller, discard the second value
+    double r = sqrt(-2.0 * log(rand_uniform(s)));
+    return r * cos(2.0 * PI * rand_uniform(s));
+}
+
+static double rand_exponential(struct sim_s * s, double mean) {
+    return -log(rand_uniform(s)) * mean;
+}
+
+static void sim_advance(const struct config_s * config, double dt) {
+    struct sim_s * s = &sim_;
+    while (dt > 0) {
+        double step = WANDER_STEP - s->wander_accum;
+        if (step > dt) {
+            step = dt;
+        }
+        s->counter += COUNTER_FREQ * (1.0 + s->rate_error) * step;
+        s->t += step;
+        s->wander_accum += step;
+        dt -= step;
+        if (s->wander_accum >= WANDER_STEP) {
+            s->wander_accum = 0.0;
+            s->rate_error += config->wander_ppb * 1e-9 * sqrt(WANDER_STEP) * rand_gauss(s);
+        }
+    }
+    counter_ = (uint64_t) s->counter;
+}
+
+static int64_t sim_utc() {
+    return TIME_EPOCH + (int64_t) (sim_.t * FBP_TIME_SECOND);
+}
+
+static void sim_exchange(const struct config_s * config, struct fbp_ts_s * ts) {
+    double base = config->delay_us * 0.5e-6;
+    double asymmetry = config->asymmetry_us * 0.5e-6;
+    double jitter = config->jitter_us * 1e-6;
+    uint64_t src_tx = counter_;
+    sim_advance(config, base + asymmetry + rand_exponential(&sim_, jitter));
+    int64_t tgt_rx = sim_utc();
+    sim_advance(config, TGT_PROCESS_TIME);
+    int64_t tgt_tx = sim_utc();
+    sim_advance(config, base - asymmetry + rand_exponential(&sim_, jitter));
+    fbp_ts_update(ts, src_tx, tgt_rx, tgt_tx, counter_);
+}
+
+static int compare_f64(const void * a, const void * b) {
+    double x = *((const double *) a);
+    double y = *((const double *) b);
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static double percentile(const double * sorted, uint32_t count, double p) {
+    uint32_t idx = (uint32_t) (p * (count - 1) + 0.5);
+    return sorted[idx];
+}
+
+static void run(const struct config_s * config, double interval, struct stats_s * stats) {
+    uint32_t updates = (uint32_t) (config->duration / interval);
+    uint32_t warmup = updates / 4;  // let the estimator converge
+    if (warmup < 20) {
+        warmup = 20;
+    }
+    uint32_t capacity = (updates + 1) * SAMPLES_PER_UPDATE;
+    double * err = malloc(capacity * sizeof(double));
+    uint32_t count = 0;
+    double sum = 0.0;
+
+    memset(&sim_, 0, sizeof(sim_));
+    sim_.rate_error = config->ppm * 1e-6;
+    sim_.rng = config->seed ? config->seed : 1;
+    counter_ = 0;
+    struct fbp_ts_s * ts = fbp_ts_initialize(config->estimator);
+
+    for (uint32_t i = 0; i < updates + warmup; ++i) {
+        double t_start = sim_.t;
+        sim_exchange(config, ts);
+        double remaining = interval - (sim_.t - t_start);
+        double step = remaining / SAMPLES_PER_UPDATE;
+        for (int k = 0; k < SAMPLES_PER_UPDATE; ++k) {
+            sim_advance(config, step);
+            if ((i >= warmup) && (count < capacity)) {
+                int64_t e = fbp_ts_time(ts) - sim_utc();
+                double e_us = ((double) e) * (1e6 / FBP_TIME_SECOND);
+                sum += e_us;
+                err[count++] = fabs(e_us);
+            }
+        }
+    }
+
+    struct fbp_ts_status_s status;
+    fbp_ts_status_get(ts, &status);
+    fbp_ts_finalize(ts);
+
+    qsort(err, count, sizeof(double), compare_f64);
+    stats->mean_us = count ? sum / count : 0.0;
+    stats->p50_us = count ? percentile(err, count, 0.50) : 0.0;
+    stats->p90_us = count ? percentile(err, count, 0.90) : 0.0;
+    stats->p99_us = count ? percentile(err, count, 0.99) : 0.0;
+    stats->max_us = count ? err[count - 1] : 0.0;
+    stats->update_count = status.update_count;
+    stats->reject_count = status.reject_count;
+    free(err);
+}
+
+static double cost_ns(clock_t start, clock_t stop, uint64_t count) {
+    return ((double) (stop - start)) * 1e9 / ((double) CLOCKS_PER_SEC * (double) count);
+}
+
+static void cost(const struct config_s * config) {
+    volatile int64_t sink = 0;
+    int64_t * times = malloc(COST_BATCH * sizeof(int64_t));
+    uint64_t * counters = malloc(COST_BATCH * sizeof(uint64_t));
+    counter_ = 0;
+    struct fbp_ts_s * ts = fbp_ts_initialize(config->estimator);
+    fbp_ts_update(ts, 0, TIME_EPOCH, TIME_EPOCH, 0);
+
+    clock_t start = clock();
+    for (uint32_t i = 0; i < COST_ITERATIONS; ++i) {
+        counter_ = i;
+        sink += fbp_ts_time(ts);
+    }
+    clock_t stop = clock();
+    printf("fbp_ts_time:       %.2f ns/call\n", cost_ns(start, stop, COST_ITERATIONS));
+
+    for (uint32_t i = 0; i < COST_BATCH; ++i) {
+        counters[i] = i * 16;
+    }
+    uint32_t batches = COST_ITERATIONS / COST_BATCH;
+    start = clock();
+    for (uint32_t i = 0; i < batches; ++i) {
+        counters[0] = i;
+        fbp_ts_time_batch(ts, counters, times, COST_BATCH);
+        sink += times[i & (COST_BATCH - 1)];
+    }
+    stop = clock();
+    printf("fbp_ts_time_batch: %.2f ns/sample\n", cost_ns(start, stop, (uint64_t) batches * COST_BATCH));
+
+    (void) sink;
+    fbp_ts_finalize(ts);
+    free(counters);
+    free(times);
+}
+
+static void usage(const char * name) {
+    printf("usage: %s [-e snap|servo] [-p ppm] [-w ppb_per_sqrt_s] [-d delay_us] [-a asymmetry_us]\n"
+           "       [-j jitter_us] [-T duration_s] [-t target_us] [-s seed]\n", name);
+}
+
+static int parse_args(struct config_s * config, int argc, char * argv[]) {
+    for (int i = 1; i < argc; i += 2) {
+        const char * opt = argv[i];
+        if ((opt[0] != '-') || !opt[1] || opt[2] || ((i + 1) >= argc)) {
+            return 1;
+        }
+        const char * value = argv[i + 1];
+        switch (opt[1]) {
+            case 'e':
+                if (0 == strcmp(value, "snap")) {
+                    config->estimator = FBP_TS_ESTIMATOR_SNAP;
+                } else if (0 == strcmp(value, "servo")) {
+                    config->estimator = FBP_TS_ESTIMATOR_SERVO;
+                } else {
+                    return 1;
+                }
+                break;
+            case 'p': config->ppm = strtod(value, NULL); break;
+            case 'w': config->wander_ppb = strtod(value, NULL); break;
+            case 'd': config->delay_us = strtod(value, NULL); break;
+            case 'a': config->asymmetry_us = strtod(value, NULL); break;
+            case 'j': config->jitter_us = strtod(value, NULL); break;
+            case 'T': config->duration = strtod(value, NULL); break;
+            case 't': config->target_us = strtod(value, NULL); break;
+            case 's': config->seed = strtoull(value, NULL, 0); break;
+            default: return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char * argv[]) {
+    struct config_s config = {
+        .estimator = FBP_TS_ESTIMATOR_SERVO,
+        .ppm = 50.0,
+        .wander_ppb = 1.0,
+        .delay_us = 1000.0,
+        .asymmetry_us = 0.0,
+        .jitter_us = 100.0,
+        .duration = 3600.0,
+        .target_us = 100.0,
+        .seed = 1,
+    };
+    if (parse_args(&config, argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("estimator=%s, ppm=%.3f, wander=%.3f ppb/sqrt(s), delay=%.1f us, asymmetry=%.1f us, jitter=%.1f us\n",
+           (config.estimator == FBP_TS_ESTIMATOR_SERVO) ? "servo" : "snap",
+           config.ppm, config.wander_ppb, config.delay_us, config.asymmetry_us, config.jitter_us);
+    printf("%10s %10s %10s %10s %10s %10s %8s %8s\n",
+           "interval_s", "mean_us", "p50_us", "p90_us", "p99_us", "max_us", "updates", "rejects");
+
+    double best = 0.0;  // longest interval where it and all shorter intervals meet the target
+    bool failed = false;
+    for (int i = 0; i < INTERVAL_COUNT; ++i) {
+        struct stats_s stats;
+        run(&config, INTERVALS[i], &stats);
+        printf("%10.1f %10.2f %10.2f %10.2f %10.2f %10.2f %8" PRIu32 " %8" PRIu32 "\n",
+               INTERVALS[i], stats.mean_us, stats.p50_us, stats.p90_us, stats.p99_us, stats.max_us,
+               stats.update_count, stats.reject_count);
+        if (stats.p99_us > config.target_us) {
+            failed = true;
+        } else if (!failed) {
+            best = INTERVALS[i];
+        }
+    }
+    if (best > 0.0) {
+        printf("longest update interval for p99 <= %.1f us: %.1f s (%.3f Hz)\n",
+               config.target_us, best, 1.0 / best);
+    } else {
+        printf("no update interval meets p99 <= %.1f us\n", config.target_us);
+    }
+
+    cost(&config);
+    return 0;
+}
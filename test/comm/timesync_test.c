@@ -45,7 +45,7 @@ uint32_t fbp_time_counter_u32_() {
 #define SETUP()                                         \
     (void) state;                                       \
     counter_ = 0;                                       \
-    struct fbp_ts_s * self = fbp_ts_initialize()
+    struct fbp_ts_s * self = fbp_ts_initialize(FBP_TS_ESTIMATOR_SNAP)
 
 
 #define TEARDOWN() \
@@ -105,12 +105,124 @@ static void test_multiple_zero_noise(void ** state) {
     TEARDOWN();
 }
 
+static void test_time_batch(void ** state) {
+    SETUP();
+    uint64_t counter[8];
+    int64_t time[8];
+    for (int i = 0; i < 8; ++i) {
+        counter[i] = 60000 + i * 250;
+    }
+    fbp_ts_time_batch(self, counter, time, 8);
+    assert_time_within_1us(time[4], FBP_TIME_MINUTE + FBP_TIME_SECOND);
+
+    counter_ = 60000;
+    fbp_ts_update(self, counter_, FBP_TIME_HOUR, FBP_TIME_HOUR, counter_);
+    fbp_ts_time_batch(NULL, counter, time, 8);
+    for (int i = 0; i < 8; ++i) {
+        counter_ = counter[i];
+        assert_int_equal(fbp_ts_time(self), time[i]);
+    }
+    assert_time_within_1us(time[4], FBP_TIME_HOUR + FBP_TIME_SECOND);
+    TEARDOWN();
+
+    fbp_ts_time_batch(NULL, counter, time, 8);
+    assert_int_equal(0, time[0]);
+    assert_int_equal(0, time[7]);
+}
+
+#define SERVO_DRIFT_PER_MINUTE (6 * FBP_TIME_MILLISECOND)  // 100 ppm slow counter
+
+static void test_servo_drift(void ** state) {
+    (void) state;
+    counter_ = 60000;
+    struct fbp_ts_s * self = fbp_ts_initialize(FBP_TS_ESTIMATOR_SERVO);
+    struct fbp_ts_status_s status;
+    int64_t time = FBP_TIME_HOUR;
+    int64_t time_prev = 0;
+    for (int i = 0; i < 40; ++i) {
+        fbp_ts_update(self, counter_ - 1, time, time, counter_ + 1);
+        int64_t t = fbp_ts_time(self);
+        if (i) {
+            // slews, never steps by more than the correction
+            assert_true((t - time_prev) > (60 * FBP_TIME_SECOND - SERVO_DRIFT_PER_MINUTE));
+        }
+        if (i >= 20) {
+            assert_time_within_1us(t, time);
+        }
+        counter_ += 60 * COUNTER_FREQ;
+        time += 60 * FBP_TIME_SECOND + SERVO_DRIFT_PER_MINUTE;
+        time_prev = t;
+    }
+    assert_int_equal(0, fbp_ts_status_get(self, &status));
+    assert_int_equal(FBP_TS_ESTIMATOR_SERVO, status.estimator);
+    assert_int_equal(40, status.update_count);
+    assert_int_equal(0, status.reject_count);
+    assert_in_range(status.drift_ppb, -100010, -99990);
+    assert_true(status.uncertainty < FBP_TIME_MICROSECOND);
+    TEARDOWN();
+}
+
+static void test_servo_outlier(void ** state) {
+    (void) state;
+    counter_ = 60000;
+    struct fbp_ts_s * self = fbp_ts_initialize(FBP_TS_ESTIMATOR_SERVO);
+    struct fbp_ts_status_s status;
+    int64_t time = FBP_TIME_HOUR;
+    for (int i = 0; i < 8; ++i) {
+        if (i == 5) {
+            // long, asymmetric round trip
+            fbp_ts_update(self, counter_ - 1, time + 40 * FBP_TIME_MILLISECOND,
+                          time + 40 * FBP_TIME_MILLISECOND, counter_ + 100);
+            assert_time_within_1us(fbp_ts_time(self), time);
+        } else {
+            fbp_ts_update(self, counter_ - 1, time, time, counter_ + 1);
+        }
+        assert_time_within_1us(fbp_ts_time(self), time);
+        counter_ += 10 * COUNTER_FREQ;
+        time += 10 * FBP_TIME_SECOND;
+    }
+    assert_int_equal(0, fbp_ts_status_get(self, &status));
+    assert_int_equal(7, status.update_count);
+    assert_int_equal(1, status.reject_count);
+    assert_int_equal(0, status.drift_ppb);
+    TEARDOWN();
+}
+
+static void test_servo_jitter(void ** state) {
+    (void) state;
+    counter_ = 60000;
+    struct fbp_ts_s * self = fbp_ts_initialize(FBP_TS_ESTIMATOR_SERVO);
+    struct fbp_ts_status_s status;
+    int64_t time = FBP_TIME_HOUR;
+    for (int i = 0; i < 40; ++i) {
+        if (i & 1) {
+            // queued request: longer round trip, midpoint 1 ms early
+            fbp_ts_update(self, counter_ - 3, time, time, counter_ + 1);
+        } else {
+            fbp_ts_update(self, counter_ - 1, time, time, counter_ + 1);
+        }
+        if (i >= 20) {
+            assert_in_range(fbp_ts_time(self), time - 20 * FBP_TIME_MICROSECOND, time + 20 * FBP_TIME_MICROSECOND);
+        }
+        counter_ += 10 * COUNTER_FREQ;
+        time += 10 * FBP_TIME_SECOND;
+    }
+    assert_int_equal(0, fbp_ts_status_get(self, &status));
+    assert_int_equal(40, status.update_count);
+    assert_true((status.drift_ppb > -1000) && (status.drift_ppb < 1000));
+    TEARDOWN();
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
             cmocka_unit_test(test_initialize),
             cmocka_unit_test(test_single_exact_update),
             cmocka_unit_test(test_single_inexact_update),
             cmocka_unit_test(test_multiple_zero_noise),
+            cmocka_unit_test(test_time_batch),
+            cmocka_unit_test(test_servo_drift),
+            cmocka_unit_test(test_servo_outlier),
+            cmocka_unit_test(test_servo_jitter),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
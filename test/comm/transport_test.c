@@ -20,10 +20,28 @@
 #include <cmocka.h>
 #include <string.h>
 #include "fitterbap/comm/transport.h"
+#include "fitterbap/ec.h"
 #include "fitterbap/platform.h"
 
 
 uint8_t DATA1[] = {1, 2, 3, 4, 5, 6, 7, 8};
+static int mutex_instance_;
+static int mutex_depth_;
+
+fbp_os_mutex_t fbp_os_mutex_alloc_() {return (fbp_os_mutex_t) &mutex_instance_;}
+void fbp_os_mutex_free_(fbp_os_mutex_t mutex) {(void) mutex;}
+
+void fbp_os_mutex_lock_(fbp_os_mutex_t mutex) {
+    assert_ptr_equal(&mutex_instance_, mutex);
+    assert_int_equal(0, mutex_depth_);  // never nested
+    ++mutex_depth_;
+}
+
+void fbp_os_mutex_unlock_(fbp_os_mutex_t mutex) {
+    assert_ptr_equal(&mutex_instance_, mutex);
+    assert_int_equal(1, mutex_depth_);
+    --mutex_depth_;
+}
 
 
 struct fbp_dl_s {
@@ -33,12 +51,23 @@ struct fbp_dl_s {
 static int32_t ll_send(void * user_data, uint16_t metadata,
                      uint8_t const *msg, uint32_t msg_size) {
     (void) user_data;
+    assert_int_equal(0, mutex_depth_);  // callbacks run unlocked
     check_expected(metadata);
     check_expected(msg_size);
     check_expected_ptr(msg);
     return 0;
 }
 
+static int32_t ll_sendv(void * user_data, uint16_t metadata,
+                        struct fbp_iovec_s const *iov, uint32_t iov_count) {
+    (void) user_data;
+    (void) iov;
+    assert_int_equal(0, mutex_depth_);
+    check_expected(metadata);
+    check_expected(iov_count);
+    return 0;
+}
+
 #define expect_send(_metadata, _msg_data, _msg_size, _timeout_ms)    \
     expect_value(ll_send, metadata, _metadata);    \
     expect_value(ll_send, msg_size, _msg_size );   \
@@ -71,8 +100,35 @@ static void test_send(void ** state) {
     assert_int_not_equal(0, fbp_transport_send(self->t, FBP_TRANSPORT_PORT_MAX + 1, FBP_TRANSPORT_SEQ_SINGLE, 0, DATA1, sizeof(DATA1)));
 }
 
+static void test_sendv(void ** state) {
+    struct fbp_dl_s * self = (struct fbp_dl_s *) *state;
+    struct fbp_iovec_s iov[3] = {
+            {.buf = DATA1, .size = 2},
+            {.buf = DATA1 + 2, .size = 0},
+            {.buf = DATA1 + 2, .size = sizeof(DATA1) - 2},
+    };
+    struct fbp_transport_port_status_s status;
+
+    // no ll_sendv registered: gather and use ll_send
+    expect_send(0x12C3, DATA1, sizeof(DATA1), 0);
+    assert_int_equal(0, fbp_transport_sendv(self->t, 3, FBP_TRANSPORT_SEQ_SINGLE, 0x12, iov, 3));
+
+    fbp_transport_register_ll_sendv(self->t, ll_sendv);
+    expect_value(ll_sendv, metadata, 0x12C3);
+    expect_value(ll_sendv, iov_count, 3);
+    assert_int_equal(0, fbp_transport_sendv(self->t, 3, FBP_TRANSPORT_SEQ_SINGLE, 0x12, iov, 3));
+    expect_value(ll_sendv, metadata, 0x12C3);
+    expect_value(ll_sendv, iov_count, 1);
+    assert_int_equal(0, fbp_transport_send(self->t, 3, FBP_TRANSPORT_SEQ_SINGLE, 0x12, DATA1, sizeof(DATA1)));
+
+    assert_int_equal(0, fbp_transport_port_status_get(self->t, 3, &status));
+    assert_int_equal(3, status.tx_msgs);
+    assert_int_equal(3 * sizeof(DATA1), status.tx_bytes);
+}
+
 static void on_event(void *user_data, enum fbp_dl_event_e event) {
     (void) user_data;
+    assert_int_equal(0, mutex_depth_);
     check_expected(event);
 }
 
@@ -83,6 +139,7 @@ static void on_recv(void *user_data, uint8_t port_id,
                     enum fbp_transport_seq_e seq, uint8_t port_data,
                     uint8_t *msg, uint32_t msg_size) {
     (void) user_data;
+    assert_int_equal(0, mutex_depth_);
     check_expected(port_id);
     check_expected(seq);
     check_expected(port_data);
@@ -195,14 +252,175 @@ static void test_event_inject(void ** state) {
     fbp_transport_event_inject(self->t, FBP_DL_EV_DISCONNECTED);
 }
 
+static void test_port_status(void ** state) {
+    struct fbp_dl_s *self = (struct fbp_dl_s *) *state;
+    struct fbp_transport_port_status_s status;
+
+    expect_event(FBP_DL_EV_CONNECTED);
+    assert_int_equal(0, fbp_transport_port_register(self->t, 1, NULL, on_event, on_recv, self));
+    expect_send(0x12C1, DATA1, sizeof(DATA1), 0);
+    assert_int_equal(0, fbp_transport_send(self->t, 1, FBP_TRANSPORT_SEQ_SINGLE, 0x12, DATA1, sizeof(DATA1)));
+    expect_recv(1, FBP_TRANSPORT_SEQ_SINGLE, 0x12, DATA1, 4);
+    fbp_transport_on_recv_cbk(self->t, MPACK(1, SINGLE, 0x12), DATA1, 4);
+
+    assert_int_equal(0, fbp_transport_port_status_get(self->t, 1, &status));
+    assert_int_equal(1, status.tx_msgs);
+    assert_int_equal(sizeof(DATA1), status.tx_bytes);
+    assert_int_equal(1, status.rx_msgs);
+    assert_int_equal(4, status.rx_bytes);
+    assert_int_equal(0, status.credit_limit);
+    assert_int_equal(0, status.queue_depth);
+
+    assert_int_equal(0, fbp_transport_port_status_get(self->t, 2, &status));
+    assert_int_equal(0, status.tx_msgs);
+    assert_int_equal(0, status.rx_msgs);
+    assert_int_not_equal(0, fbp_transport_port_status_get(self->t, FBP_TRANSPORT_PORT_MAX + 1, &status));
+
+    assert_int_equal(0, fbp_transport_port_status_clear(self->t, 1));
+    assert_int_equal(0, fbp_transport_port_status_get(self->t, 1, &status));
+    assert_int_equal(0, status.tx_msgs);
+    assert_int_equal(0, status.rx_bytes);
+}
+
+static void test_port_credits(void ** state) {
+    struct fbp_dl_s *self = (struct fbp_dl_s *) *state;
+    struct fbp_transport_port_status_s status;
+
+    // limits do not apply until the peer grants credits
+    assert_int_equal(0, fbp_transport_port_credit_limit_set(self->t, 3, 2));
+    for (int i = 0; i < 3; ++i) {
+        expect_send(0x00C3, DATA1, sizeof(DATA1), 0);
+        assert_int_equal(0, fbp_transport_send(self->t, 3, FBP_TRANSPORT_SEQ_SINGLE, 0, DATA1, sizeof(DATA1)));
+    }
+    fbp_transport_credit_enable(self->t, true);
+
+    expect_send(0x00C3, DATA1, sizeof(DATA1), 0);
+    assert_int_equal(0, fbp_transport_send(self->t, 3, FBP_TRANSPORT_SEQ_SINGLE, 0, DATA1, sizeof(DATA1)));
+    expect_send(0x00C3, DATA1, sizeof(DATA1), 0);
+    assert_int_equal(0, fbp_transport_send(self->t, 3, FBP_TRANSPORT_SEQ_SINGLE, 0, DATA1, sizeof(DATA1)));
+    assert_int_equal(FBP_ERROR_FULL, fbp_transport_send(self->t, 3, FBP_TRANSPORT_SEQ_SINGLE, 0, DATA1, sizeof(DATA1)));
+
+    // other ports are not affected
+    expect_send(0x00C4, DATA1, sizeof(DATA1), 0);
+    assert_int_equal(0, fbp_transport_send(self->t, 4, FBP_TRANSPORT_SEQ_SINGLE, 0, DATA1, sizeof(DATA1)));
+
+    assert_int_equal(0, fbp_transport_port_status_get(self->t, 3, &status));
+    assert_int_equal(5, status.tx_msgs);  // including 3 before credits were enabled
+    assert_int_equal(1, status.tx_blocked);
+    assert_int_equal(2, status.credit_limit);
+    assert_int_equal(0, status.credits);
+    assert_int_equal(2, status.queue_depth);
+    assert_int_equal(2, status.queue_depth_max);
+
+    assert_int_equal(0, fbp_transport_port_credit_return(self->t, 3, 1));
+    assert_int_equal(0, fbp_transport_port_status_get(self->t, 3, &status));
+    assert_int_equal(1, status.credits);
+    assert_int_equal(1, status.queue_depth);
+    expect_send(0x00C3, DATA1, sizeof(DATA1), 0);
+    assert_int_equal(0, fbp_transport_send(self->t, 3, FBP_TRANSPORT_SEQ_SINGLE, 0, DATA1, sizeof(DATA1)));
+
+    // saturate at limit
+    assert_int_equal(0, fbp_transport_port_credit_return(self->t, 3, 10));
+    assert_int_equal(0, fbp_transport_port_status_get(self->t, 3, &status));
+    assert_int_equal(2, status.credits);
+    assert_int_equal(0, status.queue_depth);
+
+    // disconnect restores credits and disables them until negotiated again
+    expect_send(0x00C3, DATA1, sizeof(DATA1), 0);
+    assert_int_equal(0, fbp_transport_send(self->t, 3, FBP_TRANSPORT_SEQ_SINGLE, 0, DATA1, sizeof(DATA1)));
+    fbp_transport_on_event_cbk(self->t, FBP_DL_EV_DISCONNECTED);
+    assert_int_equal(0, fbp_transport_port_status_get(self->t, 3, &status));
+    assert_int_equal(2, status.credits);
+    assert_int_equal(0, status.queue_depth);
+    fbp_transport_credit_enable(self->t, true);
+
+    // disable
+    assert_int_equal(0, fbp_transport_port_credit_limit_set(self->t, 3, 0));
+    for (int i = 0; i < 4; ++i) {
+        expect_send(0x00C3, DATA1, sizeof(DATA1), 0);
+        assert_int_equal(0, fbp_transport_send(self->t, 3, FBP_TRANSPORT_SEQ_SINGLE, 0, DATA1, sizeof(DATA1)));
+    }
+}
+
+static void on_credit(void * user_data) {
+    (void) user_data;
+    assert_int_equal(0, mutex_depth_);
+    function_called();
+}
+
+static void test_credit_grant(void ** state) {
+    struct fbp_dl_s *self = (struct fbp_dl_s *) *state;
+    expect_event(FBP_DL_EV_CONNECTED);
+    assert_int_equal(0, fbp_transport_port_register(self->t, 1, NULL, on_event, on_recv, self));
+    fbp_transport_register_credit_fn(self->t, on_credit, self);
+
+    // not counted until the peer grants credits
+    expect_recv(1, FBP_TRANSPORT_SEQ_SINGLE, 0x12, DATA1, 4);
+    fbp_transport_on_recv_cbk(self->t, MPACK(1, SINGLE, 0x12), DATA1, 4);
+    assert_int_equal(0, fbp_transport_credit_grant_take(self->t, 1));
+
+    // notify once per batch
+    fbp_transport_credit_enable(self->t, true);
+    expect_function_call(on_credit);
+    for (int i = 0; i < 3; ++i) {
+        expect_recv(1, FBP_TRANSPORT_SEQ_SINGLE, 0x12, DATA1, 4);
+        fbp_transport_on_recv_cbk(self->t, MPACK(1, SINGLE, 0x12), DATA1, 4);
+    }
+    assert_int_equal(3, fbp_transport_credit_grant_take(self->t, 1));
+    assert_int_equal(0, fbp_transport_credit_grant_take(self->t, 1));
+
+    // port 0 carries the grants, so it is never counted
+    fbp_transport_on_recv_cbk(self->t, MPACK(0, SINGLE, 0x12), DATA1, 4);
+    assert_int_equal(0, fbp_transport_credit_grant_take(self->t, 0));
+
+    // disconnect discards pending grants
+    expect_function_call(on_credit);
+    expect_recv(1, FBP_TRANSPORT_SEQ_SINGLE, 0x12, DATA1, 4);
+    fbp_transport_on_recv_cbk(self->t, MPACK(1, SINGLE, 0x12), DATA1, 4);
+    expect_event(FBP_DL_EV_DISCONNECTED);
+    fbp_transport_on_event_cbk(self->t, FBP_DL_EV_DISCONNECTED);
+    assert_int_equal(0, fbp_transport_credit_grant_take(self->t, 1));
+}
+
+static void test_credit_release_deferred(void ** state) {
+    struct fbp_dl_s *self = (struct fbp_dl_s *) *state;
+    expect_event(FBP_DL_EV_CONNECTED);
+    assert_int_equal(0, fbp_transport_port_register(self->t, 1, NULL, on_event, on_recv, self));
+    assert_int_equal(0, fbp_transport_port_credit_defer(self->t, 1, true));
+    fbp_transport_register_credit_fn(self->t, on_credit, self);
+    fbp_transport_credit_enable(self->t, true);
+
+    // received but not yet released by the port consumer
+    for (int i = 0; i < 3; ++i) {
+        expect_recv(1, FBP_TRANSPORT_SEQ_SINGLE, 0x12, DATA1, 4);
+        fbp_transport_on_recv_cbk(self->t, MPACK(1, SINGLE, 0x12), DATA1, 4);
+    }
+    assert_int_equal(0, fbp_transport_credit_grant_take(self->t, 1));
+
+    expect_function_call(on_credit);
+    assert_int_equal(0, fbp_transport_port_credit_release(self->t, 1, 2));
+    assert_int_equal(0, fbp_transport_port_credit_release(self->t, 1, 1));
+    assert_int_equal(3, fbp_transport_credit_grant_take(self->t, 1));
+
+    assert_int_equal(0, fbp_transport_port_credit_release(self->t, 0, 1));
+    assert_int_equal(0, fbp_transport_credit_grant_take(self->t, 0));
+    assert_int_not_equal(0, fbp_transport_port_credit_release(self->t, FBP_TRANSPORT_PORT_MAX + 1, 1));
+    assert_int_not_equal(0, fbp_transport_port_credit_defer(self->t, FBP_TRANSPORT_PORT_MAX + 1, true));
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
             cmocka_unit_test_setup_teardown(test_send, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_sendv, setup, teardown),
             cmocka_unit_test_setup_teardown(test_event, setup, teardown),
             cmocka_unit_test_setup_teardown(test_event_when_not_connected, setup, teardown),
             cmocka_unit_test_setup_teardown(test_recv, setup, teardown),
             cmocka_unit_test_setup_teardown(test_default, setup, teardown),
             cmocka_unit_test_setup_teardown(test_event_inject, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_port_status, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_port_credits, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_credit_grant, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_credit_release_deferred, setup, teardown),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2022 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ *
+ * @brief PubSub publish latency benchmark.
+ *
+ * This program measures the time for fbp_pubsub_publish() followed by
+ * fbp_pubsub_process() as the topic tree grows.  Each tree has one
+ * subscriber per leaf group and places all leaves under a few parents,
+ * so each parent has many siblings.  The program publishes to random
+ * 4-level topics and reports ns per publish, both by topic string
+ * and by topic handle.
+ *
+ * The program then measures publish throughput with N producer threads
+ * and a single consumer thread calling fbp_pubsub_process(), which is
+ * the typical multi-threaded configuration.
+ *
+ * Usage: pubsub_bench
+ */
+
+#include "fitterbap/pubsub.h"
+#include "fitterbap/os/mutex.h"
+#include "fitterbap/time.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define PUBLISH_COUNT (1000000)
+#define GROUP_COUNT (4)
+
+static const uint32_t TOPIC_COUNTS[] = {16, 64, 256, 1024, 2048, 4096};
+#define TOPIC_COUNTS_LENGTH ((int) (sizeof(TOPIC_COUNTS) / sizeof(TOPIC_COUNTS[0])))
+
+#define PRODUCER_PUBLISH_COUNT (200000)
+static const uint32_t PRODUCER_COUNTS[] = {1, 2, 4, 8};
+#define PRODUCER_COUNTS_LENGTH ((int) (sizeof(PRODUCER_COUNTS) / sizeof(PRODUCER_COUNTS[0])))
+#define PRODUCER_COUNT_MAX (8)
+
+struct producer_s {
+    struct fbp_pubsub_s * ps;
+    char topic[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+};
+
+static uint32_t rx_count_;
+
+void fbp_fatal(char const * file, int line, char const * msg) {
+    printf("FATAL: %s:%d: %s\n", file, line, msg);
+    fflush(stdout);
+    exit(1);
+}
+
+void * fbp_alloc_(fbp_size_t size_bytes) {
+    return malloc((size_t) size_bytes);
+}
+
+void fbp_free_(void * ptr) {
+    free(ptr);
+}
+
+void fbp_log_printf_(const char * format, ...) {
+    va_list arg;
+    va_start(arg, format);
+    vprintf(format, arg);
+    va_end(arg);
+}
+
+static uint8_t on_pub(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) user_data;
+    (void) topic;
+    (void) value;
+    ++rx_count_;
+    return 0;
+}
+
+static void topic_name(char * topic, uint32_t idx) {
+    snprintf(topic, FBP_PUBSUB_TOPIC_LENGTH_MAX, "b/g%u/t%u/v", (unsigned int) (idx % GROUP_COUNT),
+             (unsigned int) idx);
+}
+
+static double bench(uint32_t topic_count, bool use_handle) {
+    char * topics = malloc((size_t) topic_count * FBP_PUBSUB_TOPIC_LENGTH_MAX);
+    struct fbp_pubsub_topic_s ** handles = malloc(topic_count * sizeof(struct fbp_pubsub_topic_s *));
+    uint32_t * order = malloc(PUBLISH_COUNT * sizeof(uint32_t));
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("b", 0);
+
+    for (uint32_t i = 0; i < GROUP_COUNT; ++i) {
+        char group[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+        snprintf(group, sizeof(group), "b/g%u", (unsigned int) i);
+        fbp_pubsub_subscribe(ps, group, FBP_PUBSUB_SFLAG_PUB, on_pub, NULL);
+    }
+    for (uint32_t i = 0; i < topic_count; ++i) {
+        char * topic = topics + i * FBP_PUBSUB_TOPIC_LENGTH_MAX;
+        topic_name(topic, i);
+        fbp_pubsub_publish(ps, topic, &fbp_union_u32(0), NULL, NULL);
+        handles[i] = fbp_pubsub_topic_handle_get(ps, topic);
+    }
+    fbp_pubsub_process(ps);
+    for (uint32_t i = 0; i < PUBLISH_COUNT; ++i) {
+        order[i] = (uint32_t) rand() % topic_count;
+    }
+
+    rx_count_ = 0;
+    clock_t start = clock();
+    if (use_handle) {
+        for (uint32_t i = 0; i < PUBLISH_COUNT; ++i) {
+            fbp_pubsub_publish_handle(ps, handles[order[i]], &fbp_union_u32(i), NULL, NULL);
+            fbp_pubsub_process(ps);
+        }
+    } else {
+        for (uint32_t i = 0; i < PUBLISH_COUNT; ++i) {
+            fbp_pubsub_publish(ps, topics + order[i] * FBP_PUBSUB_TOPIC_LENGTH_MAX, &fbp_union_u32(i), NULL, NULL);
+            fbp_pubsub_process(ps);
+        }
+    }
+    clock_t stop = clock();
+    if (rx_count_ != PUBLISH_COUNT) {
+        printf("ERROR: received %u of %u\n", (unsigned int) rx_count_, (unsigned int) PUBLISH_COUNT);
+    }
+
+    fbp_pubsub_finalize(ps);
+    free(order);
+    free(handles);
+    free(topics);
+    return ((double) (stop - start)) * 1e9 / ((double) CLOCKS_PER_SEC * PUBLISH_COUNT);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI producer_thread(LPVOID arg) {
+#else
+static void * producer_thread(void * arg) {
+#endif
+    struct producer_s * p = (struct producer_s *) arg;
+    for (uint32_t i = 0; i < PRODUCER_PUBLISH_COUNT; ++i) {
+        fbp_pubsub_publish(p->ps, p->topic, &fbp_union_u32(i), NULL, NULL);
+    }
+    return 0;
+}
+
+static double bench_producers(uint32_t producer_count) {
+    struct producer_s producers[PRODUCER_COUNT_MAX];
+#if defined(_WIN32)
+    HANDLE threads[PRODUCER_COUNT_MAX];
+#else
+    pthread_t threads[PRODUCER_COUNT_MAX];
+#endif
+    uint32_t total = producer_count * PRODUCER_PUBLISH_COUNT;
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("b", 0);
+    fbp_os_mutex_t mutex = fbp_os_mutex_alloc("pubsub_bench");
+    fbp_pubsub_register_mutex(ps, mutex);
+    fbp_pubsub_subscribe(ps, "b", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL);
+    for (uint32_t i = 0; i < producer_count; ++i) {
+        producers[i].ps = ps;
+        snprintf(producers[i].topic, sizeof(producers[i].topic), "b/p%u/v", (unsigned int) i);
+        fbp_pubsub_publish(ps, producers[i].topic, &fbp_union_u32(0), NULL, NULL);
+    }
+    fbp_pubsub_process(ps);
+
+    rx_count_ = 0;
+    uint64_t start = fbp_time_counter_u64();
+    for (uint32_t i = 0; i < producer_count; ++i) {
+#if defined(_WIN32)
+        threads[i] = CreateThread(NULL, 0, producer_thread, &producers[i], 0, NULL);
+#else
+        pthread_create(&threads[i], NULL, producer_thread, &producers[i]);
+#endif
+    }
+    while (rx_count_ < total) {
+        fbp_pubsub_process(ps);
+    }
+    uint64_t stop = fbp_time_counter_u64();
+    for (uint32_t i = 0; i < producer_count; ++i) {
+#if defined(_WIN32)
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+
+    fbp_pubsub_finalize(ps);
+    fbp_os_mutex_free(mutex);
+    double duration = ((double) (stop - start)) / fbp_time_counter_frequency();
+    return ((double) total) / duration;
+}
+
+int main(void) {
+    srand(1);
+    printf("%8s %12s %12s\n", "topics", "topic_ns", "handle_ns");
+    for (int i = 0; i < TOPIC_COUNTS_LENGTH; ++i) {
+        double topic_ns = bench(TOPIC_COUNTS[i], false);
+        double handle_ns = bench(TOPIC_COUNTS[i], true);
+        printf("%8u %12.1f %12.1f\n", (unsigned int) TOPIC_COUNTS[i], topic_ns, handle_ns);
+        fflush(stdout);
+    }
+
+    printf("\n%8s %12s\n", "threads", "msg_per_s");
+    for (int i = 0; i < PRODUCER_COUNTS_LENGTH; ++i) {
+        double rate = bench_producers(PRODUCER_COUNTS[i]);
+        printf("%8u %12.0f\n", (unsigned int) PRODUCER_COUNTS[i], rate);
+        fflush(stdout);
+    }
+    return 0;
+}
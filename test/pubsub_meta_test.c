@@ -115,12 +115,47 @@ static void test_bool(void **state) {
     assert_int_equal(1, value.value.u8);
 }
 
+const char * META_INVALID_OPTION = "{"
+    "\"dtype\": \"u8\","
+    "\"options\": [[1, \"one\"], [300, \"big\"], [2, \"two\"]]"
+"}";
+
+static void check_compiled(const char * meta, struct fbp_union_s value) {
+    struct fbp_union_s expect = value;
+    int32_t rc = fbp_pubsub_meta_value(meta, &expect);
+    struct fbp_pubsub_meta_validator_s * v = fbp_pubsub_meta_compile(meta);
+    assert_non_null(v);
+    assert_int_equal(rc, fbp_pubsub_meta_validate(v, &value));
+    assert_true(fbp_union_eq_exact(&expect, &value));
+    fbp_pubsub_meta_free(v);
+}
+
+static void test_compiled(void **state) {
+    (void) state;
+    const char * metas[] = {META1, META_NO_DEFAULT, META_BOOL};
+    for (uint32_t i = 0; i < sizeof(metas) / sizeof(metas[0]); ++i) {
+        check_compiled(metas[i], fbp_union_u8(3));
+        check_compiled(metas[i], fbp_union_u32_r(10));
+        check_compiled(metas[i], fbp_union_i32(-1));
+        check_compiled(metas[i], fbp_union_u64(11));
+        check_compiled(metas[i], cstr("three"));
+        check_compiled(metas[i], cstr("3"));
+        check_compiled(metas[i], cstr("true"));
+        check_compiled(metas[i], cstr("__invalid__"));
+    }
+    check_compiled(META_INVALID_OPTION, fbp_union_u8(1));
+    check_compiled(META_INVALID_OPTION, cstr("one"));
+    check_compiled(META_INVALID_OPTION, cstr("two"));
+    assert_null(fbp_pubsub_meta_compile("{\"dtype\": "));
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
             cmocka_unit_test(test_basic),
             cmocka_unit_test(test_value),
             cmocka_unit_test(test_no_default),
             cmocka_unit_test(test_bool),
+            cmocka_unit_test(test_compiled),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
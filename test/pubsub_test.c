@@ -19,13 +19,22 @@
 #include <setjmp.h>
 #include <cmocka.h>
 #include <string.h>
+#include "fitterbap/crc.h"
+#include "fitterbap/cstr.h"
 #include "fitterbap/ec.h"
 #include "fitterbap/platform.h"
 #include "fitterbap/pubsub.h"
+#include "fitterbap/time.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 static const char * META1 =
     "{"
         "\"dtype\": \"u32\","
@@ -474,6 +483,883 @@ static void test_unretained(void ** state) {
     fbp_pubsub_finalize(ps);
 }
 
+static void test_many_topics(void ** state) {
+    (void) state;
+    char topic[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    struct fbp_union_s value;
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    for (uint32_t i = 0; i < 500; ++i) {
+        snprintf(topic, sizeof(topic), "s/g%u/t%u", i % 7, i);
+        assert_int_equal(0, fbp_pubsub_publish(ps, topic, &fbp_union_u32_r(i), NULL, NULL));
+    }
+    fbp_pubsub_process(ps);
+    for (uint32_t i = 0; i < 500; ++i) {
+        snprintf(topic, sizeof(topic), "s/g%u/t%u", i % 7, i);
+        assert_int_equal(0, fbp_pubsub_query(ps, topic, &value));
+        assert_int_equal(i, value.value.u32);
+    }
+    assert_int_not_equal(0, fbp_pubsub_query(ps, "s/g1/t0", &value));
+    assert_int_not_equal(0, fbp_pubsub_query(ps, "s/g0t0", &value));
+    assert_int_equal(0, fbp_pubsub_query(ps, "s/g3/t10/", &value));  // not normalized
+    assert_int_equal(10, value.value.u32);
+
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/g5", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    expect_pub_u32("s/g5/t271", 1000);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/g5/t271", &fbp_union_u32_r(1000), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/g4/t270", &fbp_union_u32_r(1000), NULL, NULL));
+    fbp_pubsub_process(ps);
+    fbp_pubsub_finalize(ps);
+}
+
+static void test_handle(void ** state) {
+    (void) state;
+    struct fbp_union_s value;
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    assert_null(fbp_pubsub_topic_handle_get(ps, ""));
+    assert_null(fbp_pubsub_topic_handle_get(ps, "s/hello/world$"));
+    assert_null(fbp_pubsub_topic_handle_get(ps, "s/hello/world#"));
+    struct fbp_pubsub_topic_s * h = fbp_pubsub_topic_handle_get(ps, "s/hello/world");
+    assert_non_null(h);
+    assert_ptr_equal(h, fbp_pubsub_topic_handle_get(ps, "s/hello/world"));
+
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/hello", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    expect_pub_u32("s/hello/world", 42);
+    assert_int_equal(0, fbp_pubsub_publish_handle(ps, h, &fbp_union_u32_r(42), NULL, NULL));
+    fbp_pubsub_process(ps);
+    assert_int_equal(0, fbp_pubsub_query(ps, "s/hello/world", &value));
+    assert_int_equal(42, value.value.u32);
+    assert_int_equal(0, fbp_pubsub_publish_handle(ps, h, &fbp_union_u32_r(42), NULL, NULL));  // dedup
+
+    // handle publish uses metadata and return codes
+    expect_pub_u8("s/hello/world", 2);
+    assert_int_equal(0, fbp_pubsub_meta(ps, "s/hello/world", META2));
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "", FBP_PUBSUB_SFLAG_RETURN_CODE, on_pub, NULL));
+    expect_pub_u8("s/hello/world", 1);
+    assert_int_equal(0, fbp_pubsub_publish_handle(ps, h, &fbp_union_cstr_r("one"), NULL, NULL));
+    expect_pub_i32("s/hello/world#", FBP_ERROR_PARAMETER_INVALID);
+    assert_int_equal(0, fbp_pubsub_publish_handle(ps, h, &fbp_union_cstr_r("__invalid__"), NULL, NULL));
+    fbp_pubsub_process(ps);
+    fbp_pubsub_finalize(ps);
+}
+
+struct unsub_s {
+    struct fbp_pubsub_s * ps;
+    uint32_t count;
+};
+
+static uint8_t on_pub_unsub(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) topic;
+    (void) value;
+    struct unsub_s * u = (struct unsub_s *) user_data;
+    ++u->count;
+    assert_int_equal(0, fbp_pubsub_unsubscribe(u->ps, "s", on_pub, NULL));
+    return 0;
+}
+
+static void test_dispatch_cache(void ** state) {
+    (void) state;
+    struct unsub_s u;
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    u.ps = ps;
+    u.count = 0;
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/a", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    expect_pub_u32("s/a/b", 1);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a/b", &fbp_union_u32_r(1), NULL, NULL));
+    fbp_pubsub_process(ps);
+
+    // subscribe to an ancestor after the cache is built
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    expect_pub_u32("s/a/b", 2);
+    expect_pub_u32("s/a/b", 2);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a/b", &fbp_union_u32_r(2), NULL, NULL));
+    fbp_pubsub_process(ps);
+
+    // unsubscribe a later subscriber from within a callback
+    assert_int_equal(0, fbp_pubsub_unsubscribe(ps, "s/a", on_pub, NULL));
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/a/b", FBP_PUBSUB_SFLAG_PUB, on_pub_unsub, &u));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a/b", &fbp_union_u32_r(3), NULL, NULL));
+    fbp_pubsub_process(ps);
+    assert_int_equal(1, u.count);
+    fbp_pubsub_finalize(ps);
+}
+
+static void test_queue_order(void ** state) {
+    (void) state;
+    char msg[] = "hello";
+    fbp_os_mutex_t mutex = fbp_os_mutex_alloc("pubsub");
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 64);
+    fbp_pubsub_register_mutex(ps, mutex);
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    fbp_pubsub_process(ps);
+
+    // more pending messages than the free message cache holds
+    for (int k = 0; k < 2; ++k) {
+        for (uint32_t i = 0; i < 200; ++i) {
+            assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &fbp_union_u32(i), NULL, NULL));
+            expect_pub_u32("s/a", i);
+            if (0 == (i % 50)) {
+                assert_int_equal(0, fbp_pubsub_publish(ps, "s/b", &fbp_union_str(msg), NULL, NULL));
+                expect_pub_cstr("s/b", msg);
+            }
+        }
+        fbp_pubsub_process(ps);
+    }
+
+    fbp_pubsub_finalize(ps);
+    fbp_os_mutex_free(mutex);
+}
+
+static uint8_t on_pub_keep(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) topic;
+    const uint8_t ** keep = (const uint8_t **) user_data;
+    assert_int_equal(FBP_UNION_FLAG_REF, value->flags & FBP_UNION_FLAG_REF);
+    fbp_pubsub_buf_incr(value->value.bin);
+    *keep = value->value.bin;
+    return 0;
+}
+
+static void test_ref_buf(void ** state) {
+    (void) state;
+    const uint8_t * keep = NULL;
+    struct fbp_union_s v;
+    fbp_os_mutex_t mutex = fbp_os_mutex_alloc("pubsub");
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);  // no copy buffer
+    fbp_pubsub_register_mutex(ps, mutex);
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/a", FBP_PUBSUB_SFLAG_PUB, on_pub_keep, &keep));
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/b", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    fbp_pubsub_process(ps);
+
+    // large unretained buffer, subscriber keeps a reference
+    uint8_t * buf = fbp_pubsub_buf_alloc(4096);
+    fbp_memset(buf, 0x5a, 4096);
+    v = fbp_union_bin(buf, 4096);
+    v.flags = FBP_UNION_FLAG_REF;
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &v, NULL, NULL));
+    fbp_pubsub_process(ps);
+    assert_ptr_equal(buf, keep);
+    assert_int_equal(0x5a, keep[4095]);
+    fbp_pubsub_buf_decr(keep);
+
+    // retained buffers, topic keeps a reference until replaced
+    char * str = (char *) fbp_pubsub_buf_alloc(6);
+    fbp_cstr_copy(str, "hello", 6);
+    v = fbp_union_str(str);
+    v.flags = FBP_UNION_FLAG_REF | FBP_UNION_FLAG_RETAIN;
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b", &v, NULL, NULL));
+    expect_pub_cstr("s/b", "hello");
+    fbp_pubsub_process(ps);
+    assert_int_equal(0, fbp_pubsub_query(ps, "s/b", &v));
+    assert_ptr_equal(str, v.value.str);
+    fbp_pubsub_buf_decr(v.value.str);
+
+    str = (char *) fbp_pubsub_buf_alloc(6);
+    fbp_cstr_copy(str, "world", 6);
+    v = fbp_union_str(str);
+    v.flags = FBP_UNION_FLAG_REF | FBP_UNION_FLAG_RETAIN;
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b", &v, NULL, NULL));
+    expect_pub_cstr("s/b", "world");
+    fbp_pubsub_process(ps);
+
+    // pending buffers are released on finalize
+    str = (char *) fbp_pubsub_buf_alloc(6);
+    fbp_cstr_copy(str, "there", 6);
+    v = fbp_union_str(str);
+    v.flags = FBP_UNION_FLAG_REF;
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b", &v, NULL, NULL));
+    fbp_pubsub_finalize(ps);
+    fbp_os_mutex_free(mutex);
+}
+
+static void test_conflate(void ** state) {
+    (void) state;
+    fbp_os_mutex_t mutex = fbp_os_mutex_alloc("pubsub");
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    fbp_pubsub_register_mutex(ps, mutex);
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    assert_int_equal(0, fbp_pubsub_topic_conflate(ps, "s/a", true));
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_topic_conflate(ps, "s/a$", true));
+    fbp_pubsub_process(ps);
+
+    // delivered at the first pending position with the latest value
+    struct fbp_pubsub_topic_s * h = fbp_pubsub_topic_handle_get(ps, "s/a");
+    expect_pub_u32("s/a", 100);
+    for (uint32_t i = 0; i < 10; ++i) {
+        assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &fbp_union_u32_r(i), NULL, NULL));
+        assert_int_equal(0, fbp_pubsub_publish(ps, "s/b", &fbp_union_u32_r(i), NULL, NULL));
+        expect_pub_u32("s/b", i);
+    }
+    assert_int_equal(0, fbp_pubsub_publish_handle(ps, h, &fbp_union_u32_r(100), NULL, NULL));
+    fbp_pubsub_process(ps);
+
+    // replaced reference buffers are released
+    for (uint32_t i = 0; i < 3; ++i) {
+        char * str = (char *) fbp_pubsub_buf_alloc(4);
+        fbp_cstr_copy(str, "abc", 4);
+        str[2] = (char) ('0' + i);
+        struct fbp_union_s v = fbp_union_str(str);
+        v.flags = FBP_UNION_FLAG_REF;
+        assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &v, NULL, NULL));
+    }
+    expect_pub_cstr("s/a", "ab2");
+    fbp_pubsub_process(ps);
+
+    // disabled, all values delivered
+    assert_int_equal(0, fbp_pubsub_topic_conflate(ps, "s/a", false));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &fbp_union_u32_r(1), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &fbp_union_u32_r(2), NULL, NULL));
+    expect_pub_u32("s/a", 1);
+    expect_pub_u32("s/a", 2);
+    fbp_pubsub_process(ps);
+
+    fbp_pubsub_finalize(ps);
+    fbp_os_mutex_free(mutex);
+}
+
+static void on_publish_count(void * user_data) {
+    uint32_t * count = (uint32_t *) user_data;
+    ++*count;
+}
+
+static void test_publish_batch(void ** state) {
+    (void) state;
+    uint32_t wakeups = 0;
+    char msg[] = "0123456789abcde";
+    fbp_os_mutex_t mutex = fbp_os_mutex_alloc("pubsub");
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 64);
+    fbp_pubsub_register_mutex(ps, mutex);
+    fbp_pubsub_register_on_publish(ps, on_publish_count, &wakeups);
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    fbp_pubsub_process(ps);
+    wakeups = 0;
+
+    struct fbp_pubsub_entry_s entries[] = {
+            {.topic="s/a", .handle=NULL, .value=fbp_union_u32_r(1)},
+            {.topic=NULL, .handle=fbp_pubsub_topic_handle_get(ps, "s/b"), .value=fbp_union_u32_r(2)},
+            {.topic="s/c", .handle=NULL, .value=fbp_union_str(msg)},
+            {.topic="s/d", .handle=NULL, .value=fbp_union_cstr_r("hello")},
+            {.topic="s/e", .handle=NULL, .value=fbp_union_str(msg)},
+    };
+    assert_int_equal(0, fbp_pubsub_publish_batch(ps, entries, 5));
+    assert_int_equal(1, wakeups);
+    msg[0] = 'x';  // payloads were copied
+    expect_pub_u32("s/a", 1);
+    expect_pub_u32("s/b", 2);
+    expect_pub_cstr("s/c", "0123456789abcde");
+    expect_pub_cstr("s/d", "hello");
+    expect_pub_cstr("s/e", "0123456789abcde");
+    fbp_pubsub_process(ps);
+
+    // all or nothing
+    entries[1].handle = NULL;
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_publish_batch(ps, entries, 5));
+    entries[1].topic = "s/b";
+    entries[0].value = fbp_union_u32_r(3);
+    entries[1].value = fbp_union_u32_r(4);
+    assert_int_equal(0, fbp_pubsub_publish_batch(ps, entries, 2));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/f", &fbp_union_str(msg), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/f", &fbp_union_str(msg), NULL, NULL));
+    assert_int_equal(FBP_ERROR_NOT_ENOUGH_MEMORY, fbp_pubsub_publish_batch(ps, entries, 5));
+    assert_int_equal(0, fbp_pubsub_publish_batch(ps, entries, 0));
+    expect_pub_u32("s/a", 3);
+    expect_pub_u32("s/b", 4);
+    expect_pub_cstr("s/f", "x123456789abcde");
+    expect_pub_cstr("s/f", "x123456789abcde");
+    fbp_pubsub_process(ps);
+
+    fbp_pubsub_finalize(ps);
+    fbp_os_mutex_free(mutex);
+}
+
+static uint8_t on_pub_count(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) topic;
+    (void) value;
+    uint32_t * count = (uint32_t *) user_data;
+    ++*count;
+    return 0;
+}
+
+static void test_process_budget(void ** state) {
+    (void) state;
+    char topic[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    uint32_t count = 0;
+    fbp_os_mutex_t mutex = fbp_os_mutex_alloc("pubsub");
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    fbp_pubsub_register_mutex(ps, mutex);
+    for (uint32_t i = 0; i < 20; ++i) {
+        snprintf(topic, sizeof(topic), "s/g%u/t%u", (unsigned int) (i / 5), (unsigned int) i);
+        assert_int_equal(0, fbp_pubsub_publish(ps, topic, &fbp_union_u32_r(i), NULL, NULL));
+    }
+    fbp_pubsub_process(ps);
+
+    // retained replay resumes across calls
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s", FBP_PUBSUB_SFLAG_PUB | FBP_PUBSUB_SFLAG_RETAIN, on_pub_count, &count));
+    assert_true(fbp_pubsub_process_budget(ps, 10, 0));  // subscribe message, root topics
+    assert_true(count < 10);
+    uint32_t count_prev = count;
+    assert_true(fbp_pubsub_process_budget(ps, 1, FBP_TIME_SECOND));
+    assert_true(count <= count_prev + 1);
+    assert_false(fbp_pubsub_process_budget(ps, 0, FBP_TIME_SECOND));
+    assert_int_equal(20, count);
+
+    // updates wait for the pending replay
+    count = 0;
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/g1", FBP_PUBSUB_SFLAG_PUB | FBP_PUBSUB_SFLAG_RETAIN, on_pub_count, &count));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/g1/t5", &fbp_union_u32_r(100), NULL, NULL));
+    assert_true(fbp_pubsub_process_budget(ps, 4, 0));  // subscribe, g1 without value, t5, t6
+    assert_int_equal(2, count);
+    assert_false(fbp_pubsub_process_budget(ps, 0, 0));
+    assert_int_equal(7, count);  // 5 replay + 2 subscriptions for the update
+
+    // unsubscribe cancels a pending replay
+    assert_int_equal(0, fbp_pubsub_unsubscribe_from_all(ps, on_pub_count, &count));
+    count = 0;
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s", FBP_PUBSUB_SFLAG_PUB | FBP_PUBSUB_SFLAG_RETAIN, on_pub_count, &count));
+    assert_true(fbp_pubsub_process_budget(ps, 8, 0));
+    assert_int_equal(0, fbp_pubsub_unsubscribe_from_all(ps, on_pub_count, &count));
+    count_prev = count;
+    assert_false(fbp_pubsub_process_budget(ps, 0, 0));
+    assert_int_equal(count_prev, count);
+
+    fbp_pubsub_finalize(ps);
+    fbp_os_mutex_free(mutex);
+}
+
+static void test_wildcard(void ** state) {
+    (void) state;
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a/din", &fbp_union_u32_r(1), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b/din", &fbp_union_u32_r(2), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b/dout", &fbp_union_u32_r(3), NULL, NULL));
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_subscribe(ps, "s/a+", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_subscribe(ps, "s/#/din", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+
+    // '+' matches exactly one level, retained values filtered too
+    expect_pub_u32("s/a/din", 1);
+    expect_pub_u32("s/b/din", 2);
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/+/din", FBP_PUBSUB_SFLAG_RETAIN | FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    expect_pub_u32("s/c/din", 4);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/c/din", &fbp_union_u32_r(4), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/c/dout", &fbp_union_u32_r(5), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/c/din/x", &fbp_union_u32_r(6), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/din", &fbp_union_u32_r(7), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_unsubscribe(ps, "s/+/din", on_pub, NULL));
+    assert_int_equal(FBP_ERROR_NOT_FOUND, fbp_pubsub_unsubscribe(ps, "s/+/din", on_pub, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a/din", &fbp_union_u32_r(8), NULL, NULL));
+
+    // '#' matches the parent and all descendants
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "+/b/#", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    expect_pub_u32("s/b", 9);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b", &fbp_union_u32_r(9), NULL, NULL));
+    expect_pub_u32("s/b/dout/x", 10);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b/dout/x", &fbp_union_u32_r(10), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/c/dout/x", &fbp_union_u32_r(11), NULL, NULL));
+    fbp_pubsub_finalize(ps);
+}
+
+struct executor_ctx_s {
+    struct fbp_pubsub_executor_s * executor;
+    bool drain;
+    uint32_t notify_count;
+};
+
+static void on_executor_enqueue(void * user_data) {
+    struct executor_ctx_s * ctx = (struct executor_ctx_s *) user_data;
+    ++ctx->notify_count;
+    if (ctx->drain) {
+        fbp_pubsub_executor_process(ctx->executor, 0);
+    }
+}
+
+static void test_executor(void ** state) {
+    (void) state;
+    char str[8];
+    struct executor_ctx_s ctx = {NULL, false, 0};
+    struct fbp_pubsub_executor_config_s config = {
+        .queue_size = 2,
+        .overflow = FBP_PUBSUB_OVERFLOW_DROP_OLDEST,
+        .mutex = NULL,
+        .on_enqueue_fn = on_executor_enqueue,
+        .on_enqueue_user_data = &ctx,
+    };
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 1000);
+
+    // drop oldest, callbacks only run from fbp_pubsub_executor_process()
+    ctx.executor = fbp_pubsub_executor_alloc(&config);
+    assert_non_null(ctx.executor);
+    assert_int_equal(0, fbp_pubsub_subscribe_executor(ps, "s/x", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL, ctx.executor));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/x/a", &fbp_union_u32(1), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/x/a", &fbp_union_u32(2), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/x/b", &fbp_union_u32(3), NULL, NULL));
+    assert_int_equal(3, ctx.notify_count);
+    assert_int_equal(1, fbp_pubsub_executor_drop_count(ctx.executor));
+    expect_pub_u32("s/x/a", 2);
+    expect_pub_u32("s/x/b", 3);
+    assert_int_equal(2, fbp_pubsub_executor_process(ctx.executor, 0));
+    assert_int_equal(0, fbp_pubsub_executor_process(ctx.executor, 0));
+
+    // message buffer values are copied
+    fbp_cstr_copy(str, "hello", sizeof(str));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/x/s", &fbp_union_str(str), NULL, NULL));
+    fbp_cstr_copy(str, "world", sizeof(str));
+    expect_pub_cstr("s/x/s", "hello");
+    assert_int_equal(1, fbp_pubsub_executor_process(ctx.executor, 1));
+
+    // unsubscribe discards queued messages
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/x/a", &fbp_union_u32(4), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_unsubscribe(ps, "s/x", on_pub, NULL));
+    assert_int_equal(0, fbp_pubsub_executor_process(ctx.executor, 0));
+
+    // unsubscribe keeps queued messages for other subscriptions with the same callback
+    assert_int_equal(0, fbp_pubsub_subscribe_executor(ps, "s/x/a", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL, ctx.executor));
+    assert_int_equal(0, fbp_pubsub_subscribe_executor(ps, "s/x/b", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL, ctx.executor));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/x/a", &fbp_union_u32(5), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/x/b", &fbp_union_u32(6), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_unsubscribe(ps, "s/x/a", on_pub, NULL));
+    expect_pub_u32("s/x/b", 6);
+    assert_int_equal(1, fbp_pubsub_executor_process(ctx.executor, 0));
+    assert_int_equal(0, fbp_pubsub_unsubscribe(ps, "s/x/b", on_pub, NULL));
+    fbp_pubsub_executor_free(ctx.executor);
+
+    // conflate replaces the queued value in place
+    config.overflow = FBP_PUBSUB_OVERFLOW_CONFLATE;
+    ctx.executor = fbp_pubsub_executor_alloc(&config);
+    assert_int_equal(0, fbp_pubsub_subscribe_executor(ps, "s/y", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL, ctx.executor));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/y/a", &fbp_union_u32(1), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/y/b", &fbp_union_u32(2), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/y/a", &fbp_union_u32(3), NULL, NULL));
+    assert_int_equal(1, fbp_pubsub_executor_drop_count(ctx.executor));
+    expect_pub_u32("s/y/a", 3);
+    expect_pub_u32("s/y/b", 2);
+    assert_int_equal(2, fbp_pubsub_executor_process(ctx.executor, 0));
+    assert_int_equal(0, fbp_pubsub_unsubscribe(ps, "s/y", on_pub, NULL));
+    fbp_pubsub_executor_free(ctx.executor);
+
+    // block waits for the worker, which keeps order, retained values included
+    config.overflow = FBP_PUBSUB_OVERFLOW_BLOCK;
+    config.queue_size = 1;
+    ctx.executor = fbp_pubsub_executor_alloc(&config);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/z/a", &fbp_union_u32_r(1), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_subscribe_executor(ps, "s/z", FBP_PUBSUB_SFLAG_RETAIN | FBP_PUBSUB_SFLAG_PUB,
+                                                      on_pub, NULL, ctx.executor));
+    ctx.drain = true;
+    expect_pub_u32("s/z/a", 1);
+    expect_pub_u32("s/z/a", 2);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/z/a", &fbp_union_u32_r(2), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_executor_drop_count(ctx.executor));
+
+    // block times out without a worker, then drops without waiting until the worker runs
+    ctx.drain = false;
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/z/a", &fbp_union_u32_r(3), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/z/a", &fbp_union_u32_r(4), NULL, NULL));
+    assert_int_equal(1, fbp_pubsub_executor_drop_count(ctx.executor));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/z/a", &fbp_union_u32_r(5), NULL, NULL));
+    assert_int_equal(2, fbp_pubsub_executor_drop_count(ctx.executor));
+    expect_pub_u32("s/z/a", 5);
+    assert_int_equal(1, fbp_pubsub_executor_process(ctx.executor, 0));
+    assert_int_equal(0, fbp_pubsub_unsubscribe(ps, "s/z", on_pub, NULL));
+    fbp_pubsub_executor_free(ctx.executor);
+    fbp_pubsub_finalize(ps);
+}
+
+static void test_history(void ** state) {
+    (void) state;
+    int64_t t[8];
+    union fbp_union_inner_u v[8];
+    uint8_t type = 0;
+    uint32_t count = 8;
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_topic_history(ps, "s/h$", 3));
+    assert_int_equal(FBP_ERROR_NOT_FOUND, fbp_pubsub_history_get(ps, "s/h", 0, t, v, &type, &count));
+    assert_int_equal(0, count);
+    assert_int_equal(0, fbp_pubsub_topic_history(ps, "s/h", 3));
+    for (uint32_t i = 1; i <= 4; ++i) {
+        assert_int_equal(0, fbp_pubsub_publish(ps, "s/h", &fbp_union_u32_r(i), NULL, NULL));
+    }
+
+    // ring keeps the most recent records, oldest first
+    count = 8;
+    assert_int_equal(0, fbp_pubsub_history_get(ps, "s/h", 0, t, v, &type, &count));
+    assert_int_equal(3, count);
+    assert_int_equal(FBP_UNION_U32, type);
+    assert_int_equal(2, v[0].u32);
+    assert_int_equal(3, v[1].u32);
+    assert_int_equal(4, v[2].u32);
+    assert_true(t[0] <= t[1]);
+    assert_true(t[1] <= t[2]);
+    count = 2;
+    assert_int_equal(0, fbp_pubsub_history_get(ps, "s/h", 0, NULL, v, NULL, &count));
+    assert_int_equal(2, count);
+    assert_int_equal(3, v[0].u32);
+    assert_int_equal(4, v[1].u32);
+    count = 8;
+    assert_int_equal(0, fbp_pubsub_history_get(ps, "s/h", t[2] + 1, t, v, &type, &count));
+    assert_int_equal(0, count);
+
+    // pointer types are not recorded, type changes restart
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/h", &fbp_union_cstr("x"), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/h", &fbp_union_i32(-5), NULL, NULL));
+    count = 8;
+    assert_int_equal(0, fbp_pubsub_history_get(ps, "s/h", 0, t, v, &type, &count));
+    assert_int_equal(1, count);
+    assert_int_equal(FBP_UNION_I32, type);
+    assert_int_equal(-5, v[0].i32);
+
+    assert_int_equal(0, fbp_pubsub_topic_history(ps, "s/h", 0));
+    assert_int_equal(FBP_ERROR_NOT_FOUND, fbp_pubsub_history_get(ps, "s/h", 0, t, v, &type, &count));
+    assert_int_equal(0, fbp_pubsub_topic_history(ps, "s/h2", 2));
+    fbp_pubsub_finalize(ps);
+}
+
+static void test_owned_prefix(void ** state) {
+    (void) state;
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s" FBP_PUBSUB_UNIT_SEP_STR "t/", 0);
+    assert_string_equal("s" FBP_PUBSUB_UNIT_SEP_STR "t", fbp_pubsub_topic_prefix(ps));
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "", FBP_PUBSUB_SFLAG_PUB | FBP_PUBSUB_SFLAG_RETURN_CODE, on_pub, NULL));
+    expect_pub_u32(FBP_PUBSUB_CONFIG_RETURN_CODE, 1);
+    assert_int_equal(0, fbp_pubsub_publish(ps, FBP_PUBSUB_CONFIG_RETURN_CODE, &fbp_union_u32_r(1), NULL, NULL));
+
+    // owned topics respond with return codes, including topics created later
+    expect_pub_u32("t/x", 1);
+    expect_pub_i32("t/x#", 0);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "t/x", &fbp_union_u32(1), NULL, NULL));
+    expect_pub_u32("t/x/y", 2);
+    expect_pub_i32("t/x/y#", 0);
+    struct fbp_pubsub_topic_s * h = fbp_pubsub_topic_handle_get(ps, "t/x/y");
+    assert_int_equal(0, fbp_pubsub_publish_handle(ps, h, &fbp_union_u32(2), NULL, NULL));
+
+    // other prefixes, including names that share a prefix string, do not
+    expect_pub_u32("tt/x", 3);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "tt/x", &fbp_union_u32(3), NULL, NULL));
+    expect_pub_u32("u", 4);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "u", &fbp_union_u32(4), NULL, NULL));
+    fbp_pubsub_finalize(ps);
+}
+
+struct query_thread_s {
+    struct fbp_pubsub_s * ps;
+    volatile bool quit;
+    uint32_t count;
+    uint32_t errors;
+};
+
+#if defined(_WIN32)
+static DWORD WINAPI query_thread(LPVOID arg) {
+#else
+static void * query_thread(void * arg) {
+#endif
+    struct query_thread_s * q = (struct query_thread_s *) arg;
+    struct fbp_union_s v;
+    while (!q->quit) {
+        if (fbp_pubsub_query(q->ps, "s/q", &v) || (v.value.u32 != 42)) {
+            ++q->errors;
+        }
+        if (0 == fbp_pubsub_query(q->ps, "s/none/q", &v)) {
+            ++q->errors;
+        }
+        ++q->count;
+    }
+    return 0;
+}
+
+static void test_thread_topic_create(void ** state) {
+    (void) state;
+    char topic[FBP_PUBSUB_TOPIC_LENGTH_MAX];
+    fbp_os_mutex_t mutex = fbp_os_mutex_alloc("pubsub");
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    fbp_pubsub_register_mutex(ps, mutex);
+    struct query_thread_s q = {.ps = ps, .quit = false, .count = 0, .errors = 0};
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/q", &fbp_union_u32_r(42), NULL, NULL));
+    fbp_pubsub_process(ps);
+
+    // grow the topic and intern indices while another thread queries
+#if defined(_WIN32)
+    HANDLE thread = CreateThread(NULL, 0, query_thread, &q, 0, NULL);
+#else
+    pthread_t thread;
+    pthread_create(&thread, NULL, query_thread, &q);
+#endif
+    for (uint32_t i = 0; i < 20000; ++i) {
+        snprintf(topic, sizeof(topic), "s/n%u/v%u", (unsigned int) (i / 4), (unsigned int) i);
+        assert_int_equal(0, fbp_pubsub_publish(ps, topic, &fbp_union_u32_r(i), NULL, NULL));
+        fbp_pubsub_process(ps);
+    }
+    fbp_pubsub_process(ps);
+    q.quit = true;
+#if defined(_WIN32)
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+    assert_true(q.count > 0);
+    assert_int_equal(0, q.errors);
+    fbp_pubsub_finalize(ps);
+    fbp_os_mutex_free(mutex);
+}
+
+static void test_long_subtopic(void ** state) {
+    (void) state;
+    struct fbp_union_s v;
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/temperature", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    expect_pub_u32("s/temperature/value", 1);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/temperature/value", &fbp_union_u32_r(1), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/humidity/value", &fbp_union_u32_r(2), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_query(ps, "s/temperature/value", &v));
+    assert_int_equal(1, v.value.u32);
+    assert_int_equal(0, fbp_pubsub_query(ps, "s/humidity/value", &v));
+    assert_int_equal(2, v.value.u32);
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_query(ps, "s/pressure/value", &v));
+
+    struct fbp_pubsub_topic_s * h = fbp_pubsub_topic_handle_get(ps, "s/temperature/value");
+    expect_pub_u32("s/temperature/value", 3);
+    assert_int_equal(0, fbp_pubsub_publish_handle(ps, h, &fbp_union_u32_r(3), NULL, NULL));
+    fbp_pubsub_finalize(ps);
+}
+
+static uint8_t on_pub_topic(void * user_data, const char * topic, const struct fbp_union_s * value) {
+    (void) value;
+    *((const char **) user_data) = topic;
+    return 0;
+}
+
+static void test_topic_resolved(void ** state) {
+    (void) state;
+    const char * topic = NULL;
+    char buf[FBP_PUBSUB_TOPIC_LENGTH_MAX + 1];
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s", FBP_PUBSUB_SFLAG_PUB, on_pub_topic, &topic));
+
+    // string publishes carry the topic, whose path is shared
+    strcpy(buf, "s/a/b");
+    assert_int_equal(0, fbp_pubsub_publish(ps, buf, &fbp_union_u32_r(1), NULL, NULL));
+    assert_string_equal("s/a/b", topic);
+    assert_ptr_not_equal(buf, topic);
+    const char * path = topic;
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a/b", &fbp_union_u32_r(2), NULL, NULL));
+    assert_ptr_equal(path, topic);
+    struct fbp_pubsub_topic_s * h = fbp_pubsub_topic_handle_get(ps, "s/a/b");
+    assert_int_equal(0, fbp_pubsub_publish_handle(ps, h, &fbp_union_u32_r(3), NULL, NULL));
+    assert_ptr_equal(path, topic);
+
+    // FBP_PUBSUB_TOPIC_LENGTH_MAX includes the terminator
+    memset(buf, 'x', sizeof(buf));
+    buf[0] = 's';
+    buf[1] = '/';
+    buf[FBP_PUBSUB_TOPIC_LENGTH_MAX - 1] = 0;
+    assert_int_equal(0, fbp_pubsub_publish(ps, buf, &fbp_union_u32_r(4), NULL, NULL));
+    assert_string_equal(buf, topic);
+    buf[FBP_PUBSUB_TOPIC_LENGTH_MAX - 1] = 'x';
+    buf[FBP_PUBSUB_TOPIC_LENGTH_MAX] = 0;
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_publish(ps, buf, &fbp_union_u32_r(5), NULL, NULL));
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_subscribe(ps, buf, FBP_PUBSUB_SFLAG_PUB, on_pub_topic, &topic));
+    fbp_pubsub_finalize(ps);
+}
+
+static void test_node_pool(void ** state) {
+    (void) state;
+    struct fbp_pubsub_config_s config = {
+        .buffer_size = 0,
+        .topic_max = 2,
+        .subscriber_max = 1,
+    };
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize_config("s", &config);
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "", FBP_PUBSUB_SFLAG_PUB | FBP_PUBSUB_SFLAG_RETURN_CODE, on_pub, NULL));
+    expect_pub_u32("s/a", 1);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &fbp_union_u32_r(1), NULL, NULL));
+
+    // topic pool exhausted
+    expect_pub_i32("s/b#", FBP_ERROR_NOT_ENOUGH_MEMORY);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b", &fbp_union_u32_r(2), NULL, NULL));
+    assert_null(fbp_pubsub_topic_handle_get(ps, "s/c"));
+    assert_non_null(fbp_pubsub_topic_handle_get(ps, "s/a"));
+
+    // subscriber pool exhausted, subscribe dropped
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/a", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    expect_pub_u32("s/a", 3);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &fbp_union_u32_r(3), NULL, NULL));
+
+    // released subscribers are reused
+    assert_int_equal(0, fbp_pubsub_unsubscribe(ps, "", on_pub, NULL));
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    expect_pub_u32("s/a", 4);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &fbp_union_u32_r(4), NULL, NULL));
+
+    // wildcard retained replay uses the name table and traversal pool
+    assert_int_equal(0, fbp_pubsub_unsubscribe(ps, "s", on_pub, NULL));
+    expect_pub_u32("s/a", 4);
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/+", FBP_PUBSUB_SFLAG_RETAIN, on_pub, NULL));
+    fbp_pubsub_finalize(ps);
+}
+
+// The image header is 24 bytes with the CRC at offset 16, then the first record.
+#define SNAPSHOT_HDR_SZ (24)
+#define SNAPSHOT_REC_TYPE (SNAPSHOT_HDR_SZ + 0)
+#define SNAPSHOT_REC_SIZE (SNAPSHOT_HDR_SZ + 8)
+
+static void snapshot_crc_update(uint8_t * image, uint32_t sz) {
+    uint32_t crc = fbp_crc32(0, image + SNAPSHOT_HDR_SZ, sz - SNAPSHOT_HDR_SZ);
+    fbp_memcpy(image + 16, &crc, sizeof(crc));
+}
+
+static void snapshot_corrupt_expect(const uint8_t * image, uint32_t sz, int32_t rc) {
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    assert_int_equal(rc, fbp_pubsub_snapshot_restore(ps, image, sz));
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_query(ps, "s/m", NULL));
+    fbp_pubsub_finalize(ps);
+}
+
+static void snapshot_corrupt(const uint8_t * image, uint32_t sz) {
+    uint8_t c[1024];
+    uint32_t u32;
+
+    fbp_memcpy(c, image, sz);
+    c[sz - 1] ^= 0x01;  // payload bit error, such as worn flash
+    snapshot_corrupt_expect(c, sz, FBP_ERROR_MESSAGE_INTEGRITY);
+
+    fbp_memcpy(c, image, sz);
+    u32 = 0xfffffff0U;  // rec_end would wrap
+    fbp_memcpy(c + SNAPSHOT_REC_SIZE, &u32, sizeof(u32));
+    snapshot_crc_update(c, sz);
+    snapshot_corrupt_expect(c, sz, FBP_ERROR_INVALID_MESSAGE_LENGTH);
+
+    fbp_memcpy(c, image, sz);
+    u32 = 1;  // size for a non-pointer type
+    fbp_memcpy(c + SNAPSHOT_REC_SIZE, &u32, sizeof(u32));
+    snapshot_crc_update(c, sz);
+    snapshot_corrupt_expect(c, sz, FBP_ERROR_SYNTAX_ERROR);
+
+    fbp_memcpy(c, image, sz);
+    c[SNAPSHOT_REC_TYPE] = FBP_UNION_RSV0;
+    snapshot_crc_update(c, sz);
+    snapshot_corrupt_expect(c, sz, FBP_ERROR_NOT_SUPPORTED);
+}
+
+static void test_snapshot(void ** state) {
+    (void) state;
+    uint8_t image[1024];
+    uint32_t sz = 0;
+    uint32_t sz_inc = 0;
+    struct fbp_union_s v;
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
+    assert_int_equal(0, fbp_pubsub_meta(ps, "s/m", META2));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/m", &fbp_union_u8_r(5), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &fbp_union_u32_r(1), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b", &fbp_union_cstr_r("hello"), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/u", &fbp_union_u32(2), NULL, NULL));
+
+    assert_int_equal(0, fbp_pubsub_snapshot_save(ps, NULL, &sz, false));
+    uint32_t sz_required = sz;
+    sz = 8;
+    assert_int_equal(FBP_ERROR_TOO_SMALL, fbp_pubsub_snapshot_save(ps, image, &sz, false));
+    assert_int_equal(sz_required, sz);
+    sz = sizeof(image);
+    assert_int_equal(0, fbp_pubsub_snapshot_save(ps, image, &sz, false));
+    assert_int_equal(sz_required, sz);
+    sz_inc = sizeof(image) - sz;
+    assert_int_equal(0, fbp_pubsub_snapshot_save(ps, image + sz, &sz_inc, true));
+    assert_int_equal(0, sz_inc);
+
+    // incremental image appended to the full image
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &fbp_union_u32_r(3), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b", &fbp_union_null(), NULL, NULL));
+    sz_inc = sizeof(image) - sz;
+    assert_int_equal(0, fbp_pubsub_snapshot_save(ps, image + sz, &sz_inc, true));
+    assert_true(sz_inc > 0);
+    fbp_memset(image + sz + sz_inc, 0xff, 32);  // erased flash
+    fbp_pubsub_finalize(ps);
+
+    struct fbp_pubsub_config_s config = {
+        .buffer_size = 0,
+        .snapshot = image,
+        .snapshot_size = sz + sz_inc + 32,
+    };
+    ps = fbp_pubsub_initialize_config("s", &config);
+    assert_int_equal(0, fbp_pubsub_query(ps, "s/a", &v));
+    assert_int_equal(3, v.value.u32);
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_query(ps, "s/b", &v));
+    assert_int_equal(FBP_ERROR_PARAMETER_INVALID, fbp_pubsub_query(ps, "s/u", &v));
+
+    // restored values survive the metadata default, restored metadata validates
+    expect_pub_u8("s/m", 5);
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s/m", FBP_PUBSUB_SFLAG_RETAIN | FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    assert_int_equal(0, fbp_pubsub_meta(ps, "s/m", META2));
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "", FBP_PUBSUB_SFLAG_RETURN_CODE, on_pub, NULL));
+    expect_pub_i32("s/m#", FBP_ERROR_PARAMETER_INVALID);
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/m", &fbp_union_cstr_r("__invalid__"), NULL, NULL));
+    fbp_pubsub_finalize(ps);
+
+    // corrupt image
+    ps = fbp_pubsub_initialize("s", 0);
+    assert_int_equal(FBP_ERROR_INVALID_MESSAGE_LENGTH, fbp_pubsub_snapshot_restore(ps, image, 40));
+    fbp_pubsub_finalize(ps);
+    snapshot_corrupt(image, sz);
+}
+
+struct profiles_s {
+    uint32_t count;
+    struct fbp_pubsub_profile_s profile[8];
+    char topic[8][FBP_PUBSUB_TOPIC_LENGTH_MAX];
+};
+
+static void on_profile(void * user_data, const struct fbp_pubsub_profile_s * profile) {
+    struct profiles_s * p = (struct profiles_s *) user_data;
+    assert_true(p->count < 8);
+    p->profile[p->count] = *profile;
+    fbp_cstr_copy(p->topic[p->count], profile->topic, FBP_PUBSUB_TOPIC_LENGTH_MAX);
+    p->profile[p->count].topic = p->topic[p->count];
+    ++p->count;
+}
+
+static void test_stats(void ** state) {
+    (void) state;
+    struct fbp_pubsub_stats_s stats;
+    struct profiles_s profiles;
+    struct fbp_union_s v;
+    fbp_os_mutex_t mutex = fbp_os_mutex_alloc("pubsub");
+    struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 100);
+    fbp_pubsub_register_mutex(ps, mutex);
+    assert_int_equal(0, fbp_pubsub_publish(ps, FBP_PUBSUB_CONFIG_STATS, &fbp_union_u32_r(1), NULL, NULL));
+    assert_int_equal(0, fbp_pubsub_subscribe(ps, "s", FBP_PUBSUB_SFLAG_PUB, on_pub, NULL));
+    fbp_pubsub_process(ps);
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        assert_int_equal(0, fbp_pubsub_publish(ps, "s/a", &fbp_union_u32(i), NULL, NULL));
+        expect_pub_u32("s/a", i);
+    }
+    assert_int_equal(0, fbp_pubsub_publish(ps, "s/b", &fbp_union_str("hello"), NULL, NULL));
+    expect_pub_cstr("s/b", "hello");
+    fbp_pubsub_process(ps);
+
+    assert_int_equal(0, fbp_pubsub_stats_get(ps, &stats));
+    assert_int_equal(4, stats.msg_count);  // subscribe queued before enable
+    assert_int_equal(4, stats.queue_depth_max);
+    assert_true(stats.mrb_used_max >= 6);
+    assert_int_equal(100, stats.mrb_size);
+    assert_int_equal(0, stats.drop_count);
+
+    profiles.count = 0;
+    assert_int_equal(0, fbp_pubsub_stats_dump(ps, on_profile, &profiles));
+    assert_int_equal(3, profiles.count);
+    assert_string_equal("s", profiles.profile[0].topic);
+    assert_ptr_equal(on_pub, profiles.profile[0].cbk_fn);
+    assert_int_equal(4, profiles.profile[0].count);
+    assert_true(profiles.profile[0].time_min <= profiles.profile[0].time_avg);
+    assert_true(profiles.profile[0].time_avg <= profiles.profile[0].time_max);
+    assert_string_equal("s/a", profiles.profile[1].topic);
+    assert_null(profiles.profile[1].cbk_fn);
+    assert_int_equal(3, profiles.profile[1].count);
+    assert_string_equal("s/b", profiles.profile[2].topic);
+    assert_int_equal(1, profiles.profile[2].count);
+
+    assert_int_equal(0, fbp_pubsub_stats_publish(ps));
+    fbp_pubsub_process(ps);
+    assert_int_equal(0, fbp_pubsub_query(ps, FBP_PUBSUB_STATS_QUEUE, &v));
+    assert_int_equal(4, v.value.u32);
+    fbp_pubsub_finalize(ps);
+    fbp_os_mutex_free(mutex);
+}
+
 static void test_nopub(void ** state) {
     (void) state;
     struct fbp_pubsub_s * ps = fbp_pubsub_initialize("s", 0);
@@ -712,6 +1598,24 @@ int main(void) {
             cmocka_unit_test_setup_teardown(test_unsubscribe, setup, teardown),
             cmocka_unit_test_setup_teardown(test_unsubscribe_from_all, setup, teardown),
             cmocka_unit_test_setup_teardown(test_unretained, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_many_topics, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_handle, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_dispatch_cache, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_queue_order, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_ref_buf, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_conflate, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_publish_batch, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_process_budget, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_wildcard, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_executor, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_history, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_owned_prefix, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_thread_topic_create, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_long_subtopic, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_topic_resolved, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_node_pool, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_snapshot, setup, teardown),
+            cmocka_unit_test_setup_teardown(test_stats, setup, teardown),
             cmocka_unit_test_setup_teardown(test_nopub, setup, teardown),
             cmocka_unit_test_setup_teardown(test_meta_when_not_req_or_rsp_subscriber, setup, teardown),
             cmocka_unit_test_setup_teardown(test_meta_req_forward_root, setup, teardown),